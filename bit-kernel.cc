@@ -1,8 +1,16 @@
 // Copyright 2017  Baidu (author: Meixu Song)
 
 #include "matrix/bit-kernel.h"
+#include <algorithm>
 #include <bitset>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -27,4 +35,237 @@ int32 bit_kernel_for_uint64_8_1(uint64 x, uint64 y) {
   return rt;
 }
 
-}
\ No newline at end of file
+int32 bit_kernel_dot_uint64(uint64 x, uint64 y, int32 align_bits) {
+  const uint64 slot_mask = align_bits == 64 ?
+      ~static_cast<uint64>(0) : (static_cast<uint64>(1) << align_bits) - 1;
+  int32 rt = 0;
+  for (int32 shift = 0; shift < 64; shift += align_bits) {
+    rt += static_cast<int32>(((x >> shift) & slot_mask)
+                             * ((y >> shift) & slot_mask));
+  }
+  return rt;
+}
+
+void bit_kernel_transpose_block(const uint64 *in, MatrixIndexT in_stride,
+                                int32 align_bits, uint64 *out,
+                                MatrixIndexT out_stride) {
+  const int32 n = 64 / align_bits;
+  uint64 a[64];
+  for (int32 k = 0; k < n; ++k) {
+    a[k] = in[k * in_stride];
+  }
+  // The first value is in the most significant slot, so at each level the low
+  // half of row k is swapped with the high half of row k + d.
+  uint64 m = 0x00000000ffffffffULL;
+  for (int32 j = 32; j >= align_bits; j >>= 1, m ^= (m << j)) {
+    const int32 d = j / align_bits;
+    for (int32 k = 0; k < n; k = ((k | d) + 1) & ~d) {
+      uint64 t = (a[k] ^ (a[k | d] >> j)) & m;
+      a[k] ^= t;
+      a[k | d] ^= (t << j);
+    }
+  }
+  for (int32 k = 0; k < n; ++k) {
+    out[k * out_stride] = a[k];
+  }
+}
+
+#if defined(__AVX2__)
+// <out> must be 32-byte aligned if <stream> is true.
+static inline void store_ps(float *out, __m256 value, bool stream) {
+  if (stream) {
+    _mm256_stream_ps(out, value);
+  } else {
+    _mm256_storeu_ps(out, value);
+  }
+}
+
+// 1-bit values packed 64 per word: each byte is broadcast to 8 lanes, tested
+// against one bit per lane (most significant bit first) and used to blend
+// between offset - scale and offset + scale.
+static void unpack_row_1_1(const uint64 *in, MatrixIndexT num_words,
+                           float scale, float offset, float *out,
+                           bool stream) {
+  const __m256i bits = _mm256_setr_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+  const __m256 neg = _mm256_set1_ps(offset - scale);
+  const __m256 pos = _mm256_set1_ps(offset + scale);
+  for (MatrixIndexT w = 0; w < num_words; ++w) {
+    uint64 word = in[w];
+    for (int32 b = 0; b < 8; ++b) {
+      __m256i byte = _mm256_set1_epi32((word >> (56 - 8 * b)) & 0xff);
+      __m256i set = _mm256_cmpeq_epi32(_mm256_and_si256(byte, bits), bits);
+      store_ps(out + 8 * b,
+               _mm256_blendv_ps(neg, pos, _mm256_castsi256_ps(set)), stream);
+    }
+    out += 64;
+  }
+}
+
+// Values in 8-bit slots: the word is byte swapped so that its first value
+// comes first in memory, then zero extended and converted to float.
+static void unpack_row_8(const uint64 *in, MatrixIndexT num_words,
+                         int32 quant_bits, float scale, float offset,
+                         float *out, bool stream) {
+  const __m256 mul = _mm256_set1_ps(quant_bits == 1 ? 2 * scale : scale);
+  const __m256 add = _mm256_set1_ps(quant_bits == 1 ? offset - scale : offset);
+  const __m256i mask = _mm256_set1_epi32(quant_bits == 1 ? 1 : 0xff);
+  for (MatrixIndexT w = 0; w < num_words; ++w) {
+    __m128i bytes = _mm_cvtsi64_si128(
+        static_cast<long long>(__builtin_bswap64(in[w])));
+    __m256i values = _mm256_and_si256(_mm256_cvtepu8_epi32(bytes), mask);
+    store_ps(out, _mm256_add_ps(
+        _mm256_mul_ps(_mm256_cvtepi32_ps(values), mul), add), stream);
+    out += 8;
+  }
+}
+#endif
+
+void bit_kernel_unpack_row(const uint64 *in, MatrixIndexT num_words,
+                           int32 quant_bits, int32 align_bits, float scale,
+                           float offset, float *out, bool stream) {
+#if defined(__AVX2__)
+  if (align_bits == 1 || align_bits == 8) {
+    // Both kernels write whole 32-byte vectors from <out> on.
+    stream = stream && reinterpret_cast<uintptr_t>(out) % 32 == 0;
+    if (align_bits == 1) {
+      unpack_row_1_1(in, num_words, scale, offset, out, stream);
+    } else {
+      unpack_row_8(in, num_words, quant_bits, scale, offset, out, stream);
+    }
+    if (stream) {
+      // Non-temporal stores are weakly ordered; makes them visible before the
+      // caller hands the output to another thread.
+      _mm_sfence();
+    }
+    return;
+  }
+#endif
+  const int32 pack_factor = 64 / align_bits;
+  const uint64 slot_mask = align_bits == 64 ?
+      ~static_cast<uint64>(0) : (static_cast<uint64>(1) << align_bits) - 1;
+  for (MatrixIndexT w = 0; w < num_words; ++w) {
+    uint64 word = in[w];
+    for (int32 i = 0; i < pack_factor; ++i) {
+      uint64 value = (word >> (64 - align_bits * (i + 1))) & slot_mask;
+      if (quant_bits == 1) {
+        out[i] = (value & 1) ? offset + scale : offset - scale;
+      } else {
+        out[i] = offset + scale * value;
+      }
+    }
+    out += pack_factor;
+  }
+}
+
+#if defined(__AVX2__)
+// Codes of 8 values, as int32.
+static inline __m256i pack_codes(const float *in, __m256 low, __m256 inv_step,
+                                 __m256 max_code) {
+  __m256 code = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(in), low),
+                              inv_step);
+  code = _mm256_round_ps(code, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  // max(code, 0) returns 0 for NaN as well.
+  code = _mm256_min_ps(_mm256_max_ps(code, _mm256_setzero_ps()), max_code);
+  return _mm256_cvtps_epi32(code);
+}
+
+// 1-bit values packed 64 per word, the inverse of unpack_row_1_1(): a code is
+// 1 where the scaled value rounds above 0, i.e. is greater than 0.5, which
+// also maps NaN to 0 as pack_codes() does. The lanes are reversed so that
+// the sign mask has the first value in its most significant bit.
+static void pack_row_1_1(const float *in, MatrixIndexT num_words, float low,
+                         float inv_step, uint64 *out) {
+  const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  const __m256 low_v = _mm256_set1_ps(low);
+  const __m256 inv_step_v = _mm256_set1_ps(inv_step);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  for (MatrixIndexT w = 0; w < num_words; ++w) {
+    uint64 word = 0;
+    for (int32 b = 0; b < 8; ++b) {
+      __m256 x = _mm256_permutevar8x32_ps(_mm256_loadu_ps(in + 8 * b),
+                                          reverse);
+      __m256 code = _mm256_mul_ps(_mm256_sub_ps(x, low_v), inv_step_v);
+      word = (word << 8) | static_cast<uint64>(
+          _mm256_movemask_ps(_mm256_cmp_ps(code, half, _CMP_GT_OQ)));
+    }
+    out[w] = word;
+    in += 64;
+  }
+}
+#endif
+
+void bit_kernel_pack_row(const float *in, MatrixIndexT num_words,
+                         int32 quant_bits, int32 align_bits, float low,
+                         float inv_step, uint64 *out) {
+  SNOWBOY_ASSERT(quant_bits > 0 && quant_bits < 64);
+  const float max_code = static_cast<float>((1ull << quant_bits) - 1);
+  MatrixIndexT w = 0;
+#if defined(__AVX2__)
+  if (align_bits == 1) {
+    pack_row_1_1(in, num_words, low, inv_step, out);
+    return;
+  }
+  if (align_bits == 8) {
+    // Narrows 8 codes to bytes, then byte swaps so that the first value is in
+    // the most significant slot.
+    const __m256 low_v = _mm256_set1_ps(low);
+    const __m256 inv_step_v = _mm256_set1_ps(inv_step);
+    const __m256 max_code_v = _mm256_set1_ps(max_code);
+    for (; w < num_words; ++w) {
+      __m256i codes = pack_codes(in + 8 * w, low_v, inv_step_v, max_code_v);
+      __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(codes),
+                                       _mm256_extracti128_si256(codes, 1));
+      words = _mm_packus_epi16(words, words);
+      out[w] = __builtin_bswap64(
+          static_cast<uint64>(_mm_cvtsi128_si64(words)));
+    }
+    return;
+  }
+#endif
+  const int32 pack_factor = 64 / align_bits;
+  for (; w < num_words; ++w) {
+    uint64 word = 0;
+    for (int32 i = 0; i < pack_factor; ++i) {
+      float code = std::nearbyint((in[w * pack_factor + i] - low) * inv_step);
+      code = code > 0.0f ? std::min(code, max_code) : 0.0f;
+      if (align_bits < 64) {
+        word <<= align_bits;
+      }
+      word += static_cast<uint64>(code);
+    }
+    out[w] = word;
+  }
+}
+
+void bit_kernel_min_max(const float *in, MatrixIndexT n,
+                        float *min, float *max) {
+  float lo = std::numeric_limits<float>::infinity();
+  float hi = -std::numeric_limits<float>::infinity();
+  MatrixIndexT i = 0;
+#if defined(__AVX2__)
+  if (n >= 8) {
+    __m256 lo_v = _mm256_loadu_ps(in);
+    __m256 hi_v = lo_v;
+    for (i = 8; i + 8 <= n; i += 8) {
+      __m256 x = _mm256_loadu_ps(in + i);
+      lo_v = _mm256_min_ps(lo_v, x);
+      hi_v = _mm256_max_ps(hi_v, x);
+    }
+    float lo_buf[8], hi_buf[8];
+    _mm256_storeu_ps(lo_buf, lo_v);
+    _mm256_storeu_ps(hi_buf, hi_v);
+    for (int32 j = 0; j < 8; ++j) {
+      lo = std::min(lo, lo_buf[j]);
+      hi = std::max(hi, hi_buf[j]);
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    lo = std::min(lo, in[i]);
+    hi = std::max(hi, in[i]);
+  }
+  *min = lo;
+  *max = hi;
+}
+
+}
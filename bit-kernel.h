@@ -13,6 +13,42 @@ namespace snowboy {
 // for x is a 8-bits vec, y is a 1-bit vec, this give the inner dot
 int32 bit_kernel_for_uint64_8_1(uint64 x, uint64 y);
 
+// Dot product of the unsigned values in the <align_bits> slots of x and y, for
+// y with more than 1 bit.
+int32 bit_kernel_dot_uint64(uint64 x, uint64 y, int32 align_bits);
+
+// Unpacks and dequantizes one row of <num_words> packed words into
+// num_words * 64 / align_bits floats. The first value of a word is in its most
+// significant slot. 1-bit values map to offset - scale / offset + scale, the
+// others to offset + scale * value. If <stream> is true, <out> is written with
+// non-temporal stores where the kernel and the alignment of <out> allow it.
+void bit_kernel_unpack_row(const uint64 *in, MatrixIndexT num_words,
+                           int32 quant_bits, int32 align_bits, float scale,
+                           float offset, float *out, bool stream = false);
+
+// Quantizes and packs num_words * 64 / align_bits floats into <num_words>
+// words, the inverse of bit_kernel_unpack_row(): each value is coded as
+// round((in[i] - low) * inv_step), to nearest even, clamped to
+// [0, 2^quant_bits - 1].
+void bit_kernel_pack_row(const float *in, MatrixIndexT num_words,
+                         int32 quant_bits, int32 align_bits, float low,
+                         float inv_step, uint64 *out);
+
+// Transposes a square block of 64 / align_bits words, each holding as many
+// values of <align_bits> bits, with the recursive swap and mask algorithm: the
+// two off-diagonal quarters are swapped with one shift and mask per word pair,
+// then the quarters of the quarters, down to single values, so a block costs
+// log2(64 / align_bits) passes over its words. Row k of the block is read from
+// in[k * in_stride] and written to out[k * out_stride]; <in> and <out> must not
+// overlap.
+void bit_kernel_transpose_block(const uint64 *in, MatrixIndexT in_stride,
+                                int32 align_bits, uint64 *out,
+                                MatrixIndexT out_stride);
+
+// Gets the minimum and maximum of <n> floats in one vectorized pass.
+void bit_kernel_min_max(const float *in, MatrixIndexT n,
+                        float *min, float *max);
+
 }
 
 #endif //SNOWBOY_BIT_KERNEL_H
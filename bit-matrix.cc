@@ -1,12 +1,18 @@
 // Copyright 2017  Baidu (author: Meixu Song)
 
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 
 #include "matrix/bit-matrix.h"
 #include "matrix/bit-kernel.h"
+#include "matrix/kernel-tuning.h"
+#include "matrix/matrix-memory.h"
 #include "matrix/matrix-wrapper.h"
+#include "matrix/perf-counters.h"
+#include "matrix/trace-events.h"
+#include "matrix/thread-pool.h"
 #include "matrix/vector-wrapper.h"
 #include "utils/snowboy-io.h"
 #include "utils/snowboy-math.h"
@@ -18,11 +24,12 @@ namespace snowboy {
 
 void BitMatrix::ReleaseBitMatrixMemory() {
   if (data_ != NULL)
-    SnowboyMemalignFree(data_);
+    MatrixMemalignFree(data_);
   num_rows_ = 0;
   num_cols_ = 0;
   stride_ = 0;
   data_ = NULL;
+  row_params_ = NULL;
 }
 
 void BitMatrix::AllocateBitMatrixMemory(const MatrixIndexT rows,
@@ -34,27 +41,43 @@ void BitMatrix::AllocateBitMatrixMemory(const MatrixIndexT rows,
     num_cols_ = 0;
     stride_ = 0;
     data_ = NULL;
+    row_params_ = NULL;
     return;
   }
 
-  SNOWBOY_ASSERT(SNOWBOY_MEM_ALIGN % sizeof(float) == 0);
-  size_t num_per_align = SNOWBOY_MEM_ALIGN / sizeof(uint64);
+  const size_t pad_bytes =
+      std::max<size_t>(SNOWBOY_MEM_ALIGN, kMatrixPadBytes);
+  SNOWBOY_ASSERT(pad_bytes % sizeof(uint64) == 0);
+  size_t num_per_align = pad_bytes / sizeof(uint64);
   MatrixIndexT pad = (num_per_align - cols % num_per_align) % num_per_align;
   size_t size = sizeof(uint64)
       * static_cast<size_t>(rows) * static_cast<size_t>(cols + pad);
-  void *data = SnowboyMemalign(SNOWBOY_MEM_ALIGN, size);
+  void *data = MatrixMemalign(
+      pad_bytes, size + sizeof(float) * 2 * static_cast<size_t>(rows));
 
   if (data != NULL) {
     data_ = static_cast<uint64 *>(data);
+    row_params_ = reinterpret_cast<float *>(static_cast<char *>(data) + size);
     num_rows_ = rows;
     num_cols_ = cols;
     stride_ = cols + pad;
   } else {
     throw std::bad_alloc();
   }
+  if (pad != 0) {
+    // Split like Quantize(), so that pages are first touched by the threads
+    // that fill the rows.
+    ParallelFor(0, num_rows_, ParallelGrain(stride_ * PackFactor()),
+                [this](MatrixIndexT row_begin, MatrixIndexT row_end) {
+      for (MatrixIndexT r = row_begin; r < row_end; ++r) {
+        std::memset(data_ + r * stride_ + num_cols_, 0,
+                    sizeof(uint64) * (stride_ - num_cols_));
+      }
+    });
+  }
 }
 
-void BitMatrix::Set(const uint64 value) {
+void BitMatrixBase::Set(const uint64 value) {
   for (MatrixIndexT r = 0; r < num_rows_; ++r) {
     for (MatrixIndexT c = 0; c < num_cols_; ++c) {
       (*this)(r, c) = value;
@@ -75,43 +98,159 @@ void BitMatrix::Resize(const MatrixIndexT rows,
     ReleaseBitMatrixMemory();
   }
   AllocateBitMatrixMemory(rows, cols);
+  SetRowScales(HasRowScales());
 }
 
-void BitMatrix::CopyFromBitMat(const BitMatrix& mat) {
-  if ((void*)(&mat) == (void*)this) {
+void BitMatrixBase::CopyFromBitMat(const BitMatrixBase& mat,
+                                   const MatrixTransposeType trans) {
+  if (trans == kNoTrans) {
+    if ((void*)(&mat) == (void*)this) {
+      return;
+    }
+    SNOWBOY_ASSERT(num_rows_ == mat.NumRows() && num_cols_ == mat.NumCols());
+    for (MatrixIndexT r = 0; r < num_rows_; ++r) {
+      Row(r).CopyFromBitVec(mat.Row(r));
+    }
     return;
   }
-  SNOWBOY_ASSERT(num_rows_ == mat.NumRows() && num_cols_ == mat.NumCols());
-  for (MatrixIndexT r = 0; r < num_rows_; ++r) {
-    Row(r).CopyFromBitVec(mat.Row(r));
+
+  SNOWBOY_ASSERT((void*)(&mat) != (void*)this);
+  SNOWBOY_ASSERT(align_bits_ == mat.AlignBits());
+  const MatrixIndexT pack_factor = PackFactor();
+  if (mat.NumRows() % pack_factor != 0) {
+    SNOWBOY_ERROR << "Fail to transpose BitMatrix: " << mat.NumRows()
+        << " rows do not fill words of " << pack_factor << " values.";
   }
+  SNOWBOY_ASSERT(num_rows_ == mat.NumCols() * pack_factor &&
+      num_cols_ * pack_factor == mat.NumRows());
+  // Word w of block row b of <mat> becomes word b of block row w.
+  ParallelFor(0, mat.NumCols(), ParallelGrain(mat.NumRows() * pack_factor),
+              [this, &mat, pack_factor](MatrixIndexT begin, MatrixIndexT end) {
+    for (MatrixIndexT w = begin; w < end; ++w) {
+      for (MatrixIndexT b = 0; b < num_cols_; ++b) {
+        bit_kernel_transpose_block(mat.RowData(b * pack_factor) + w,
+                                   mat.Stride(), align_bits_,
+                                   RowData(w * pack_factor) + b, stride_);
+      }
+    }
+  });
 }
 
-// float * int, can use neon to accelarete?
-// todo: combine BN & nonlinear together, and use 8/16-bit BN
-// to avoid int -> float -> int -> float, use int always
-void BitMatrix::ToMatrix(MatrixBase *out) const {
-  if (quant_bits_ == 1) {
-    for (MatrixIndexT r = 0; r < num_rows_; ++r) {
-      for (MatrixIndexT c = 0; c < num_cols_; ++c) {
-        (*out)(r, c) = data_[r * stride_ + c] == 1 ? scale_ : -scale_;
-      }
+BitMatrix::BitMatrix(const BitMatrixBase &mat,
+                     const MatrixTransposeType trans)
+    : BitMatrixBase(), static_scale_(0), row_params_(NULL) {
+  if (trans == kNoTrans) {
+    *this = mat;
+    return;
+  }
+  if (mat.HasRowScales()) {
+    SNOWBOY_ERROR << "Fail to transpose BitMatrix: it has row scales.";
+  }
+  scale_ = mat.Scale();
+  static_scale_ = mat.Scale();
+  offset_ = mat.Offset();
+  quant_bits_ = mat.QuantBits();
+  align_bits_ = mat.AlignBits();
+  Resize(mat.NumCols() * PackFactor(), mat.NumRows() / PackFactor());
+  CopyFromBitMat(mat, kTrans);
+}
+
+void BitMatrix::Swap(BitMatrix *other) {
+  std::swap(num_rows_, other->num_rows_);
+  std::swap(num_cols_, other->num_cols_);
+  std::swap(stride_, other->stride_);
+  std::swap(data_, other->data_);
+  std::swap(scale_, other->scale_);
+  std::swap(static_scale_, other->static_scale_);
+  std::swap(offset_, other->offset_);
+  std::swap(row_scales_, other->row_scales_);
+  std::swap(row_offsets_, other->row_offsets_);
+  std::swap(quant_bits_, other->quant_bits_);
+  std::swap(align_bits_, other->align_bits_);
+  // The row scale pointers stay valid, the buffers move with the data.
+  std::swap(row_params_, other->row_params_);
+}
+
+void BitMatrix::Transpose() {
+  BitMatrix tmp(*this, kTrans);
+  tmp.Swap(this);
+}
+
+void BitMatrixBase::ToMatrix(MatrixBase *out) const {
+  SNOWBOY_ASSERT(out != NULL);
+  SNOWBOY_PERF_SCOPE("ToMatrix", num_rows_, num_cols_ * PackFactor(), 0);
+  SNOWBOY_TRACE_SCOPE("ToMatrix", num_rows_, num_cols_ * PackFactor(), 0,
+                      sizeof(uint64) * num_rows_ * num_cols_
+                      + sizeof(float) * out->NumRows() * out->NumCols());
+  SNOWBOY_ASSERT(out->NumRows() == num_rows_ &&
+      out->NumCols() == num_cols_ * PackFactor());
+  // A large output would only evict the weights on its way through the
+  // caches, so it bypasses them.
+  const bool stream = UseStreamingStores(
+      static_cast<int64>(sizeof(float)) * out->NumRows() * out->NumCols());
+  ParallelFor(0, num_rows_, ParallelGrain(out->NumCols()),
+              [&](MatrixIndexT row_begin, MatrixIndexT row_end) {
+    for (MatrixIndexT r = row_begin; r < row_end; ++r) {
+      bit_kernel_unpack_row(RowData(r), num_cols_, quant_bits_, align_bits_,
+                            RowScale(r), RowOffset(r), out->RowData(r),
+                            stream);
     }
-  } else {
-    for (MatrixIndexT r = 0; r < num_rows_; ++r) {
-      for (MatrixIndexT c = 0; c < num_cols_; ++c) {
-        (*out)(r, c) = scale_ * data_[r * stride_ + c];
-      }
+  });
+}
+
+void BitMatrixBase::ToMatrix(const VectorBase &row_scales,
+                             MatrixBase *out) const {
+  SNOWBOY_ASSERT(out != NULL && row_scales.Dim() == num_rows_);
+  SNOWBOY_PERF_SCOPE("ToMatrix", num_rows_, num_cols_ * PackFactor(), 0);
+  SNOWBOY_TRACE_SCOPE("ToMatrix", num_rows_, num_cols_ * PackFactor(), 0,
+                      sizeof(uint64) * num_rows_ * num_cols_
+                      + sizeof(float) * out->NumRows() * out->NumCols());
+  SNOWBOY_ASSERT(out->NumRows() == num_rows_ &&
+      out->NumCols() == num_cols_ * PackFactor());
+  const bool stream = UseStreamingStores(
+      static_cast<int64>(sizeof(float)) * out->NumRows() * out->NumCols());
+  ParallelFor(0, num_rows_, ParallelGrain(out->NumCols()),
+              [&](MatrixIndexT row_begin, MatrixIndexT row_end) {
+    for (MatrixIndexT r = row_begin; r < row_end; ++r) {
+      bit_kernel_unpack_row(RowData(r), num_cols_, quant_bits_, align_bits_,
+                            row_scales(r), RowOffset(r), out->RowData(r),
+                            stream);
     }
+  });
+}
+
+// Gets the scale and the offset that map codes onto [low, high]: codes 0 and 1
+// are offset - scale and offset + scale for 1-bit values, and code k is
+// offset + k * scale otherwise.
+static inline void range_to_scale(const float low, const float high,
+                                  const int32 quant_bits,
+                                  float *scale, float *offset) {
+  const float range = high > low ? high - low : 0.0f;
+  if (quant_bits == 1) {
+    *scale = 0.5f * range;
+    *offset = low + *scale;
+  } else {
+    *scale = range / ((1ull << quant_bits) - 1);
+    *offset = low;
   }
 }
 
-int32 BitMatrix::quantize(float x) {
-  return roundf(x * (pow(2, quant_bits_) - 1));
+void BitMatrix::SetRowScales(const bool has_row_scales) {
+  if (has_row_scales && row_params_ != NULL) {
+    row_scales_ = row_params_;
+    row_offsets_ = row_params_ + num_rows_;
+  } else {
+    row_scales_ = NULL;
+    row_offsets_ = NULL;
+  }
 }
 
-void BitMatrix::Quantize(const MatrixBase &in) {
+void BitMatrix::Quantize(const MatrixBase &in, const BitQuantizeType type) {
   SNOWBOY_ASSERT(align_bits_ > 0);
+  SNOWBOY_PERF_SCOPE("Quantize", in.NumRows(), in.NumCols(), 0);
+  SNOWBOY_TRACE_SCOPE("Quantize", in.NumRows(), in.NumCols(), 0,
+                      static_cast<int64>(in.NumRows()) * in.NumCols()
+                      * (8 * sizeof(float) + align_bits_) / 8);
   if (num_rows_ != in.NumRows() || num_cols_ != in.NumCols() / (8 * sizeof(uint64) / align_bits_))
     Resize(in.NumRows(), in.NumCols() / (8 * sizeof(uint64) / align_bits_));
   if ((void *) (&in) == (void *) this) {
@@ -120,42 +259,92 @@ void BitMatrix::Quantize(const MatrixBase &in) {
   SNOWBOY_ASSERT(num_rows_ == in.NumRows() &&
       num_cols_ == in.NumCols() / (8 * sizeof(uint64) / align_bits_));
   SNOWBOY_ASSERT(align_bits_ >= quant_bits_);
+  // Codes go up to 2^quant_bits - 1, which needs a shift of less than 64.
+  SNOWBOY_ASSERT(quant_bits_ > 0 && quant_bits_ < 64);
 
   int32 contain_nums = 8 * sizeof(uint64) / align_bits_;
-  // ToDo: make this robust to any num_cols_
-  for (MatrixIndexT r = 0; r < num_rows_; ++r) {
-    for (MatrixIndexT c = 0; c < num_cols_; ++c) {
-      uint64 tmp = quantize(in(r, c * contain_nums));
-      for (MatrixIndexT i = 1; i < contain_nums; ++i) {
-        tmp = tmp << align_bits_;
-        tmp += quantize(in(r, c * contain_nums + i));
-      }
-      data_[r * stride_ + c] = tmp;
+  const MatrixIndexT num_values = num_cols_ * contain_nums;
+  SetRowScales(type == kQuantizePerRow);
+  if (type == kQuantizeStatic) {
+    // A dynamic Quantize() in between leaves the static scale as it was.
+    scale_ = static_scale_;
+    offset_ = 0.0f;
+  } else if (type == kQuantizePerTensor) {
+    // The range of the whole matrix is needed before packing the first row,
+    // so this is a second pass over <in>, see the header.
+    float low = 0.0f, high = 0.0f;
+    for (MatrixIndexT r = 0; r < num_rows_; ++r) {
+      float row_low, row_high;
+      bit_kernel_min_max(in.RowData(r), num_values, &row_low, &row_high);
+      low = r == 0 ? row_low : std::min(low, row_low);
+      high = r == 0 ? row_high : std::max(high, row_high);
     }
+    range_to_scale(low, high, quant_bits_, &scale_, &offset_);
   }
+
+  // Large matrices are split by rows across the shared pool. A freshly
+  // resized matrix is not touched before this, so each page is first touched,
+  // and thus placed, by the thread that quantizes its rows.
+  ParallelFor(0, num_rows_, ParallelGrain(num_values),
+              [&](MatrixIndexT row_begin, MatrixIndexT row_end) {
+    for (MatrixIndexT r = row_begin; r < row_end; ++r) {
+      const float *row = in.RowData(r);
+      if (type == kQuantizePerRow) {
+        float low, high;
+        bit_kernel_min_max(row, num_values, &low, &high);
+        range_to_scale(low, high, quant_bits_, &row_params_[r],
+                       &row_params_[num_rows_ + r]);
+      }
+      // Static codes are round(x / scale), as before offsets were supported.
+      float low = 0.0f, step = scale_;
+      if (type != kQuantizeStatic) {
+        float scale = RowScale(r), offset = RowOffset(r);
+        low = quant_bits_ == 1 ? offset - scale : offset;
+        step = quant_bits_ == 1 ? 2 * scale : scale;
+      }
+      float inv_step = step > 0.0f ? static_cast<float>(1.0 / step) : 0.0f;
+      bit_kernel_pack_row(row, num_cols_, quant_bits_, align_bits_, low,
+                          inv_step, RowData(r));
+    }
+  });
 }
 
 // quantize Matrix in into in_bits, and store in BitMatrix
-BitMatrix::BitMatrix(const MatrixBase &in, int32 in_bits) :
-    num_rows_(0), num_cols_(0), stride_(0), data_(NULL) {
+BitMatrix::BitMatrix(const MatrixBase &in, int32 in_bits)
+    : BitMatrixBase(), static_scale_(0), row_params_(NULL) {
   quant_bits_ = in_bits;
   scale_ = 1 / (pow(2, quant_bits_) - 1);
+  static_scale_ = scale_;
   align_bits_ = in_bits;
   Resize(in.NumRows(), in.NumCols() / (8 * sizeof(uint64) / align_bits_));
   Quantize(in);
 }
 
 // quantize Matrix in into in_bits, and store in BitMatrix
-BitMatrix::BitMatrix(const MatrixBase &in, int32 quant_bits, int32 align_bits) :
-    num_rows_(0), num_cols_(0), stride_(0), data_(NULL) {
+BitMatrix::BitMatrix(const MatrixBase &in, int32 quant_bits, int32 align_bits)
+    : BitMatrixBase(), static_scale_(0), row_params_(NULL) {
   quant_bits_ = quant_bits;
   scale_ = 1 / (pow(2, quant_bits_) - 1);
+  static_scale_ = scale_;
   align_bits_ = align_bits;
   Resize(in.NumRows(), in.NumCols() / (8 * sizeof(uint64) / align_bits_));
   Quantize(in);
 }
 
-void MatBitMat(const MatrixBase &x, const BitMatrix &y, MatrixBase *out) {
+// quantize Matrix in with a calibrated scale, and store in BitMatrix
+BitMatrix::BitMatrix(const MatrixBase &in, int32 quant_bits, int32 align_bits,
+                     float scale)
+    : BitMatrixBase(), static_scale_(0), row_params_(NULL) {
+  SNOWBOY_ASSERT(scale > 0);
+  quant_bits_ = quant_bits;
+  scale_ = scale;
+  static_scale_ = scale;
+  align_bits_ = align_bits;
+  Resize(in.NumRows(), in.NumCols() / (8 * sizeof(uint64) / align_bits_));
+  Quantize(in);
+}
+
+void MatBitMat(const MatrixBase &x, const BitMatrixBase &y, MatrixBase *out) {
 //  if (y.quant_bits_ == 1) {
 //    for (MatrixIndexT r = 0; r < x.NumRows(); ++r) {
 //      for (MatrixIndexT c = 0; c < x.NumCols(); ++c) {
@@ -168,40 +357,208 @@ void MatBitMat(const MatrixBase &x, const BitMatrix &y, MatrixBase *out) {
 //  }
 }
 
-void BitMatrix::AddBitMatBitMat(const BitMatrix &mat1,
-                                const BitMatrix &mat2) {
-  SNOWBOY_ASSERT(mat1.NumCols() == mat2.NumCols() &&
-      mat1.NumRows() == num_rows_ &&
-      mat2.NumRows() == num_cols_);
+void BitMatrixBase::AddBitMatBitMat(const BitMatrixBase &mat1,
+                                    const BitMatrixBase &mat2) {
+  SNOWBOY_ASSERT(mat1.NumRows() == num_rows_ && mat2.NumRows() == num_cols_);
   SNOWBOY_ASSERT(&mat1 != this && &mat2 != this);
-
+  Int32Matrix products(num_rows_, num_cols_, kUndefined);
+  BitMatBitMat(mat1, mat2, &products);
   for (MatrixIndexT r = 0; r < num_rows_; ++r) {
     for (MatrixIndexT c = 0; c < num_cols_; ++c) {
-      data_[r * stride_ + c] = VecVec(mat1.Row(r), mat2.Row(c));
+      data_[r * stride_ + c] = static_cast<uint64>(products(r, c));
     }
   }
   scale_ = mat1.scale_ * mat2.scale_;
 }
 
-void BitMatBitMat(const BitMatrix &x, const BitMatrix &y, MatrixBase *out) {
-  SNOWBOY_ASSERT(x.NumCols() == y.NumCols() &&
-      x.NumRows() == out->NumRows() &&
-      y.NumRows() == out->NumCols());
-
-  float scale = x.Scale() * y.Scale();
-//  double begin, elapsed_secs = 0;
-  for (MatrixIndexT r = 0; r < out->NumRows(); ++r) {
-    for (MatrixIndexT c = 0; c < out->NumCols(); ++c) {
-//      begin = clock();
-      (*out)(r,c) = scale * VecVec(x.Row(r), y.Row(c));
-//      elapsed_secs += double(clock() - begin) / CLOCKS_PER_SEC;
-    }
+// Transposing an operand would copy it on every call, which the per-frame
+// path cannot afford, so the operands must come in the native layout.
+static void CheckNativeLayout(const MatrixTransposeType trans_x,
+                              const MatrixTransposeType trans_y) {
+  if (trans_x != kNoTrans || trans_y != kTrans) {
+    SNOWBOY_ERROR << "Fail to multiply BitMatrix: only trans_x = kNoTrans and "
+                  << "trans_y = kTrans are supported, transpose the operands "
+                  << "once with BitMatrix::Transpose() instead.";
   }
-//  std::cout << "\tvecvec:" << elapsed_secs << std::endl;
 }
 
-void BitMatrix::Write(const bool binary, std::ostream* os) const {
+void AddBitMatBitMat(const float alpha,
+                     const BitMatrixBase &x, const MatrixTransposeType trans_x,
+                     const BitMatrixBase &y, const MatrixTransposeType trans_y,
+                     const float beta, MatrixBase *out) {
+  SNOWBOY_ASSERT(out != NULL);
+  SNOWBOY_PERF_SCOPE("AddBitMatBitMat", out->NumRows(),
+                     trans_x == kNoTrans ? x.NumCols() * x.PackFactor()
+                                         : x.NumRows(),
+                     out->NumCols());
+  SNOWBOY_TRACE_SCOPE("AddBitMatBitMat", out->NumRows(),
+                      trans_x == kNoTrans ? x.NumCols() * x.PackFactor()
+                                          : x.NumRows(),
+                      out->NumCols(),
+                      sizeof(uint64)
+                      * (static_cast<int64>(x.NumRows()) * x.NumCols()
+                         + static_cast<int64>(y.NumRows()) * y.NumCols())
+                      + static_cast<int64>(sizeof(float)) * out->NumRows()
+                      * out->NumCols());
+  CheckNativeLayout(trans_x, trans_y);
+  const BitMatrixBase &a = x;
+  const BitMatrixBase &b = y;
+  SNOWBOY_ASSERT(a.NumCols() == b.NumCols() &&
+      a.NumRows() == out->NumRows() &&
+      b.NumRows() == out->NumCols());
+
+  // With x = x_scale * x_code + x_offset, and y = y_scale * y_code:
+  // x . y = y_scale * (x_scale * (x_code . y_code) + x_offset * sum(y_code)).
+  // The kernel reads 1-bit x codes as 0 and 1, i.e. x = 2 * x_scale * x_code
+  // + x_offset - x_scale.
+  const bool x_binary = a.QuantBits() == 1;
+  const bool has_offsets = x_binary || a.Offset() != 0 || a.HasRowScales();
+  // Large products are split by output columns, i.e. rows of the weights, so
+  // that each thread reads its own share of them even for a single frame.
+  // The scales and sums of y live on the stack, a block of columns at a time,
+  // so that the per-frame path does not allocate. Weight rows are prefetched
+  // PrefetchRows() ahead while the first row of x goes through a block; the
+  // other rows of x find the block in cache.
+  const MatrixIndexT prefetch_rows = PrefetchRows();
+  const size_t row_bytes = sizeof(uint64) * b.NumCols();
+  ParallelFor(0, out->NumCols(),
+              ParallelGrain(static_cast<int64>(out->NumRows()) * a.NumCols()),
+              [&](MatrixIndexT col_begin, MatrixIndexT col_end) {
+    const MatrixIndexT kBlockCols = 64;
+    float y_scales[kBlockCols];
+    float y_sums[kBlockCols];
+    for (MatrixIndexT c0 = col_begin; c0 < col_end; c0 += kBlockCols) {
+      const MatrixIndexT block_cols = std::min(kBlockCols, col_end - c0);
+      for (MatrixIndexT c = 0; c < block_cols; ++c) {
+        SNOWBOY_ASSERT(b.RowOffset(c0 + c) == 0);
+        y_scales[c] = alpha * b.RowScale(c0 + c);
+        y_sums[c] = has_offsets ? b.Row(c0 + c).Sum() : 0;
+      }
+      for (MatrixIndexT r = 0; r < out->NumRows(); ++r) {
+        const BitVector x_row = a.Row(r);
+        float x_scale = a.RowScale(r);
+        float x_offset = a.RowOffset(r);
+        if (x_binary) {
+          x_offset -= x_scale;
+          x_scale *= 2;
+        }
+        float *out_data = out->RowData(r) + c0;
+        for (MatrixIndexT c = 0; c < block_cols; ++c) {
+          if (r == 0 && prefetch_rows > 0 &&
+              c0 + c + prefetch_rows < col_end) {
+            PrefetchRange(b.RowData(c0 + c + prefetch_rows), row_bytes);
+          }
+          float value = y_scales[c] * (x_scale * VecVec(x_row, b.Row(c0 + c))
+                                       + x_offset * y_sums[c]);
+          // beta == 0 does not read <out>, as in BLAS.
+          out_data[c] = (beta == 0) ? value : value + beta * out_data[c];
+        }
+      }
+    }
+  });
+}
+
+void AddBitMatBitMat(const int32 alpha,
+                     const BitMatrixBase &x, const MatrixTransposeType trans_x,
+                     const BitMatrixBase &y, const MatrixTransposeType trans_y,
+                     const int32 beta, MatrixBaseT<int32> *out) {
+  SNOWBOY_ASSERT(out != NULL);
+  SNOWBOY_PERF_SCOPE("AddBitMatBitMat", out->NumRows(),
+                     trans_x == kNoTrans ? x.NumCols() * x.PackFactor()
+                                         : x.NumRows(),
+                     out->NumCols());
+  SNOWBOY_TRACE_SCOPE("AddBitMatBitMat", out->NumRows(),
+                      trans_x == kNoTrans ? x.NumCols() * x.PackFactor()
+                                          : x.NumRows(),
+                      out->NumCols(),
+                      sizeof(uint64)
+                      * (static_cast<int64>(x.NumRows()) * x.NumCols()
+                         + static_cast<int64>(y.NumRows()) * y.NumCols())
+                      + static_cast<int64>(sizeof(float)) * out->NumRows()
+                      * out->NumCols());
+  CheckNativeLayout(trans_x, trans_y);
+  const BitMatrixBase &a = x;
+  const BitMatrixBase &b = y;
+  SNOWBOY_ASSERT(a.NumCols() == b.NumCols() &&
+      a.NumRows() == out->NumRows() &&
+      b.NumRows() == out->NumCols());
+
+  // As above, weight rows are prefetched while the first row of x goes
+  // through a block of them, and the other rows of x find the block in cache.
+  const MatrixIndexT prefetch_rows = PrefetchRows();
+  const size_t row_bytes = sizeof(uint64) * b.NumCols();
+  ParallelFor(0, out->NumCols(),
+              ParallelGrain(static_cast<int64>(out->NumRows()) * a.NumCols()),
+              [&](MatrixIndexT col_begin, MatrixIndexT col_end) {
+    const MatrixIndexT kBlockCols = 64;
+    for (MatrixIndexT c0 = col_begin; c0 < col_end; c0 += kBlockCols) {
+      const MatrixIndexT block_end = std::min(c0 + kBlockCols, col_end);
+      for (MatrixIndexT r = 0; r < out->NumRows(); ++r) {
+        const BitVector x_row = a.Row(r);
+        int32 *out_data = out->RowData(r);
+        for (MatrixIndexT c = c0; c < block_end; ++c) {
+          if (r == 0 && prefetch_rows > 0 && c + prefetch_rows < col_end) {
+            PrefetchRange(b.RowData(c + prefetch_rows), row_bytes);
+          }
+          int32 value = alpha * VecVec(x_row, b.Row(c));
+          out_data[c] = (beta == 0) ? value : value + beta * out_data[c];
+        }
+      }
+    }
+  });
+}
+
+void BitMatBitMat(const BitMatrixBase &x, const BitMatrixBase &y,
+                  MatrixBase *out) {
+  AddBitMatBitMat(1.0f, x, kNoTrans, y, kTrans, 0.0f, out);
+}
+
+void BitMatBitMat(const BitMatrixBase &x, const BitMatrixBase &y,
+                  MatrixBaseT<int32> *out) {
+  AddBitMatBitMat(1, x, kNoTrans, y, kTrans, 0, out);
+}
+
+BitSubMatrix BitMatrixBase::Range(const MatrixIndexT row_offset,
+                                   const MatrixIndexT num_rows,
+                                   const MatrixIndexT col_offset,
+                                   const MatrixIndexT num_cols) const {
+  return BitSubMatrix(*this, row_offset, num_rows, col_offset, num_cols);
+}
+
+BitSubMatrix BitMatrixBase::RowRange(const MatrixIndexT row_offset,
+                                      const MatrixIndexT num_rows) const {
+  return BitSubMatrix(*this, row_offset, num_rows, 0, num_cols_);
+}
+
+BitSubMatrix BitMatrixBase::ColRange(const MatrixIndexT col_offset,
+                                      const MatrixIndexT num_cols) const {
+  return BitSubMatrix(*this, 0, num_rows_, col_offset, num_cols);
+}
+
+BitSubMatrix::BitSubMatrix(const BitMatrixBase& mat,
+                           const MatrixIndexT row_offset,
+                           const MatrixIndexT num_rows,
+                           const MatrixIndexT col_offset,
+                           const MatrixIndexT num_cols) :
+    BitMatrixBase(num_rows, num_cols, mat.Stride(),
+                  const_cast<uint64*>(mat.Data()
+                                      + row_offset * mat.Stride() + col_offset),
+                  mat.Scale(), mat.Offset(),
+                  mat.HasRowScales() ? mat.RowScaleData() + row_offset : NULL,
+                  mat.HasRowScales() ? mat.RowOffsetData() + row_offset : NULL,
+                  mat.QuantBits(), mat.AlignBits()) {
+  SNOWBOY_ASSERT(row_offset >= 0 && num_rows >= 0);
+  SNOWBOY_ASSERT(col_offset >= 0 && num_cols >= 0);
+  SNOWBOY_ASSERT(row_offset + num_rows <= mat.NumRows());
+  SNOWBOY_ASSERT(col_offset + num_cols <= mat.NumCols());
+}
+
+void BitMatrixBase::Write(const bool binary, std::ostream* os) const {
   SNOWBOY_ASSERT(os != NULL);
+  if (offset_ != 0 || row_scales_ != NULL) {
+    // Only activations are quantized dynamically, they are not stored.
+    SNOWBOY_ERROR << "Fail to write BitMatrix: it has offsets.";
+  }
   if (!os->good()) {
     SNOWBOY_ERROR << "Fail to write Matrix to stream.";
   }
@@ -267,6 +624,7 @@ void BitMatrix::Read(const bool binary, std::istream *is) {
     ReadBasicType(binary, &align_bits_, is);
     ExpectToken(binary, "<Scale>", is);
     ReadBasicType(binary, &scale_, is);
+    static_scale_ = scale_;
     SNOWBOY_ASSERT(align_bits_ >= quant_bits_);
     if ((MatrixIndexT) (num_rows) != num_rows_
         || (MatrixIndexT) (num_cols) != num_cols_) {
@@ -296,6 +654,7 @@ void BitMatrix::Read(const bool binary, std::istream *is) {
     ReadBasicType(binary, &align_bits_, is);
     ExpectToken(binary, "<Scale>", is);
     ReadBasicType(binary, &scale_, is);
+    static_scale_ = scale_;
     SNOWBOY_ASSERT(align_bits_ >= quant_bits_);
     ExpectToken(binary, "[", is);
     std::vector<uint64> data;
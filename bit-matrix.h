@@ -16,65 +16,78 @@ namespace snowboy {
 
 //void Quantize(const MatrixBase &in, int32 in_to_bits, BitMatrix *out);
 
-void MatBitMat(const MatrixBase &x, const BitMatrix &y, MatrixBase *out);
-void BitMatBitMat(const BitMatrix &x, const BitMatrix &y, MatrixBase *out);
+void MatBitMat(const MatrixBase &x, const BitMatrixBase &y, MatrixBase *out);
+// out = x * y^T, dequantized with the scales and offsets of <x> (per row, if
+// it was quantized with kQuantizePerRow) and the scales of <y>, which must have
+// no offsets, e.g. static weights.
+void BitMatBitMat(const BitMatrixBase &x, const BitMatrixBase &y,
+                  MatrixBase *out);
+
+// Same as above, but keeps the integer dot products, i.e. without the
+// x.Scale() * y.Scale() factor, so integer pipelines need not go through float.
+void BitMatBitMat(const BitMatrixBase &x, const BitMatrixBase &y,
+                  MatrixBaseT<int32> *out);
+
+// out = alpha * op(x) * op(y) + beta * out, with the same conventions as
+// MatrixBase::AddMatMat(); BitMatBitMat() is the case alpha = 1, beta = 0,
+// trans_x = kNoTrans and trans_y = kTrans. That is the only layout supported,
+// where both operands are packed along the inner dimension; other
+// combinations are an error, as they would copy an operand on every call, so
+// transpose such operands once, e.g. weights at load time, with
+// BitMatrix::Transpose(). When beta is 0, <out> is only written, so it may be
+// uninitialized.
+void AddBitMatBitMat(const float alpha,
+                     const BitMatrixBase &x, const MatrixTransposeType trans_x,
+                     const BitMatrixBase &y, const MatrixTransposeType trans_y,
+                     const float beta, MatrixBase *out);
+
+// Same as above, on the integer dot products of the codes.
+void AddBitMatBitMat(const int32 alpha,
+                     const BitMatrixBase &x, const MatrixTransposeType trans_x,
+                     const BitMatrixBase &y, const MatrixTransposeType trans_y,
+                     const int32 beta, MatrixBaseT<int32> *out);
+
+enum BitQuantizeType {
+  kQuantizeStatic,     // Uses the current Scale(), with no offset.
+  kQuantizePerTensor,  // Scale and offset from the min and max of the matrix.
+  kQuantizePerRow      // Scale and offset from the min and max of each row.
+};
 
-class BitMatrix {
+// Common part of BitMatrix and BitSubMatrix. Each element is a uint64 word that
+// packs PackFactor() values of AlignBits() bits, so column indices and ranges
+// are in words, and column ranges are always word aligned.
+class BitMatrixBase {
  public:
-  explicit BitMatrix(const MatrixBase &in, int32 in_bits);
-
-  explicit BitMatrix(const MatrixBase &in, int32 quant_bits, int32 align_bits);
-
-  explicit BitMatrix(const MatrixIndexT rows,
-                     const MatrixIndexT cols) :
-      data_(NULL), scale_(1), quant_bits_(0) {
-    align_bits_ = 8 * sizeof(uint64);
-    Resize(rows, cols);
-  }
-
-  // Constructor, this version creates an empty matrix, and is only callable
-  // from child classes.
-  BitMatrix() : num_rows_(0), num_cols_(0), stride_(0),
-                         data_(NULL),
-                         scale_(0), quant_bits_(0) {
-    align_bits_ = 8 * sizeof(uint64);
-  }
-
-  // Constructor, this version creates a matrix with given data, and is only
-  // callable from child classes.
-//  explicit BitMatrix(const MatrixIndexT rows,
-//                     const MatrixIndexT cols,
-//                     const MatrixIndexT stride,
-//                     uint64 *data) :
-//      num_rows_(rows), num_cols_(cols), stride_(stride), data_(data) {}
-
-  // Destructor, only callable from child classes.
-  ~BitMatrix() {}
-
-  BitMatrix& operator=(const BitMatrix& other) {
-    if (num_rows_ != other.NumRows() || num_cols_ != other.NumCols()) {
-      Resize(other.NumRows(), other.NumCols());
-    }
-    scale_ = other.Scale();
-    quant_bits_ = other.QuantBits();
-    align_bits_ = other.AlignBits();
-    CopyFromBitMat(other);
-    return *this;
-  }
-
-  void CopyFromBitMat(const BitMatrix& mat);
-
+  // Copies the codes of <mat>, which must have the same AlignBits(). With
+  // kTrans, *this has mat.NumCols() * PackFactor() rows and the rows of <mat>
+  // are a multiple of PackFactor(); blocks of PackFactor() words are
+  // transposed by bit_kernel_transpose_block(). Scales are not copied.
+  void CopyFromBitMat(const BitMatrixBase& mat,
+                      const MatrixTransposeType trans = kNoTrans);
+
+  // Unpacks and dequantizes into <out>, which has NumCols() * PackFactor()
+  // columns. 1-bit values become RowOffset(r) -/+ RowScale(r), the others
+  // RowOffset(r) + RowScale(r) * value. Uses SIMD for 1-bit and 8-bit slots.
+  // Large matrices are converted by the threads of ThreadPool::Current(); if
+  // <out> was resized with kUndefined, its pages are first touched by the
+  // threads that fill them.
   void ToMatrix(MatrixBase *out) const;
 
+  // Same as above, with the given scales instead of RowScale().
+  void ToMatrix(const VectorBase &row_scales, MatrixBase *out) const;
+
   // Returns number of rows.
   inline MatrixIndexT NumRows() const { return num_rows_; }
 
-  // Returns number of columns.
+  // Returns number of columns, i.e., packed words per row.
   inline MatrixIndexT NumCols() const { return num_cols_; }
 
   // Returns the stride, which is the distance in memory between each row.
   inline MatrixIndexT Stride() const { return stride_; }
 
+  // Returns the number of values packed in each word.
+  inline int32 PackFactor() const { return 8 * sizeof(uint64) / align_bits_; }
+
   // Returns pointer to the data.
   inline uint64* Data() { return data_; }
   inline const uint64* Data() const { return data_; }
@@ -99,6 +112,16 @@ class BitMatrix {
     return BitVector((*this), row);
   }
 
+  // Returns a sub-part of matrix, <col_offset> and <num_cols> are in words.
+  BitSubMatrix Range(const MatrixIndexT row_offset,
+                     const MatrixIndexT num_rows,
+                     const MatrixIndexT col_offset,
+                     const MatrixIndexT num_cols) const;
+  BitSubMatrix RowRange(const MatrixIndexT row_offset,
+                        const MatrixIndexT num_rows) const;
+  BitSubMatrix ColRange(const MatrixIndexT col_offset,
+                        const MatrixIndexT num_cols) const;
+
   // Returns the value at given index.
   inline const uint64 operator()(const MatrixIndexT row,
                                  const MatrixIndexT col) const {
@@ -114,23 +137,17 @@ class BitMatrix {
   // Sets all members of a matrix to a specified value.
   void Set(const uint64 value);
 
-  void Resize(const MatrixIndexT rows,
-              const MatrixIndexT cols);
-
-  // Without transpose:
-  // *this = beta * *this + alpha * mat1 * mat2^T.
-  void AddBitMatBitMat(const BitMatrix &mat1,
-                       const BitMatrix &mat2);
-
-  void Quantize(const MatrixBase &in);
-
-  // If <add> is true, then read the Vector from stream, and add it to the
-  // current Vector.
-  void Read(const bool binary, std::istream *is);
+  // *this = mat1 * mat2^T, with the int32 dot products stored in the uint64
+  // slots and Scale() set to mat1.Scale() * mat2.Scale(). Kept for existing
+  // callers, it goes through BitMatBitMat() into an Int32Matrix, which is what
+  // new code should call.
+  void AddBitMatBitMat(const BitMatrixBase &mat1,
+                       const BitMatrixBase &mat2);
 
   void Write(const bool binary, std::ostream *os) const;
 
-  friend void MatBitMat(const MatrixBase &x, const BitMatrix &y, MatrixBase *out);
+  friend void MatBitMat(const MatrixBase &x, const BitMatrixBase &y,
+                        MatrixBase *out);
 
   int32 QuantBits() const { return quant_bits_; }
 
@@ -140,24 +157,200 @@ class BitMatrix {
 
   void Scale(float scale) { scale_ = scale; }
 
+  float Offset() const { return offset_; }
+
+  // Returns true if the matrix has a scale and an offset per row.
+  bool HasRowScales() const { return row_scales_ != NULL; }
+
+  // Returns the per-row scales and offsets, NULL if there are none.
+  const float* RowScaleData() const { return row_scales_; }
+  const float* RowOffsetData() const { return row_offsets_; }
+
+  // Returns the scale and the offset that apply to a row.
+  inline float RowScale(const MatrixIndexT row) const {
+    SNOWBOY_ASSERT(row < num_rows_ && row >= 0);
+    return row_scales_ != NULL ? row_scales_[row] : scale_;
+  }
+  inline float RowOffset(const MatrixIndexT row) const {
+    SNOWBOY_ASSERT(row < num_rows_ && row >= 0);
+    return row_offsets_ != NULL ? row_offsets_[row] : offset_;
+  }
+
  protected:
+  // Constructor, this version creates an empty matrix, and is only callable
+  // from child classes.
+  BitMatrixBase() : num_rows_(0), num_cols_(0), stride_(0), data_(NULL),
+                    scale_(0), offset_(0), row_scales_(NULL),
+                    row_offsets_(NULL), quant_bits_(0),
+                    align_bits_(8 * sizeof(uint64)) {}
+
+  // Constructor, this version creates a matrix with given data, and is only
+  // callable from child classes.
+  BitMatrixBase(const MatrixIndexT rows,
+                const MatrixIndexT cols,
+                const MatrixIndexT stride,
+                uint64 *data,
+                const float scale,
+                const float offset,
+                const float *row_scales,
+                const float *row_offsets,
+                const int32 quant_bits,
+                const int32 align_bits) :
+      num_rows_(rows), num_cols_(cols), stride_(stride), data_(data),
+      scale_(scale), offset_(offset), row_scales_(row_scales),
+      row_offsets_(row_offsets), quant_bits_(quant_bits),
+      align_bits_(align_bits) {}
+
+  // Destructor, only callable from child classes.
+  ~BitMatrixBase() {}
+
   MatrixIndexT num_rows_;
   MatrixIndexT num_cols_;
   MatrixIndexT stride_;
   uint64 *data_;
   float scale_;
+  float offset_;
+  // Per-row scales and offsets, NULL unless quantized with kQuantizePerRow.
+  const float *row_scales_;
+  const float *row_offsets_;
   int32 quant_bits_;
   int32 align_bits_;
 
-  SNOWBOY_DISALLOW_COPY(BitMatrix);
+  SNOWBOY_DISALLOW_COPY_AND_ASSIGN(BitMatrixBase);
+};
+
+class BitMatrix : public BitMatrixBase {
+ public:
+  explicit BitMatrix(const MatrixBase &in, int32 in_bits);
+
+  explicit BitMatrix(const MatrixBase &in, int32 quant_bits, int32 align_bits);
+
+  // Quantizes with a given scale, e.g. from QuantizeCalibrator, instead of
+  // 1 / (2^quant_bits - 1), which assumes <in> is in [0, 1].
+  explicit BitMatrix(const MatrixBase &in, int32 quant_bits, int32 align_bits,
+                     float scale);
+
+  explicit BitMatrix(const MatrixIndexT rows,
+                     const MatrixIndexT cols)
+      : BitMatrixBase(), static_scale_(1), row_params_(NULL) {
+    scale_ = 1;
+    Resize(rows, cols);
+  }
+
+  // Constructor, this version creates an empty matrix.
+  BitMatrix() : BitMatrixBase(), static_scale_(0), row_params_(NULL) {}
+
+  // Copy constructor, transposes <mat> if <trans> is kTrans. A transposed
+  // matrix keeps its scale and offset, but row scales have no transposed
+  // equivalent, so <mat> must not have them.
+  explicit BitMatrix(const BitMatrixBase &mat,
+                     const MatrixTransposeType trans = kNoTrans);
+
+  // Destructor.
+  ~BitMatrix() { ReleaseBitMatrixMemory(); }
+
+  BitMatrix& operator=(const BitMatrixBase& other) {
+    if (num_rows_ != other.NumRows() || num_cols_ != other.NumCols()) {
+      Resize(other.NumRows(), other.NumCols());
+    }
+    scale_ = other.Scale();
+    static_scale_ = other.Scale();
+    offset_ = other.Offset();
+    quant_bits_ = other.QuantBits();
+    align_bits_ = other.AlignBits();
+    SetRowScales(other.HasRowScales());
+    for (MatrixIndexT r = 0; other.HasRowScales() && r < num_rows_; ++r) {
+      row_params_[r] = other.RowScale(r);
+      row_params_[num_rows_ + r] = other.RowOffset(r);
+    }
+    CopyFromBitMat(other);
+    return *this;
+  }
+  BitMatrix& operator=(const BitMatrix& other) {
+    operator=(static_cast<const BitMatrixBase&>(other));
+    static_scale_ = other.static_scale_;
+    return *this;
+  }
+
+  using BitMatrixBase::Scale;
+
+  // Sets the scale that kQuantizeStatic quantizes with, and the current
+  // Scale(). A later dynamic Quantize() changes only the current one.
+  void Scale(float scale) { scale_ = scale; static_scale_ = scale; }
+
+  void Resize(const MatrixIndexT rows,
+              const MatrixIndexT cols);
+
+  // Swaps the contents of *this and *other. Shallow swap.
+  void Swap(BitMatrix *other);
+
+  // Transposes the matrix, e.g. to pack loaded weights along the inner
+  // dimension of AddBitMatBitMat(). See CopyFromBitMat() for the constraints.
+  void Transpose();
+
+  // Packs <in> into *this, in parallel for large matrices like ToMatrix().
+  // Values are stored as round((x - offset) / step), to nearest even and
+  // clamped to [0, 2^QuantBits() - 1]. With kQuantizeStatic, the offset is 0
+  // and step is Scale(). The dynamic types set the scales and the offsets from
+  // the range of the data, as activations vary with the input level, and keep
+  // the static scale for a later kQuantizeStatic. For kQuantizePerRow the
+  // range of each row is scanned right before the row is packed, while it is
+  // still in cache, so the data is read from memory once. kQuantizePerTensor
+  // needs the range of the whole matrix before it packs the first row, so it
+  // reads <in> twice, the second time from memory if <in> exceeds the cache;
+  // prefer kQuantizePerRow for large inputs. Uses SIMD for 1-bit and 8-bit
+  // slots.
+  void Quantize(const MatrixBase &in,
+                const BitQuantizeType type = kQuantizeStatic);
+
+  void Read(const bool binary, std::istream *is);
+
  private:
-  // Allocates memory for <data_>.
+  // Allocates memory for <data_>, and for <row_params_> in the same block, so
+  // that a later kQuantizePerRow does not allocate, e.g. in a
+  // NoAllocationScope.
   void AllocateBitMatrixMemory(const MatrixIndexT rows, const MatrixIndexT cols);
 
   void ReleaseBitMatrixMemory();
 
-  int32 quantize(float x);
-  void BitVecBitVec();
+  // Points the row scales to <row_params_>, or to nothing.
+  void SetRowScales(const bool has_row_scales);
+
+  // The scale of kQuantizeStatic, while <scale_> is the one of the last
+  // Quantize().
+  float static_scale_;
+
+  // Scales of the rows, followed by their offsets, after the rows of <data_>.
+  float *row_params_;
+
+  SNOWBOY_DISALLOW_COPY(BitMatrix);
+};
+
+// Non-owning view of a BitMatrixBase, see BitMatrixBase::Range(). The bit
+// kernels take BitMatrixBase, so they work on views as they do on matrices,
+// e.g. to split the rows across threads or to multiply with the gates of a
+// stacked weight matrix.
+class BitSubMatrix : public BitMatrixBase {
+ public:
+  // Constructor, this version creates a BitSubMatrix from BitMatrix or
+  // BitSubMatrix, and it is not const-safe.
+  BitSubMatrix(const BitMatrixBase& mat,
+               const MatrixIndexT row_offset,
+               const MatrixIndexT num_rows,
+               const MatrixIndexT col_offset,
+               const MatrixIndexT num_cols);
+
+  // Copy constructor, needed for Range() to work in base class.
+  BitSubMatrix(const BitSubMatrix& other) :
+      BitMatrixBase(other.num_rows_, other.num_cols_, other.stride_,
+                    other.data_, other.scale_, other.offset_,
+                    other.row_scales_, other.row_offsets_, other.quant_bits_,
+                    other.align_bits_) {}
+
+  ~BitSubMatrix() {}
+
+ private:
+  SNOWBOY_DISALLOW_ASSIGN(BitSubMatrix);
 };
 
 }
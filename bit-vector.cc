@@ -19,14 +19,21 @@ int32 VecVec(const BitVector &x, const BitVector &y) {
   SNOWBOY_ASSERT(x.Dim() == y.Dim());
   int32 result = 0;
   if (y.QuantBits() == 1) {
+    // The kernel takes 8 slots of 8 bits in both words.
+    SNOWBOY_ASSERT(x.AlignBits() == 8 && y.AlignBits() == 8);
     for (int k = 0; k < x.Dim(); ++k) {
       result += bit_kernel_for_uint64_8_1(x(k), y(k));
     }
+  } else {
+    SNOWBOY_ASSERT(x.AlignBits() == y.AlignBits());
+    for (int k = 0; k < x.Dim(); ++k) {
+      result += bit_kernel_dot_uint64(x(k), y(k), y.AlignBits());
+    }
   }
   return result;
 }
 
-BitVector::BitVector(const BitMatrix& mat, MatrixIndexT row) {
+BitVector::BitVector(const BitMatrixBase& mat, MatrixIndexT row) {
   data_ = const_cast<uint64*>(mat.RowData(row));
   dim_ = mat.NumCols();
   quant_bits_ = mat.QuantBits();
@@ -34,6 +41,41 @@ BitVector::BitVector(const BitMatrix& mat, MatrixIndexT row) {
   scale_ = mat.Scale();
 }
 
+BitVector::BitVector(const BitVector& vec,
+                     const MatrixIndexT origin,
+                     const MatrixIndexT length) {
+  SNOWBOY_ASSERT(origin >= 0 && length >= 0 && origin + length <= vec.Dim());
+  data_ = const_cast<uint64*>(vec.Data() + origin);
+  dim_ = length;
+  quant_bits_ = vec.QuantBits();
+  align_bits_ = vec.AlignBits();
+  scale_ = vec.Scale();
+}
+
+int32 BitVector::Sum() const {
+  const int32 pack_factor = 8 * sizeof(uint64) / align_bits_;
+  int32 sum = 0;
+  if (quant_bits_ == 1) {
+    // Counts the lowest bit of each slot.
+    uint64 mask = 0;
+    for (int32 i = 0; i < pack_factor; ++i) {
+      mask |= static_cast<uint64>(1) << (i * align_bits_);
+    }
+    for (MatrixIndexT k = 0; k < dim_; ++k) {
+      sum += __builtin_popcountll(data_[k] & mask);
+    }
+    return 2 * sum - dim_ * pack_factor;
+  }
+  const uint64 slot_mask = align_bits_ == 64 ?
+      ~static_cast<uint64>(0) : (static_cast<uint64>(1) << align_bits_) - 1;
+  for (MatrixIndexT k = 0; k < dim_; ++k) {
+    for (int32 i = 0; i < pack_factor; ++i) {
+      sum += (data_[k] >> (i * align_bits_)) & slot_mask;
+    }
+  }
+  return sum;
+}
+
 void BitVector::CopyFromBitVec(const BitVector& vec) {
   SNOWBOY_ASSERT(Dim() == vec.Dim());
   if (data_ != vec.Data()) {
@@ -11,17 +11,27 @@
 
 namespace snowboy {
 
+// Integer dot product of the codes of x and y, where 1-bit y codes count as -1
+// and +1, and both must have 8-bit slots. Otherwise x and y must have the
+// same AlignBits().
 int32 VecVec(const BitVector &x, const BitVector &y);
 
 class BitVector {
  public:
-  // Constructor, this version creates a SubVector from a row of MatrixBase, and
-  // it is not const-safe.
-  explicit BitVector(const BitMatrix& mat, MatrixIndexT row);
+  // Constructor, this version creates a view of a row of BitMatrixBase, and it
+  // is not const-safe.
+  explicit BitVector(const BitMatrixBase& mat, MatrixIndexT row);
+
+  // Constructor, this version creates a view of the words [origin, origin +
+  // length) of another BitVector, and it is not const-safe.
+  BitVector(const BitVector& vec,
+            const MatrixIndexT origin,
+            const MatrixIndexT length);
 
   // Constructor, this version creates an empty vector. We put the constructor
   // as protected so that it is only callable from child classes.
-  BitVector() : dim_(0), data_(NULL) {}
+  BitVector() : dim_(0), data_(NULL), quant_bits_(0), align_bits_(0),
+                scale_(0) {}
 
   // Destructor, memory allocation happens in child classes. We put the
   // destructor as protected so that it is only callable from child classes.
@@ -31,9 +41,19 @@ class BitVector {
   inline uint64* Data() { return data_; }
   inline const uint64* Data() const { return data_; }
 
+  // Returns a view of the words [origin, origin + length).
+  const BitVector Range(const MatrixIndexT origin,
+                        const MatrixIndexT length) const {
+    return BitVector(*this, origin, length);
+  }
+
   // Copies data from another bit-vector vec.
   void CopyFromBitVec(const BitVector& vec);
 
+  // Returns the sum of the values as the bit kernels see them, i.e., -1 or +1
+  // for 1-bit codes and the codes themselves otherwise.
+  int32 Sum() const;
+
   // Returns the  dimension of the vector.
   inline MatrixIndexT Dim() const { return dim_; }
 
@@ -65,7 +85,7 @@ class BitVector {
 
   int32 quant_bits_;
   int32 align_bits_;
-  int32 scale_;
+  float scale_;
 
   SNOWBOY_DISALLOW_ASSIGN(BitVector);
 };
@@ -0,0 +1,200 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "matrix/fixed-point.h"
+#include "matrix/matrix-wrapper.h"
+#include "matrix/perf-counters.h"
+#include "matrix/trace-events.h"
+#include "utils/snowboy-debug.h"
+
+namespace snowboy {
+
+// Number of weight rows multiplied with one input row at a time, so each load
+// of the input is used several times.
+static const MatrixIndexT kFixedRows = 4;
+
+#if defined(__AVX2__)
+static inline int32 horizontal_sum(__m256i x) {
+  __m128i y = _mm_add_epi32(_mm256_castsi256_si128(x),
+                            _mm256_extracti128_si256(x, 1));
+  y = _mm_add_epi32(y, _mm_shuffle_epi32(y, _MM_SHUFFLE(1, 0, 3, 2)));
+  y = _mm_add_epi32(y, _mm_shuffle_epi32(y, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(y);
+}
+#elif defined(__SSE2__)
+static inline int32 horizontal_sum(__m128i y) {
+  y = _mm_add_epi32(y, _mm_shuffle_epi32(y, _MM_SHUFFLE(1, 0, 3, 2)));
+  y = _mm_add_epi32(y, _mm_shuffle_epi32(y, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(y);
+}
+#endif
+
+// result[j] = x . w[j] for <num_w> (at most kFixedRows) rows of <w>. The sums
+// wrap around like the SIMD code does, hence uint32 in the scalar tail.
+static inline void fixed_dot_rows(const int16* x, const int16* const* w,
+                                  MatrixIndexT num_w, MatrixIndexT dim,
+                                  int32* result) {
+  MatrixIndexT k = 0;
+  uint32 sum[kFixedRows] = {0, 0, 0, 0};
+#if defined(__AVX2__)
+  __m256i acc[kFixedRows] = {_mm256_setzero_si256(), _mm256_setzero_si256(),
+                             _mm256_setzero_si256(), _mm256_setzero_si256()};
+  for (; k + 16 <= dim; k += 16) {
+    __m256i xv = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + k));
+    for (MatrixIndexT j = 0; j < num_w; ++j) {
+      __m256i wv =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w[j] + k));
+      acc[j] = _mm256_add_epi32(acc[j], _mm256_madd_epi16(xv, wv));
+    }
+  }
+  for (MatrixIndexT j = 0; j < num_w; ++j) {
+    sum[j] = horizontal_sum(acc[j]);
+  }
+#elif defined(__SSE2__)
+  __m128i acc[kFixedRows] = {_mm_setzero_si128(), _mm_setzero_si128(),
+                             _mm_setzero_si128(), _mm_setzero_si128()};
+  for (; k + 8 <= dim; k += 8) {
+    __m128i xv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + k));
+    for (MatrixIndexT j = 0; j < num_w; ++j) {
+      __m128i wv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w[j] + k));
+      acc[j] = _mm_add_epi32(acc[j], _mm_madd_epi16(xv, wv));
+    }
+  }
+  for (MatrixIndexT j = 0; j < num_w; ++j) {
+    sum[j] = horizontal_sum(acc[j]);
+  }
+#endif
+  for (; k < dim; ++k) {
+    for (MatrixIndexT j = 0; j < num_w; ++j) {
+      sum[j] += static_cast<uint32>(static_cast<int32>(x[k]) * w[j][k]);
+    }
+  }
+  for (MatrixIndexT j = 0; j < num_w; ++j) {
+    result[j] = static_cast<int32>(sum[j]);
+  }
+}
+
+// Rounds, shifts, saturates and applies the activation to one accumulator.
+static inline int16 fixed_requantize(const int64 value, const int32 shift,
+                                     const MatrixActivationType act,
+                                     const int16 ceil) {
+  int64 v = value;
+  if (shift > 0) {
+    v = (v + (static_cast<int64>(1) << (shift - 1))) >> shift;
+  } else if (shift < 0) {
+    v = v * (static_cast<int64>(1) << -shift);
+  }
+  v = std::max<int64>(std::numeric_limits<int16>::min(),
+                      std::min<int64>(std::numeric_limits<int16>::max(), v));
+  if (act == kRelu) {
+    v = std::max<int64>(v, 0);
+  } else if (act == kClippedRelu) {
+    v = std::min<int64>(std::max<int64>(v, 0), ceil);
+  }
+  return static_cast<int16>(v);
+}
+
+int32 FixedPointFracBits(const MatrixBase& mat) {
+  float max_abs = 0.0f;
+  for (MatrixIndexT r = 0; r < mat.NumRows(); ++r) {
+    for (MatrixIndexT c = 0; c < mat.NumCols(); ++c) {
+      max_abs = std::max(max_abs, std::abs(mat(r, c)));
+    }
+  }
+  int32 frac_bits = 15;
+  // Rounding can take max_abs * 2^frac_bits up by a half.
+  while (frac_bits > -16 && std::ldexp(max_abs, frac_bits) >= 32767.5f) {
+    --frac_bits;
+  }
+  return frac_bits;
+}
+
+void ReadFixedPointMatrix(const bool binary, std::istream* is,
+                          Int16Matrix* mat, int32* frac_bits) {
+  SNOWBOY_ASSERT(is != NULL && mat != NULL && frac_bits != NULL);
+  Matrix tmp;
+  tmp.Read(binary, is);
+  if (*frac_bits < 0) {
+    *frac_bits = FixedPointFracBits(tmp);
+  }
+  mat->Resize(tmp.NumRows(), tmp.NumCols(), kUndefined);
+  mat->CopyFromMat(tmp, std::ldexp(1.0f, *frac_bits));
+}
+
+void FixedMatMat(const MatrixBaseT<int16>& x, const MatrixBaseT<int16>& w,
+                 MatrixBaseT<int32>* out) {
+  SNOWBOY_PERF_SCOPE("FixedMatMat", x.NumRows(), x.NumCols(), w.NumRows());
+  SNOWBOY_TRACE_SCOPE("FixedMatMat", x.NumRows(), x.NumCols(), w.NumRows(),
+                      sizeof(int16) * (x.NumRows() + w.NumRows()) * x.NumCols()
+                      + sizeof(int32) * x.NumRows() * w.NumRows());
+  SNOWBOY_ASSERT(out != NULL);
+  SNOWBOY_ASSERT(x.NumCols() == w.NumCols() &&
+      x.NumRows() == out->NumRows() && w.NumRows() == out->NumCols());
+  for (MatrixIndexT r = 0; r < x.NumRows(); ++r) {
+    int32* out_data = out->RowData(r);
+    for (MatrixIndexT c = 0; c < w.NumRows(); c += kFixedRows) {
+      MatrixIndexT num_w = std::min(kFixedRows, w.NumRows() - c);
+      const int16* w_rows[kFixedRows];
+      for (MatrixIndexT j = 0; j < num_w; ++j) {
+        w_rows[j] = w.RowData(c + j);
+      }
+      fixed_dot_rows(x.RowData(r), w_rows, num_w, x.NumCols(), out_data + c);
+    }
+  }
+}
+
+void FixedMatVec(const MatrixBaseT<int16>& w, const VectorBaseT<int16>& x,
+                 VectorBaseT<int32>* out) {
+  SNOWBOY_PERF_SCOPE("FixedMatVec", 1, w.NumCols(), w.NumRows());
+  SNOWBOY_TRACE_SCOPE("FixedMatVec", 1, w.NumCols(), w.NumRows(),
+                      sizeof(int16) * (w.NumRows() + 1) * w.NumCols()
+                      + sizeof(int32) * w.NumRows());
+  SNOWBOY_ASSERT(out != NULL);
+  SNOWBOY_ASSERT(w.NumCols() == x.Dim() && w.NumRows() == out->Dim());
+  for (MatrixIndexT c = 0; c < w.NumRows(); c += kFixedRows) {
+    MatrixIndexT num_w = std::min(kFixedRows, w.NumRows() - c);
+    const int16* w_rows[kFixedRows];
+    for (MatrixIndexT j = 0; j < num_w; ++j) {
+      w_rows[j] = w.RowData(c + j);
+    }
+    fixed_dot_rows(x.Data(), w_rows, num_w, x.Dim(), out->Data() + c);
+  }
+}
+
+void FixedAffine(const MatrixBaseT<int16>& x, const MatrixBaseT<int16>& w,
+                 const VectorBaseT<int32>& bias, const int32 shift,
+                 const MatrixActivationType act, const int16 ceil,
+                 MatrixBaseT<int16>* out) {
+  SNOWBOY_ASSERT(out != NULL);
+  SNOWBOY_ASSERT(x.NumCols() == w.NumCols() && bias.Dim() == w.NumRows() &&
+      x.NumRows() == out->NumRows() && w.NumRows() == out->NumCols());
+  if (act != kNoActivation && act != kRelu && act != kClippedRelu) {
+    SNOWBOY_ERROR << "Activation " << act << " is not supported in fixed "
+                  << "point.";
+  }
+  for (MatrixIndexT r = 0; r < x.NumRows(); ++r) {
+    int16* out_data = out->RowData(r);
+    for (MatrixIndexT c = 0; c < w.NumRows(); c += kFixedRows) {
+      MatrixIndexT num_w = std::min(kFixedRows, w.NumRows() - c);
+      const int16* w_rows[kFixedRows];
+      int32 dot[kFixedRows];
+      for (MatrixIndexT j = 0; j < num_w; ++j) {
+        w_rows[j] = w.RowData(c + j);
+      }
+      fixed_dot_rows(x.RowData(r), w_rows, num_w, x.NumCols(), dot);
+      for (MatrixIndexT j = 0; j < num_w; ++j) {
+        out_data[c + j] = fixed_requantize(
+            static_cast<int64>(dot[j]) + bias(c + j), shift, act, ceil);
+      }
+    }
+  }
+}
+
+}  // namespace snowboy
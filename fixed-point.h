@@ -0,0 +1,51 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+// Int16 fixed-point layers, in between the float path and the BitMatrix path.
+// An int16 value v with <frac_bits> fractional bits stands for
+// v / 2^frac_bits. Products are accumulated in int32 with pmaddwd, which wraps
+// on overflow, so the fractional bits of the inputs and weights should leave
+// enough headroom for the inner dimension: with Q15 inputs and Q15 weights a
+// single product already uses 30 bits.
+
+#ifndef SNOWBOY_MATRIX_FIXED_POINT_H_
+#define SNOWBOY_MATRIX_FIXED_POINT_H_
+
+#include <istream>
+
+#include "matrix/matrix-common.h"
+#include "utils/snowboy-types.h"
+
+namespace snowboy {
+
+// Returns the largest number of fractional bits, at most 15, such that all
+// elements of <mat> fit in int16. Can be negative for elements >= 32768.
+int32 FixedPointFracBits(const MatrixBase& mat);
+
+// Reads a float matrix, as written by Matrix::Write(), and converts it to
+// fixed point with FixedPointFracBits() fractional bits, or with <*frac_bits>
+// if it is not negative. Returns the fractional bits used in <*frac_bits>.
+void ReadFixedPointMatrix(const bool binary, std::istream* is,
+                          Int16Matrix* mat, int32* frac_bits);
+
+// out = x * w^T, without any shift, i.e. <out> has the sum of the fractional
+// bits of <x> and <w>.
+void FixedMatMat(const MatrixBaseT<int16>& x, const MatrixBaseT<int16>& w,
+                 MatrixBaseT<int32>* out);
+
+// out = w * x, with the same conventions as FixedMatMat().
+void FixedMatVec(const MatrixBaseT<int16>& w, const VectorBaseT<int16>& x,
+                 VectorBaseT<int32>* out);
+
+// Fixed-point DNN layer:
+// out = act(round((x * w^T + bias) / 2^shift)), saturated to int16,
+// where <bias> has the fractional bits of the product and
+// shift = frac_bits(x) + frac_bits(w) - frac_bits(out). Supports kNoActivation,
+// kRelu and kClippedRelu, in which case <ceil> is in the units of <out>.
+void FixedAffine(const MatrixBaseT<int16>& x, const MatrixBaseT<int16>& w,
+                 const VectorBaseT<int32>& bias, const int32 shift,
+                 const MatrixActivationType act, const int16 ceil,
+                 MatrixBaseT<int16>* out);
+
+}  // namespace snowboy
+
+#endif  // SNOWBOY_MATRIX_FIXED_POINT_H_
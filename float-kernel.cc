@@ -0,0 +1,538 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <limits>
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+#include "matrix/float-kernel.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#define SNOWBOY_FLOAT_KERNEL_AVX2
+#endif
+
+namespace snowboy {
+
+// Blocks with both sides not larger than this are transposed directly; two
+// 32 * 32 float blocks take 8KB, which leaves room in L1.
+static const MatrixIndexT kTransposeBlock = 32;
+
+#ifdef __AVX__
+static inline void transpose_8x8(const float *src, MatrixIndexT src_stride,
+                                 float *dst, MatrixIndexT dst_stride) {
+  __m256 r0 = _mm256_loadu_ps(src + 0 * src_stride);
+  __m256 r1 = _mm256_loadu_ps(src + 1 * src_stride);
+  __m256 r2 = _mm256_loadu_ps(src + 2 * src_stride);
+  __m256 r3 = _mm256_loadu_ps(src + 3 * src_stride);
+  __m256 r4 = _mm256_loadu_ps(src + 4 * src_stride);
+  __m256 r5 = _mm256_loadu_ps(src + 5 * src_stride);
+  __m256 r6 = _mm256_loadu_ps(src + 6 * src_stride);
+  __m256 r7 = _mm256_loadu_ps(src + 7 * src_stride);
+
+  __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+  __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+  __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+  __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+  __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+  __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+  __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+  __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+
+  __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+  __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+  __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+  __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+  __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+  __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+  __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+  __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+  _mm256_storeu_ps(dst + 0 * dst_stride, _mm256_permute2f128_ps(s0, s4, 0x20));
+  _mm256_storeu_ps(dst + 1 * dst_stride, _mm256_permute2f128_ps(s1, s5, 0x20));
+  _mm256_storeu_ps(dst + 2 * dst_stride, _mm256_permute2f128_ps(s2, s6, 0x20));
+  _mm256_storeu_ps(dst + 3 * dst_stride, _mm256_permute2f128_ps(s3, s7, 0x20));
+  _mm256_storeu_ps(dst + 4 * dst_stride, _mm256_permute2f128_ps(s0, s4, 0x31));
+  _mm256_storeu_ps(dst + 5 * dst_stride, _mm256_permute2f128_ps(s1, s5, 0x31));
+  _mm256_storeu_ps(dst + 6 * dst_stride, _mm256_permute2f128_ps(s2, s6, 0x31));
+  _mm256_storeu_ps(dst + 7 * dst_stride, _mm256_permute2f128_ps(s3, s7, 0x31));
+}
+#else
+static inline void transpose_8x8(const float *src, MatrixIndexT src_stride,
+                                 float *dst, MatrixIndexT dst_stride) {
+  for (MatrixIndexT r = 0; r < 8; ++r) {
+    for (MatrixIndexT c = 0; c < 8; ++c) {
+      dst[c * dst_stride + r] = src[r * src_stride + c];
+    }
+  }
+}
+#endif
+
+static void transpose_block(const float *src, MatrixIndexT src_stride,
+                            MatrixIndexT rows, MatrixIndexT cols,
+                            float *dst, MatrixIndexT dst_stride) {
+  MatrixIndexT r = 0;
+  for (; r + 8 <= rows; r += 8) {
+    MatrixIndexT c = 0;
+    for (; c + 8 <= cols; c += 8) {
+      transpose_8x8(src + r * src_stride + c, src_stride,
+                    dst + c * dst_stride + r, dst_stride);
+    }
+    for (; c < cols; ++c) {
+      for (MatrixIndexT i = r; i < r + 8; ++i) {
+        dst[c * dst_stride + i] = src[i * src_stride + c];
+      }
+    }
+  }
+  for (; r < rows; ++r) {
+    for (MatrixIndexT c = 0; c < cols; ++c) {
+      dst[c * dst_stride + r] = src[r * src_stride + c];
+    }
+  }
+}
+
+void float_kernel_transpose(const float *src, MatrixIndexT src_stride,
+                            MatrixIndexT rows, MatrixIndexT cols,
+                            float *dst, MatrixIndexT dst_stride) {
+  if (rows <= kTransposeBlock && cols <= kTransposeBlock) {
+    transpose_block(src, src_stride, rows, cols, dst, dst_stride);
+  } else if (rows >= cols) {
+    // Splits at a multiple of 8 so that the 8x8 tiles stay full.
+    MatrixIndexT half = (rows / 2 + 7) & ~7;
+    float_kernel_transpose(src, src_stride, half, cols, dst, dst_stride);
+    float_kernel_transpose(src + half * src_stride, src_stride,
+                           rows - half, cols, dst + half, dst_stride);
+  } else {
+    MatrixIndexT half = (cols / 2 + 7) & ~7;
+    float_kernel_transpose(src, src_stride, rows, half, dst, dst_stride);
+    float_kernel_transpose(src + half, src_stride, rows, cols - half,
+                           dst + half * dst_stride, dst_stride);
+  }
+}
+
+void float_kernel_transpose_inplace(float *data,
+                                    MatrixIndexT rows, MatrixIndexT cols) {
+  if (rows <= 1 || cols <= 1) {
+    return;  // Same layout before and after.
+  }
+  // Element at position i moves to position (i * rows) mod (size - 1); the
+  // first and the last elements stay where they are. Each cycle is rotated
+  // once, from its smallest position, which is found by walking the cycle
+  // until it comes back to <start> or goes below it.
+  const size_t last = static_cast<size_t>(rows) * cols - 1;
+  for (size_t start = 1; start < last; ++start) {
+    size_t i = (start * rows) % last;
+    while (i > start) {
+      i = (i * rows) % last;
+    }
+    if (i != start) {
+      continue;  // Already rotated from a smaller position.
+    }
+    float carry = data[start];
+    do {
+      size_t next = (i * rows) % last;
+      float tmp = data[next];
+      data[next] = carry;
+      carry = tmp;
+      i = next;
+    } while (i != start);
+  }
+}
+
+#ifdef SNOWBOY_FLOAT_KERNEL_AVX2
+// Mask with the first n (0 < n < 8) lanes set, for the tails.
+static inline __m256i tail_mask(MatrixIndexT n) {
+  return _mm256_cmpgt_epi32(_mm256_set1_epi32(n),
+                            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+// Loads the first n (0 < n < 8) floats, the other lanes are -inf.
+static inline __m256 load_tail(const float *in, MatrixIndexT n) {
+  __m256i mask = tail_mask(n);
+  return _mm256_blendv_ps(
+      _mm256_set1_ps(-std::numeric_limits<float>::infinity()),
+      _mm256_maskload_ps(in, mask), _mm256_castsi256_ps(mask));
+}
+
+// Cephes expf. Results below FLT_MIN are flushed to zero.
+static inline __m256 exp_ps(__m256 x) {
+  const __m256 hi = _mm256_set1_ps(88.72283935546875f);
+  const __m256 lo = _mm256_set1_ps(-87.33654475f);
+  __m256 nan = _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+  __m256 over = _mm256_cmp_ps(x, hi, _CMP_GT_OQ);
+  __m256 under = _mm256_cmp_ps(x, lo, _CMP_LT_OQ);
+  __m256 in = x;
+  x = _mm256_max_ps(_mm256_min_ps(x, hi), lo);
+
+  // exp(x) = 2^n * exp(r), with r = x - n * log(2) in [-log(2)/2, log(2)/2].
+  __m256 fx = _mm256_round_ps(
+      _mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)),
+      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+
+  __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894e-2f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201e-1f));
+  y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), x);
+  y = _mm256_add_ps(y, _mm256_set1_ps(1.0f));
+
+  // n can be 128 at the top of the range, so 2^n is built in two halves.
+  __m256i n = _mm256_cvtps_epi32(fx);
+  __m256i n1 = _mm256_srai_epi32(n, 1);
+  __m256i n2 = _mm256_sub_epi32(n, n1);
+  const __m256i bias = _mm256_set1_epi32(127);
+  y = _mm256_mul_ps(y, _mm256_castsi256_ps(
+      _mm256_slli_epi32(_mm256_add_epi32(n1, bias), 23)));
+  y = _mm256_mul_ps(y, _mm256_castsi256_ps(
+      _mm256_slli_epi32(_mm256_add_epi32(n2, bias), 23)));
+
+  y = _mm256_blendv_ps(
+      y, _mm256_set1_ps(std::numeric_limits<float>::infinity()), over);
+  y = _mm256_andnot_ps(under, y);
+  return _mm256_blendv_ps(y, in, nan);
+}
+
+// Cephes logf. Zero gives -inf, negative values give NaN.
+static inline __m256 log_ps(__m256 x) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 inf = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+  __m256 nan = _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+  __m256 negative = _mm256_cmp_ps(x, zero, _CMP_LT_OQ);
+  __m256 is_zero = _mm256_cmp_ps(x, zero, _CMP_EQ_OQ);
+  __m256 is_inf = _mm256_cmp_ps(x, inf, _CMP_EQ_OQ);
+  __m256 in = x;
+  x = _mm256_max_ps(x, _mm256_set1_ps(FLT_MIN));
+
+  // x = m * 2^e, with m in [sqrt(0.5), sqrt(2)).
+  __m256i exponent = _mm256_srli_epi32(_mm256_castps_si256(x), 23);
+  x = _mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(~0x7f800000)));
+  x = _mm256_or_ps(x, _mm256_set1_ps(0.5f));
+  __m256 e = _mm256_cvtepi32_ps(
+      _mm256_sub_epi32(exponent, _mm256_set1_epi32(126)));
+  __m256 small = _mm256_cmp_ps(x, _mm256_set1_ps(0.707106781186547524f),
+                               _CMP_LT_OQ);
+  __m256 tmp = _mm256_and_ps(x, small);
+  x = _mm256_sub_ps(x, one);
+  e = _mm256_sub_ps(e, _mm256_and_ps(one, small));
+  x = _mm256_add_ps(x, tmp);
+
+  __m256 z = _mm256_mul_ps(x, x);
+  __m256 y = _mm256_set1_ps(7.0376836292e-2f);
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-1.1514610310e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.1676998740e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-1.2420140846e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.4249322787e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-1.6668057665e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(2.0000714765e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-2.4999993993e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(3.3333331174e-1f));
+  y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+  y = _mm256_fmadd_ps(e, _mm256_set1_ps(-2.12194440e-4f), y);
+  y = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), y);
+  x = _mm256_add_ps(x, y);
+  x = _mm256_fmadd_ps(e, _mm256_set1_ps(0.693359375f), x);
+
+  x = _mm256_blendv_ps(
+      x, _mm256_set1_ps(std::numeric_limits<float>::quiet_NaN()), negative);
+  x = _mm256_blendv_ps(x, _mm256_sub_ps(zero, inf), is_zero);
+  x = _mm256_blendv_ps(x, inf, is_inf);
+  return _mm256_blendv_ps(x, in, nan);
+}
+
+static inline float horizontal_max(__m256 x) {
+  __m128 y = _mm_max_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+  y = _mm_max_ps(y, _mm_movehl_ps(y, y));
+  y = _mm_max_ss(y, _mm_shuffle_ps(y, y, 1));
+  return _mm_cvtss_f32(y);
+}
+
+// Computes the max and sum(exp(in - max)) in one pass. Each lane keeps its own
+// max and sum; the sum is rescaled once per 32 elements when the max grows.
+static void softmax_normalizer(const float *in, MatrixIndexT n,
+                               float *max, float *sum) {
+  __m256 m = _mm256_set1_ps(-FLT_MAX);
+  __m256 s = _mm256_setzero_ps();
+  MatrixIndexT i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256 v0 = _mm256_loadu_ps(in + i);
+    __m256 v1 = _mm256_loadu_ps(in + i + 8);
+    __m256 v2 = _mm256_loadu_ps(in + i + 16);
+    __m256 v3 = _mm256_loadu_ps(in + i + 24);
+    __m256 cm = _mm256_max_ps(_mm256_max_ps(v0, v1), _mm256_max_ps(v2, v3));
+    cm = _mm256_max_ps(cm, m);
+    s = _mm256_mul_ps(s, exp_ps(_mm256_sub_ps(m, cm)));
+    s = _mm256_add_ps(s, exp_ps(_mm256_sub_ps(v0, cm)));
+    s = _mm256_add_ps(s, exp_ps(_mm256_sub_ps(v1, cm)));
+    s = _mm256_add_ps(s, exp_ps(_mm256_sub_ps(v2, cm)));
+    s = _mm256_add_ps(s, exp_ps(_mm256_sub_ps(v3, cm)));
+    m = cm;
+  }
+  for (; i < n; i += 8) {
+    __m256 v = (i + 8 <= n) ? _mm256_loadu_ps(in + i)
+                            : load_tail(in + i, n - i);
+    __m256 cm = _mm256_max_ps(m, v);
+    s = _mm256_mul_ps(s, exp_ps(_mm256_sub_ps(m, cm)));
+    s = _mm256_add_ps(s, exp_ps(_mm256_sub_ps(v, cm)));
+    m = cm;
+  }
+
+  float lane_max[8], lane_sum[8];
+  _mm256_storeu_ps(lane_max, m);
+  _mm256_storeu_ps(lane_sum, s);
+  *max = horizontal_max(m);
+  *sum = 0.0f;
+  for (int32 j = 0; j < 8; ++j) {
+    *sum += lane_sum[j] * std::exp(lane_max[j] - *max);
+  }
+}
+
+void float_kernel_exp(const float *in, float *out, MatrixIndexT n) {
+  MatrixIndexT i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(out + i, exp_ps(_mm256_loadu_ps(in + i)));
+  }
+  if (i < n) {
+    __m256i mask = tail_mask(n - i);
+    _mm256_maskstore_ps(out + i, mask,
+                        exp_ps(_mm256_maskload_ps(in + i, mask)));
+  }
+}
+
+bool float_kernel_log(const float *in, float *out, MatrixIndexT n) {
+  const __m256 zero = _mm256_setzero_ps();
+  __m256 invalid = zero;
+  MatrixIndexT i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_loadu_ps(in + i);
+    invalid = _mm256_or_ps(invalid, _mm256_cmp_ps(v, zero, _CMP_NGT_UQ));
+    _mm256_storeu_ps(out + i, log_ps(v));
+  }
+  if (i < n) {
+    __m256i mask = tail_mask(n - i);
+    __m256 v = _mm256_maskload_ps(in + i, mask);
+    invalid = _mm256_or_ps(invalid, _mm256_and_ps(
+        _mm256_cmp_ps(v, zero, _CMP_NGT_UQ), _mm256_castsi256_ps(mask)));
+    _mm256_maskstore_ps(out + i, mask, log_ps(v));
+  }
+  return _mm256_movemask_ps(invalid) == 0;
+}
+
+MatrixIndexT float_kernel_pow(const float *in, float *out,
+                              MatrixIndexT n, float power) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 inf = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+  const __m256 p = _mm256_set1_ps(power);
+  MatrixIndexT overflow = -1;
+  MatrixIndexT i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_loadu_ps(in + i);
+    if (_mm256_movemask_ps(_mm256_cmp_ps(v, zero, _CMP_GT_OQ)) == 0xff) {
+      v = exp_ps(_mm256_mul_ps(p, log_ps(v)));
+      _mm256_storeu_ps(out + i, v);
+      int32 mask = _mm256_movemask_ps(_mm256_cmp_ps(v, inf, _CMP_EQ_OQ));
+      if (overflow < 0 && mask != 0) {
+        overflow = i + __builtin_ctz(mask);
+      }
+    } else {
+      for (MatrixIndexT j = i; j < i + 8; ++j) {
+        out[j] = std::pow(in[j], power);
+        if (overflow < 0 && out[j] == HUGE_VAL) {
+          overflow = j;
+        }
+      }
+    }
+  }
+  for (; i < n; ++i) {
+    out[i] = std::pow(in[i], power);
+    if (overflow < 0 && out[i] == HUGE_VAL) {
+      overflow = i;
+    }
+  }
+  return overflow;
+}
+
+float float_kernel_softmax(const float *in, float *out, MatrixIndexT n) {
+  float max, sum;
+  softmax_normalizer(in, n, &max, &sum);
+  const __m256 m = _mm256_set1_ps(max);
+  const __m256 scale = _mm256_set1_ps(1.0f / sum);
+  MatrixIndexT i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = exp_ps(_mm256_sub_ps(_mm256_loadu_ps(in + i), m));
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(v, scale));
+  }
+  if (i < n) {
+    __m256i mask = tail_mask(n - i);
+    __m256 v = exp_ps(_mm256_sub_ps(_mm256_maskload_ps(in + i, mask), m));
+    _mm256_maskstore_ps(out + i, mask, _mm256_mul_ps(v, scale));
+  }
+  return max + std::log(sum);
+}
+
+float float_kernel_log_softmax(const float *in, float *out, MatrixIndexT n) {
+  float max, sum;
+  softmax_normalizer(in, n, &max, &sum);
+  const float normalizer = max + std::log(sum);
+  const __m256 offset = _mm256_set1_ps(normalizer);
+  MatrixIndexT i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(out + i,
+                     _mm256_sub_ps(_mm256_loadu_ps(in + i), offset));
+  }
+  for (; i < n; ++i) {
+    out[i] = in[i] - normalizer;
+  }
+  return normalizer;
+}
+#else
+void float_kernel_exp(const float *in, float *out, MatrixIndexT n) {
+  for (MatrixIndexT i = 0; i < n; ++i) {
+    out[i] = std::exp(in[i]);
+  }
+}
+
+bool float_kernel_log(const float *in, float *out, MatrixIndexT n) {
+  bool positive = true;
+  for (MatrixIndexT i = 0; i < n; ++i) {
+    positive = positive && in[i] > 0;
+    out[i] = std::log(in[i]);
+  }
+  return positive;
+}
+
+MatrixIndexT float_kernel_pow(const float *in, float *out,
+                              MatrixIndexT n, float power) {
+  MatrixIndexT overflow = -1;
+  for (MatrixIndexT i = 0; i < n; ++i) {
+    out[i] = std::pow(in[i], power);
+    if (overflow < 0 && out[i] == HUGE_VAL) {
+      overflow = i;
+    }
+  }
+  return overflow;
+}
+
+// Computes the max and sum(exp(in - max)) in one pass over memory, as the AVX2
+// version: the max of each block of 32 elements is taken while the block is in
+// L1, and the running sum is rescaled when the max grows.
+static void softmax_normalizer(const float *in, MatrixIndexT n,
+                               float *max, float *sum) {
+  float m = -std::numeric_limits<float>::infinity(), s = 0.0f;
+  for (MatrixIndexT i = 0; i < n; i += 32) {
+    const MatrixIndexT end = std::min<MatrixIndexT>(n, i + 32);
+    float block_max = m;
+    for (MatrixIndexT j = i; j < end; ++j) {
+      block_max = in[j] > block_max ? in[j] : block_max;
+    }
+    if (block_max > m) {
+      s *= std::exp(m - block_max);
+      m = block_max;
+    }
+    for (MatrixIndexT j = i; j < end; ++j) {
+      s += std::exp(in[j] - m);
+    }
+  }
+  *max = m;
+  *sum = s;
+}
+
+float float_kernel_softmax(const float *in, float *out, MatrixIndexT n) {
+  float max, sum;
+  softmax_normalizer(in, n, &max, &sum);
+  const float scale = 1.0f / sum;
+  for (MatrixIndexT i = 0; i < n; ++i) {
+    out[i] = std::exp(in[i] - max) * scale;
+  }
+  return max + std::log(sum);
+}
+
+float float_kernel_log_softmax(const float *in, float *out, MatrixIndexT n) {
+  float max, sum;
+  softmax_normalizer(in, n, &max, &sum);
+  const float normalizer = max + std::log(sum);
+  for (MatrixIndexT i = 0; i < n; ++i) {
+    out[i] = in[i] - normalizer;
+  }
+  return normalizer;
+}
+#endif
+
+#ifdef SNOWBOY_FLOAT_KERNEL_AVX2
+static inline __m256 bias_act_ps(__m256 x, MatrixActivationType act,
+                                 __m256 ceil) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  switch (act) {
+    case kRelu:
+      return _mm256_max_ps(x, zero);
+    case kClippedRelu:
+      return _mm256_min_ps(_mm256_max_ps(x, zero), ceil);
+    case kSigmoid:
+      return _mm256_div_ps(one, _mm256_add_ps(
+          one, exp_ps(_mm256_sub_ps(zero, x))));
+    case kTanh: {
+      // tanh(x) = 2 / (1 + exp(-2x)) - 1.
+      __m256 e = exp_ps(_mm256_mul_ps(x, _mm256_set1_ps(-2.0f)));
+      return _mm256_sub_ps(_mm256_div_ps(_mm256_set1_ps(2.0f),
+                                         _mm256_add_ps(one, e)), one);
+    }
+    default:
+      return x;
+  }
+}
+
+void float_kernel_bias_act(float *data, const float *bias, MatrixIndexT n,
+                           MatrixActivationType act, float ceil) {
+  const __m256 c = _mm256_set1_ps(ceil);
+  MatrixIndexT i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 x = _mm256_loadu_ps(data + i);
+    if (bias != NULL) {
+      x = _mm256_add_ps(x, _mm256_loadu_ps(bias + i));
+    }
+    _mm256_storeu_ps(data + i, bias_act_ps(x, act, c));
+  }
+  if (i < n) {
+    __m256i mask = tail_mask(n - i);
+    __m256 x = _mm256_maskload_ps(data + i, mask);
+    if (bias != NULL) {
+      x = _mm256_add_ps(x, _mm256_maskload_ps(bias + i, mask));
+    }
+    _mm256_maskstore_ps(data + i, mask, bias_act_ps(x, act, c));
+  }
+}
+#else
+void float_kernel_bias_act(float *data, const float *bias, MatrixIndexT n,
+                           MatrixActivationType act, float ceil) {
+  for (MatrixIndexT i = 0; i < n; ++i) {
+    float x = bias == NULL ? data[i] : data[i] + bias[i];
+    switch (act) {
+      case kRelu:
+        x = x < 0.0f ? 0.0f : x;
+        break;
+      case kClippedRelu:
+        x = x < 0.0f ? 0.0f : (x > ceil ? ceil : x);
+        break;
+      case kSigmoid:
+        x = 1.0f / (1.0f + std::exp(-x));
+        break;
+      case kTanh:
+        x = std::tanh(x);
+        break;
+      default:
+        break;
+    }
+    data[i] = x;
+  }
+}
+#endif
+
+}
@@ -0,0 +1,59 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#ifndef SNOWBOY_FLOAT_KERNEL_H
+#define SNOWBOY_FLOAT_KERNEL_H
+
+#include "matrix/matrix-common.h"
+#include "utils/snowboy-types.h"
+
+namespace snowboy {
+
+// dst = src^T, where src is a rows * cols matrix. The two buffers must not
+// overlap. This is cache-oblivious: the matrix is split recursively until the
+// blocks fit in L1, which are then transposed in 8x8 tiles (AVX shuffles when
+// available).
+void float_kernel_transpose(const float *src, MatrixIndexT src_stride,
+                            MatrixIndexT rows, MatrixIndexT cols,
+                            float *dst, MatrixIndexT dst_stride);
+
+// In-place transpose of a rows * cols matrix whose rows are contiguous, i.e.
+// the stride is cols before and rows after the call. Follows the permutation
+// cycles from their smallest positions, so it needs no extra memory, at the
+// cost of walking each cycle once more to find its leader.
+void float_kernel_transpose_inplace(float *data,
+                                    MatrixIndexT rows, MatrixIndexT cols);
+
+// out[i] = exp(in[i]). With AVX2 and FMA this uses a polynomial (Cephes expf)
+// with a relative error below 1e-7, about 1 ulp, over the normal range;
+// otherwise it calls std::exp. <in> and <out> may be the same buffer, the same
+// holds for the kernels below.
+void float_kernel_exp(const float *in, float *out, MatrixIndexT n);
+
+// out[i] = log(in[i]), a polynomial with a relative error below 1e-7 when AVX2
+// and FMA are available. Returns false if any input is not positive, in
+// which case the corresponding output is -inf (zero) or NaN (negative).
+bool float_kernel_log(const float *in, float *out, MatrixIndexT n);
+
+// out[i] = pow(in[i], power), computed as exp(power * log(in[i])) for positive
+// inputs, and with std::pow for the rest. The relative error grows with
+// |power * log(in[i])|. Returns the index of the first element that overflowed
+// to infinity, or -1.
+MatrixIndexT float_kernel_pow(const float *in, float *out,
+                              MatrixIndexT n, float power);
+
+// out = softmax(in), and returns the log normalizer max + log(sum(exp(in -
+// max))). Reads <in> once to get both the max and the sum (the sum is rescaled
+// whenever the max changes) and writes <out> in a second pass.
+float float_kernel_softmax(const float *in, float *out, MatrixIndexT n);
+
+// out = log(softmax(in)), returns the log normalizer as above.
+float float_kernel_log_softmax(const float *in, float *out, MatrixIndexT n);
+
+// data[i] = act(data[i] + bias[i]). <bias> can be NULL, <ceil> is only used by
+// kClippedRelu.
+void float_kernel_bias_act(float *data, const float *bias, MatrixIndexT n,
+                           MatrixActivationType act, float ceil);
+
+}
+
+#endif //SNOWBOY_FLOAT_KERNEL_H
@@ -0,0 +1,386 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#if defined(__AVX2__) && defined(__FMA__) && defined(__F16C__)
+#include <immintrin.h>
+#define SNOWBOY_HALF_MATRIX_AVX2
+#endif
+
+#include "matrix/half-matrix.h"
+#include "matrix/matrix-memory.h"
+#include "matrix/matrix-wrapper.h"
+#include "matrix/perf-counters.h"
+#include "matrix/trace-events.h"
+#include "matrix/vector-wrapper.h"
+#include "utils/snowboy-io.h"
+
+namespace snowboy {
+
+static inline uint32 float_bits(float f) {
+  uint32 bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+static inline float bits_float(uint32 bits) {
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+static inline uint16 float_to_fp16(float f) {
+  uint32 bits = float_bits(f);
+  uint16 sign = (bits >> 16) & 0x8000;
+  uint32 abs = bits & 0x7fffffff;
+  if (abs >= 0x7f800000) {
+    // Inf or NaN.
+    return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+  }
+  if (abs >= 0x477ff000) {
+    // Rounds to infinity (the largest half is 65504).
+    return sign | 0x7c00;
+  }
+  if (abs < 0x38800000) {
+    // Subnormal half, or zero.
+    if (abs < 0x33000000) {
+      return sign;
+    }
+    uint32 exponent = abs >> 23;
+    uint32 mantissa = (abs & 0x7fffff) | 0x800000;
+    uint32 shift = 126 - exponent;
+    uint32 result = mantissa >> shift;
+    uint32 remainder = mantissa & ((1u << shift) - 1);
+    uint32 half = 1u << (shift - 1);
+    if (remainder > half || (remainder == half && (result & 1))) {
+      ++result;
+    }
+    return sign | result;
+  }
+  uint32 result = (abs - 0x38000000) >> 13;
+  uint32 remainder = abs & 0x1fff;
+  if (remainder > 0x1000 || (remainder == 0x1000 && (result & 1))) {
+    ++result;
+  }
+  return sign | result;
+}
+
+static inline float fp16_to_float(uint16 h) {
+  uint32 sign = static_cast<uint32>(h & 0x8000) << 16;
+  uint32 exponent = (h >> 10) & 0x1f;
+  uint32 mantissa = h & 0x3ff;
+  if (exponent == 0) {
+    if (mantissa == 0) {
+      return bits_float(sign);
+    }
+    // Subnormal half, normalized as a float.
+    exponent = 113;
+    while ((mantissa & 0x400) == 0) {
+      mantissa <<= 1;
+      --exponent;
+    }
+    return bits_float(sign | (exponent << 23) | ((mantissa & 0x3ff) << 13));
+  } else if (exponent == 31) {
+    return bits_float(sign | 0x7f800000 | (mantissa << 13));
+  }
+  return bits_float(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+static inline uint16 float_to_bf16(float f) {
+  uint32 bits = float_bits(f);
+  if ((bits & 0x7fffffff) > 0x7f800000) {
+    return (bits >> 16) | 0x40;  // Keeps NaN a (quiet) NaN.
+  }
+  return (bits + 0x7fff + ((bits >> 16) & 1)) >> 16;
+}
+
+static inline float bf16_to_float(uint16 h) {
+  return bits_float(static_cast<uint32>(h) << 16);
+}
+
+#ifdef SNOWBOY_HALF_MATRIX_AVX2
+// Widens 8 half precision values to float.
+static inline __m256 load_half(const uint16 *in, MatrixHalfType type) {
+  __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+  if (type == kFloat16) {
+    return _mm256_cvtph_ps(h);
+  } else {
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+  }
+}
+
+static inline float horizontal_sum(__m256 x) {
+  __m128 y = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+  y = _mm_add_ps(y, _mm_movehl_ps(y, y));
+  y = _mm_add_ss(y, _mm_shuffle_ps(y, y, 1));
+  return _mm_cvtss_f32(y);
+}
+#endif
+
+static inline float half_to_float(uint16 h, MatrixHalfType type) {
+  return type == kFloat16 ? fp16_to_float(h) : bf16_to_float(h);
+}
+
+void FloatToHalf(const float *in, uint16 *out, MatrixIndexT n,
+                 MatrixHalfType type) {
+  MatrixIndexT i = 0;
+#ifdef SNOWBOY_HALF_MATRIX_AVX2
+  if (type == kFloat16) {
+    for (; i + 8 <= n; i += 8) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                       _mm256_cvtps_ph(_mm256_loadu_ps(in + i),
+                                       _MM_FROUND_TO_NEAREST_INT));
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    out[i] = (type == kFloat16) ? float_to_fp16(in[i]) : float_to_bf16(in[i]);
+  }
+}
+
+void HalfToFloat(const uint16 *in, float *out, MatrixIndexT n,
+                 MatrixHalfType type) {
+  MatrixIndexT i = 0;
+#ifdef SNOWBOY_HALF_MATRIX_AVX2
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(out + i, load_half(in + i, type));
+  }
+#endif
+  for (; i < n; ++i) {
+    out[i] = half_to_float(in[i], type);
+  }
+}
+
+// Dot products of <num_x> (at most 4) float rows with one half precision row.
+static inline void half_dot_rows(const float *const *x, MatrixIndexT num_x,
+                                 const uint16 *w, MatrixIndexT dim,
+                                 MatrixHalfType type, float *result) {
+  MatrixIndexT k = 0;
+  for (MatrixIndexT j = 0; j < num_x; ++j) {
+    result[j] = 0.0f;
+  }
+#ifdef SNOWBOY_HALF_MATRIX_AVX2
+  __m256 acc[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(),
+                   _mm256_setzero_ps(), _mm256_setzero_ps()};
+  for (; k + 8 <= dim; k += 8) {
+    __m256 wv = load_half(w + k, type);
+    for (MatrixIndexT j = 0; j < num_x; ++j) {
+      acc[j] = _mm256_fmadd_ps(_mm256_loadu_ps(x[j] + k), wv, acc[j]);
+    }
+  }
+  for (MatrixIndexT j = 0; j < num_x; ++j) {
+    result[j] = horizontal_sum(acc[j]);
+  }
+#endif
+  for (; k < dim; ++k) {
+    float wk = half_to_float(w[k], type);
+    for (MatrixIndexT j = 0; j < num_x; ++j) {
+      result[j] += x[j][k] * wk;
+    }
+  }
+}
+
+void AddMatHalfMat(const float alpha, const MatrixBase &x, const HalfMatrix &w,
+                   const float beta, MatrixBase *out) {
+  SNOWBOY_PERF_SCOPE("AddMatHalfMat", x.NumRows(), x.NumCols(), w.NumRows());
+  SNOWBOY_TRACE_SCOPE("AddMatHalfMat", x.NumRows(), x.NumCols(), w.NumRows(),
+                      sizeof(float) * x.NumRows() * (x.NumCols() + w.NumRows())
+                      + sizeof(uint16) * w.NumRows() * w.NumCols());
+  SNOWBOY_ASSERT(out != NULL);
+  SNOWBOY_ASSERT(x.NumCols() == w.NumCols() &&
+      x.NumRows() == out->NumRows() && w.NumRows() == out->NumCols());
+  const MatrixIndexT dim = x.NumCols();
+  // Each weight row is widened once for 4 input rows.
+  for (MatrixIndexT r = 0; r < x.NumRows(); r += 4) {
+    MatrixIndexT num_x = std::min<MatrixIndexT>(4, x.NumRows() - r);
+    const float *x_rows[4];
+    for (MatrixIndexT j = 0; j < num_x; ++j) {
+      x_rows[j] = x.RowData(r + j);
+    }
+    for (MatrixIndexT c = 0; c < w.NumRows(); ++c) {
+      float dot[4];
+      half_dot_rows(x_rows, num_x, w.RowData(c), dim, w.Type(), dot);
+      for (MatrixIndexT j = 0; j < num_x; ++j) {
+        float &o = (*out)(r + j, c);
+        o = (beta == 0.0f ? 0.0f : beta * o) + alpha * dot[j];
+      }
+    }
+  }
+}
+
+void AddHalfMatVec(const float alpha, const HalfMatrix &w, const VectorBase &x,
+                   const float beta, VectorBase *out) {
+  SNOWBOY_PERF_SCOPE("AddHalfMatVec", 1, w.NumCols(), w.NumRows());
+  SNOWBOY_TRACE_SCOPE("AddHalfMatVec", 1, w.NumCols(), w.NumRows(),
+                      sizeof(float) * (w.NumCols() + w.NumRows())
+                      + sizeof(uint16) * w.NumRows() * w.NumCols());
+  SNOWBOY_ASSERT(out != NULL && out != &x);
+  SNOWBOY_ASSERT(w.NumCols() == x.Dim() && w.NumRows() == out->Dim());
+  const float *x_data = x.Data();
+  for (MatrixIndexT c = 0; c < w.NumRows(); ++c) {
+    float dot;
+    half_dot_rows(&x_data, 1, w.RowData(c), x.Dim(), w.Type(), &dot);
+    float &o = (*out)(c);
+    o = (beta == 0.0f ? 0.0f : beta * o) + alpha * dot;
+  }
+}
+
+HalfMatrix::HalfMatrix(const MatrixBase &mat, const MatrixHalfType type) :
+    num_rows_(0), num_cols_(0), stride_(0), data_(NULL), type_(type) {
+  CopyFromMat(mat);
+}
+
+float HalfMatrix::operator()(const MatrixIndexT row,
+                             const MatrixIndexT col) const {
+  SNOWBOY_ASSERT(row < num_rows_ && col < num_cols_ && row >= 0 && col >= 0);
+  return half_to_float(data_[row * stride_ + col], type_);
+}
+
+void HalfMatrix::AllocateHalfMatrixMemory(const MatrixIndexT rows,
+                                          const MatrixIndexT cols) {
+  SNOWBOY_ASSERT(rows >= 0 && cols >= 0);
+
+  if (rows == 0 || cols == 0) {
+    num_rows_ = 0;
+    num_cols_ = 0;
+    stride_ = 0;
+    data_ = NULL;
+    return;
+  }
+
+  SNOWBOY_ASSERT(SNOWBOY_MEM_ALIGN % sizeof(uint16) == 0);
+  size_t num_per_align = SNOWBOY_MEM_ALIGN / sizeof(uint16);
+  MatrixIndexT pad = (num_per_align - cols % num_per_align) % num_per_align;
+  size_t size = sizeof(uint16)
+      * static_cast<size_t>(rows) * static_cast<size_t>(cols + pad);
+  void *data = MatrixMemalign(SNOWBOY_MEM_ALIGN, size);
+
+  if (data != NULL) {
+    data_ = static_cast<uint16 *>(data);
+    num_rows_ = rows;
+    num_cols_ = cols;
+    stride_ = cols + pad;
+  } else {
+    throw std::bad_alloc();
+  }
+}
+
+void HalfMatrix::ReleaseHalfMatrixMemory() {
+  if (data_ != NULL)
+    MatrixMemalignFree(data_);
+  num_rows_ = 0;
+  num_cols_ = 0;
+  stride_ = 0;
+  data_ = NULL;
+}
+
+void HalfMatrix::Resize(const MatrixIndexT rows, const MatrixIndexT cols) {
+  if (num_rows_ != rows || num_cols_ != cols) {
+    ReleaseHalfMatrixMemory();
+    AllocateHalfMatrixMemory(rows, cols);
+  }
+  // Zero is all bits zero in both formats.
+  if (data_ != NULL) {
+    std::memset(data_, 0, sizeof(uint16) * num_rows_ * stride_);
+  }
+}
+
+void HalfMatrix::Swap(HalfMatrix *other) {
+  std::swap(num_rows_, other->num_rows_);
+  std::swap(num_cols_, other->num_cols_);
+  std::swap(stride_, other->stride_);
+  std::swap(data_, other->data_);
+  std::swap(type_, other->type_);
+}
+
+void HalfMatrix::CopyFromMat(const MatrixBase &mat) {
+  if (num_rows_ != mat.NumRows() || num_cols_ != mat.NumCols()) {
+    Resize(mat.NumRows(), mat.NumCols());
+  }
+  for (MatrixIndexT r = 0; r < num_rows_; ++r) {
+    FloatToHalf(mat.RowData(r), RowData(r), num_cols_, type_);
+  }
+}
+
+void HalfMatrix::CopyToMat(MatrixBase *mat) const {
+  SNOWBOY_ASSERT(mat != NULL);
+  SNOWBOY_ASSERT(mat->NumRows() == num_rows_ && mat->NumCols() == num_cols_);
+  for (MatrixIndexT r = 0; r < num_rows_; ++r) {
+    HalfToFloat(RowData(r), mat->RowData(r), num_cols_, type_);
+  }
+}
+
+void HalfMatrix::Write(const bool binary, std::ostream *os) const {
+  SNOWBOY_ASSERT(os != NULL);
+  if (!os->good()) {
+    SNOWBOY_ERROR << "Fail to write HalfMatrix to stream.";
+  }
+  int32 type = type_;
+  if (binary) {
+    WriteToken(binary, "HM", os);
+    int32 rows = num_rows_;         // 32-bit on disk.
+    int32 cols = num_cols_;         // 32-bit on disk
+    WriteBasicType(binary, rows, os);
+    WriteBasicType(binary, cols, os);
+    WriteToken(binary, "<HalfType>", os);
+    WriteBasicType(binary, type, os);
+    for (MatrixIndexT i = 0; i < num_rows_; ++i) {
+      os->write(reinterpret_cast<const char*>(RowData(i)),
+                sizeof(uint16) * static_cast<size_t>(num_cols_));
+    }
+  } else {
+    // Text mode goes through float, the values are exact.
+    WriteToken(binary, "<HalfType>", os);
+    WriteBasicType(binary, type, os);
+    Matrix tmp(num_rows_, num_cols_, kUndefined);
+    CopyToMat(&tmp);
+    tmp.Write(binary, os);
+  }
+  if (!os->good()) {
+    SNOWBOY_ERROR << "Fail to write HalfMatrix to stream.";
+  }
+}
+
+void HalfMatrix::Read(const bool binary, std::istream *is) {
+  SNOWBOY_ASSERT(is != NULL);
+  // Float matrices start with "FM" in binary mode and "[" in text mode.
+  if (binary ? is->peek() == 'F' : (*is >> std::ws).peek() == '[') {
+    Matrix tmp;
+    tmp.Read(binary, is);
+    CopyFromMat(tmp);
+    return;
+  }
+
+  int32 type;
+  if (binary) {
+    int32 num_rows, num_cols;
+    ExpectToken(binary, "HM", is);
+    ReadBasicType(binary, &num_rows, is);
+    ReadBasicType(binary, &num_cols, is);
+    ExpectToken(binary, "<HalfType>", is);
+    ReadBasicType(binary, &type, is);
+    type_ = static_cast<MatrixHalfType>(type);
+    Resize(num_rows, num_cols);
+    for (MatrixIndexT i = 0; i < num_rows_; ++i) {
+      is->read(reinterpret_cast<char*>(RowData(i)),
+               sizeof(uint16) * num_cols_);
+      if (is->fail()) {
+        break;
+      }
+    }
+    if (is->fail()) {
+      SNOWBOY_ERROR << "Fail to read HalfMatrix.";
+    }
+  } else {
+    ExpectToken(binary, "<HalfType>", is);
+    ReadBasicType(binary, &type, is);
+    type_ = static_cast<MatrixHalfType>(type);
+    Matrix tmp;
+    tmp.Read(binary, is);
+    CopyFromMat(tmp);
+  }
+}
+
+}
@@ -0,0 +1,113 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#ifndef SNOWBOY_HALF_MATRIX_H
+#define SNOWBOY_HALF_MATRIX_H
+
+#include <istream>
+#include <ostream>
+
+#include "matrix/matrix-common.h"
+#include "utils/snowboy-debug.h"
+#include "utils/snowboy-types.h"
+#include "utils/snowboy-utils.h"
+
+namespace snowboy {
+
+// Converts between float and 16-bit values, rounding to nearest even.
+void FloatToHalf(const float *in, uint16 *out, MatrixIndexT n,
+                 MatrixHalfType type);
+void HalfToFloat(const uint16 *in, float *out, MatrixIndexT n,
+                 MatrixHalfType type);
+
+// out = beta * out + alpha * x * w^T, i.e. a layer with float input <x> and
+// half precision weights <w>, which are widened to float in registers.
+void AddMatHalfMat(const float alpha, const MatrixBase &x, const HalfMatrix &w,
+                   const float beta, MatrixBase *out);
+
+// out = beta * out + alpha * w * x.
+void AddHalfMatVec(const float alpha, const HalfMatrix &w, const VectorBase &x,
+                   const float beta, VectorBase *out);
+
+// Matrix stored in half precision (fp16 or bf16), e.g. for weights, which
+// halves the memory traffic of layers that are memory-bandwidth bound. It is
+// only a storage format: values are converted from and to float, and the
+// kernels above do the arithmetic in float. HalfVector, in half-vector.h, is
+// the vector counterpart.
+class HalfMatrix {
+ public:
+  // Constructor, this version creates an empty matrix.
+  explicit HalfMatrix(const MatrixHalfType type = kFloat16) :
+      num_rows_(0), num_cols_(0), stride_(0), data_(NULL), type_(type) {}
+
+  // Constructor, this version converts a float matrix.
+  explicit HalfMatrix(const MatrixBase &mat,
+                      const MatrixHalfType type = kFloat16);
+
+  ~HalfMatrix() { ReleaseHalfMatrixMemory(); }
+
+  // Returns number of rows.
+  inline MatrixIndexT NumRows() const { return num_rows_; }
+
+  // Returns number of columns.
+  inline MatrixIndexT NumCols() const { return num_cols_; }
+
+  // Returns the stride, which is the distance in memory between each row.
+  inline MatrixIndexT Stride() const { return stride_; }
+
+  // Returns the storage type.
+  inline MatrixHalfType Type() const { return type_; }
+
+  // Returns pointer to the data.
+  inline uint16* Data() { return data_; }
+  inline const uint16* Data() const { return data_; }
+
+  // Returns pointer to data for one row.
+  inline uint16* RowData(const MatrixIndexT row) {
+    SNOWBOY_ASSERT(row < num_rows_ && row >= 0);
+    return data_ + row * stride_;
+  }
+  inline const uint16* RowData(const MatrixIndexT row) const {
+    SNOWBOY_ASSERT(row < num_rows_ && row >= 0);
+    return data_ + row * stride_;
+  }
+
+  // Returns the value at given index, converted to float.
+  float operator()(const MatrixIndexT row, const MatrixIndexT col) const;
+
+  // Resizes the matrix, values are set to zero.
+  void Resize(const MatrixIndexT rows, const MatrixIndexT cols);
+
+  // Swaps the contents of *this and *other. Shallow swap.
+  void Swap(HalfMatrix *other);
+
+  // Converts from float, resizing the matrix if needed.
+  void CopyFromMat(const MatrixBase &mat);
+
+  // Converts to float, <mat> must have the same size.
+  void CopyToMat(MatrixBase *mat) const;
+
+  // Also accepts float matrices written by MatrixBase::Write(), which are
+  // converted to Type(), so that models can be moved over layer by layer.
+  void Read(const bool binary, std::istream *is);
+
+  void Write(const bool binary, std::ostream *os) const;
+
+ private:
+  // Allocates memory for <data_>.
+  void AllocateHalfMatrixMemory(const MatrixIndexT rows,
+                                const MatrixIndexT cols);
+
+  void ReleaseHalfMatrixMemory();
+
+  MatrixIndexT num_rows_;
+  MatrixIndexT num_cols_;
+  MatrixIndexT stride_;
+  uint16 *data_;
+  MatrixHalfType type_;
+
+  SNOWBOY_DISALLOW_COPY_AND_ASSIGN(HalfMatrix);
+};
+
+}
+
+#endif //SNOWBOY_HALF_MATRIX_H
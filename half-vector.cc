@@ -0,0 +1,147 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "matrix/half-matrix.h"
+#include "matrix/half-vector.h"
+#include "matrix/matrix-memory.h"
+#include "matrix/vector-wrapper.h"
+#include "utils/snowboy-io.h"
+
+namespace snowboy {
+
+HalfVector::HalfVector(const VectorBase &vec, const MatrixHalfType type) :
+    dim_(0), data_(NULL), type_(type) {
+  CopyFromVec(vec);
+}
+
+float HalfVector::operator()(const MatrixIndexT index) const {
+  SNOWBOY_ASSERT(index < dim_ && index >= 0);
+  float value;
+  HalfToFloat(data_ + index, &value, 1, type_);
+  return value;
+}
+
+void HalfVector::AllocateHalfVectorMemory(const MatrixIndexT dim) {
+  SNOWBOY_ASSERT(dim >= 0);
+
+  if (dim == 0) {
+    dim_ = 0;
+    data_ = NULL;
+    return;
+  }
+
+  SNOWBOY_ASSERT(SNOWBOY_MEM_ALIGN % sizeof(uint16) == 0);
+  size_t num_per_align = SNOWBOY_MEM_ALIGN / sizeof(uint16);
+  MatrixIndexT pad = (num_per_align - dim % num_per_align) % num_per_align;
+  size_t size = sizeof(uint16) * static_cast<size_t>(dim + pad);
+  void *data = MatrixMemalign(SNOWBOY_MEM_ALIGN, size);
+
+  if (data != NULL) {
+    data_ = static_cast<uint16 *>(data);
+    dim_ = dim;
+  } else {
+    throw std::bad_alloc();
+  }
+}
+
+void HalfVector::ReleaseHalfVectorMemory() {
+  if (data_ != NULL)
+    MatrixMemalignFree(data_);
+  dim_ = 0;
+  data_ = NULL;
+}
+
+void HalfVector::Resize(const MatrixIndexT dim) {
+  if (dim_ != dim) {
+    ReleaseHalfVectorMemory();
+    AllocateHalfVectorMemory(dim);
+  }
+  // Zero is all bits zero in both formats.
+  if (data_ != NULL) {
+    std::memset(data_, 0, sizeof(uint16) * dim_);
+  }
+}
+
+void HalfVector::Swap(HalfVector *other) {
+  std::swap(dim_, other->dim_);
+  std::swap(data_, other->data_);
+  std::swap(type_, other->type_);
+}
+
+void HalfVector::CopyFromVec(const VectorBase &vec) {
+  if (dim_ != vec.Dim()) {
+    Resize(vec.Dim());
+  }
+  FloatToHalf(vec.Data(), data_, dim_, type_);
+}
+
+void HalfVector::CopyToVec(VectorBase *vec) const {
+  SNOWBOY_ASSERT(vec != NULL);
+  SNOWBOY_ASSERT(vec->Dim() == dim_);
+  HalfToFloat(data_, vec->Data(), dim_, type_);
+}
+
+void HalfVector::Write(const bool binary, std::ostream *os) const {
+  SNOWBOY_ASSERT(os != NULL);
+  if (!os->good()) {
+    SNOWBOY_ERROR << "Fail to write HalfVector to stream.";
+  }
+  int32 type = type_;
+  if (binary) {
+    WriteToken(binary, "HV", os);
+    int32 dim = dim_;               // 32-bit on disk.
+    WriteBasicType(binary, dim, os);
+    WriteToken(binary, "<HalfType>", os);
+    WriteBasicType(binary, type, os);
+    os->write(reinterpret_cast<const char*>(data_),
+              sizeof(uint16) * static_cast<size_t>(dim_));
+  } else {
+    // Text mode goes through float, the values are exact.
+    WriteToken(binary, "<HalfType>", os);
+    WriteBasicType(binary, type, os);
+    Vector tmp(dim_, kUndefined);
+    CopyToVec(&tmp);
+    tmp.Write(binary, os);
+  }
+  if (!os->good()) {
+    SNOWBOY_ERROR << "Fail to write HalfVector to stream.";
+  }
+}
+
+void HalfVector::Read(const bool binary, std::istream *is) {
+  SNOWBOY_ASSERT(is != NULL);
+  // Float vectors start with "FV" in binary mode and "[" in text mode.
+  if (binary ? is->peek() == 'F' : (*is >> std::ws).peek() == '[') {
+    Vector tmp;
+    tmp.Read(binary, is);
+    CopyFromVec(tmp);
+    return;
+  }
+
+  int32 type;
+  if (binary) {
+    int32 dim;
+    ExpectToken(binary, "HV", is);
+    ReadBasicType(binary, &dim, is);
+    ExpectToken(binary, "<HalfType>", is);
+    ReadBasicType(binary, &type, is);
+    type_ = static_cast<MatrixHalfType>(type);
+    Resize(dim);
+    is->read(reinterpret_cast<char*>(data_), sizeof(uint16) * dim_);
+    if (is->fail()) {
+      SNOWBOY_ERROR << "Fail to read HalfVector.";
+    }
+  } else {
+    ExpectToken(binary, "<HalfType>", is);
+    ReadBasicType(binary, &type, is);
+    type_ = static_cast<MatrixHalfType>(type);
+    Vector tmp;
+    tmp.Read(binary, is);
+    CopyFromVec(tmp);
+  }
+}
+
+}
@@ -0,0 +1,78 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#ifndef SNOWBOY_HALF_VECTOR_H
+#define SNOWBOY_HALF_VECTOR_H
+
+#include <istream>
+#include <ostream>
+
+#include "matrix/matrix-common.h"
+#include "utils/snowboy-debug.h"
+#include "utils/snowboy-types.h"
+#include "utils/snowboy-utils.h"
+
+namespace snowboy {
+
+// Vector stored in half precision (fp16 or bf16), the counterpart of
+// HalfMatrix, e.g. for the biases of a layer whose weights are a HalfMatrix.
+// As HalfMatrix, it is only a storage format: values are converted from and to
+// float with FloatToHalf() and HalfToFloat().
+class HalfVector {
+ public:
+  // Constructor, this version creates an empty vector.
+  explicit HalfVector(const MatrixHalfType type = kFloat16) :
+      dim_(0), data_(NULL), type_(type) {}
+
+  // Constructor, this version converts a float vector.
+  explicit HalfVector(const VectorBase &vec,
+                      const MatrixHalfType type = kFloat16);
+
+  ~HalfVector() { ReleaseHalfVectorMemory(); }
+
+  // Returns the dimension of the vector.
+  inline MatrixIndexT Dim() const { return dim_; }
+
+  // Returns the storage type.
+  inline MatrixHalfType Type() const { return type_; }
+
+  // Returns a pointer to the start of the vector's data.
+  inline uint16* Data() { return data_; }
+  inline const uint16* Data() const { return data_; }
+
+  // Returns the value at given index, converted to float.
+  float operator()(const MatrixIndexT index) const;
+
+  // Resizes the vector, values are set to zero.
+  void Resize(const MatrixIndexT dim);
+
+  // Swaps the contents of *this and *other. Shallow swap.
+  void Swap(HalfVector *other);
+
+  // Converts from float, resizing the vector if needed.
+  void CopyFromVec(const VectorBase &vec);
+
+  // Converts to float, <vec> must have the same dimension.
+  void CopyToVec(VectorBase *vec) const;
+
+  // Also accepts float vectors written by VectorBase::Write(), which are
+  // converted to Type().
+  void Read(const bool binary, std::istream *is);
+
+  void Write(const bool binary, std::ostream *os) const;
+
+ private:
+  // Allocates memory for <data_>.
+  void AllocateHalfVectorMemory(const MatrixIndexT dim);
+
+  void ReleaseHalfVectorMemory();
+
+  MatrixIndexT dim_;
+  uint16 *data_;
+  MatrixHalfType type_;
+
+  SNOWBOY_DISALLOW_COPY_AND_ASSIGN(HalfVector);
+};
+
+}
+
+#endif //SNOWBOY_HALF_VECTOR_H
@@ -0,0 +1,32 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#include <atomic>
+
+#include "matrix/kernel-tuning.h"
+#include "utils/snowboy-debug.h"
+
+namespace snowboy {
+
+// Read once per kernel call, so relaxed loads are enough.
+static std::atomic<int32> prefetch_rows(0);
+static std::atomic<int64> streaming_store_bytes(64 << 20);
+
+void SetPrefetchRows(const int32 rows) {
+  SNOWBOY_ASSERT(rows >= 0);
+  prefetch_rows.store(rows, std::memory_order_relaxed);
+}
+
+int32 PrefetchRows() {
+  return prefetch_rows.load(std::memory_order_relaxed);
+}
+
+void SetStreamingStoreBytes(const int64 bytes) {
+  SNOWBOY_ASSERT(bytes >= 0);
+  streaming_store_bytes.store(bytes, std::memory_order_relaxed);
+}
+
+int64 StreamingStoreBytes() {
+  return streaming_store_bytes.load(std::memory_order_relaxed);
+}
+
+}  // namespace snowboy
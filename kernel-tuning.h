@@ -0,0 +1,61 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+// Memory hints of the kernels that walk the rows of the weights. A product
+// reads the weight rows one after the other, but consecutive rows are Stride()
+// apart, and for large layers on another page, so the hardware prefetcher has
+// to pick up the stream again at every row. AddBitMatBitMat() and AddMatVec()
+// therefore prefetch the rows a few ahead of the one they work on.
+//
+// Large outputs that are not read again soon, e.g. ToMatrix() of a whole
+// batch, are written with non-temporal stores, which go around the caches
+// instead of evicting the weights from them.
+//
+// The best settings depend on the CPU and its caches; snowboy-matrix-bench
+// sweeps them with --prefetch-rows and --stream-bytes.
+
+#ifndef SNOWBOY_MATRIX_KERNEL_TUNING_H_
+#define SNOWBOY_MATRIX_KERNEL_TUNING_H_
+
+#include <cstddef>
+
+#include "matrix/matrix-common.h"
+#include "utils/snowboy-types.h"
+
+namespace snowboy {
+
+// Sets how many rows ahead the kernels prefetch; 0 disables prefetching.
+// Defaults to 0: where the kernels are compute bound, or the weights fit in
+// the caches, the hints only cost instructions, and AddMatVec() has to split
+// the weights into panels for them.
+void SetPrefetchRows(const int32 rows);
+
+int32 PrefetchRows();
+
+// Sets the size from which outputs are written with non-temporal stores; 0
+// disables them. Defaults to 64 MiB, beyond the last level cache of the
+// targets; below that size a ToMatrix() output that is read soon after is
+// faster to leave in the cache. Non-temporal stores need AVX2 and row data
+// aligned to 32 bytes, otherwise regular stores are used.
+void SetStreamingStoreBytes(const int64 bytes);
+
+int64 StreamingStoreBytes();
+
+// Returns true if an output of <bytes> should be written with non-temporal
+// stores.
+inline bool UseStreamingStores(const int64 bytes) {
+  const int64 threshold = StreamingStoreBytes();
+  return threshold > 0 && bytes >= threshold;
+}
+
+// Prefetches [data, data + bytes) into all cache levels for reading, one hint
+// per cache line.
+inline void PrefetchRange(const void* data, const size_t bytes) {
+  const char* begin = static_cast<const char*>(data);
+  for (size_t offset = 0; offset < bytes; offset += 64) {
+    __builtin_prefetch(begin + offset, 0, 3);
+  }
+}
+
+}  // namespace snowboy
+
+#endif  // SNOWBOY_MATRIX_KERNEL_TUNING_H_
@@ -6,6 +6,7 @@
 #define SNOWBOY_MATRIX_MATRIX_COMMON_H_
 
 #include "matrix/snowboy-blas.h"
+#include "utils/snowboy-types.h"
 
 namespace snowboy {
 
@@ -15,22 +16,67 @@ enum MatrixResizeType {
   kCopyData   // Sets values to old ones for shared area.
 };
 
+// Rows of Matrix and BitMatrix, and the data of Vector, are padded to a
+// multiple of this many bytes, and the padding is always zero, also after
+// Resize(), Read() and Transpose(). Kernels given these types can thus work on
+// whole SIMD vectors up to the padded size, without tail loops or masks, as
+// long as they leave the padding zero. Views, i.e. SubMatrix, SubVector and
+// BitSubMatrix, make no such promise: their padding is data of the parent.
+const int32 kMatrixPadBytes = 64;
+
 enum MatrixTransposeType {
   kTrans    = CblasTrans,   // With matrix transpose.
   kNoTrans  = CblasNoTrans  // Without matrix transpose.
 };
 
-// Forward declaration of vector and matrix classes.
-class VectorBase;
-class Vector;
-class SubVector;
-class MatrixBase;
-class Matrix;
-class SubMatrix;
+enum MatrixActivationType {
+  kNoActivation,  // Identity.
+  kRelu,          // max(x, 0).
+  kClippedRelu,   // min(max(x, 0), ceil).
+  kSigmoid,       // 1 / (1 + exp(-x)).
+  kTanh           // tanh(x).
+};
+
+enum MatrixHalfType {
+  kFloat16,   // IEEE 754 half precision, 5-bit exponent and 10-bit mantissa.
+  kBFloat16   // Upper 16 bits of a float, 8-bit exponent and 7-bit mantissa.
+};
+
+// Forward declaration of vector and matrix classes. They are templated on the
+// element type, and the names without suffix are the float ones, which have
+// all operations; see vector-wrapper.h and matrix-wrapper.h.
+template <typename Real> class VectorBaseT;
+template <typename Real> class VectorT;
+template <typename Real> class SubVectorT;
+template <typename Real> class MatrixBaseT;
+template <typename Real> class MatrixT;
+template <typename Real> class SubMatrixT;
 
+typedef VectorBaseT<float> VectorBase;
+typedef VectorT<float> Vector;
+typedef SubVectorT<float> SubVector;
+typedef MatrixBaseT<float> MatrixBase;
+typedef MatrixT<float> Matrix;
+typedef SubMatrixT<float> SubMatrix;
+
+// Integer vectors and matrices: int32 for accumulators, e.g. the output of
+// BitMatBitMat(), int16 for fixed-point values.
+typedef VectorT<int16> Int16Vector;
+typedef VectorT<int32> Int32Vector;
+typedef MatrixT<int16> Int16Matrix;
+typedef MatrixT<int32> Int32Matrix;
+
+class BitMatrixBase;
 class BitMatrix;
+class BitSubMatrix;
 class BitVector;
 
+class HalfMatrix;
+class HalfVector;
+
+// Element-wise expressions, see matrix-expression.h.
+template <typename Derived> class MatrixExpression;
+
 }  // namespace snowboy
 
 #endif  // SNOWBOY_MATRIX_MATRIX_COMMON_H_
@@ -0,0 +1,320 @@
+// matrix/matrix-expression.h
+
+// Copyright 2017  Baidu (author: Meixu Song)
+
+// Element-wise expressions on vectors and matrices, evaluated lazily. Chains of
+// element-wise calls such as
+//   v.Scale(a); v.AddVec(b, w); v.MulElements(u); v.ApplyFloor(0);
+// go over the memory once per call. With this header they can be written as
+//   v.Assign(max((a * v + b * w) * u, 0));
+// which builds the expression tree at compile time and evaluates it in a single
+// (vectorized) pass. Operands can be any VectorBase or MatrixBase, including
+// SubVector and SubMatrix views with strides. A vector used in a matrix
+// expression is broadcast to every row.
+//
+// The destination may appear in the expression, but only at the same position
+// (e.g. v.Assign(2 * v + w) is fine, v.Range(1, n).Assign(v.Range(0, n)) is
+// not).
+
+#ifndef SNOWBOY_MATRIX_MATRIX_EXPRESSION_H_
+#define SNOWBOY_MATRIX_MATRIX_EXPRESSION_H_
+
+#include <type_traits>
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+#include "matrix/matrix-common.h"
+#include "matrix/matrix-wrapper.h"
+#include "matrix/vector-wrapper.h"
+#include "utils/snowboy-debug.h"
+#include "utils/snowboy-types.h"
+
+namespace snowboy {
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Expression nodes
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// Base class of all expression nodes (CRTP). A node provides NumRows(),
+// NumCols(), Coeff(row, col) and, with AVX, Packet(row, col), which returns the
+// 8 coefficients starting at (row, col).
+template <typename Derived>
+class MatrixExpression {
+ public:
+  const Derived& derived() const { return static_cast<const Derived&>(*this); }
+
+  MatrixIndexT NumRows() const { return derived().NumRows(); }
+
+  MatrixIndexT NumCols() const { return derived().NumCols(); }
+};
+
+// Leaf node referring to the data of a vector or a matrix. A vector is a single
+// row with stride 0, so that it is broadcast to every row.
+class MatrixTerm : public MatrixExpression<MatrixTerm> {
+ public:
+  explicit MatrixTerm(const VectorBase& vec) :
+      data_(vec.Data()), num_rows_(1), num_cols_(vec.Dim()), stride_(0) {}
+
+  explicit MatrixTerm(const MatrixBase& mat) :
+      data_(mat.Data()), num_rows_(mat.NumRows()),
+      num_cols_(mat.NumCols()),
+      stride_(mat.NumRows() == 1 ? 0 : mat.Stride()) {}
+
+  MatrixIndexT NumRows() const { return num_rows_; }
+
+  MatrixIndexT NumCols() const { return num_cols_; }
+
+  float Coeff(const MatrixIndexT row, const MatrixIndexT col) const {
+    return data_[row * stride_ + col];
+  }
+
+#ifdef __AVX__
+  __m256 Packet(const MatrixIndexT row, const MatrixIndexT col) const {
+    return _mm256_loadu_ps(data_ + row * stride_ + col);
+  }
+#endif
+
+ private:
+  const float* data_;
+  MatrixIndexT num_rows_;
+  MatrixIndexT num_cols_;
+  MatrixIndexT stride_;
+};
+
+// Element-wise operations, on scalars and on packets.
+struct ExpressionAddOp {
+  static float Apply(const float a, const float b) { return a + b; }
+#ifdef __AVX__
+  static __m256 Apply(const __m256 a, const __m256 b) {
+    return _mm256_add_ps(a, b);
+  }
+#endif
+};
+
+struct ExpressionSubOp {
+  static float Apply(const float a, const float b) { return a - b; }
+#ifdef __AVX__
+  static __m256 Apply(const __m256 a, const __m256 b) {
+    return _mm256_sub_ps(a, b);
+  }
+#endif
+};
+
+struct ExpressionMulOp {
+  static float Apply(const float a, const float b) { return a * b; }
+#ifdef __AVX__
+  static __m256 Apply(const __m256 a, const __m256 b) {
+    return _mm256_mul_ps(a, b);
+  }
+#endif
+};
+
+struct ExpressionMaxOp {
+  static float Apply(const float a, const float b) { return a < b ? b : a; }
+#ifdef __AVX__
+  static __m256 Apply(const __m256 a, const __m256 b) {
+    return _mm256_max_ps(b, a);
+  }
+#endif
+};
+
+struct ExpressionMinOp {
+  static float Apply(const float a, const float b) { return b < a ? b : a; }
+#ifdef __AVX__
+  static __m256 Apply(const __m256 a, const __m256 b) {
+    return _mm256_min_ps(b, a);
+  }
+#endif
+};
+
+// Node combining two expressions element by element. An operand with a single
+// row is broadcast to the rows of the other one.
+template <typename Op, typename Lhs, typename Rhs>
+class BinaryExpression
+    : public MatrixExpression<BinaryExpression<Op, Lhs, Rhs> > {
+ public:
+  BinaryExpression(const Lhs& lhs, const Rhs& rhs) : lhs_(lhs), rhs_(rhs) {
+    SNOWBOY_ASSERT(lhs.NumCols() == rhs.NumCols());
+    SNOWBOY_ASSERT(lhs.NumRows() == rhs.NumRows()
+                   || lhs.NumRows() == 1 || rhs.NumRows() == 1);
+  }
+
+  MatrixIndexT NumRows() const {
+    return lhs_.NumRows() > rhs_.NumRows() ? lhs_.NumRows() : rhs_.NumRows();
+  }
+
+  MatrixIndexT NumCols() const { return lhs_.NumCols(); }
+
+  float Coeff(const MatrixIndexT row, const MatrixIndexT col) const {
+    return Op::Apply(lhs_.Coeff(row, col), rhs_.Coeff(row, col));
+  }
+
+#ifdef __AVX__
+  __m256 Packet(const MatrixIndexT row, const MatrixIndexT col) const {
+    return Op::Apply(lhs_.Packet(row, col), rhs_.Packet(row, col));
+  }
+#endif
+
+ private:
+  const Lhs lhs_;
+  const Rhs rhs_;
+};
+
+// Node combining an expression with a scalar, i.e. op(expr, scalar).
+template <typename Op, typename Arg>
+class ScalarExpression : public MatrixExpression<ScalarExpression<Op, Arg> > {
+ public:
+  ScalarExpression(const Arg& arg, const float scalar) :
+      arg_(arg), scalar_(scalar) {}
+
+  MatrixIndexT NumRows() const { return arg_.NumRows(); }
+
+  MatrixIndexT NumCols() const { return arg_.NumCols(); }
+
+  float Coeff(const MatrixIndexT row, const MatrixIndexT col) const {
+    return Op::Apply(arg_.Coeff(row, col), scalar_);
+  }
+
+#ifdef __AVX__
+  __m256 Packet(const MatrixIndexT row, const MatrixIndexT col) const {
+    return Op::Apply(arg_.Packet(row, col), _mm256_set1_ps(scalar_));
+  }
+#endif
+
+ private:
+  const Arg arg_;
+  const float scalar_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Operators
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// Maps an operand (VectorBase, MatrixBase or an expression) to its node.
+template <typename T, typename Enable = void>
+struct ExpressionOperand {
+  static const bool value = false;
+};
+
+template <typename T>
+struct ExpressionOperand<T, typename std::enable_if<
+    std::is_base_of<VectorBase, T>::value
+    || std::is_base_of<MatrixBase, T>::value>::type> {
+  static const bool value = true;
+  typedef MatrixTerm Type;
+  static MatrixTerm Make(const T& operand) { return MatrixTerm(operand); }
+};
+
+template <typename T>
+struct ExpressionOperand<T, typename std::enable_if<
+    std::is_base_of<MatrixExpression<T>, T>::value>::type> {
+  static const bool value = true;
+  typedef T Type;
+  static const T& Make(const T& operand) { return operand; }
+};
+
+#define SNOWBOY_EXPRESSION_BINARY_OPERATOR(name, op)                          \
+  template <typename Lhs, typename Rhs>                                       \
+  typename std::enable_if<                                                    \
+      ExpressionOperand<Lhs>::value && ExpressionOperand<Rhs>::value,         \
+      BinaryExpression<op, typename ExpressionOperand<Lhs>::Type,             \
+                       typename ExpressionOperand<Rhs>::Type> >::type         \
+  name(const Lhs& lhs, const Rhs& rhs) {                                      \
+    return BinaryExpression<op, typename ExpressionOperand<Lhs>::Type,        \
+                            typename ExpressionOperand<Rhs>::Type>(           \
+        ExpressionOperand<Lhs>::Make(lhs), ExpressionOperand<Rhs>::Make(rhs));\
+  }
+
+#define SNOWBOY_EXPRESSION_SCALAR_OPERATOR(name, op)                          \
+  template <typename Arg>                                                     \
+  typename std::enable_if<                                                    \
+      ExpressionOperand<Arg>::value,                                          \
+      ScalarExpression<op, typename ExpressionOperand<Arg>::Type> >::type     \
+  name(const Arg& arg, const float scalar) {                                  \
+    return ScalarExpression<op, typename ExpressionOperand<Arg>::Type>(       \
+        ExpressionOperand<Arg>::Make(arg), scalar);                           \
+  }                                                                           \
+  template <typename Arg>                                                     \
+  typename std::enable_if<                                                    \
+      ExpressionOperand<Arg>::value,                                          \
+      ScalarExpression<op, typename ExpressionOperand<Arg>::Type> >::type     \
+  name(const float scalar, const Arg& arg) {                                  \
+    return ScalarExpression<op, typename ExpressionOperand<Arg>::Type>(       \
+        ExpressionOperand<Arg>::Make(arg), scalar);                           \
+  }
+
+SNOWBOY_EXPRESSION_BINARY_OPERATOR(operator+, ExpressionAddOp)
+SNOWBOY_EXPRESSION_BINARY_OPERATOR(operator-, ExpressionSubOp)
+SNOWBOY_EXPRESSION_BINARY_OPERATOR(operator*, ExpressionMulOp)
+SNOWBOY_EXPRESSION_BINARY_OPERATOR(max, ExpressionMaxOp)
+SNOWBOY_EXPRESSION_BINARY_OPERATOR(min, ExpressionMinOp)
+
+SNOWBOY_EXPRESSION_SCALAR_OPERATOR(operator+, ExpressionAddOp)
+SNOWBOY_EXPRESSION_SCALAR_OPERATOR(operator*, ExpressionMulOp)
+SNOWBOY_EXPRESSION_SCALAR_OPERATOR(max, ExpressionMaxOp)
+SNOWBOY_EXPRESSION_SCALAR_OPERATOR(min, ExpressionMinOp)
+
+#undef SNOWBOY_EXPRESSION_BINARY_OPERATOR
+#undef SNOWBOY_EXPRESSION_SCALAR_OPERATOR
+
+// expr - scalar.
+template <typename Arg>
+typename std::enable_if<
+    ExpressionOperand<Arg>::value,
+    ScalarExpression<ExpressionAddOp,
+                     typename ExpressionOperand<Arg>::Type> >::type
+operator-(const Arg& arg, const float scalar) {
+  return ScalarExpression<ExpressionAddOp,
+                          typename ExpressionOperand<Arg>::Type>(
+      ExpressionOperand<Arg>::Make(arg), -scalar);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Evaluation
+//
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename Expr>
+void EvaluateExpression(const Expr& expr, float* data,
+                        const MatrixIndexT num_rows,
+                        const MatrixIndexT num_cols,
+                        const MatrixIndexT stride) {
+  for (MatrixIndexT r = 0; r < num_rows; ++r) {
+    float* row = data + r * stride;
+    MatrixIndexT c = 0;
+#ifdef __AVX__
+    for (; c + 8 <= num_cols; c += 8) {
+      _mm256_storeu_ps(row + c, expr.Packet(r, c));
+    }
+#endif
+    for (; c < num_cols; ++c) {
+      row[c] = expr.Coeff(r, c);
+    }
+  }
+}
+
+template <typename Real>
+template <typename Expr>
+void VectorBaseT<Real>::Assign(const MatrixExpression<Expr>& expr) {
+  SNOWBOY_ASSERT(expr.NumRows() == 1 && expr.NumCols() == dim_);
+  EvaluateExpression(expr.derived(), data_, 1, dim_, 0);
+}
+
+template <typename Real>
+template <typename Expr>
+void MatrixBaseT<Real>::Assign(const MatrixExpression<Expr>& expr) {
+  SNOWBOY_ASSERT(expr.NumCols() == num_cols_);
+  SNOWBOY_ASSERT(expr.NumRows() == num_rows_ || expr.NumRows() == 1);
+  EvaluateExpression(expr.derived(), data_, num_rows_, num_cols_, stride_);
+}
+
+}  // namespace snowboy
+
+#endif  // SNOWBOY_MATRIX_MATRIX_EXPRESSION_H_
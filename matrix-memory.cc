@@ -0,0 +1,368 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <execinfo.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "matrix/matrix-memory.h"
+
+namespace snowboy {
+
+enum MemoryBlockType {
+  kBlockMemalign = 0,
+  kBlockTransparent,
+  kBlockHugetlb
+};
+
+// Bookkeeping of a live allocation, stored right before the block itself, so
+// that allocating and freeing take no lock and call no operator new. The size
+// is kept since some owners, e.g. Matrix after an in place Transpose(), can no
+// longer derive it from their dimensions.
+struct MemoryBlock {
+  size_t size;
+  // Start of the underlying allocation, and for blocks mapped for huge pages,
+  // the length of the mapping after the block's page of bookkeeping.
+  void* base;
+  size_t mapped_bytes;
+  MemoryBlockType type;
+  // Blocks madvise()d for transparent huge pages are linked together, for
+  // TransparentHugePageBytes().
+  MemoryBlock* prev;
+  MemoryBlock* next;
+};
+
+static inline MemoryBlock* GetMemoryBlock(void* ptr) {
+  return reinterpret_cast<MemoryBlock*>(ptr) - 1;
+}
+
+// Only taken for blocks on huge pages, which are mapped with system calls
+// anyway.
+static std::mutex transparent_mutex;
+static MemoryBlock* transparent_blocks = NULL;
+
+static const size_t kHugePageSize = 2 << 20;
+static std::atomic<int32> huge_page_policy(kHugePagesOff);
+static std::atomic<size_t> huge_page_threshold(4 << 20);
+static std::atomic<int64> hugetlb_bytes(0);
+static std::atomic<int64> madvised_bytes(0);
+static std::atomic<int64> huge_page_fallbacks(0);
+
+static std::atomic<int64> global_num_allocs(0);
+static std::atomic<int64> global_num_frees(0);
+static std::atomic<int64> global_bytes_allocated(0);
+static std::atomic<int64> global_bytes_in_use(0);
+static std::atomic<int64> global_peak_bytes_in_use(0);
+
+static thread_local MatrixMemoryStats thread_stats = {0, 0, 0, 0, 0};
+
+static std::atomic<bool> no_allocation_abort(false);
+static std::atomic<int64> no_allocation_violations(0);
+static thread_local int32 no_allocation_depth = 0;
+
+static void UpdatePeak(std::atomic<int64>* peak, const int64 value) {
+  int64 current = peak->load(std::memory_order_relaxed);
+  while (value > current &&
+         !peak->compare_exchange_weak(current, value,
+                                      std::memory_order_relaxed)) {
+  }
+}
+
+static void AddAllocation(const int64 size) {
+  global_num_allocs.fetch_add(1, std::memory_order_relaxed);
+  global_bytes_allocated.fetch_add(size, std::memory_order_relaxed);
+  UpdatePeak(&global_peak_bytes_in_use,
+             global_bytes_in_use.fetch_add(size, std::memory_order_relaxed)
+             + size);
+  ++thread_stats.num_allocs;
+  thread_stats.bytes_allocated += size;
+  thread_stats.bytes_in_use += size;
+  thread_stats.peak_bytes_in_use = std::max(thread_stats.peak_bytes_in_use,
+                                            thread_stats.bytes_in_use);
+}
+
+static void AddFree(const int64 size) {
+  global_num_frees.fetch_add(1, std::memory_order_relaxed);
+  global_bytes_in_use.fetch_sub(size, std::memory_order_relaxed);
+  ++thread_stats.num_frees;
+  thread_stats.bytes_in_use -= size;
+}
+
+// Maps <size> bytes, rounded up to whole huge pages, for <type>, preceded by
+// one regular page for the MemoryBlock. Returns the block, aligned to a huge
+// page, or NULL if the mapping fails.
+static void* MapHugePages(const size_t size, const MemoryBlockType type,
+                          size_t* mapped_bytes) {
+#if defined(__linux__)
+  const size_t length = (size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  const size_t page = sysconf(_SC_PAGESIZE);
+  // Reserves room for an aligned block and the page before it, then trims
+  // both ends.
+  const int reserve_prot = (type == kBlockHugetlb) ? PROT_NONE
+                                                   : PROT_READ | PROT_WRITE;
+  char* base = static_cast<char*>(mmap(NULL, length + kHugePageSize + page,
+                                       reserve_prot,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (base == MAP_FAILED) {
+    return NULL;
+  }
+  char* ptr = reinterpret_cast<char*>(
+      (reinterpret_cast<uintptr_t>(base) + page + kHugePageSize - 1)
+      & ~(kHugePageSize - 1));
+  if (ptr - page > base) {
+    munmap(base, ptr - page - base);
+  }
+  munmap(ptr + length, base + length + kHugePageSize + page - (ptr + length));
+  if (type == kBlockHugetlb) {
+#if defined(MAP_HUGETLB)
+    if (mmap(ptr, length, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_FIXED, -1, 0)
+        != MAP_FAILED &&
+        mmap(ptr - page, page, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED) {
+      *mapped_bytes = length;
+      return ptr;
+    }
+#endif
+    munmap(ptr - page, page + length);
+    return NULL;
+  }
+#if defined(MADV_HUGEPAGE)
+  madvise(ptr, length, MADV_HUGEPAGE);
+  *mapped_bytes = length;
+  return ptr;
+#else
+  munmap(ptr - page, page + length);
+#endif
+#endif
+  return NULL;
+}
+
+void* MatrixMemalign(const size_t align, const size_t size) {
+  CheckNoAllocationScope(size);
+  SNOWBOY_ASSERT(align > 0 && (align & (align - 1)) == 0);
+  MemoryBlockType type = kBlockMemalign;
+  size_t mapped_bytes = 0;
+  void* ptr = NULL;
+  const int32 policy = huge_page_policy.load(std::memory_order_relaxed);
+  if (policy != kHugePagesOff &&
+      size >= huge_page_threshold.load(std::memory_order_relaxed) &&
+      align <= kHugePageSize) {
+    if (policy == kHugePagesHugetlb) {
+      type = kBlockHugetlb;
+      ptr = MapHugePages(size, kBlockHugetlb, &mapped_bytes);
+      if (ptr == NULL) {
+        huge_page_fallbacks.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    if (ptr == NULL) {
+      type = kBlockTransparent;
+      ptr = MapHugePages(size, kBlockTransparent, &mapped_bytes);
+      if (ptr == NULL) {
+        huge_page_fallbacks.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  }
+  void* base = NULL;
+  if (ptr == NULL) {
+    type = kBlockMemalign;
+    mapped_bytes = 0;
+    // The MemoryBlock goes in front, in a whole number of <align> units.
+    const size_t offset = (sizeof(MemoryBlock) + align - 1) & ~(align - 1);
+    base = SnowboyMemalign(std::max(align, sizeof(void*)), offset + size);
+    if (base == NULL) {
+      return NULL;
+    }
+    ptr = static_cast<char*>(base) + offset;
+  } else if (type == kBlockHugetlb) {
+    hugetlb_bytes.fetch_add(size, std::memory_order_relaxed);
+  } else {
+    madvised_bytes.fetch_add(size, std::memory_order_relaxed);
+  }
+  MemoryBlock* block = GetMemoryBlock(ptr);
+  block->size = size;
+  block->base = base;
+  block->mapped_bytes = mapped_bytes;
+  block->type = type;
+  block->prev = NULL;
+  block->next = NULL;
+  if (type == kBlockTransparent) {
+    std::lock_guard<std::mutex> lock(transparent_mutex);
+    block->next = transparent_blocks;
+    if (transparent_blocks != NULL) {
+      transparent_blocks->prev = block;
+    }
+    transparent_blocks = block;
+  }
+  AddAllocation(size);
+  return ptr;
+}
+
+void MatrixMemalignFree(void* ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  const MemoryBlock block = *GetMemoryBlock(ptr);
+  AddFree(block.size);
+  if (block.type == kBlockMemalign) {
+    SnowboyMemalignFree(block.base);
+    return;
+  }
+  if (block.type == kBlockHugetlb) {
+    hugetlb_bytes.fetch_sub(block.size, std::memory_order_relaxed);
+  } else {
+    // The links may have changed since the copy above.
+    std::lock_guard<std::mutex> lock(transparent_mutex);
+    MemoryBlock* live = GetMemoryBlock(ptr);
+    if (live->prev != NULL) {
+      live->prev->next = live->next;
+    } else {
+      transparent_blocks = live->next;
+    }
+    if (live->next != NULL) {
+      live->next->prev = live->prev;
+    }
+    madvised_bytes.fetch_sub(block.size, std::memory_order_relaxed);
+  }
+#if defined(__linux__)
+  const size_t page = sysconf(_SC_PAGESIZE);
+  munmap(ptr, block.mapped_bytes);
+  munmap(static_cast<char*>(ptr) - page, page);
+#endif
+}
+
+void SetHugePagePolicy(const HugePagePolicy policy, const size_t threshold) {
+  huge_page_threshold.store(threshold, std::memory_order_relaxed);
+  huge_page_policy.store(policy, std::memory_order_relaxed);
+}
+
+// Sums the AnonHugePages of the mappings in /proc/self/smaps that overlap
+// blocks madvise()d for transparent huge pages, at most the overlap each.
+static int64 TransparentHugePageBytes() {
+  std::vector<std::pair<uintptr_t, uintptr_t> > ranges;
+  {
+    std::lock_guard<std::mutex> lock(transparent_mutex);
+    for (MemoryBlock* block = transparent_blocks; block != NULL;
+         block = block->next) {
+      uintptr_t begin = reinterpret_cast<uintptr_t>(block + 1);
+      ranges.push_back(std::make_pair(begin, begin + block->mapped_bytes));
+    }
+  }
+  if (ranges.empty()) {
+    return 0;
+  }
+  std::ifstream is("/proc/self/smaps");
+  std::string line;
+  int64 total = 0;
+  int64 overlap = 0;
+  while (std::getline(is, line)) {
+    uintptr_t begin, end;
+    char dash;
+    std::istringstream iss(line);
+    if (line.compare(0, 14, "AnonHugePages:") == 0) {
+      int64 kb = 0;
+      std::istringstream value(line.substr(14));
+      value >> kb;
+      total += std::min<int64>(kb * 1024, overlap);
+    } else if ((iss >> std::hex >> begin >> dash >> end) && dash == '-') {
+      // Header of the next mapping.
+      overlap = 0;
+      for (size_t i = 0; i < ranges.size(); ++i) {
+        uintptr_t b = std::max(begin, ranges[i].first);
+        uintptr_t e = std::min(end, ranges[i].second);
+        if (e > b) {
+          overlap += e - b;
+        }
+      }
+    }
+  }
+  return total;
+}
+
+void GetHugePageStats(HugePageStats* stats) {
+  SNOWBOY_ASSERT(stats != NULL);
+  stats->hugetlb_bytes = hugetlb_bytes.load(std::memory_order_relaxed);
+  stats->madvised_bytes = madvised_bytes.load(std::memory_order_relaxed);
+  stats->transparent_bytes = std::min(stats->madvised_bytes,
+                                      TransparentHugePageBytes());
+  stats->num_fallbacks = huge_page_fallbacks.load(std::memory_order_relaxed);
+}
+
+void GetMatrixMemoryStats(MatrixMemoryStats* stats) {
+  SNOWBOY_ASSERT(stats != NULL);
+  stats->num_allocs = global_num_allocs.load(std::memory_order_relaxed);
+  stats->num_frees = global_num_frees.load(std::memory_order_relaxed);
+  stats->bytes_allocated =
+      global_bytes_allocated.load(std::memory_order_relaxed);
+  stats->bytes_in_use = global_bytes_in_use.load(std::memory_order_relaxed);
+  stats->peak_bytes_in_use =
+      global_peak_bytes_in_use.load(std::memory_order_relaxed);
+}
+
+void GetThreadMatrixMemoryStats(MatrixMemoryStats* stats) {
+  SNOWBOY_ASSERT(stats != NULL);
+  *stats = thread_stats;
+}
+
+void ResetMatrixMemoryPeak() {
+  global_peak_bytes_in_use.store(
+      global_bytes_in_use.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  thread_stats.peak_bytes_in_use = thread_stats.bytes_in_use;
+}
+
+void SetNoAllocationAbort(const bool abort) {
+  no_allocation_abort.store(abort, std::memory_order_relaxed);
+}
+
+int64 NumNoAllocationViolations() {
+  return no_allocation_violations.load(std::memory_order_relaxed);
+}
+
+bool InNoAllocationScope() {
+  return no_allocation_depth > 0;
+}
+
+void CheckNoAllocationScope(const size_t size) {
+  if (no_allocation_depth == 0) {
+    return;
+  }
+  no_allocation_violations.fetch_add(1, std::memory_order_relaxed);
+  if (!no_allocation_abort.load(std::memory_order_relaxed)) {
+    return;
+  }
+  // Nothing below calls operator new, so that this also works from there.
+  std::fprintf(stderr, "Allocation of %lu bytes inside a NoAllocationScope\n",
+               static_cast<unsigned long>(size));
+#if defined(__GLIBC__)
+  void* frames[64];
+  int num_frames = backtrace(frames, 64);
+  backtrace_symbols_fd(frames, num_frames, 2);
+#endif
+  std::abort();
+}
+
+NoAllocationScope::NoAllocationScope() {
+  ++no_allocation_depth;
+}
+
+NoAllocationScope::~NoAllocationScope() {
+  --no_allocation_depth;
+}
+
+}  // namespace snowboy
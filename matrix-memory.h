@@ -0,0 +1,127 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+// Memory of the matrix library. All matrices and vectors that own their data
+// (MatrixT, VectorT, BitMatrix and HalfMatrix) allocate it with
+// MatrixMemalign(), which keeps process-wide and per-thread counts of
+// allocations, bytes and the peak of bytes in use.
+//
+// A steady-state region, e.g. the processing of one audio frame, is declared
+// with a NoAllocationScope. An allocation inside it is a violation: violations
+// are counted, and in abort mode, see SetNoAllocationAbort(), the process
+// prints the size and a backtrace of the allocation and aborts, which makes
+// per-frame temporaries easy to find and keeps them out once removed. Loops
+// that a thread in a scope hands to the thread pool are checked on the
+// workers too.
+//
+// Only the library's own buffers go through MatrixMemalign(). An application
+// that replaces operator new can call CheckNoAllocationScope() from it, so
+// that any heap allocation in a scope is caught.
+//
+// Large buffers, e.g. weights that a GEMM streams through, can be backed by
+// 2 MiB pages to cut dTLB misses, see SetHugePagePolicy(). Above the
+// threshold they are mapped 2 MiB aligned, either madvise()d for transparent
+// huge pages or from the hugetlbfs pool, and fall back to regular pages if
+// that fails. GetHugePageStats() tells how many bytes actually landed on
+// huge pages. Huge pages are only supported on Linux.
+
+#ifndef SNOWBOY_MATRIX_MATRIX_MEMORY_H_
+#define SNOWBOY_MATRIX_MATRIX_MEMORY_H_
+
+#include <cstddef>
+
+#include "matrix/matrix-common.h"
+#include "utils/snowboy-debug.h"
+#include "utils/snowboy-types.h"
+#include "utils/snowboy-utils.h"
+
+namespace snowboy {
+
+struct MatrixMemoryStats {
+  int64 num_allocs;
+  int64 num_frees;
+  // Total bytes ever allocated.
+  int64 bytes_allocated;
+  int64 bytes_in_use;
+  // Largest <bytes_in_use> since the start or ResetMatrixMemoryPeak().
+  int64 peak_bytes_in_use;
+};
+
+enum HugePagePolicy {
+  // Regular pages only.
+  kHugePagesOff = 0,
+  // madvise(MADV_HUGEPAGE) on 2 MiB aligned mappings; the kernel backs them
+  // with huge pages when it can, also later through khugepaged.
+  kHugePagesTransparent,
+  // MAP_HUGETLB mappings from the reserved pool, see
+  // /proc/sys/vm/nr_hugepages, falling back to kHugePagesTransparent.
+  kHugePagesHugetlb
+};
+
+struct HugePageStats {
+  // Bytes in use mapped from the hugetlbfs pool.
+  int64 hugetlb_bytes;
+  // Bytes in use madvise()d for transparent huge pages.
+  int64 madvised_bytes;
+  // Part of <madvised_bytes> backed by huge pages right now, read from
+  // /proc/self/smaps.
+  int64 transparent_bytes;
+  // Allocations above the threshold that got regular pages, or transparent
+  // ones instead of hugetlbfs pages.
+  int64 num_fallbacks;
+};
+
+// Allocates <size> bytes aligned to <align>, returns NULL on failure.
+void* MatrixMemalign(const size_t align, const size_t size);
+
+// Frees memory from MatrixMemalign(). NULL is ignored.
+void MatrixMemalignFree(void* ptr);
+
+// Backs allocations of at least <threshold> bytes with huge pages, from then
+// on. Defaults to kHugePagesOff, as small devices may not spare the memory
+// lost to rounding up to 2 MiB.
+void SetHugePagePolicy(const HugePagePolicy policy,
+                       const size_t threshold = 4 << 20);
+
+void GetHugePageStats(HugePageStats* stats);
+
+// Counts of all threads.
+void GetMatrixMemoryStats(MatrixMemoryStats* stats);
+
+// Counts of the calling thread. Memory freed by another thread than the one
+// that allocated it is counted as a free of the freeing thread, so
+// <bytes_in_use> of a single thread may be negative.
+void GetThreadMatrixMemoryStats(MatrixMemoryStats* stats);
+
+// Restarts the peaks, process-wide and of the calling thread, from the
+// current bytes in use.
+void ResetMatrixMemoryPeak();
+
+// If true, an allocation inside a NoAllocationScope prints a backtrace and
+// aborts; otherwise it is only counted. Defaults to false.
+void SetNoAllocationAbort(const bool abort);
+
+// Number of allocations inside a NoAllocationScope, over all threads.
+int64 NumNoAllocationViolations();
+
+// Returns true if the calling thread is inside a NoAllocationScope.
+bool InNoAllocationScope();
+
+// Reports an allocation of <size> bytes if the calling thread is inside a
+// NoAllocationScope. Called by MatrixMemalign().
+void CheckNoAllocationScope(const size_t size);
+
+// Declares a steady-state region on the calling thread, from construction to
+// destruction, in which nothing must be allocated. Scopes nest.
+class NoAllocationScope {
+ public:
+  NoAllocationScope();
+
+  ~NoAllocationScope();
+
+ private:
+  SNOWBOY_DISALLOW_COPY_AND_ASSIGN(NoAllocationScope);
+};
+
+}  // namespace snowboy
+
+#endif  // SNOWBOY_MATRIX_MATRIX_MEMORY_H_
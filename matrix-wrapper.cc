@@ -26,35 +26,72 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
 
+#include "matrix/float-kernel.h"
+#include "matrix/matrix-memory.h"
 #include "matrix/matrix-wrapper.h"
+#include "matrix/perf-counters.h"
+#include "matrix/thread-pool.h"
+#include "matrix/trace-events.h"
 #include "matrix/vector-wrapper.h"
 #include "utils/snowboy-io.h"
 #include "utils/snowboy-math.h"
 
 namespace snowboy {
 
+// Token of the binary format, see vector_token() in vector-wrapper.cc.
+template <typename Real> static const char* matrix_token();
+template <> const char* matrix_token<float>() { return "FM"; }
+template <> const char* matrix_token<double>() { return "DM"; }
+template <> const char* matrix_token<int16>() { return "IM16"; }
+template <> const char* matrix_token<int32>() { return "IM32"; }
+
+// Copies the transpose of the <rows> x <cols> matrix at <src> to <dst>; the
+// float version uses the blocked kernel.
+template <typename Real>
+static void transpose_copy(const Real* src, const MatrixIndexT src_stride,
+                           const MatrixIndexT rows, const MatrixIndexT cols,
+                           Real* dst, const MatrixIndexT dst_stride) {
+  for (MatrixIndexT c = 0; c < cols; ++c) {
+    for (MatrixIndexT r = 0; r < rows; ++r) {
+      dst[c * dst_stride + r] = src[r * src_stride + c];
+    }
+  }
+}
+
+static void transpose_copy(const float* src, const MatrixIndexT src_stride,
+                           const MatrixIndexT rows, const MatrixIndexT cols,
+                           float* dst, const MatrixIndexT dst_stride) {
+  float_kernel_transpose(src, src_stride, rows, cols, dst, dst_stride);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
-// MatrixBase class
+// MatrixBaseT class
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-bool MatrixBase::IsUnit(const float cutoff) const {
-  float abs_max = 0.0;
+template <typename Real>
+bool MatrixBaseT<Real>::IsUnit(const Real cutoff) const {
+  Real abs_max = 0.0;
   for (MatrixIndexT r = 0; r < num_rows_; ++r) {
     for (MatrixIndexT c = 0; c < num_cols_; ++c) {
-      float abs_diff = std::fabs((*this)(r, c) - (r == c ? 1.0 : 0.0));
+      Real abs_diff = std::fabs((*this)(r, c) - (r == c ? 1.0 : 0.0));
       abs_max = std::max(abs_max, abs_diff);
     }
   }
   return (abs_max <= cutoff);
 }
 
-bool MatrixBase::IsZero(const float cutoff) const {
-  float abs_max = 0.0;
+template <typename Real>
+bool MatrixBaseT<Real>::IsZero(const Real cutoff) const {
+  Real abs_max = 0.0;
   for (MatrixIndexT r = 0; r < num_rows_; ++r) {
     for (MatrixIndexT c = 0; c < num_cols_; ++c) {
       abs_max = std::max(abs_max, std::fabs((*this)(r, c)));
@@ -63,9 +100,10 @@ bool MatrixBase::IsZero(const float cutoff) const {
   return (abs_max <= cutoff);
 }
 
-bool MatrixBase::IsSymmetric(const float cutoff) const {
+template <typename Real>
+bool MatrixBaseT<Real>::IsSymmetric(const Real cutoff) const {
   if (num_rows_ != num_cols_) { return false; }
-  float abs_max = 0.0;
+  Real abs_max = 0.0;
   for (MatrixIndexT r = 0; r < num_rows_; ++r) {
     for (MatrixIndexT c = r + 1; c < num_cols_; ++c) {
       abs_max = std::max(abs_max, std::fabs((*this)(r, c) - (*this)(c, r)));
@@ -74,8 +112,9 @@ bool MatrixBase::IsSymmetric(const float cutoff) const {
   return (abs_max <= cutoff);
 }
 
-bool MatrixBase::IsDiagonal(const float cutoff) const {
-  float abs_max = 0.0;
+template <typename Real>
+bool MatrixBaseT<Real>::IsDiagonal(const Real cutoff) const {
+  Real abs_max = 0.0;
   for (MatrixIndexT r = 0; r < num_rows_; ++r) {
     for (MatrixIndexT c = 0; c != r && c < num_cols_; ++c) {
       abs_max = std::max(abs_max, std::fabs((*this)(r, c)));
@@ -84,7 +123,8 @@ bool MatrixBase::IsDiagonal(const float cutoff) const {
   return (abs_max <= cutoff);
 }
 
-void MatrixBase::Set(const float value) {
+template <typename Real>
+void MatrixBaseT<Real>::Set(const Real value) {
   for (MatrixIndexT r = 0; r < num_rows_; ++r) {
     for (MatrixIndexT c = 0; c < num_cols_; ++c) {
       (*this)(r, c) = value;
@@ -92,7 +132,8 @@ void MatrixBase::Set(const float value) {
   }
 }
 
-void MatrixBase::SetUnit() {
+template <typename Real>
+void MatrixBaseT<Real>::SetUnit() {
   for (MatrixIndexT r = 0; r < num_rows_; ++r) {
     for (MatrixIndexT c = 0; c < num_cols_; ++c) {
       if (r == c) {
@@ -104,7 +145,8 @@ void MatrixBase::SetUnit() {
   }
 }
 
-void MatrixBase::SetRandomGaussian() {
+template <typename Real>
+void MatrixBaseT<Real>::SetRandomGaussian() {
   for (MatrixIndexT r = 0; r < num_rows_; ++r) {
     for (MatrixIndexT c = 0; c < num_cols_; ++c) {
       (*this)(r, c) = RandomGaussian();
@@ -112,7 +154,8 @@ void MatrixBase::SetRandomGaussian() {
   }
 }
 
-void MatrixBase::SetRandomUniform() {
+template <typename Real>
+void MatrixBaseT<Real>::SetRandomUniform() {
   for (MatrixIndexT r = 0; r < num_rows_; ++r) {
     for (MatrixIndexT c = 0; c < num_cols_; ++c) {
       (*this)(r, c) = RandomUniform();
@@ -120,25 +163,43 @@ void MatrixBase::SetRandomUniform() {
   }
 }
 
-SubMatrix MatrixBase::Range(const MatrixIndexT row_offset,
-                            const MatrixIndexT num_rows,
-                            const MatrixIndexT col_offset,
-                            const MatrixIndexT num_cols) const {
-  return SubMatrix(*this, row_offset, num_rows, col_offset, num_cols);
+template <typename Real>
+SubMatrixT<Real> MatrixBaseT<Real>::Range(const MatrixIndexT row_offset,
+                                          const MatrixIndexT num_rows,
+                                          const MatrixIndexT col_offset,
+                                          const MatrixIndexT num_cols) const {
+  return SubMatrixT<Real>(*this, row_offset, num_rows, col_offset, num_cols);
 }
 
-SubMatrix MatrixBase::RowRange(const MatrixIndexT row_offset,
-                               const MatrixIndexT num_rows) const {
-  return SubMatrix(*this, row_offset, num_rows, 0, num_cols_);
+template <typename Real>
+SubMatrixT<Real> MatrixBaseT<Real>::RowRange(
+    const MatrixIndexT row_offset, const MatrixIndexT num_rows) const {
+  return SubMatrixT<Real>(*this, row_offset, num_rows, 0, num_cols_);
 }
 
-SubMatrix MatrixBase::ColRange(const MatrixIndexT col_offset,
-                               const MatrixIndexT num_cols) const {
-  return SubMatrix(*this, 0, num_rows_, col_offset, num_cols);
+template <typename Real>
+SubMatrixT<Real> MatrixBaseT<Real>::ColRange(
+    const MatrixIndexT col_offset, const MatrixIndexT num_cols) const {
+  return SubMatrixT<Real>(*this, 0, num_rows_, col_offset, num_cols);
 }
 
-void MatrixBase::CopyFromMat(const MatrixBase& mat,
-                             const MatrixTransposeType trans_type) {
+template <typename Real>
+SubMatrixT<Real> MatrixBaseT<Real>::SpliceRows(
+    const MatrixIndexT row_offset, const MatrixIndexT num_rows,
+    const MatrixIndexT num_splice) const {
+  SNOWBOY_ASSERT(row_offset >= 0 && num_rows >= 0 && num_splice > 0);
+  SNOWBOY_ASSERT(row_offset + num_rows + num_splice - 1 <= num_rows_);
+  if (stride_ != num_cols_ && num_splice > 1) {
+    SNOWBOY_ERROR << "Fail to splice rows: rows are not contiguous, stride is "
+        << stride_ << ", number of columns is " << num_cols_;
+  }
+  return SubMatrixT<Real>(data_ + row_offset * stride_,
+                   num_rows, num_splice * num_cols_, stride_);
+}
+
+template <typename Real>
+void MatrixBaseT<Real>::CopyFromMat(const MatrixBaseT<Real>& mat,
+                                    const MatrixTransposeType trans_type) {
   if ((void*)(&mat) == (void*)this) {
     return;
   }
@@ -149,27 +210,43 @@ void MatrixBase::CopyFromMat(const MatrixBase& mat,
     }
   } else {
     SNOWBOY_ASSERT(num_cols_ == mat.NumRows() && num_rows_ == mat.NumCols());
-    for (MatrixIndexT r = 0; r < num_rows_; ++r) {
-      for (MatrixIndexT c = 0; c < num_cols_; ++c) {
-        data_[r * stride_ + c] = mat(c, r);
-      }
-    }
+    transpose_copy(mat.Data(), mat.Stride(), mat.NumRows(), mat.NumCols(),
+                   data_, stride_);
+  }
+}
+
+template <typename Real>
+void MatrixBaseT<Real>::CopyFromMat(const MatrixBase& mat, const float scale) {
+  SNOWBOY_ASSERT(num_rows_ == mat.NumRows() && num_cols_ == mat.NumCols());
+  for (MatrixIndexT r = 0; r < num_rows_; ++r) {
+    Row(r).CopyFromVec(mat.Row(r), scale);
+  }
+}
+
+template <typename Real>
+void MatrixBaseT<Real>::CopyToMat(const float scale, MatrixBase* mat) const {
+  SNOWBOY_ASSERT(mat != NULL);
+  SNOWBOY_ASSERT(num_rows_ == mat->NumRows() && num_cols_ == mat->NumCols());
+  for (MatrixIndexT r = 0; r < num_rows_; ++r) {
+    SubVector row(*mat, r);
+    Row(r).CopyToVec(scale, &row);
   }
 }
 
-void MatrixBase::CopyRowsFromVec(const VectorBase& vec) {
+template <typename Real>
+void MatrixBaseT<Real>::CopyRowsFromVec(const VectorBaseT<Real>& vec) {
   if (vec.Dim() == num_rows_ * num_cols_) {
     if (stride_ == num_cols_) {
-      std::memcpy(data_, vec.Data(), sizeof(float) * vec.Dim());
+      std::memcpy(data_, vec.Data(), sizeof(Real) * vec.Dim());
     } else {
       for (MatrixIndexT r = 0; r < num_rows_; ++r) {
         std::memcpy(RowData(r),
-                    vec.Data() + r * num_cols_, sizeof(float) * num_cols_);
+                    vec.Data() + r * num_cols_, sizeof(Real) * num_cols_);
       }
     }
   } else if (vec.Dim() == num_cols_) {
     for (MatrixIndexT r = 0; r < num_rows_; ++r) {
-      std::memcpy(RowData(r), vec.Data(), sizeof(float) * num_cols_);
+      std::memcpy(RowData(r), vec.Data(), sizeof(Real) * num_cols_);
     }
   } else {
     SNOWBOY_ERROR << "Vector size should be NumRows() * NumCols() or "
@@ -178,12 +255,15 @@ void MatrixBase::CopyRowsFromVec(const VectorBase& vec) {
   }
 }
 
-void MatrixBase::CopyRowFromVec(const VectorBase& vec, const MatrixIndexT row) {
+template <typename Real>
+void MatrixBaseT<Real>::CopyRowFromVec(const VectorBaseT<Real>& vec,
+                                       const MatrixIndexT row) {
   SNOWBOY_ASSERT(vec.Dim() == num_cols_ && row < num_rows_ && row >= 0);
-  std::memcpy(RowData(row), vec.Data(), sizeof(float) * num_cols_);
+  std::memcpy(RowData(row), vec.Data(), sizeof(Real) * num_cols_);
 }
 
-void MatrixBase::CopyColsFromVec(const VectorBase& vec) {
+template <typename Real>
+void MatrixBaseT<Real>::CopyColsFromVec(const VectorBaseT<Real>& vec) {
   if (vec.Dim() == num_rows_ * num_cols_) {
     for (MatrixIndexT r = 0; r < num_rows_; ++r) {
       for (MatrixIndexT c = 0; c < num_cols_; ++c) {
@@ -201,61 +281,90 @@ void MatrixBase::CopyColsFromVec(const VectorBase& vec) {
   }
 }
 
-void MatrixBase::CopyColFromVec(const VectorBase& vec, const MatrixIndexT col) {
+template <typename Real>
+void MatrixBaseT<Real>::CopyColFromVec(const VectorBaseT<Real>& vec,
+                                       const MatrixIndexT col) {
   SNOWBOY_ASSERT(vec.Dim() == num_rows_ && col < num_cols_ && col >= 0);
   for (MatrixIndexT r = 0; r < num_rows_; ++r) {
     data_[r * stride_ + col] = vec(r);
   }
 }
 
-void MatrixBase::CopyDiagFromVec(const VectorBase& vec) {
+template <typename Real>
+void MatrixBaseT<Real>::CopyDiagFromVec(const VectorBaseT<Real>& vec) {
   SNOWBOY_ASSERT(vec.Dim() == std::min(num_cols_, num_rows_));
   for (MatrixIndexT d = 0; d < vec.Dim(); ++d) {
     data_[d * stride_ + d] = vec(d);
   }
 }
 
-void MatrixBase::CopyCols(const MatrixBase& mat,
-                          const std::vector<MatrixIndexT>& indices) {
+template <typename Real>
+void MatrixBaseT<Real>::CopyCols(const MatrixBaseT<Real>& mat,
+                                 const std::vector<MatrixIndexT>& indices) {
   SNOWBOY_ASSERT(num_rows_ == mat.NumRows());
   SNOWBOY_ASSERT(num_cols_ == static_cast<MatrixIndexT>(indices.size()));
 
-  for (MatrixIndexT r = 0; r < num_rows_; ++r) {
-    for (MatrixIndexT c = 0; c < num_cols_; ++c) {
-      SNOWBOY_ASSERT(indices[c] >= -1 && indices[c] < mat.NumCols());
-      data_[r * stride_ + c] = (indices[c] == -1) ? 0.0 : mat(r, indices[c]);
+  ParallelFor(0, num_rows_, ParallelGrain(num_cols_),
+              [&](MatrixIndexT row_begin, MatrixIndexT row_end) {
+    for (MatrixIndexT r = row_begin; r < row_end; ++r) {
+      for (MatrixIndexT c = 0; c < num_cols_; ++c) {
+        SNOWBOY_ASSERT(indices[c] >= -1 && indices[c] < mat.NumCols());
+        data_[r * stride_ + c] = (indices[c] == -1) ? 0.0 : mat(r, indices[c]);
+      }
     }
-  }
+  });
 }
 
-void MatrixBase::CopyRows(const MatrixBase& mat,
-                          const std::vector<MatrixIndexT>& indices) {
+template <typename Real>
+void MatrixBaseT<Real>::CopyRows(const MatrixBaseT<Real>& mat,
+                                 const std::vector<MatrixIndexT>& indices) {
   SNOWBOY_ASSERT(num_cols_ == mat.NumCols());
   SNOWBOY_ASSERT(num_rows_ == static_cast<MatrixIndexT>(indices.size()));
 
-  for (MatrixIndexT r = 0; r < num_rows_; ++r) {
-    SNOWBOY_ASSERT(indices[r] >= -1 && indices[r] < mat.NumRows());
-    if (indices[r] == -1) {
-      memset(data_ + r * stride_, 0, sizeof(float) * num_cols_);
-    } else {
-      memcpy(data_ + r * stride_,
-             mat.RowData(indices[r]), sizeof(float) * num_cols_);
+  ParallelFor(0, num_rows_, ParallelGrain(num_cols_),
+              [&](MatrixIndexT row_begin, MatrixIndexT row_end) {
+    for (MatrixIndexT r = row_begin; r < row_end; ++r) {
+      SNOWBOY_ASSERT(indices[r] >= -1 && indices[r] < mat.NumRows());
+      if (indices[r] == -1) {
+        memset(data_ + r * stride_, 0, sizeof(Real) * num_cols_);
+      } else {
+        memcpy(data_ + r * stride_,
+               mat.RowData(indices[r]), sizeof(Real) * num_cols_);
+      }
     }
-  }
+  });
 }
 
-void MatrixBase::Transpose() {
+template <typename Real>
+void MatrixBaseT<Real>::Transpose() {
   SNOWBOY_ASSERT(num_rows_ == num_cols_);
-  for (MatrixIndexT r = 0; r < num_rows_; ++r) {
-    for (MatrixIndexT c = 0; c < r; ++c) {
-      float& a = (*this)(r, c);
-      float& b = (*this)(c, r);
-      std::swap(a, b);
+  // Works on pairs of blocks (r, c) and (c, r), going through a small buffer on
+  // the stack.
+  const MatrixIndexT block = 32;
+  Real buffer[block * block];
+  for (MatrixIndexT r = 0; r < num_rows_; r += block) {
+    MatrixIndexT rows = std::min(block, num_rows_ - r);
+    Real* diag = data_ + r * stride_ + r;
+    float_kernel_transpose(diag, stride_, rows, rows, buffer, block);
+    for (MatrixIndexT i = 0; i < rows; ++i) {
+      std::memcpy(diag + i * stride_, buffer + i * block, sizeof(Real) * rows);
+    }
+    for (MatrixIndexT c = r + block; c < num_cols_; c += block) {
+      MatrixIndexT cols = std::min(block, num_cols_ - c);
+      Real* upper = data_ + r * stride_ + c;
+      Real* lower = data_ + c * stride_ + r;
+      float_kernel_transpose(upper, stride_, rows, cols, buffer, block);
+      float_kernel_transpose(lower, stride_, cols, rows, upper, stride_);
+      for (MatrixIndexT i = 0; i < cols; ++i) {
+        std::memcpy(lower + i * stride_,
+                    buffer + i * block, sizeof(Real) * rows);
+      }
     }
   }
 }
 
-void MatrixBase::Scale(const float alpha) {
+template <typename Real>
+void MatrixBaseT<Real>::Scale(const Real alpha) {
   if (alpha == 1.0 || num_rows_ == 0 || num_cols_ == 0) {
     return;
   }
@@ -263,15 +372,16 @@ void MatrixBase::Scale(const float alpha) {
     cblas_sscal(static_cast<size_t>(num_rows_) * static_cast<size_t>(num_cols_),
                 alpha, data_, 1);
   } else {
-    float* this_data = data_;
+    Real* this_data = data_;
     for (MatrixIndexT i = 0; i < num_rows_; ++i, this_data += stride_) {
       cblas_sscal(static_cast<size_t>(num_cols_), alpha, this_data, 1);
     }
   }
 }
 
-void MatrixBase::AddMat(const float alpha, const MatrixBase& M,
-                        const MatrixTransposeType trans_type) {
+template <typename Real>
+void MatrixBaseT<Real>::AddMat(const Real alpha, const MatrixBaseT<Real>& M,
+                               const MatrixTransposeType trans_type) {
   if (trans_type == kNoTrans) {
     SNOWBOY_ASSERT(num_rows_ == M.NumRows() && num_cols_ == M.NumCols());
   } else {
@@ -289,9 +399,9 @@ void MatrixBase::AddMat(const float alpha, const MatrixBase& M,
       if (alpha == 1.0) {
         for (MatrixIndexT row = 0; row < num_rows_; ++row) {
           for (MatrixIndexT col = 0; col < row; ++col) {
-            float* lower = data_ + (row * stride_) + col;
-            float* upper = data_ + (col * stride_) + row;
-            float sum = *lower + *upper;
+            Real* lower = data_ + (row * stride_) + col;
+            Real* upper = data_ + (col * stride_) + row;
+            Real sum = *lower + *upper;
             *lower = *upper = sum;
           }
           *(data_ + (row * stride_) + row) *= 2.0;
@@ -299,9 +409,9 @@ void MatrixBase::AddMat(const float alpha, const MatrixBase& M,
       } else {
         for (MatrixIndexT row = 0; row < num_rows_; ++row) {
           for (MatrixIndexT col = 0; col < row; ++col) {
-            float* lower = data_ + (row * stride_) + col;
-            float* upper = data_ + (col * stride_) + row;
-            float lower_tmp = *lower;
+            Real* lower = data_ + (row * stride_) + col;
+            Real* upper = data_ + (col * stride_) + row;
+            Real lower_tmp = *lower;
             *lower += alpha * *upper;
             *upper += alpha * lower_tmp;
           }
@@ -310,8 +420,8 @@ void MatrixBase::AddMat(const float alpha, const MatrixBase& M,
       }
     }
   } else {
-    float* m_data = M.data_;
-    float* this_data = data_;
+    Real* m_data = M.data_;
+    Real* this_data = data_;
     if (trans_type == kNoTrans) {
       for (MatrixIndexT row = 0; row < num_rows_;
            ++row, m_data += M.stride_, this_data += stride_) {
@@ -325,12 +435,23 @@ void MatrixBase::AddMat(const float alpha, const MatrixBase& M,
   }
 }
 
-void MatrixBase::AddMatMat(const float alpha,
-                           const MatrixBase& mat1,
-                           const MatrixTransposeType trans_mat1,
-                           const MatrixBase& mat2,
-                           const MatrixTransposeType trans_mat2,
-                           const float beta) {
+template <typename Real>
+void MatrixBaseT<Real>::AddMatMat(const Real alpha,
+                                  const MatrixBaseT<Real>& mat1,
+                                  const MatrixTransposeType trans_mat1,
+                                  const MatrixBaseT<Real>& mat2,
+                                  const MatrixTransposeType trans_mat2,
+                                  const Real beta) {
+  SNOWBOY_PERF_SCOPE("AddMatMat", num_rows_,
+                     trans_mat1 == kNoTrans ? mat1.NumCols() : mat1.NumRows(),
+                     num_cols_);
+  SNOWBOY_TRACE_SCOPE("AddMatMat", num_rows_,
+                      trans_mat1 == kNoTrans ? mat1.NumCols() : mat1.NumRows(),
+                      num_cols_,
+                      sizeof(Real)
+                      * (static_cast<int64>(mat1.NumRows()) * mat1.NumCols()
+                         + static_cast<int64>(mat2.NumRows()) * mat2.NumCols()
+                         + static_cast<int64>(num_rows_) * num_cols_));
   SNOWBOY_ASSERT((trans_mat1 == kNoTrans && trans_mat2 == kNoTrans
                   && mat1.NumCols() == mat2.NumRows()
                   && mat1.NumRows() == num_rows_
@@ -348,6 +469,10 @@ void MatrixBase::AddMatMat(const float alpha,
                      && mat1.NumCols() == num_rows_
                      && mat2.NumRows() == num_cols_));
   SNOWBOY_ASSERT(&mat1 != this && &mat2 != this);
+  if (mat1.Stride() < mat1.NumCols() || mat2.Stride() < mat2.NumCols()) {
+    AddMatMatOverlapped(alpha, mat1, trans_mat1, mat2, trans_mat2, beta);
+    return;
+  }
   cblas_sgemm(CblasRowMajor,
               static_cast<CBLAS_TRANSPOSE>(trans_mat1),
               static_cast<CBLAS_TRANSPOSE>(trans_mat2),
@@ -357,101 +482,256 @@ void MatrixBase::AddMatMat(const float alpha,
               mat2.Data(), mat2.Stride(), beta, data_, stride_);
 }
 
-void MatrixBase::MatMatRaw(const MatrixBase& mat1,
-                           const MatrixBase& mat2) {
+template <typename Real>
+void MatrixBaseT<Real>::AddMatMatBiasAct(const Real alpha,
+                                         const MatrixBaseT<Real>& mat1,
+                                         const MatrixTransposeType trans_mat1,
+                                         const MatrixBaseT<Real>& mat2,
+                                         const MatrixTransposeType trans_mat2,
+                                         const VectorBaseT<Real>& bias,
+                                         const MatrixActivationType act,
+                                         const Real ceil) {
+  SNOWBOY_ASSERT(bias.Dim() == num_cols_);
+  SNOWBOY_ASSERT(num_rows_ == (trans_mat1 == kNoTrans ? mat1.NumRows()
+                                                      : mat1.NumCols()));
+  if (num_rows_ == 0 || num_cols_ == 0) {
+    return;
+  }
+
+  // Each panel of the output is about 32KB, so that it is still in L1/L2 when
+  // the epilogue runs.
+  const size_t panel_bytes = 32768;
+  MatrixIndexT panel_rows = std::max<MatrixIndexT>(
+      4, panel_bytes / (sizeof(Real) * static_cast<size_t>(num_cols_)));
+  for (MatrixIndexT r = 0; r < num_rows_; r += panel_rows) {
+    MatrixIndexT rows = std::min(panel_rows, num_rows_ - r);
+    SubMatrixT<Real> panel(RowRange(r, rows));
+    SubMatrixT<Real> panel_mat1(trans_mat1 == kNoTrans ? mat1.RowRange(r, rows)
+                                                : mat1.ColRange(r, rows));
+    panel.AddMatMat(alpha, panel_mat1, trans_mat1, mat2, trans_mat2, 0.0f);
+    for (MatrixIndexT i = 0; i < rows; ++i) {
+      float_kernel_bias_act(panel.RowData(i), bias.Data(), num_cols_, act,
+                            ceil);
+    }
+  }
+}
+
+template <typename Real>
+void MatrixBaseT<Real>::AddMatMatOverlapped(
+    const Real alpha,
+    const MatrixBaseT<Real>& mat1, const MatrixTransposeType trans_mat1,
+    const MatrixBaseT<Real>& mat2, const MatrixTransposeType trans_mat2,
+    const Real beta) {
+  // We split only one operand at a time; AddMatMat() takes care of the other
+  // one if it overlaps as well.
+  const bool split_mat1 = mat1.Stride() < mat1.NumCols();
+  const MatrixBaseT<Real>& mat = split_mat1 ? mat1 : mat2;
+  const MatrixTransposeType trans = split_mat1 ? trans_mat1 : trans_mat2;
+  const MatrixIndexT step = mat.Stride();
+  if (step <= 0) {
+    // A view with stride 0, e.g. a single row, or one repeated, has no blocks
+    // of whole strides to split into, so it goes through a dense copy.
+    MatrixT<Real> dense(mat);
+    if (split_mat1) {
+      AddMatMat(alpha, dense, trans_mat1, mat2, trans_mat2, beta);
+    } else {
+      AddMatMat(alpha, mat1, trans_mat1, dense, trans_mat2, beta);
+    }
+    return;
+  }
+
+  for (MatrixIndexT offset = 0; offset < mat.NumCols(); offset += step) {
+    MatrixIndexT width = std::min(step, mat.NumCols() - offset);
+    SubMatrixT<Real> block(mat.ColRange(offset, width));
+    if (split_mat1 && trans == kTrans) {
+      // Columns of <mat1> index the rows of the output.
+      RowRange(offset, width).AddMatMat(alpha, block, kTrans,
+                                        mat2, trans_mat2, beta);
+    } else if (!split_mat1 && trans == kNoTrans) {
+      // Columns of <mat2> index the columns of the output.
+      ColRange(offset, width).AddMatMat(alpha, mat1, trans_mat1,
+                                        block, kNoTrans, beta);
+    } else if (split_mat1) {
+      // Columns of <mat1> index the inner dimension.
+      SubMatrixT<Real> other(trans_mat2 == kNoTrans
+                             ? mat2.RowRange(offset, width)
+                             : mat2.ColRange(offset, width));
+      AddMatMat(alpha, block, kNoTrans, other, trans_mat2,
+                offset == 0 ? beta : 1.0f);
+    } else {
+      // Columns of <mat2> index the inner dimension.
+      SubMatrixT<Real> other(trans_mat1 == kNoTrans
+                             ? mat1.ColRange(offset, width)
+                             : mat1.RowRange(offset, width));
+      AddMatMat(alpha, other, trans_mat1, block, kTrans,
+                offset == 0 ? beta : 1.0f);
+    }
+  }
+}
+
+template <typename Real>
+void MatrixBaseT<Real>::MatMatRaw(const MatrixBaseT<Real>& mat1,
+                                  const MatrixBaseT<Real>& mat2) {
+  SNOWBOY_PERF_SCOPE("MatMatRaw", num_rows_, mat1.NumCols(), num_cols_);
+  SNOWBOY_TRACE_SCOPE("MatMatRaw", num_rows_, mat1.NumCols(), num_cols_,
+                      sizeof(Real)
+                      * (static_cast<int64>(mat1.NumRows()) * mat1.NumCols()
+                         + static_cast<int64>(mat2.NumRows()) * mat2.NumCols()
+                         + static_cast<int64>(num_rows_) * num_cols_));
   SNOWBOY_ASSERT(mat1.NumCols() == mat2.NumCols() &&
       mat1.NumRows() == num_rows_ &&
       mat2.NumRows() == num_cols_);
   SNOWBOY_ASSERT(&mat1 != this && &mat2 != this);
-  for (MatrixIndexT r = 0; r < num_rows_; ++r) {
-    for (MatrixIndexT c = 0; c < num_cols_; ++c) {
-      float rt = 0;
-      for (MatrixIndexT k = 0; k < mat1.NumCols(); ++k) {
-        rt += mat1(r,k) * mat2(c,k);
+  ParallelFor(0, num_rows_,
+              ParallelGrain(static_cast<int64>(num_cols_) * mat1.NumCols()),
+              [&](MatrixIndexT row_begin, MatrixIndexT row_end) {
+    for (MatrixIndexT r = row_begin; r < row_end; ++r) {
+      for (MatrixIndexT c = 0; c < num_cols_; ++c) {
+        Real rt = 0;
+        for (MatrixIndexT k = 0; k < mat1.NumCols(); ++k) {
+          rt += mat1(r,k) * mat2(c,k);
+        }
+        data_[r * stride_ + c] = rt;
       }
-      data_[r * stride_ + c] = rt;
     }
-  }
+  });
 }
 
-void MatrixBase::AddVecVec(const float alpha,
-                           const VectorBase& vec1, const VectorBase& vec2) {
+template <typename Real>
+void MatrixBaseT<Real>::AddVecVec(const Real alpha,
+                                  const VectorBaseT<Real>& vec1,
+                                  const VectorBaseT<Real>& vec2) {
   SNOWBOY_ASSERT(num_rows_ == vec1.Dim() && num_cols_ == vec2.Dim());
   cblas_sger(CblasRowMajor, vec1.Dim(), vec2.Dim(),
              alpha, vec1.Data(), 1, vec2.Data(), 1, data_, stride_);
 }
 
-void MatrixBase::AddVecToRows(const float alpha, const VectorBase& vec) {
+template <typename Real>
+void MatrixBaseT<Real>::AddVecToRows(const Real alpha,
+                                     const VectorBaseT<Real>& vec) {
   SNOWBOY_ASSERT(num_cols_ == vec.Dim());
+  SNOWBOY_TRACE_SCOPE("AddVecToRows", num_rows_, 0, num_cols_,
+                      sizeof(Real) * (2 * static_cast<int64>(num_rows_) + 1)
+                      * num_cols_);
   if (num_cols_ <= 64) {
-    float* data = data_;
-    const float* vec_data = vec.Data();
+    Real* data = data_;
+    const Real* vec_data = vec.Data();
     for (MatrixIndexT r = 0; r < num_rows_; ++r, data += stride_) {
       for (MatrixIndexT c = 0; c < num_cols_; ++c) {
         data[c] += alpha * vec_data[c];
       }
     }
   } else {
-    Vector ones(num_rows_);
-    ones.Set(1.0);
-    AddVecVec(alpha, ones, vec);
+    // One axpy per row rather than a rank-1 update with a vector of ones,
+    // which would allocate on every call.
+    for (MatrixIndexT r = 0; r < num_rows_; ++r) {
+      cblas_saxpy(num_cols_, alpha, vec.Data(), 1, RowData(r), 1);
+    }
   }
 }
 
-void MatrixBase::ApplyFloor(const float floor) {
-  for (MatrixIndexT i = 0; i < num_rows_; ++i) {
-    float* data = RowData(i);
-    for (MatrixIndexT j = 0; j < num_cols_; ++j) {
-      data[j] = (data[j] < floor ? floor : data[j]);
+template <typename Real>
+void MatrixBaseT<Real>::ApplyFloor(const Real floor) {
+  SNOWBOY_TRACE_SCOPE("ApplyFloor", num_rows_, 0, num_cols_,
+                      2 * sizeof(Real) * num_rows_ * num_cols_);
+  ParallelFor(0, num_rows_, ParallelGrain(num_cols_),
+              [&](MatrixIndexT row_begin, MatrixIndexT row_end) {
+    for (MatrixIndexT i = row_begin; i < row_end; ++i) {
+      Real* data = RowData(i);
+      for (MatrixIndexT j = 0; j < num_cols_; ++j) {
+        data[j] = (data[j] < floor ? floor : data[j]);
+      }
     }
-  }
+  });
 }
 
-void MatrixBase::ApplyCeiling(const float ceil) {
-  for (MatrixIndexT i = 0; i < num_rows_; ++i) {
-    float* data = RowData(i);
-    for (MatrixIndexT j = 0; j < num_cols_; ++j) {
-      data[j] = (data[j] > ceil ? ceil : data[j]);
+template <typename Real>
+void MatrixBaseT<Real>::ApplyCeiling(const Real ceil) {
+  SNOWBOY_TRACE_SCOPE("ApplyCeiling", num_rows_, 0, num_cols_,
+                      2 * sizeof(Real) * num_rows_ * num_cols_);
+  ParallelFor(0, num_rows_, ParallelGrain(num_cols_),
+              [&](MatrixIndexT row_begin, MatrixIndexT row_end) {
+    for (MatrixIndexT i = row_begin; i < row_end; ++i) {
+      Real* data = RowData(i);
+      for (MatrixIndexT j = 0; j < num_cols_; ++j) {
+        data[j] = (data[j] > ceil ? ceil : data[j]);
+      }
     }
-  }
+  });
 }
 
-void MatrixBase::ApplyRange(const float floor, const float ceil) {
-  for (MatrixIndexT i = 0; i < num_rows_; ++i) {
-    float* data = RowData(i);
-    for (MatrixIndexT j = 0; j < num_cols_; ++j) {
-      if (data[j] > ceil)
-        data[j] = ceil;
-      else if(data[j] < floor)
-        data[j] = floor;
+template <typename Real>
+void MatrixBaseT<Real>::ApplyRange(const Real floor, const Real ceil) {
+  SNOWBOY_TRACE_SCOPE("ApplyRange", num_rows_, 0, num_cols_,
+                      2 * sizeof(Real) * num_rows_ * num_cols_);
+  ParallelFor(0, num_rows_, ParallelGrain(num_cols_),
+              [&](MatrixIndexT row_begin, MatrixIndexT row_end) {
+    for (MatrixIndexT i = row_begin; i < row_end; ++i) {
+      Real* data = RowData(i);
+      for (MatrixIndexT j = 0; j < num_cols_; ++j) {
+        if (data[j] > ceil)
+          data[j] = ceil;
+        else if(data[j] < floor)
+          data[j] = floor;
+      }
     }
-  }
+  });
 }
 
-void MatrixBase::MulColsVec(const VectorBase& scale) {
+template <typename Real>
+void MatrixBaseT<Real>::ApplySoftmaxPerRow() {
+  SNOWBOY_TRACE_SCOPE("ApplySoftmaxPerRow", num_rows_, 0, num_cols_,
+                      2 * sizeof(Real) * num_rows_ * num_cols_);
+  ParallelFor(0, num_rows_, ParallelGrain(num_cols_),
+              [&](MatrixIndexT row_begin, MatrixIndexT row_end) {
+    for (MatrixIndexT r = row_begin; r < row_end; ++r) {
+      Real* data = RowData(r);
+      float_kernel_softmax(data, data, num_cols_);
+    }
+  });
+}
+
+template <typename Real>
+void MatrixBaseT<Real>::ApplyLogSoftmaxPerRow() {
+  SNOWBOY_TRACE_SCOPE("ApplyLogSoftmaxPerRow", num_rows_, 0, num_cols_,
+                      2 * sizeof(Real) * num_rows_ * num_cols_);
+  ParallelFor(0, num_rows_, ParallelGrain(num_cols_),
+              [&](MatrixIndexT row_begin, MatrixIndexT row_end) {
+    for (MatrixIndexT r = row_begin; r < row_end; ++r) {
+      Real* data = RowData(r);
+      float_kernel_log_softmax(data, data, num_cols_);
+    }
+  });
+}
+
+template <typename Real>
+void MatrixBaseT<Real>::MulColsVec(const VectorBaseT<Real>& scale) {
   SNOWBOY_ASSERT(scale.Dim() == num_cols_);
   for (MatrixIndexT c = 0; c < num_cols_; ++c) {
-    float scalar = scale(c);
+    Real scalar = scale(c);
     for (MatrixIndexT r = 0; r < num_rows_; ++r) {
       (*this)(r, c) *= scalar;
     }
   }
 }
 
-void MatrixBase::MulRowsVec(const VectorBase& scale) {
+template <typename Real>
+void MatrixBaseT<Real>::MulRowsVec(const VectorBaseT<Real>& scale) {
   SNOWBOY_ASSERT(scale.Dim() == num_rows_);
   for (MatrixIndexT r = 0; r < num_rows_; r++) {
-    float scalar = scale(r);
+    Real scalar = scale(r);
     for (MatrixIndexT c = 0; c < num_cols_; c++) {
       (*this)(r, c) *= scalar;
     }
   }
 }
 
-void MatrixBase::Read(const bool binary, const bool add, std::istream* is) {
+template <typename Real>
+void MatrixBaseT<Real>::Read(const bool binary, const bool add,
+                             std::istream* is) {
   SNOWBOY_ASSERT(is != NULL);
-  Matrix tmp(num_rows_, num_cols_);
-  tmp.Read(binary, false, is);
+  MatrixT<Real> tmp(num_rows_, num_cols_);
+  tmp.Read(binary, is);
   if (tmp.NumRows() != num_rows_ || tmp.NumCols() != num_cols_) {
     SNOWBOY_ERROR << "Fail to read Matrix: size mismatch "
         << num_rows_ << " x " << num_cols_ << " v.s. "
@@ -464,18 +744,27 @@ void MatrixBase::Read(const bool binary, const bool add, std::istream* is) {
   }
 }
 
-void MatrixBase::Read(const bool binary, std::istream* is) {
+template <typename Real>
+void MatrixBaseT<Real>::Read(const bool binary, std::istream* is) {
   SNOWBOY_ASSERT(is != NULL);
-  Read(binary, false, is);
+  MatrixT<Real> tmp(num_rows_, num_cols_);
+  tmp.Read(binary, is);
+  if (tmp.NumRows() != num_rows_ || tmp.NumCols() != num_cols_) {
+    SNOWBOY_ERROR << "Fail to read Matrix: size mismatch "
+        << num_rows_ << " x " << num_cols_ << " v.s. "
+        << tmp.NumRows() << " x " << tmp.NumCols();
+  }
+  CopyFromMat(tmp);
 }
 
-void MatrixBase::Write(const bool binary, std::ostream* os) const {
+template <typename Real>
+void MatrixBaseT<Real>::Write(const bool binary, std::ostream* os) const {
   SNOWBOY_ASSERT(os != NULL);
   if (!os->good()) {
     SNOWBOY_ERROR << "Fail to write Matrix to stream.";
   }
   if (binary) {
-    WriteToken(binary, "FM", os);   // We only write float value.
+    WriteToken(binary, matrix_token<Real>(), os);
     int32 rows = num_rows_;         // 32-bit on disk.
     int32 cols = num_cols_;         // 32-bit on disk
     SNOWBOY_ASSERT(num_rows_ == (MatrixIndexT)(rows));
@@ -484,12 +773,12 @@ void MatrixBase::Write(const bool binary, std::ostream* os) const {
     WriteBasicType(binary, cols, os);
     if (Stride() == NumCols()) {
       os->write(reinterpret_cast<const char*>(Data()),
-                sizeof(float) * static_cast<size_t>(num_rows_)
+                sizeof(Real) * static_cast<size_t>(num_rows_)
                 * static_cast<size_t>(num_cols_));
     } else {
       for (MatrixIndexT i = 0; i < num_rows_; ++i) {
         os->write(reinterpret_cast<const char*>(RowData(i)),
-                  sizeof(float) * static_cast<size_t>(num_cols_));
+                  sizeof(Real) * static_cast<size_t>(num_cols_));
       }
     }
   } else {
@@ -512,17 +801,18 @@ void MatrixBase::Write(const bool binary, std::ostream* os) const {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Matrix class
+// MatrixT class
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-void Matrix::Resize(const MatrixIndexT rows,
-                    const MatrixIndexT cols,
-                    const MatrixResizeType resize_type) {
+template <typename Real>
+void MatrixT<Real>::Resize(const MatrixIndexT rows,
+                           const MatrixIndexT cols,
+                           const MatrixResizeType resize_type) {
   // First, checks if the current dimension satisfies the requested one.
-  if (num_rows_ == rows && num_cols_ == cols) {
+  if (this->num_rows_ == rows && this->num_cols_ == cols) {
     if (resize_type == kSetZero) {
-      Set(0);
+      this->Set(0);
     }
     return;
   }
@@ -531,152 +821,197 @@ void Matrix::Resize(const MatrixIndexT rows,
 
   // Second, handles the kCopyData case.
   if (local_resize_type == kCopyData) {
-    if (data_ == NULL || num_rows_ == 0 || num_cols_ == 0) {
+    if (this->data_ == NULL || this->num_rows_ == 0 || this->num_cols_ == 0) {
       local_resize_type = kSetZero;
     } else {
       MatrixResizeType new_resize_type =
-          (rows > num_rows_ || cols > num_cols_) ? kSetZero : kUndefined;
-      Matrix tmp(rows, cols, new_resize_type);
-      MatrixIndexT rows_min = std::min(rows, num_rows_);
-      MatrixIndexT cols_min = std::min(cols, num_cols_);
+          (rows > this->num_rows_ || cols > this->num_cols_)
+          ? kSetZero : kUndefined;
+      MatrixT<Real> tmp(rows, cols, new_resize_type);
+      MatrixIndexT rows_min = std::min(rows, this->num_rows_);
+      MatrixIndexT cols_min = std::min(cols, this->num_cols_);
       tmp.Range(0, rows_min, 0, cols_min).
-          CopyFromMat(Range(0, rows_min, 0, cols_min));
+          CopyFromMat(this->Range(0, rows_min, 0, cols_min));
       tmp.Swap(this);
       return;
     }
   }
 
   // Now, resize type is either kSetZero or kUndefined.
-  if (data_ != NULL) {
+  if (this->data_ != NULL) {
     ReleaseMatrixMemory();
   }
   AllocateMatrixMemory(rows, cols);
   if (local_resize_type == kSetZero) {
-    Set(0);
+    this->Set(0);
   }
 }
 
-void Matrix::Swap(Matrix* other) {
-  std::swap(num_cols_, other->num_cols_);
-  std::swap(num_rows_, other->num_rows_);
-  std::swap(stride_, other->stride_);
-  std::swap(data_, other->data_);
+template <typename Real>
+void MatrixT<Real>::Swap(MatrixT<Real>* other) {
+  std::swap(this->num_cols_, other->num_cols_);
+  std::swap(this->num_rows_, other->num_rows_);
+  std::swap(this->stride_, other->stride_);
+  std::swap(this->data_, other->data_);
 }
 
-void Matrix::RemoveRow(MatrixIndexT row) {
-  SNOWBOY_ASSERT(row >=0 && row < num_rows_);
-  for (MatrixIndexT r = row + 1; r < num_rows_; ++r) {
-    Row(r - 1).CopyFromVec(Row(r));
+template <typename Real>
+void MatrixT<Real>::RemoveRow(MatrixIndexT row) {
+  SNOWBOY_ASSERT(row >=0 && row < this->num_rows_);
+  for (MatrixIndexT r = row + 1; r < this->num_rows_; ++r) {
+    this->Row(r - 1).CopyFromVec(this->Row(r));
   }
-  num_rows_--;
+  this->num_rows_--;
 }
 
-void Matrix::Append(const MatrixBase &mat) {
-  MatrixIndexT old_num_rows_ = num_rows_;
+template <typename Real>
+void MatrixT<Real>::Append(const MatrixBaseT<Real> &mat) {
+  MatrixIndexT old_num_rows_ = this->num_rows_;
   Resize(old_num_rows_ + mat.NumRows(), mat.NumCols(), kCopyData);
-  RowRange(old_num_rows_, mat.NumRows()).CopyFromMat(mat);
+  this->RowRange(old_num_rows_, mat.NumRows()).CopyFromMat(mat);
 }
 
-void Matrix::Transpose() {
-  if (num_rows_ != num_cols_) {
-    Matrix tmp(*this, kTrans);
-    Resize(num_cols_, num_rows_, kUndefined);
-    CopyFromMat(tmp);
+template <typename Real>
+void MatrixT<Real>::Transpose() {
+  if (this->num_rows_ == this->num_cols_) {
+    (static_cast<MatrixBaseT<Real>&>(*this)).Transpose();
+    return;
+  }
+
+  // Transposes in place if the transposed matrix, with its own padding, fits in
+  // the current allocation: we pack the rows, follow the permutation cycles and
+  // then spread the rows out to the new stride.
+  const MatrixIndexT rows = this->num_rows_;
+  const MatrixIndexT cols = this->num_cols_;
+  const MatrixIndexT new_stride = PaddedStride(rows);
+  if (static_cast<size_t>(cols) * static_cast<size_t>(new_stride)
+      <= static_cast<size_t>(rows) * static_cast<size_t>(this->stride_)) {
+    for (MatrixIndexT r = 1; r < rows; ++r) {
+      std::memmove(this->data_ + r * cols, this->data_ + r * this->stride_,
+                   sizeof(Real) * cols);
+    }
+    float_kernel_transpose_inplace(this->data_, rows, cols);
+    for (MatrixIndexT r = cols - 1; r > 0; --r) {
+      std::memmove(this->data_ + r * new_stride, this->data_ + r * rows,
+                   sizeof(Real) * rows);
+    }
+    this->num_rows_ = cols;
+    this->num_cols_ = rows;
+    this->stride_ = new_stride;
+    ZeroPadding();
   } else {
-    (static_cast<MatrixBase&>(*this)).Transpose();
+    MatrixT<Real> tmp(cols, rows, kUndefined);
+    tmp.CopyFromMat(*this, kTrans);
+    Swap(&tmp);
   }
 }
 
-Matrix& Matrix::operator=(const Matrix& other) {
-  if (num_rows_ != other.NumRows() || num_cols_ != other.NumCols()) {
+template <typename Real>
+MatrixT<Real>& MatrixT<Real>::operator=(const MatrixT<Real>& other) {
+  if (this->num_rows_ != other.NumRows()
+      || this->num_cols_ != other.NumCols()) {
     Resize(other.NumRows(), other.NumCols(), kUndefined);
   }
-  CopyFromMat(other);
+  this->CopyFromMat(other);
   return *this;
 }
 
-Matrix& Matrix::operator=(const MatrixBase& other) {
-  if (num_rows_ != other.NumRows() || num_cols_ != other.NumCols()) {
+template <typename Real>
+MatrixT<Real>& MatrixT<Real>::operator=(const MatrixBaseT<Real>& other) {
+  if (this->num_rows_ != other.NumRows()
+      || this->num_cols_ != other.NumCols()) {
     Resize(other.NumRows(), other.NumCols(), kUndefined);
   }
-  CopyFromMat(other);
+  this->CopyFromMat(other);
   return *this;
 }
 
-void Matrix::AllocateMatrixMemory(const MatrixIndexT rows,
-                                  const MatrixIndexT cols) {
+template <typename Real>
+void MatrixT<Real>::AllocateMatrixMemory(const MatrixIndexT rows,
+                                         const MatrixIndexT cols) {
   SNOWBOY_ASSERT(rows >= 0 && cols >= 0);
 
   if (rows == 0 || cols == 0) {
-    num_rows_ = 0;
-    num_cols_ = 0;
-    stride_ = 0;
-    data_ = NULL;
+    this->num_rows_ = 0;
+    this->num_cols_ = 0;
+    this->stride_ = 0;
+    this->data_ = NULL;
     return;
   }
 
-  SNOWBOY_ASSERT(SNOWBOY_MEM_ALIGN % sizeof(float) == 0);
-  size_t num_per_align = SNOWBOY_MEM_ALIGN / sizeof(float);
-  MatrixIndexT pad = (num_per_align - cols % num_per_align) % num_per_align;
-  size_t size = sizeof(float)
-      * static_cast<size_t>(rows) * static_cast<size_t>(cols + pad);
-  void* data = SnowboyMemalign(SNOWBOY_MEM_ALIGN, size);
+  MatrixIndexT stride = PaddedStride(cols);
+  size_t size = sizeof(Real)
+      * static_cast<size_t>(rows) * static_cast<size_t>(stride);
+  void* data = MatrixMemalign(
+      std::max<size_t>(SNOWBOY_MEM_ALIGN, kMatrixPadBytes), size);
 
   if (data != NULL) {
-    data_ = static_cast<float*>(data);
-    num_rows_ = rows;
-    num_cols_ = cols;
-    stride_ = cols + pad;
+    this->data_ = static_cast<Real*>(data);
+    this->num_rows_ = rows;
+    this->num_cols_ = cols;
+    this->stride_ = stride;
+    ZeroPadding();
   } else {
     throw std::bad_alloc();
   }
 }
 
-void Matrix::ReleaseMatrixMemory() {
-  if (data_ != NULL)
-    SnowboyMemalignFree(data_);
-  num_rows_ = 0;
-  num_cols_ = 0;
-  stride_ = 0;
-  data_ = NULL;
+template <typename Real>
+MatrixIndexT MatrixT<Real>::PaddedStride(const MatrixIndexT cols) {
+  const size_t pad_bytes =
+      std::max<size_t>(SNOWBOY_MEM_ALIGN, kMatrixPadBytes);
+  SNOWBOY_ASSERT(pad_bytes % sizeof(Real) == 0);
+  size_t num_per_align = pad_bytes / sizeof(Real);
+  MatrixIndexT pad = (num_per_align - cols % num_per_align) % num_per_align;
+  return cols + pad;
 }
 
-void Matrix::Read(const bool binary, const bool add, std::istream* is) {
-  SNOWBOY_ASSERT(is != NULL);
-  if (add) {
-    Matrix tmp;
-    tmp.Read(binary, false, is);
-    if (num_rows_ == 0) {
-      Resize(tmp.NumRows(), tmp.NumCols());
-    } else {
-      if (tmp.NumRows() != num_rows_
-          || tmp.NumCols() != num_cols_) {
-        SNOWBOY_ERROR << "Fail to read Matrix: size mismatch "
-            << num_rows_ << " x " << num_cols_ << " v.s. "
-            << tmp.NumRows() << " x " << tmp.NumCols();
-      }
-    }
-    AddMat(1.0, tmp);
+template <typename Real>
+void MatrixT<Real>::ZeroPadding() {
+  if (this->stride_ == this->num_cols_) {
     return;
   }
+  // Split like the loops that fill the rows, so that pages are first touched
+  // by the same threads.
+  ParallelFor(0, this->num_rows_, ParallelGrain(this->stride_),
+              [this](MatrixIndexT row_begin, MatrixIndexT row_end) {
+    for (MatrixIndexT r = row_begin; r < row_end; ++r) {
+      std::memset(this->data_ + r * this->stride_ + this->num_cols_, 0,
+                  sizeof(Real) * (this->stride_ - this->num_cols_));
+    }
+  });
+}
 
+template <typename Real>
+void MatrixT<Real>::ReleaseMatrixMemory() {
+  if (this->data_ != NULL)
+    MatrixMemalignFree(this->data_);
+  this->num_rows_ = 0;
+  this->num_cols_ = 0;
+  this->stride_ = 0;
+  this->data_ = NULL;
+}
+
+template <typename Real>
+void MatrixT<Real>::Read(const bool binary, std::istream* is) {
+  SNOWBOY_ASSERT(is != NULL);
   if (binary) {
     int32 num_rows, num_cols;
-    ExpectToken(binary, "FM", is);
+    ExpectToken(binary, matrix_token<Real>(), is);
     ReadBasicType(binary, &num_rows, is);
     ReadBasicType(binary, &num_cols, is);
-    if ((MatrixIndexT)(num_rows) != num_rows_
-        || (MatrixIndexT)(num_cols) != num_cols_) {
+    if ((MatrixIndexT)(num_rows) != this->num_rows_
+        || (MatrixIndexT)(num_cols) != this->num_cols_) {
       Resize(num_rows, num_cols);
     }
     if (num_rows * num_cols != 0) {
-      if (stride_ == num_cols_) {
-        is->read(reinterpret_cast<char*>(data_),
-                 sizeof(float) * num_rows * num_cols);
+      if (this->stride_ == this->num_cols_) {
+        is->read(reinterpret_cast<char*>(this->data_),
+                 sizeof(Real) * num_rows * num_cols);
       } else {
         for (MatrixIndexT i = 0; i < (MatrixIndexT)(num_rows); ++i) {
-          is->read(reinterpret_cast<char*>(RowData(i)),
-                   sizeof(float) * num_cols);
+          is->read(reinterpret_cast<char*>(this->RowData(i)),
+                   sizeof(Real) * num_cols);
           if (is->fail()) {
             break;
           }
@@ -688,7 +1023,7 @@ void Matrix::Read(const bool binary, const bool add, std::istream* is) {
     }
   } else {
     ExpectToken(binary, "[", is);
-    std::vector<float> data;
+    std::vector<Real> data;
     int32 num_rows = 0;
     int32 num_cols = 0;
     int32 this_num_cols = 0;
@@ -696,7 +1031,7 @@ void Matrix::Read(const bool binary, const bool add, std::istream* is) {
     while (!is_end) {
       int next_char = is->peek();
       if (next_char == '-' || (next_char >= '0' && next_char <= '9')) {
-        float f;
+        Real f;
         *is >> f;
         if ((!std::isspace(is->peek()))
             && is->peek() != ']' && is->peek() != ';') {
@@ -753,33 +1088,65 @@ void Matrix::Read(const bool binary, const bool add, std::istream* is) {
   }
 }
 
-void Matrix::Read(const bool binary, std::istream* is) {
+template <typename Real>
+void MatrixT<Real>::Read(const bool binary, const bool add, std::istream* is) {
   SNOWBOY_ASSERT(is != NULL);
-  Read(binary, false, is);
+  if (add) {
+    MatrixT<Real> tmp;
+    tmp.Read(binary, is);
+    if (this->num_rows_ == 0) {
+      Resize(tmp.NumRows(), tmp.NumCols());
+    } else {
+      if (tmp.NumRows() != this->num_rows_
+          || tmp.NumCols() != this->num_cols_) {
+        SNOWBOY_ERROR << "Fail to read Matrix: size mismatch "
+            << this->num_rows_ << " x " << this->num_cols_ << " v.s. "
+            << tmp.NumRows() << " x " << tmp.NumCols();
+      }
+    }
+    this->AddMat(1.0, tmp);
+    return;
+  }
+
+  Read(binary, is);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// SubMatrix class
+// SubMatrixT class
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-SubMatrix::SubMatrix(const MatrixBase& mat,
-                     const MatrixIndexT row_offset,
-                     const MatrixIndexT num_rows,
-                     const MatrixIndexT col_offset,
-                     const MatrixIndexT num_cols) {
+template <typename Real>
+SubMatrixT<Real>::SubMatrixT(const MatrixBaseT<Real>& mat,
+                             const MatrixIndexT row_offset,
+                             const MatrixIndexT num_rows,
+                             const MatrixIndexT col_offset,
+                             const MatrixIndexT num_cols) {
   SNOWBOY_ASSERT(row_offset >= 0 && num_rows >= 0);
   SNOWBOY_ASSERT(col_offset >= 0 && num_cols >= 0);
   SNOWBOY_ASSERT(row_offset + num_rows <= mat.NumRows());
   SNOWBOY_ASSERT(col_offset + num_cols <= mat.NumCols());
-  num_rows_ = num_rows;
-  num_cols_ = num_cols;
-  stride_ = mat.Stride();
-  data_ = const_cast<float*>(mat.Data()
+  this->num_rows_ = num_rows;
+  this->num_cols_ = num_cols;
+  this->stride_ = mat.Stride();
+  this->data_ = const_cast<Real*>(mat.Data()
                              + row_offset * mat.Stride() + col_offset);
 }
 
+template <typename Real>
+SubMatrixT<Real>::SubMatrixT(const Real* data,
+                             const MatrixIndexT num_rows,
+                             const MatrixIndexT num_cols,
+                             const MatrixIndexT stride) {
+  SNOWBOY_ASSERT(num_rows >= 0 && num_cols >= 0 && stride >= 0);
+  SNOWBOY_ASSERT(num_rows <= 1 || num_cols == 0 || stride > 0);
+  this->num_rows_ = num_rows;
+  this->num_cols_ = num_cols;
+  this->stride_ = stride;
+  this->data_ = const_cast<Real*>(data);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Functions
@@ -806,4 +1173,93 @@ bool IsEqual(const float tolerance,
   return true;
 }
 
+template <typename Real>
+bool IsEqual(const MatrixBaseT<Real>& mat1, const MatrixBaseT<Real>& mat2) {
+  if (mat1.NumRows() != mat2.NumRows() || mat1.NumCols() != mat2.NumCols()) {
+    return false;
+  }
+  for (MatrixIndexT r = 0; r < mat1.NumRows(); ++r) {
+    if (!std::equal(mat1.RowData(r), mat1.RowData(r) + mat1.NumCols(),
+                    mat2.RowData(r))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// All members for float. For the other element types, only the members that
+// do not need cblas or the float kernels, see matrix-wrapper.h.
+template class MatrixBaseT<float>;
+template class MatrixT<float>;
+template class SubMatrixT<float>;
+
+#define SNOWBOY_INSTANTIATE_MATRIX(Real)                                      \
+  template void MatrixBaseT<Real>::Set(const Real value);                    \
+  template void MatrixBaseT<Real>::SetUnit();                                \
+  template SubMatrixT<Real> MatrixBaseT<Real>::Range(                         \
+      const MatrixIndexT row_offset, const MatrixIndexT num_rows,             \
+      const MatrixIndexT col_offset, const MatrixIndexT num_cols) const;      \
+  template SubMatrixT<Real> MatrixBaseT<Real>::RowRange(                      \
+      const MatrixIndexT row_offset, const MatrixIndexT num_rows) const;      \
+  template SubMatrixT<Real> MatrixBaseT<Real>::ColRange(                      \
+      const MatrixIndexT col_offset, const MatrixIndexT num_cols) const;      \
+  template SubMatrixT<Real> MatrixBaseT<Real>::SpliceRows(                    \
+      const MatrixIndexT row_offset, const MatrixIndexT num_rows,             \
+      const MatrixIndexT num_splice) const;                                   \
+  template void MatrixBaseT<Real>::CopyFromMat(                               \
+      const MatrixBaseT<Real>& mat, const MatrixTransposeType trans_type);    \
+  template void MatrixBaseT<Real>::CopyFromMat(const MatrixBase& mat,         \
+                                               const float scale);            \
+  template void MatrixBaseT<Real>::CopyToMat(const float scale,               \
+                                             MatrixBase* mat) const;          \
+  template void MatrixBaseT<Real>::CopyRowsFromVec(                           \
+      const VectorBaseT<Real>& vec);                                          \
+  template void MatrixBaseT<Real>::CopyRowFromVec(                            \
+      const VectorBaseT<Real>& vec, const MatrixIndexT row);                  \
+  template void MatrixBaseT<Real>::CopyColsFromVec(                           \
+      const VectorBaseT<Real>& vec);                                          \
+  template void MatrixBaseT<Real>::CopyColFromVec(                            \
+      const VectorBaseT<Real>& vec, const MatrixIndexT col);                  \
+  template void MatrixBaseT<Real>::CopyDiagFromVec(                           \
+      const VectorBaseT<Real>& vec);                                          \
+  template void MatrixBaseT<Real>::CopyCols(                                  \
+      const MatrixBaseT<Real>& mat, const std::vector<MatrixIndexT>& indices);\
+  template void MatrixBaseT<Real>::CopyRows(                                  \
+      const MatrixBaseT<Real>& mat, const std::vector<MatrixIndexT>& indices);\
+  template void MatrixBaseT<Real>::Read(const bool binary, std::istream* is); \
+  template void MatrixBaseT<Real>::Write(const bool binary,                   \
+                                         std::ostream* os) const;             \
+  template void MatrixT<Real>::Resize(const MatrixIndexT rows,                \
+                                      const MatrixIndexT cols,                \
+                                      const MatrixResizeType resize_type);    \
+  template void MatrixT<Real>::Swap(MatrixT<Real>* other);                    \
+  template void MatrixT<Real>::RemoveRow(MatrixIndexT row);                   \
+  template void MatrixT<Real>::Append(const MatrixBaseT<Real>& mat);          \
+  template MatrixT<Real>& MatrixT<Real>::operator=(                           \
+      const MatrixT<Real>& other);                                            \
+  template MatrixT<Real>& MatrixT<Real>::operator=(                           \
+      const MatrixBaseT<Real>& other);                                        \
+  template void MatrixT<Real>::Read(const bool binary, std::istream* is);     \
+  template void MatrixT<Real>::AllocateMatrixMemory(const MatrixIndexT rows,  \
+                                                    const MatrixIndexT cols); \
+  template MatrixIndexT MatrixT<Real>::PaddedStride(const MatrixIndexT cols); \
+  template void MatrixT<Real>::ZeroPadding();                                 \
+  template void MatrixT<Real>::ReleaseMatrixMemory();                         \
+  template class SubMatrixT<Real>;
+
+SNOWBOY_INSTANTIATE_MATRIX(double)
+SNOWBOY_INSTANTIATE_MATRIX(int16)
+SNOWBOY_INSTANTIATE_MATRIX(int32)
+
+#undef SNOWBOY_INSTANTIATE_MATRIX
+
+template bool IsEqual(const MatrixBaseT<float>& mat1,
+                      const MatrixBaseT<float>& mat2);
+template bool IsEqual(const MatrixBaseT<double>& mat1,
+                      const MatrixBaseT<double>& mat2);
+template bool IsEqual(const MatrixBaseT<int16>& mat1,
+                      const MatrixBaseT<int16>& mat2);
+template bool IsEqual(const MatrixBaseT<int32>& mat1,
+                      const MatrixBaseT<int32>& mat2);
+
 } // namespace snowboy
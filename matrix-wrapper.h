@@ -40,36 +40,23 @@ namespace snowboy {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// MatrixBase class
+// MatrixBaseT class
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-class MatrixBase {
+// Common part of MatrixT and SubMatrixT, templated on the element type. As for
+// VectorBaseT, the members that copy, view, convert and serialize the data are
+// instantiated for float, double, int16 and int32, and the arithmetic only
+// defined for float, i.e. for MatrixBase.
+template <typename Real>
+class MatrixBaseT {
  public:
-  // Returns true if the matrix is all zeros, except for ones on diagonal.
-  bool IsUnit(const float cutoff = 1.0e-06) const;
-
-  // Returns true if matrix is all zeros.
-  bool IsZero(const float cutoff = 1.0e-06) const;
-
-  // Returns true if matrix is symmetric.
-  bool IsSymmetric(const float cutoff = 1.0e-06) const;
-
-  // Returns true if matrix is diagonal.
-  bool IsDiagonal(const float cutoff = 1.0e-06) const;
-
   // Sets all members of a matrix to a specified value.
-  void Set(const float value);
+  void Set(const Real value);
 
   // Sets all members of a matrix to zero, except ones along diagonal.
   void SetUnit();
 
-  // Sets to random values of a normal distribution.
-  void SetRandomGaussian();
-
-  // Sets to numbers uniformly distributed on (0, 1).
-  void SetRandomUniform();
-
   // Returns number of rows.
   inline MatrixIndexT NumRows() const { return num_rows_; }
 
@@ -80,198 +67,278 @@ class MatrixBase {
   inline MatrixIndexT Stride() const { return stride_; }
 
   // Returns pointer to the data.
-  inline float* Data() { return data_; }
-  inline const float* Data() const { return data_; }
+  inline Real* Data() { return data_; }
+  inline const Real* Data() const { return data_; }
 
   // Returns pointer to data for one row.
-  inline float* RowData(const MatrixIndexT row) {
+  inline Real* RowData(const MatrixIndexT row) {
     SNOWBOY_ASSERT(row < num_rows_ && row >= 0);
     return data_ + row * stride_;
   }
-  inline const float* RowData(const MatrixIndexT row) const {
+  inline const Real* RowData(const MatrixIndexT row) const {
     SNOWBOY_ASSERT(row < num_rows_ && row >= 0);
     return data_ + row * stride_;
   }
 
   // Returns the value at given index.
-  inline const float operator()(const MatrixIndexT row,
-                                const MatrixIndexT col) const {
+  inline const Real operator()(const MatrixIndexT row,
+                               const MatrixIndexT col) const {
     SNOWBOY_ASSERT(row < num_rows_ && col < num_cols_ && row >= 0 && col >= 0);
     return *(data_ + row * stride_ + col);
   }
-  inline float& operator()(const MatrixIndexT row,
-                           const MatrixIndexT col) {
+  inline Real& operator()(const MatrixIndexT row,
+                          const MatrixIndexT col) {
     SNOWBOY_ASSERT(row < num_rows_ && col < num_cols_ && row >= 0 && col >= 0);
     return *(data_ + row * stride_ + col);
   }
 
   // Returns specific row of matrix.
-  inline SubVector Row(const MatrixIndexT row) {
+  inline SubVectorT<Real> Row(const MatrixIndexT row) {
     SNOWBOY_ASSERT(row < num_rows_ && row >= 0);
-    return SubVector((*this), row);
+    return SubVectorT<Real>((*this), row);
   }
-  inline const SubVector Row(const MatrixIndexT row) const {
+  inline const SubVectorT<Real> Row(const MatrixIndexT row) const {
     SNOWBOY_ASSERT(row < num_rows_ && row >= 0);
-    return SubVector((*this), row);
+    return SubVectorT<Real>((*this), row);
   }
 
   // Returns a sub-part of matrix.
-  SubMatrix Range(const MatrixIndexT row_offset,
-                  const MatrixIndexT num_rows,
-                  const MatrixIndexT col_offset,
-                  const MatrixIndexT num_cols) const;
-  SubMatrix RowRange(const MatrixIndexT row_offset,
-                     const MatrixIndexT num_rows) const;
-  SubMatrix ColRange(const MatrixIndexT col_offset,
-                     const MatrixIndexT num_cols) const;
+  SubMatrixT<Real> Range(const MatrixIndexT row_offset,
+                         const MatrixIndexT num_rows,
+                         const MatrixIndexT col_offset,
+                         const MatrixIndexT num_cols) const;
+  SubMatrixT<Real> RowRange(const MatrixIndexT row_offset,
+                            const MatrixIndexT num_rows) const;
+  SubMatrixT<Real> ColRange(const MatrixIndexT col_offset,
+                            const MatrixIndexT num_cols) const;
+
+  // Returns a spliced view of the matrix: row r of the view is the
+  // concatenation of rows [row_offset + r, row_offset + r + num_splice). The
+  // rows of the view overlap in memory (Stride() < NumCols() of the view), so
+  // frame context is spliced without copying anything. Only works when the rows
+  // of *this are contiguous, i.e., Stride() == NumCols().
+  SubMatrixT<Real> SpliceRows(const MatrixIndexT row_offset,
+                              const MatrixIndexT num_rows,
+                              const MatrixIndexT num_splice) const;
 
   // Copies data from another matrix.
-  void CopyFromMat(const MatrixBase& mat,
+  void CopyFromMat(const MatrixBaseT<Real>& mat,
                    const MatrixTransposeType trans_type = kNoTrans);
 
+  // Converts from float: *this = scale * mat, rounded to nearest and saturated
+  // to the range of Real for integer types.
+  void CopyFromMat(const MatrixBase& mat, const float scale);
+
+  // Converts to float: *mat = scale * *this.
+  void CopyToMat(const float scale, MatrixBase* mat) const;
+
   // Copies data from vector to matrix:
   // 1. if vec.Dim() equals NumRows() * NumCols(), then we create the matrix by
   //    break the vector down into rows.
   // 2. if vec.Dim() equals NumCols(), then we create the matrix by copying one
   //    vector to each row.
-  void CopyRowsFromVec(const VectorBase& vec);
+  void CopyRowsFromVec(const VectorBaseT<Real>& vec);
 
   // Copies vector into specific row of matrix.
-  void CopyRowFromVec(const VectorBase& vec, const MatrixIndexT row);
+  void CopyRowFromVec(const VectorBaseT<Real>& vec, const MatrixIndexT row);
 
   // Copies data from vector to matrix:
   // 1. if vec.Dim() equals NumRows() * NumCols(), then we create the matrix by
   //    break the vector down into columns.
   // 2. if vec.Dim() equals NumCols(), then we create the matrix by copying one
   //    vector to each column.
-  void CopyColsFromVec(const VectorBase& vec);
+  void CopyColsFromVec(const VectorBaseT<Real>& vec);
 
   // Copies vector into specific column of matrix.
-  void CopyColFromVec(const VectorBase& vec, const MatrixIndexT col);
+  void CopyColFromVec(const VectorBaseT<Real>& vec, const MatrixIndexT col);
 
   // Copies vector into diagonal of matrix.
-  void CopyDiagFromVec(const VectorBase& vec);
+  void CopyDiagFromVec(const VectorBaseT<Real>& vec);
 
   // Column re-ordering:
   // Copies column r from column indices[r] of matrix mat. If indices[r] == -1,
   // then sets column r to zero.
-  void CopyCols(const MatrixBase& mat,
+  void CopyCols(const MatrixBaseT<Real>& mat,
                 const std::vector<MatrixIndexT>& indices);
 
   // Row re-ordering:
   // Copies row r from r indices[r] of matrix mat. If indices[r] == -1, then
   // sets row r to zero.
-  void CopyRows(const MatrixBase& mat,
+  void CopyRows(const MatrixBaseT<Real>& mat,
                 const std::vector<MatrixIndexT>& indices);
 
-  // Transposes the matrix, only support square matrix here.
+  void Read(const bool binary, std::istream* is);
+
+  void Write(const bool binary, std::ostream* os) const;
+
+  // The members below are only defined for float, and deleted for the other
+  // element types, see SNOWBOY_DELETE_MATRIX_ARITHMETIC.
+
+  // Returns true if the matrix is all zeros, except for ones on diagonal.
+  bool IsUnit(const Real cutoff = 1.0e-06) const;
+
+  // Returns true if matrix is all zeros.
+  bool IsZero(const Real cutoff = 1.0e-06) const;
+
+  // Returns true if matrix is symmetric.
+  bool IsSymmetric(const Real cutoff = 1.0e-06) const;
+
+  // Returns true if matrix is diagonal.
+  bool IsDiagonal(const Real cutoff = 1.0e-06) const;
+
+  // Sets to random values of a normal distribution.
+  void SetRandomGaussian();
+
+  // Sets to numbers uniformly distributed on (0, 1).
+  void SetRandomUniform();
+
+  // Evaluates an element-wise expression into the matrix in a single pass,
+  // e.g. m.Assign(max(m + bias, 0)), where vectors are broadcast to every row.
+  // Needs matrix/matrix-expression.h.
+  template <typename Expr>
+  void Assign(const MatrixExpression<Expr>& expr);
+
+  // Transposes the matrix, only support square matrix here. Blocked, works in
+  // place.
   void Transpose();
 
   // *this = alpha * *this
-  void Scale(const float alpha);
+  void Scale(const Real alpha);
 
   // *this += alpha * M.
-  void AddMat(const float alpha, const MatrixBase& M,
+  void AddMat(const Real alpha, const MatrixBaseT<Real>& M,
               const MatrixTransposeType trans_type = kNoTrans);
 
   // Without transpose:
   // *this = beta * *this + alpha * mat1 * mat2^T.
-  void AddMatMat(const float alpha,
-                 const MatrixBase& mat1, const MatrixTransposeType trans_mat1,
-                 const MatrixBase& mat2, const MatrixTransposeType trans_mat2,
-                 const float beta);
+  // Either of <mat1> and <mat2> can be an overlapping view (see SpliceRows()).
+  void AddMatMat(const Real alpha,
+                 const MatrixBaseT<Real>& mat1,
+                 const MatrixTransposeType trans_mat1,
+                 const MatrixBaseT<Real>& mat2,
+                 const MatrixTransposeType trans_mat2,
+                 const Real beta);
+
+  // Affine transform followed by a nonlinearity, e.g. a DNN layer:
+  // *this = act(alpha * mat1 * mat2 + bias), where <mat1> and <mat2> follow the
+  // same conventions as in AddMatMat(), and <bias> is added to each row. The
+  // product is computed in panels of rows that stay in cache while the bias
+  // and the activation are applied. <ceil> is only used by kClippedRelu.
+  void AddMatMatBiasAct(const Real alpha,
+                        const MatrixBaseT<Real>& mat1,
+                        const MatrixTransposeType trans_mat1,
+                        const MatrixBaseT<Real>& mat2,
+                        const MatrixTransposeType trans_mat2,
+                        const VectorBaseT<Real>& bias,
+                        const MatrixActivationType act,
+                        const Real ceil = 0.0f);
 
   // *this = mat1 * mat2^T
-  void MatMatRaw(const MatrixBase& mat1, const MatrixBase& mat2);
+  void MatMatRaw(const MatrixBaseT<Real>& mat1, const MatrixBaseT<Real>& mat2);
 
   // *this += alpha * vec1 * vec2^T.
-  void AddVecVec(const float alpha,
-                 const VectorBase& vec1, const VectorBase& vec2);
+  void AddVecVec(const Real alpha,
+                 const VectorBaseT<Real>& vec1, const VectorBaseT<Real>& vec2);
 
   // this->Row(i) += alpha * vec.
-  void AddVecToRows(const float alpha, const VectorBase& vec);
+  void AddVecToRows(const Real alpha, const VectorBaseT<Real>& vec);
 
   // Applies floor to all elements.
-  void ApplyFloor(const float floor);
+  void ApplyFloor(const Real floor);
+
+  void ApplyCeiling(const Real ceil);
 
-  void ApplyCeiling(const float ceil);
+  void ApplyRange(const Real floor, const Real ceil);
 
-  void ApplyRange(const float floor, const float ceil);
+  // Applies soft-max to each row.
+  void ApplySoftmaxPerRow();
+
+  // Applies log soft-max to each row.
+  void ApplyLogSoftmaxPerRow();
 
   // Scales each column by a scalar taken from that dimension of the vector.
-  void MulColsVec(const VectorBase& scale);
+  void MulColsVec(const VectorBaseT<Real>& scale);
 
   // Scales each row by a scalar taken from that dimension of the vector.
-  void MulRowsVec(const VectorBase& scale);
+  void MulRowsVec(const VectorBaseT<Real>& scale);
 
   // If <add> is true, then read the Vector from stream, and add it to the
   // current Vector.
   void Read(const bool binary, const bool add, std::istream* is);
-  void Read(const bool binary, std::istream* is);
-
-  void Write(const bool binary, std::ostream* os) const;
 
  protected:
 
   // Constructor, this version creates an empty matrix, and is only callable
   // from child classes.
-  explicit MatrixBase(): num_rows_(0), num_cols_(0), stride_(0), data_(NULL) {}
+  explicit MatrixBaseT(): num_rows_(0), num_cols_(0), stride_(0), data_(NULL) {}
 
   // Constructor, this version creates a matrix with given data, and is only
   // callable from child classes.
-  explicit MatrixBase(const MatrixIndexT rows,
-                      const MatrixIndexT cols,
-                      const MatrixIndexT stride,
-                      float* data) :
+  explicit MatrixBaseT(const MatrixIndexT rows,
+                       const MatrixIndexT cols,
+                       const MatrixIndexT stride,
+                       Real* data) :
       num_rows_(rows), num_cols_(cols), stride_(stride), data_(data) {}
 
   // Destructor, only callable from child classes.
-  ~MatrixBase() { }
+  ~MatrixBaseT() { }
+
+  // AddMatMat() for the case where <mat1> or <mat2> has overlapping rows, which
+  // cblas does not accept (it requires lda >= number of columns). The
+  // overlapping operand is split into column blocks of width Stride(), each of
+  // which is a regular view, and the products of the blocks are accumulated.
+  void AddMatMatOverlapped(const Real alpha,
+                           const MatrixBaseT<Real>& mat1,
+                           const MatrixTransposeType trans_mat1,
+                           const MatrixBaseT<Real>& mat2,
+                           const MatrixTransposeType trans_mat2,
+                           const Real beta);
 
   MatrixIndexT num_rows_;
   MatrixIndexT num_cols_;
   MatrixIndexT stride_;
-  float* data_;
+  Real* data_;
 
-  SNOWBOY_DISALLOW_COPY_AND_ASSIGN(MatrixBase);
+  SNOWBOY_DISALLOW_COPY_AND_ASSIGN(MatrixBaseT);
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Matrix class
+// MatrixT class
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-class Matrix : public MatrixBase {
+template <typename Real>
+class MatrixT : public MatrixBaseT<Real> {
  public:
   // Constructor, this version creates an empty matrix.
-  Matrix() : MatrixBase() {}
+  MatrixT() : MatrixBaseT<Real>() {}
 
   // Constructor, this version creates a matrix with specified size.
-  explicit Matrix(const MatrixIndexT rows,
-                  const MatrixIndexT cols,
-                  const MatrixResizeType resize_type = kSetZero) :
-      MatrixBase() {
+  explicit MatrixT(const MatrixIndexT rows,
+                   const MatrixIndexT cols,
+                   const MatrixResizeType resize_type = kSetZero) :
+      MatrixBaseT<Real>() {
     Resize(rows, cols, resize_type);
   }
 
   // Copy constructor, this version is need to avoid the default copy
   // constructor.
-  explicit Matrix(const Matrix& mat) : MatrixBase() {
+  explicit MatrixT(const MatrixT<Real>& mat) : MatrixBaseT<Real>() {
     Resize(mat.NumRows(), mat.NumCols(), kUndefined);
-    CopyFromMat(mat);
+    this->CopyFromMat(mat);
   }
 
   // Copy constructor, this version can copy with transpose.
-  explicit Matrix(const MatrixBase& mat,
-                  const MatrixTransposeType trans_type = kNoTrans) :
-      MatrixBase() {
+  explicit MatrixT(const MatrixBaseT<Real>& mat,
+                   const MatrixTransposeType trans_type = kNoTrans) :
+      MatrixBaseT<Real>() {
     if (trans_type == kNoTrans) {
       Resize(mat.NumRows(), mat.NumCols(), kUndefined);
-      CopyFromMat(mat, trans_type);
+      this->CopyFromMat(mat, trans_type);
     } else {
       Resize(mat.NumCols(), mat.NumRows(), kUndefined);
-      CopyFromMat(mat, trans_type);
+      this->CopyFromMat(mat, trans_type);
     }
   }
 
@@ -282,65 +349,139 @@ class Matrix : public MatrixBase {
               const MatrixResizeType resize_type = kSetZero);
 
   // Swaps the contents of *this and *other. Shallow swap.
-  void Swap(Matrix* other);
+  void Swap(MatrixT<Real>* other);
 
   // Removes a specified row.
   void RemoveRow(const MatrixIndexT row);
 
   // append a row
-  void Append(const MatrixBase& mat);
+  void Append(const MatrixBaseT<Real>& mat);
 
-  // Transposes the matrix.
+  // Transposes the matrix. Non-square matrices are transposed in place when the
+  // transposed matrix fits in the current allocation, and through a temporary
+  // otherwise. Only defined for float.
   void Transpose();
 
-  // Assignment operator, one for class Matrix and another for MatrixBase.
-  Matrix& operator=(const Matrix& other);
-  Matrix& operator=(const MatrixBase& other);
+  // Assignment operator, one for class MatrixT and another for MatrixBaseT.
+  MatrixT<Real>& operator=(const MatrixT<Real>& other);
+  MatrixT<Real>& operator=(const MatrixBaseT<Real>& other);
 
   // Distructor.
-  ~Matrix() { ReleaseMatrixMemory(); }
+  ~MatrixT() { ReleaseMatrixMemory(); }
+
+  void Read(const bool binary, std::istream* is);
 
   // If <add> is true, then read the Vector from stream, and add it to the
-  // current Vector.
+  // current Vector. Only defined for float.
   void Read(const bool binary, const bool add, std::istream* is);
-  void Read(const bool binary, std::istream* is);
 
  private:
   // Allocates memory for <data_>.
   void AllocateMatrixMemory(const MatrixIndexT rows, const MatrixIndexT cols);
 
+  // Returns the stride used for a matrix with <cols> columns, a multiple of
+  // kMatrixPadBytes.
+  static MatrixIndexT PaddedStride(const MatrixIndexT cols);
+
+  // Sets the columns between NumCols() and Stride() to zero.
+  void ZeroPadding();
+
   void ReleaseMatrixMemory();
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// SubMatrix class
+// SubMatrixT class
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-class SubMatrix : public MatrixBase {
+template <typename Real>
+class SubMatrixT : public MatrixBaseT<Real> {
  public:
-  // Constructor, this version creates a SubMatrix from Matrix or SubMatrix, and
-  // it is not const-safe.
-  SubMatrix(const MatrixBase& mat,
-            const MatrixIndexT row_offset,
-            const MatrixIndexT num_rows,
-            const MatrixIndexT col_offset,
-            const MatrixIndexT num_cols);
+  // Constructor, this version creates a SubMatrixT from MatrixT or SubMatrixT,
+  // and it is not const-safe.
+  SubMatrixT(const MatrixBaseT<Real>& mat,
+             const MatrixIndexT row_offset,
+             const MatrixIndexT num_rows,
+             const MatrixIndexT col_offset,
+             const MatrixIndexT num_cols);
+
+  // Constructor, this version creates a SubMatrixT from raw data, and it is not
+  // const-safe. <stride> can be smaller than <num_cols>, in which case
+  // consecutive rows overlap in memory; such a view should only be read from.
+  SubMatrixT(const Real* data,
+             const MatrixIndexT num_rows,
+             const MatrixIndexT num_cols,
+             const MatrixIndexT stride);
 
   // Copy constructor, needed for Range() to work in base class.
-  SubMatrix(const SubMatrix& other) : MatrixBase(other.num_rows_,
-                                                 other.num_cols_,
-                                                 other.stride_,
-                                                 other.data_) {}
+  SubMatrixT(const SubMatrixT<Real>& other) :
+      MatrixBaseT<Real>(other.num_rows_, other.num_cols_,
+                        other.stride_, other.data_) {}
 
-  ~SubMatrix() {}
+  ~SubMatrixT() {}
 
  private:
-  SubMatrix() {}  // Blocks the default constructor.
-  SNOWBOY_DISALLOW_ASSIGN(SubMatrix);
+  SubMatrixT() {}  // Blocks the default constructor.
+  SNOWBOY_DISALLOW_ASSIGN(SubMatrixT);
 };
 
+// As for vectors, the arithmetic is deleted for the element types other than
+// float, so that a call fails to compile rather than to link.
+#define SNOWBOY_DELETE_MATRIX_ARITHMETIC(Real)                                \
+  template <> bool MatrixBaseT<Real>::IsUnit(const Real cutoff) const         \
+      = delete;                                                               \
+  template <> bool MatrixBaseT<Real>::IsZero(const Real cutoff) const         \
+      = delete;                                                               \
+  template <> bool MatrixBaseT<Real>::IsSymmetric(const Real cutoff) const    \
+      = delete;                                                               \
+  template <> bool MatrixBaseT<Real>::IsDiagonal(const Real cutoff) const     \
+      = delete;                                                               \
+  template <> void MatrixBaseT<Real>::SetRandomGaussian() = delete;           \
+  template <> void MatrixBaseT<Real>::SetRandomUniform() = delete;            \
+  template <> void MatrixBaseT<Real>::Transpose() = delete;                   \
+  template <> void MatrixBaseT<Real>::Scale(const Real alpha) = delete;       \
+  template <> void MatrixBaseT<Real>::AddMat(                                 \
+      const Real alpha, const MatrixBaseT<Real>& M,                           \
+      const MatrixTransposeType trans_type) = delete;                         \
+  template <> void MatrixBaseT<Real>::AddMatMat(                              \
+      const Real alpha, const MatrixBaseT<Real>& mat1,                        \
+      const MatrixTransposeType trans_mat1, const MatrixBaseT<Real>& mat2,    \
+      const MatrixTransposeType trans_mat2, const Real beta) = delete;        \
+  template <> void MatrixBaseT<Real>::AddMatMatBiasAct(                       \
+      const Real alpha, const MatrixBaseT<Real>& mat1,                        \
+      const MatrixTransposeType trans_mat1, const MatrixBaseT<Real>& mat2,    \
+      const MatrixTransposeType trans_mat2, const VectorBaseT<Real>& bias,    \
+      const MatrixActivationType act, const Real ceil) = delete;              \
+  template <> void MatrixBaseT<Real>::MatMatRaw(                              \
+      const MatrixBaseT<Real>& mat1, const MatrixBaseT<Real>& mat2) = delete; \
+  template <> void MatrixBaseT<Real>::AddVecVec(                              \
+      const Real alpha, const VectorBaseT<Real>& vec1,                        \
+      const VectorBaseT<Real>& vec2) = delete;                                \
+  template <> void MatrixBaseT<Real>::AddVecToRows(                           \
+      const Real alpha, const VectorBaseT<Real>& vec) = delete;               \
+  template <> void MatrixBaseT<Real>::ApplyFloor(const Real floor) = delete;  \
+  template <> void MatrixBaseT<Real>::ApplyCeiling(const Real ceil) = delete; \
+  template <> void MatrixBaseT<Real>::ApplyRange(const Real floor,            \
+                                                 const Real ceil) = delete;   \
+  template <> void MatrixBaseT<Real>::ApplySoftmaxPerRow() = delete;          \
+  template <> void MatrixBaseT<Real>::ApplyLogSoftmaxPerRow() = delete;       \
+  template <> void MatrixBaseT<Real>::MulColsVec(                             \
+      const VectorBaseT<Real>& scale) = delete;                               \
+  template <> void MatrixBaseT<Real>::MulRowsVec(                             \
+      const VectorBaseT<Real>& scale) = delete;                               \
+  template <> void MatrixBaseT<Real>::Read(const bool binary, const bool add, \
+                                           std::istream* is) = delete;        \
+  template <> void MatrixT<Real>::Transpose() = delete;                       \
+  template <> void MatrixT<Real>::Read(const bool binary, const bool add,     \
+                                       std::istream* is) = delete;
+
+SNOWBOY_DELETE_MATRIX_ARITHMETIC(double)
+SNOWBOY_DELETE_MATRIX_ARITHMETIC(int16)
+SNOWBOY_DELETE_MATRIX_ARITHMETIC(int32)
+
+#undef SNOWBOY_DELETE_MATRIX_ARITHMETIC
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Functions
@@ -350,6 +491,10 @@ class SubMatrix : public MatrixBase {
 bool IsEqual(const float tolerance,
              const MatrixBase& mat1, const MatrixBase& mat2);
 
+// Returns true if the matrices have the same size and elements.
+template <typename Real>
+bool IsEqual(const MatrixBaseT<Real>& mat1, const MatrixBaseT<Real>& mat2);
+
 }  // namespace snowboy
 
 #endif  // SNOWBOY_MATRIX_MATRIX_WRAPPER_H_
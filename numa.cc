@@ -0,0 +1,178 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "matrix/numa.h"
+#include "matrix/thread-pool.h"
+
+namespace snowboy {
+
+// Nodes with CPUs, read once from sysfs.
+struct NumaTopology {
+  // System id and CPUs of each node.
+  std::vector<int32> node_ids;
+  std::vector<std::vector<int32> > node_cpus;
+  // Node index of each CPU, -1 for CPUs of no node.
+  std::vector<int32> cpu_nodes;
+
+  NumaTopology();
+};
+
+// Parses a sysfs CPU list such as "0-3,8,10-11".
+static void ParseCpuList(const std::string& list, std::vector<int32>* cpus) {
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (item.empty() || item == "\n") {
+      continue;
+    }
+    size_t dash = item.find('-');
+    int32 first = std::atoi(item.substr(0, dash).c_str());
+    int32 last = (dash == std::string::npos)
+        ? first : std::atoi(item.substr(dash + 1).c_str());
+    for (int32 cpu = first; cpu <= last; ++cpu) {
+      cpus->push_back(cpu);
+    }
+  }
+}
+
+NumaTopology::NumaTopology() {
+#if defined(__linux__)
+  std::ifstream online("/sys/devices/system/node/online");
+  std::string line;
+  std::vector<int32> ids;
+  if (online.good() && std::getline(online, line)) {
+    ParseCpuList(line, &ids);
+  }
+  for (size_t i = 0; i < ids.size(); ++i) {
+    std::ostringstream path;
+    path << "/sys/devices/system/node/node" << ids[i] << "/cpulist";
+    std::ifstream is(path.str().c_str());
+    std::vector<int32> cpus;
+    if (is.good() && std::getline(is, line)) {
+      ParseCpuList(line, &cpus);
+    }
+    // Memory-only nodes have no CPUs to run a reader on.
+    if (cpus.empty()) {
+      continue;
+    }
+    for (size_t c = 0; c < cpus.size(); ++c) {
+      if (cpus[c] >= static_cast<int32>(cpu_nodes.size())) {
+        cpu_nodes.resize(cpus[c] + 1, -1);
+      }
+      cpu_nodes[cpus[c]] = node_ids.size();
+    }
+    node_ids.push_back(ids[i]);
+    node_cpus.push_back(cpus);
+  }
+#endif
+  if (node_ids.empty()) {
+    node_ids.push_back(0);
+    node_cpus.push_back(std::vector<int32>());
+  }
+}
+
+static const NumaTopology& GetNumaTopology() {
+  static const NumaTopology topology;
+  return topology;
+}
+
+int32 NumNumaNodes() {
+  return GetNumaTopology().node_ids.size();
+}
+
+int32 CurrentNumaNode() {
+#if defined(__linux__)
+  const NumaTopology& topology = GetNumaTopology();
+  if (topology.node_ids.size() == 1) {
+    return 0;
+  }
+  // sched_getcpu() goes through the vDSO, so this is cheap enough per call.
+  int cpu = sched_getcpu();
+  if (cpu >= 0 && cpu < static_cast<int>(topology.cpu_nodes.size()) &&
+      topology.cpu_nodes[cpu] >= 0) {
+    return topology.cpu_nodes[cpu];
+  }
+#endif
+  return 0;
+}
+
+void GetNumaNodeCpus(const int32 node, std::vector<int32>* cpus) {
+  SNOWBOY_ASSERT(cpus != NULL);
+  SNOWBOY_ASSERT(node >= 0 && node < NumNumaNodes());
+  *cpus = GetNumaTopology().node_cpus[node];
+}
+
+void RunOnNumaNode(const int32 node, const std::function<void()>& func) {
+  SNOWBOY_ASSERT(node >= 0 && node < NumNumaNodes());
+  if (NumNumaNodes() == 1) {
+    func();
+    return;
+  }
+  std::thread thread([node, &func]() {
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    const std::vector<int32>& cpus = GetNumaTopology().node_cpus[node];
+    for (size_t c = 0; c < cpus.size(); ++c) {
+      CPU_SET(cpus[c], &cpu_set);
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+                               &cpu_set) != 0) {
+      SNOWBOY_WARN << "Fail to pin a thread to NUMA node " << node;
+    }
+#endif
+    // Pool workers may sit on other nodes, so everything runs here.
+    ScopedThreadPool serial(NULL);
+    func();
+  });
+  thread.join();
+}
+
+bool BindToNumaNode(const void* data, const size_t bytes, const int32 node) {
+  SNOWBOY_ASSERT(node >= 0 && node < NumNumaNodes());
+  if (NumNumaNodes() == 1) {
+    return true;
+  }
+#if defined(__linux__) && defined(SYS_mbind)
+  // Only whole pages, so that neighbouring allocations are left alone.
+  const uintptr_t page = sysconf(_SC_PAGESIZE);
+  const uintptr_t address = reinterpret_cast<uintptr_t>(data);
+  const uintptr_t begin = (address + page - 1) & ~(page - 1);
+  const uintptr_t end = (address + bytes) & ~(page - 1);
+  if (data == NULL || end <= begin) {
+    return true;
+  }
+  const int32 node_id = GetNumaTopology().node_ids[node];
+  const int kMpolBind = 2;
+  const unsigned kMpolMfMove = 1 << 1;
+  const size_t kMaskBits = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> mask(node_id / kMaskBits + 1, 0);
+  mask[node_id / kMaskBits] |= 1UL << (node_id % kMaskBits);
+  if (syscall(SYS_mbind, begin, end - begin, kMpolBind, mask.data(),
+              mask.size() * kMaskBits + 1, kMpolMfMove) == 0) {
+    return true;
+  }
+  static std::atomic<bool> warned(false);
+  if (!warned.exchange(true)) {
+    SNOWBOY_WARN << "mbind() failed, weights stay where they were first "
+        << "touched.";
+  }
+#endif
+  return false;
+}
+
+}  // namespace snowboy
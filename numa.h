@@ -0,0 +1,108 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+// NUMA placement of read-only weights. On a multi-socket host, a thread that
+// reads weights from another socket's memory pays the remote latency on every
+// frame, and the weights of a model end up on the node of whichever thread
+// loaded them. NumaReplicated<T> keeps one copy of a weight matrix per NUMA
+// node, each written by a thread pinned to that node, so that first touch
+// places it there, and then bound to the node with mbind(). Local() returns
+// the copy of the calling thread's node.
+//
+// The topology comes from /sys/devices/system/node, so no libnuma is needed.
+// On a single-node machine, on systems other than Linux, or if the topology
+// can not be read, there is one node and NumaReplicated<T> holds a single
+// copy, with no extra memory.
+
+#ifndef SNOWBOY_MATRIX_NUMA_H_
+#define SNOWBOY_MATRIX_NUMA_H_
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include "matrix/matrix-common.h"
+#include "utils/snowboy-debug.h"
+#include "utils/snowboy-types.h"
+#include "utils/snowboy-utils.h"
+
+namespace snowboy {
+
+// Returns the number of NUMA nodes with CPUs, at least 1. Nodes are numbered
+// 0 to NumNumaNodes() - 1 below, which need not match the ids of the system.
+int32 NumNumaNodes();
+
+// Returns the node of the CPU the calling thread runs on, 0 if unknown.
+int32 CurrentNumaNode();
+
+// Gets the CPUs of <node>; empty if the topology is unknown.
+void GetNumaNodeCpus(const int32 node, std::vector<int32>* cpus);
+
+// Runs func() on a thread pinned to the CPUs of <node>, with the matrix
+// library running serially on it, and returns when it is done. Runs func() on
+// the calling thread if there is only one node.
+void RunOnNumaNode(const int32 node, const std::function<void()>& func);
+
+// Binds the whole pages in [data, data + bytes) to <node>, moving those
+// already placed elsewhere. Returns false if that is not supported.
+bool BindToNumaNode(const void* data, const size_t bytes, const int32 node);
+
+// One copy of a read-only matrix per NUMA node. T is Matrix or BitMatrix, or
+// any matrix type with Swap(), a constructor T(const T&, kNoTrans), Data(),
+// NumRows() and Stride().
+template <typename T>
+class NumaReplicated {
+ public:
+  // Takes the contents of <weights>, which is left empty, and replicates them
+  // on every node.
+  explicit NumaReplicated(T* weights) {
+    SNOWBOY_ASSERT(weights != NULL);
+    const int32 num_nodes = NumNumaNodes();
+    if (num_nodes == 1) {
+      replicas_.push_back(new T());
+      replicas_[0]->Swap(weights);
+      return;
+    }
+    replicas_.resize(num_nodes, NULL);
+    for (int32 node = 0; node < num_nodes; ++node) {
+      RunOnNumaNode(node, [this, weights, node]() {
+        replicas_[node] = new T(*weights, kNoTrans);
+      });
+      BindToNumaNode(replicas_[node]->Data(),
+                     sizeof(*replicas_[node]->Data())
+                     * replicas_[node]->NumRows() * replicas_[node]->Stride(),
+                     node);
+    }
+    T empty;
+    weights->Swap(&empty);
+  }
+
+  ~NumaReplicated() {
+    for (size_t i = 0; i < replicas_.size(); ++i) {
+      delete replicas_[i];
+    }
+  }
+
+  int32 NumReplicas() const { return replicas_.size(); }
+
+  const T& Replica(const int32 node) const {
+    SNOWBOY_ASSERT(node >= 0 && node < NumReplicas());
+    return *replicas_[node];
+  }
+
+  // Returns the copy of the calling thread's node.
+  const T& Local() const {
+    if (replicas_.size() == 1) {
+      return *replicas_[0];
+    }
+    return *replicas_[CurrentNumaNode()];
+  }
+
+ private:
+  std::vector<T*> replicas_;
+
+  SNOWBOY_DISALLOW_COPY_AND_ASSIGN(NumaReplicated);
+};
+
+}  // namespace snowboy
+
+#endif  // SNOWBOY_MATRIX_NUMA_H_
@@ -0,0 +1,219 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "matrix/perf-counters.h"
+
+#ifdef SNOWBOY_PERF_COUNTERS
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace snowboy {
+
+#ifdef SNOWBOY_PERF_COUNTERS
+
+// Kernel name and shape. Names are string literals, compared by content since
+// the same literal may have several addresses.
+struct PerfCounterKey {
+  const char* name;
+  MatrixIndexT m;
+  MatrixIndexT k;
+  MatrixIndexT n;
+
+  bool operator<(const PerfCounterKey& other) const {
+    int cmp = std::strcmp(name, other.name);
+    if (cmp != 0) return cmp < 0;
+    if (m != other.m) return m < other.m;
+    if (k != other.k) return k < other.k;
+    return n < other.n;
+  }
+};
+
+static std::mutex perf_mutex;
+static std::map<PerfCounterKey, PerfCounterStats> perf_stats;
+
+// The counters of one thread, opened as one group so that a single read()
+// returns all of them, and closed when the thread exits.
+class ThreadPerfCounters {
+ public:
+  ThreadPerfCounters() : leader_(-1), num_open_(0), depth_(0) {
+    for (int32 i = 0; i < kPerfNumCounters; ++i) {
+      fds_[i] = -1;
+      slots_[i] = -1;
+    }
+    const uint32 types[kPerfNumCounters] = {
+      PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+      PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE
+    };
+    const uint64 configs[kPerfNumCounters] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+      PERF_COUNT_HW_CACHE_MISSES,
+      PERF_COUNT_HW_BRANCH_MISSES
+    };
+    for (int32 i = 0; i < kPerfNumCounters; ++i) {
+      struct perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = types[i];
+      attr.config = configs[i];
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      int fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader_, 0);
+      if (fd < 0) {
+        if (i == kPerfCycles) {
+          return;  // No counters on this thread.
+        }
+        continue;
+      }
+      if (leader_ < 0) {
+        leader_ = fd;
+      }
+      fds_[i] = fd;
+      slots_[i] = num_open_++;
+    }
+  }
+
+  ~ThreadPerfCounters() {
+    for (int32 i = 0; i < kPerfNumCounters; ++i) {
+      if (fds_[i] >= 0) {
+        close(fds_[i]);
+      }
+    }
+  }
+
+  bool Available() const { return leader_ >= 0; }
+
+  // Reads all counters, -1 for those that could not be opened, and the times
+  // the group was enabled and actually counting. The group is scheduled as a
+  // whole, so the two times hold for every counter.
+  bool Read(int64* counts, uint64* enabled, uint64* running) const {
+    // Number of counters, the two times, then the counters.
+    uint64 buffer[kPerfNumCounters + 3];
+    ssize_t size = sizeof(uint64) * (num_open_ + 3);
+    if (read(leader_, buffer, size) != size) {
+      return false;
+    }
+    *enabled = buffer[1];
+    *running = buffer[2];
+    for (int32 i = 0; i < kPerfNumCounters; ++i) {
+      counts[i] = slots_[i] >= 0 ? static_cast<int64>(buffer[slots_[i] + 3])
+                                 : -1;
+    }
+    return true;
+  }
+
+  // Nesting depth of PerfCounterScope on this thread.
+  int32& Depth() { return depth_; }
+
+ private:
+  int leader_;
+  int fds_[kPerfNumCounters];
+  // Position of each counter in the group read, -1 if not open.
+  int32 slots_[kPerfNumCounters];
+  int32 num_open_;
+  int32 depth_;
+};
+
+static ThreadPerfCounters* GetThreadPerfCounters() {
+  static thread_local ThreadPerfCounters counters;
+  return &counters;
+}
+
+PerfCounterScope::PerfCounterScope(const char* name, const MatrixIndexT m,
+                                   const MatrixIndexT k, const MatrixIndexT n)
+    : name_(name), m_(m), k_(k), n_(n), active_(false), begin_enabled_(0),
+      begin_running_(0) {
+  ThreadPerfCounters* counters = GetThreadPerfCounters();
+  if (counters->Depth()++ > 0 || !counters->Available()) {
+    return;
+  }
+  active_ = counters->Read(begin_, &begin_enabled_, &begin_running_);
+}
+
+PerfCounterScope::~PerfCounterScope() {
+  ThreadPerfCounters* counters = GetThreadPerfCounters();
+  --counters->Depth();
+  int64 end[kPerfNumCounters];
+  uint64 end_enabled, end_running;
+  if (!active_ || !counters->Read(end, &end_enabled, &end_running)) {
+    return;
+  }
+  // If the counters were multiplexed during the scope, extrapolate them to the
+  // whole scope.
+  const uint64 enabled = end_enabled - begin_enabled_;
+  const uint64 running = end_running - begin_running_;
+  const double ratio = running > 0 ?
+      static_cast<double>(enabled) / running : 0.0;
+  PerfCounterKey key = {name_, m_, k_, n_};
+  std::lock_guard<std::mutex> lock(perf_mutex);
+  std::map<PerfCounterKey, PerfCounterStats>::iterator iter =
+      perf_stats.find(key);
+  if (iter == perf_stats.end()) {
+    PerfCounterStats stats;
+    stats.name = name_;
+    stats.m = m_;
+    stats.k = k_;
+    stats.n = n_;
+    stats.calls = 0;
+    for (int32 i = 0; i < kPerfNumCounters; ++i) {
+      stats.counts[i] = begin_[i] < 0 ? -1 : 0;
+    }
+    iter = perf_stats.insert(std::make_pair(key, stats)).first;
+  }
+  PerfCounterStats& stats = iter->second;
+  ++stats.calls;
+  for (int32 i = 0; i < kPerfNumCounters; ++i) {
+    if (stats.counts[i] >= 0 && begin_[i] >= 0) {
+      const int64 count = end[i] - begin_[i];
+      stats.counts[i] += running == enabled ? count :
+          static_cast<int64>(count * ratio + 0.5);
+    }
+  }
+}
+
+bool PerfCountersAvailable() {
+  return GetThreadPerfCounters()->Available();
+}
+
+void GetPerfCounterStats(std::vector<PerfCounterStats>* stats) {
+  SNOWBOY_ASSERT(stats != NULL);
+  stats->clear();
+  std::lock_guard<std::mutex> lock(perf_mutex);
+  for (std::map<PerfCounterKey, PerfCounterStats>::const_iterator iter =
+           perf_stats.begin(); iter != perf_stats.end(); ++iter) {
+    stats->push_back(iter->second);
+  }
+}
+
+void ResetPerfCounters() {
+  std::lock_guard<std::mutex> lock(perf_mutex);
+  perf_stats.clear();
+}
+
+#else
+
+bool PerfCountersAvailable() {
+  return false;
+}
+
+void GetPerfCounterStats(std::vector<PerfCounterStats>* stats) {
+  SNOWBOY_ASSERT(stats != NULL);
+  stats->clear();
+}
+
+void ResetPerfCounters() {}
+
+#endif  // SNOWBOY_PERF_COUNTERS
+
+}  // namespace snowboy
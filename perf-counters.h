@@ -0,0 +1,104 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+// Hardware performance counters around the matrix kernels, read with Linux
+// perf_event_open(), so no external tools are needed. Kernels open a scope
+// with SNOWBOY_PERF_SCOPE(name, m, k, n); the counts (cycles, instructions,
+// L1D read misses, LLC misses, branch misses) are aggregated per kernel name
+// and shape, and can be queried with GetPerfCounterStats().
+//
+// The scopes are compiled out entirely unless SNOWBOY_PERF_COUNTERS is
+// defined, e.g. with CXXFLAGS += -DSNOWBOY_PERF_COUNTERS. Scopes nest: only the
+// outermost scope of a thread is measured, so a kernel called by another one is
+// accounted to its caller. A nested scope does not read the counters, but
+// still updates a thread-local depth, so scopes go on the matrix-level entry
+// points, not on per-row kernels like VecVec() called from AddBitMatBitMat().
+//
+// Only the calling thread is counted, so for kernels that run on the thread
+// pool the counts cover the caller's share of the loop; use a pool without
+// workers to see the whole kernel. When more counters are opened than the CPU
+// has, the kernel multiplexes them; the counts of each scope are then scaled
+// by the time the group was enabled over the time it was counting, which is
+// an estimate, and scopes during which the group was never scheduled only add
+// to <calls>. Counters that the kernel or the CPU does not support, e.g. in a
+// VM or with perf_event_paranoid > 2, are reported as -1.
+
+#ifndef SNOWBOY_MATRIX_PERF_COUNTERS_H_
+#define SNOWBOY_MATRIX_PERF_COUNTERS_H_
+
+#include <vector>
+
+#include "matrix/matrix-common.h"
+#include "utils/snowboy-debug.h"
+#include "utils/snowboy-types.h"
+#include "utils/snowboy-utils.h"
+
+namespace snowboy {
+
+enum PerfCounterType {
+  kPerfCycles = 0,
+  kPerfInstructions,
+  kPerfL1DMisses,
+  kPerfLLCMisses,
+  kPerfBranchMisses,
+  kPerfNumCounters
+};
+
+// Totals of one kernel and shape, over <calls> outermost scopes.
+struct PerfCounterStats {
+  const char* name;
+  MatrixIndexT m;
+  MatrixIndexT k;
+  MatrixIndexT n;
+  int64 calls;
+  // Indexed by PerfCounterType, -1 if the counter is not available.
+  int64 counts[kPerfNumCounters];
+};
+
+// Returns true if SNOWBOY_PERF_COUNTERS is defined and the cycle counter can
+// be opened on the calling thread.
+bool PerfCountersAvailable();
+
+// Gets the totals of all kernels and shapes measured since the last
+// ResetPerfCounters(), sorted by name and shape.
+void GetPerfCounterStats(std::vector<PerfCounterStats>* stats);
+
+void ResetPerfCounters();
+
+#ifdef SNOWBOY_PERF_COUNTERS
+
+// Reads the counters of the calling thread on construction and destruction,
+// and adds the difference to the totals of <name> and the shape. <name> must
+// be a string literal, it is kept as is.
+class PerfCounterScope {
+ public:
+  PerfCounterScope(const char* name, const MatrixIndexT m,
+                   const MatrixIndexT k, const MatrixIndexT n);
+
+  ~PerfCounterScope();
+
+ private:
+  const char* name_;
+  MatrixIndexT m_;
+  MatrixIndexT k_;
+  MatrixIndexT n_;
+  bool active_;
+  int64 begin_[kPerfNumCounters];
+  // Times the counter group was enabled and running, for multiplexing.
+  uint64 begin_enabled_;
+  uint64 begin_running_;
+
+  SNOWBOY_DISALLOW_COPY_AND_ASSIGN(PerfCounterScope);
+};
+
+#define SNOWBOY_PERF_SCOPE(name, m, k, n) \
+  ::snowboy::PerfCounterScope snowboy_perf_scope_(name, m, k, n)
+
+#else
+
+#define SNOWBOY_PERF_SCOPE(name, m, k, n)
+
+#endif  // SNOWBOY_PERF_COUNTERS
+
+}  // namespace snowboy
+
+#endif  // SNOWBOY_MATRIX_PERF_COUNTERS_H_
@@ -0,0 +1,254 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "matrix/matrix-wrapper.h"
+#include "matrix/quantize-calibration.h"
+#include "utils/snowboy-debug.h"
+#include "utils/snowboy-io.h"
+
+namespace snowboy {
+
+QuantizeCalibrator::QuantizeCalibrator(const int32 num_bins) :
+    histogram_(num_bins, 0.0), range_(0.0f), abs_max_(0.0f), count_(0.0) {
+  // Merging bins in pairs needs an even number of bins.
+  SNOWBOY_ASSERT(num_bins >= 2 && num_bins % 2 == 0);
+}
+
+void QuantizeCalibrator::GrowRange(const float value) {
+  if (range_ == 0.0f) {
+    range_ = value;
+    return;
+  }
+  const size_t num_bins = histogram_.size();
+  while (range_ < value) {
+    for (size_t i = 0; i < num_bins / 2; ++i) {
+      histogram_[i] = histogram_[2 * i] + histogram_[2 * i + 1];
+    }
+    std::fill(histogram_.begin() + num_bins / 2, histogram_.end(), 0.0);
+    range_ *= 2;
+  }
+}
+
+void QuantizeCalibrator::Accumulate(const MatrixBase& mat) {
+  float mat_max = 0.0f;
+  for (MatrixIndexT r = 0; r < mat.NumRows(); ++r) {
+    const float* data = mat.RowData(r);
+    for (MatrixIndexT c = 0; c < mat.NumCols(); ++c) {
+      mat_max = std::max(mat_max, std::abs(data[c]));
+    }
+  }
+  if (!(mat_max < std::numeric_limits<float>::infinity())) {
+    SNOWBOY_ERROR << "Fail to calibrate: data is not finite.";
+  }
+  abs_max_ = std::max(abs_max_, mat_max);
+  if (mat_max > range_) {
+    GrowRange(mat_max);
+  }
+  if (range_ == 0.0f) {
+    // All zeros so far; they only count.
+    histogram_[0] += static_cast<double>(mat.NumRows()) * mat.NumCols();
+    count_ += static_cast<double>(mat.NumRows()) * mat.NumCols();
+    return;
+  }
+
+  const int32 last_bin = histogram_.size() - 1;
+  const float inv_width = 1.0f / BinWidth();
+  for (MatrixIndexT r = 0; r < mat.NumRows(); ++r) {
+    const float* data = mat.RowData(r);
+    for (MatrixIndexT c = 0; c < mat.NumCols(); ++c) {
+      int32 bin = static_cast<int32>(std::abs(data[c]) * inv_width);
+      histogram_[std::min(bin, last_bin)] += 1.0;
+    }
+  }
+  count_ += static_cast<double>(mat.NumRows()) * mat.NumCols();
+}
+
+void QuantizeCalibrator::Merge(const QuantizeCalibrator& other) {
+  SNOWBOY_ASSERT(histogram_.size() == other.histogram_.size());
+  if (other.count_ == 0.0) {
+    return;
+  }
+  // Brings both histograms to the larger range; the ranges of two
+  // calibrators need not be related by a power of two, so bins of the other
+  // one are re-binned by their centers.
+  GrowRange(other.range_);
+  const float width = BinWidth();
+  const float other_width = other.BinWidth();
+  const int32 last_bin = histogram_.size() - 1;
+  for (size_t i = 0; i < other.histogram_.size(); ++i) {
+    if (other.histogram_[i] == 0.0) {
+      continue;
+    }
+    int32 bin = width > 0.0f ?
+        static_cast<int32>((i + 0.5f) * other_width / width) : 0;
+    histogram_[std::min(bin, last_bin)] += other.histogram_[i];
+  }
+  abs_max_ = std::max(abs_max_, other.abs_max_);
+  count_ += other.count_;
+}
+
+float QuantizeCalibrator::KLClipValue(const int32 num_levels) const {
+  const int32 num_bins = histogram_.size();
+  if (num_levels >= num_bins) {
+    return abs_max_;
+  }
+
+  // Tries clipping after each bin from num_levels on, as in TensorRT: the
+  // reference P is the clipped histogram with the outliers added to its last
+  // bin, Q quantizes the first <i> bins to <num_levels> levels and spreads each
+  // level evenly over its non-empty bins.
+  std::vector<double> p(num_bins), q(num_bins);
+  double best_divergence = std::numeric_limits<double>::max();
+  int32 best_i = num_bins;
+  double outliers = 0.0;
+  for (int32 j = num_levels; j < num_bins; ++j) {
+    outliers += histogram_[j];
+  }
+  for (int32 i = num_levels; i <= num_bins; ++i) {
+    std::copy(histogram_.begin(), histogram_.begin() + i, p.begin());
+    p[i - 1] += outliers;
+    if (i < num_bins) {
+      outliers -= histogram_[i];
+    }
+
+    const double bins_per_level = static_cast<double>(i) / num_levels;
+    for (int32 level = 0; level < num_levels; ++level) {
+      int32 start = static_cast<int32>(level * bins_per_level);
+      int32 end = std::min(i, static_cast<int32>((level + 1) * bins_per_level));
+      if (level == num_levels - 1) {
+        end = i;
+      }
+      double sum = 0.0;
+      int32 non_empty = 0;
+      for (int32 b = start; b < end; ++b) {
+        sum += histogram_[b];
+        non_empty += histogram_[b] > 0.0;
+      }
+      for (int32 b = start; b < end; ++b) {
+        q[b] = histogram_[b] > 0.0 ? sum / non_empty : 0.0;
+      }
+    }
+
+    double p_sum = 0.0, q_sum = 0.0;
+    for (int32 b = 0; b < i; ++b) {
+      p_sum += p[b];
+      q_sum += q[b];
+    }
+    if (p_sum == 0.0 || q_sum == 0.0) {
+      continue;
+    }
+    double divergence = 0.0;
+    for (int32 b = 0; b < i; ++b) {
+      if (p[b] == 0.0) {
+        continue;
+      }
+      // An empty Q bin under a non-empty P bin (the outlier bin) gets a small
+      // probability instead of an infinite divergence.
+      double qb = q[b] > 0.0 ? q[b] / q_sum : 1e-10;
+      divergence += p[b] / p_sum * std::log(p[b] / p_sum / qb);
+    }
+    if (divergence < best_divergence) {
+      best_divergence = divergence;
+      best_i = i;
+    }
+  }
+  return std::min(abs_max_, best_i * BinWidth());
+}
+
+float QuantizeCalibrator::ClipValue(const QuantizeCalibrationType type,
+                                    const int32 quant_bits,
+                                    const float percentile) const {
+  SNOWBOY_ASSERT(quant_bits > 0 && quant_bits < 32);
+  if (count_ == 0.0 || range_ == 0.0f) {
+    return 0.0f;
+  }
+  switch (type) {
+    case kCalibrateAbsMax:
+      return abs_max_;
+    case kCalibratePercentile: {
+      SNOWBOY_ASSERT(percentile > 0.0f && percentile <= 100.0f);
+      const double target = count_ * percentile / 100.0;
+      double sum = 0.0;
+      for (size_t i = 0; i < histogram_.size(); ++i) {
+        sum += histogram_[i];
+        if (sum >= target) {
+          return std::min(abs_max_, (i + 1) * BinWidth());
+        }
+      }
+      return abs_max_;
+    }
+    case kCalibrateKL:
+      return KLClipValue(1 << quant_bits);
+    default:
+      SNOWBOY_ERROR << "Unknown calibration type " << type;
+  }
+  return abs_max_;
+}
+
+float QuantizeCalibrator::Scale(const QuantizeCalibrationType type,
+                                const int32 quant_bits,
+                                const float percentile) const {
+  if (quant_bits < 2) {
+    SNOWBOY_ERROR << "Fail to calibrate a scale for " << quant_bits
+        << "-bit codes: their threshold is at half the scale. Quantize them "
+        << "with kQuantizePerTensor or kQuantizePerRow instead.";
+  }
+  float clip = ClipValue(type, quant_bits, percentile);
+  if (clip <= 0.0f) {
+    return 1.0f;
+  }
+  return clip / ((1u << quant_bits) - 1);
+}
+
+void QuantizeCalibrator::Write(const bool binary, std::ostream* os) const {
+  SNOWBOY_ASSERT(os != NULL);
+  WriteToken(binary, "<QuantizeCalibrator>", os);
+  WriteToken(binary, "<NumBins>", os);
+  WriteBasicType(binary, static_cast<int32>(histogram_.size()), os);
+  WriteToken(binary, "<Range>", os);
+  WriteBasicType(binary, range_, os);
+  WriteToken(binary, "<AbsMax>", os);
+  WriteBasicType(binary, abs_max_, os);
+  WriteToken(binary, "<Count>", os);
+  WriteBasicType(binary, count_, os);
+  WriteToken(binary, "<Histogram>", os);
+  for (size_t i = 0; i < histogram_.size(); ++i) {
+    WriteBasicType(binary, histogram_[i], os);
+  }
+  WriteToken(binary, "</QuantizeCalibrator>", os);
+  if (!os->good()) {
+    SNOWBOY_ERROR << "Fail to write QuantizeCalibrator to stream.";
+  }
+}
+
+void QuantizeCalibrator::Read(const bool binary, std::istream* is) {
+  SNOWBOY_ASSERT(is != NULL);
+  int32 num_bins;
+  ExpectToken(binary, "<QuantizeCalibrator>", is);
+  ExpectToken(binary, "<NumBins>", is);
+  ReadBasicType(binary, &num_bins, is);
+  if (num_bins < 2 || num_bins % 2 != 0) {
+    SNOWBOY_ERROR << "Fail to read QuantizeCalibrator: bad number of bins "
+                  << num_bins;
+  }
+  histogram_.resize(num_bins);
+  ExpectToken(binary, "<Range>", is);
+  ReadBasicType(binary, &range_, is);
+  ExpectToken(binary, "<AbsMax>", is);
+  ReadBasicType(binary, &abs_max_, is);
+  ExpectToken(binary, "<Count>", is);
+  ReadBasicType(binary, &count_, is);
+  ExpectToken(binary, "<Histogram>", is);
+  for (int32 i = 0; i < num_bins; ++i) {
+    ReadBasicType(binary, &histogram_[i], is);
+  }
+  ExpectToken(binary, "</QuantizeCalibrator>", is);
+  if (is->fail()) {
+    SNOWBOY_ERROR << "Fail to read QuantizeCalibrator.";
+  }
+}
+
+}  // namespace snowboy
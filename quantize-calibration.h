@@ -0,0 +1,83 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#ifndef SNOWBOY_MATRIX_QUANTIZE_CALIBRATION_H_
+#define SNOWBOY_MATRIX_QUANTIZE_CALIBRATION_H_
+
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "matrix/matrix-common.h"
+#include "utils/snowboy-types.h"
+#include "utils/snowboy-utils.h"
+
+namespace snowboy {
+
+enum QuantizeCalibrationType {
+  kCalibrateAbsMax,     // Clips at the largest magnitude seen.
+  kCalibratePercentile, // Clips at a percentile of the magnitudes.
+  kCalibrateKL          // Clips where the KL divergence between the original
+                        // and the quantized distribution is smallest.
+};
+
+// Chooses the scale of a BitMatrix from representative data. Activations of
+// one layer (or its weights) are streamed through Accumulate(), which keeps a
+// histogram of their magnitudes; the histogram doubles its range whenever a
+// larger value comes in, so its size stays fixed. Scale() then picks a clip
+// value T and returns T / (2^quant_bits - 1), which is passed to BitMatrix and
+// written with it. Since BitMatrix codes are unsigned, negative values clip
+// to zero.
+//
+// 1-bit codes are not calibrated: static quantization packs round(x / scale),
+// a threshold at scale / 2, but decodes the codes as -scale and +scale, so a
+// clip value would send positive values below clip / 2 to -clip. 1-bit data
+// goes through kQuantizePerTensor or kQuantizePerRow instead, which put the
+// threshold at the middle of the range.
+class QuantizeCalibrator {
+ public:
+  explicit QuantizeCalibrator(const int32 num_bins = 2048);
+
+  // Adds the elements of <mat> to the statistics.
+  void Accumulate(const MatrixBase& mat);
+
+  // Merges the statistics of another calibrator, e.g. from another thread.
+  void Merge(const QuantizeCalibrator& other);
+
+  // Returns the clip value for <quant_bits>-bit codes. <percentile> is in
+  // (0, 100] and only used by kCalibratePercentile.
+  float ClipValue(const QuantizeCalibrationType type, const int32 quant_bits,
+                  const float percentile = 99.99f) const;
+
+  // Returns ClipValue() / (2^quant_bits - 1), or 1 if nothing was seen.
+  // <quant_bits> must be at least 2, see above.
+  float Scale(const QuantizeCalibrationType type, const int32 quant_bits,
+              const float percentile = 99.99f) const;
+
+  // Largest magnitude seen so far.
+  float AbsMax() const { return abs_max_; }
+
+  // Number of values seen so far.
+  double Count() const { return count_; }
+
+  void Read(const bool binary, std::istream* is);
+
+  void Write(const bool binary, std::ostream* os) const;
+
+ private:
+  // Doubles the range until it covers <value>, merging pairs of bins.
+  void GrowRange(const float value);
+
+  // Returns the clip value that minimizes the KL divergence.
+  float KLClipValue(const int32 num_levels) const;
+
+  float BinWidth() const { return range_ / histogram_.size(); }
+
+  std::vector<double> histogram_;
+  float range_;
+  float abs_max_;
+  double count_;
+};
+
+}  // namespace snowboy
+
+#endif  // SNOWBOY_MATRIX_QUANTIZE_CALIBRATION_H_
@@ -0,0 +1,502 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+// Micro-benchmarks of the matrix kernels. Sweeps the shapes out(batch, n) =
+// x(batch, k) * w(n, k)^T, times each kernel with wall time after warmup over
+// repeated runs, and reports the median and p99 time, GOPS and bytes/s. With
+// --json the results are written one per line, and with --baseline they are
+// compared against such a file from an earlier run, so regressions show up.
+// When built with SNOWBOY_PERF_COUNTERS and the counters can be opened, the
+// hardware counts per call are added to the results. --prefetch-rows and
+// --stream-bytes sweep the memory hints of the kernels, see kernel-tuning.h,
+// to pick the settings for a CPU. Run "make bench" to build,
+// run, and compare against snowboy-matrix-bench-baseline.json, and "make
+// bench_baseline" to update it.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "matrix/bit-matrix.h"
+#include "matrix/kernel-tuning.h"
+#include "matrix/matrix-memory.h"
+#include "matrix/matrix-wrapper.h"
+#include "matrix/perf-counters.h"
+#include "matrix/thread-pool.h"
+#include "matrix/vector-wrapper.h"
+
+namespace snowboy {
+
+struct BenchOptions {
+  int32 warmup;
+  int32 min_repeats;
+  int32 max_repeats;
+  double min_seconds;
+  double max_seconds;
+  double threshold;
+  std::vector<int32> batches;
+  std::vector<int32> ks;
+  std::vector<int32> ns;
+  std::vector<std::string> kernels;
+  // Settings of the kernel memory hints to sweep.
+  std::vector<int32> prefetch_rows;
+  std::vector<int64> stream_bytes;
+  std::string json;
+  std::string baseline;
+  HugePagePolicy huge_pages;
+
+  BenchOptions() : warmup(3), min_repeats(10), max_repeats(1000),
+                   min_seconds(0.2), max_seconds(2.0), threshold(0.1),
+                   huge_pages(kHugePagesOff) {
+    batches.push_back(1);
+    batches.push_back(16);
+    batches.push_back(256);
+    ks.push_back(64);
+    ks.push_back(512);
+    ks.push_back(4096);
+    ns = ks;
+    prefetch_rows.push_back(PrefetchRows());
+    stream_bytes.push_back(StreamingStoreBytes());
+  }
+};
+
+struct BenchResult {
+  std::string name;
+  int32 m;
+  int32 k;
+  int32 n;
+  int32 prefetch_rows;
+  int64 stream_bytes;
+  int32 repeats;
+  double median_us;
+  double p99_us;
+  double gops;
+  double gbytes_per_s;
+  // Per call, indexed by PerfCounterType, -1 if not available.
+  double counters[kPerfNumCounters];
+};
+
+static double NowSeconds() {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Results of runs with the default kernel hints are keyed without them, as
+// in files written before they could be swept.
+static std::string BenchKey(const std::string& name, int32 m, int32 k,
+                            int32 n, int32 prefetch_rows,
+                            int64 stream_bytes) {
+  std::ostringstream oss;
+  oss << name << " " << m << "x" << k << "x" << n;
+  if (prefetch_rows != PrefetchRows() ||
+      stream_bytes != StreamingStoreBytes()) {
+    oss << " pf=" << prefetch_rows << " nt=" << stream_bytes;
+  }
+  return oss.str();
+}
+
+// Times <func> and appends the result, unless --kernels excludes <name>.
+// <ops> and <bytes> are per call; bytes counts the data read and written once.
+static void RunBench(const BenchOptions& opts, const std::string& name,
+                     int32 m, int32 k, int32 n, double ops, double bytes,
+                     const std::function<void()>& func,
+                     std::vector<BenchResult>* results) {
+  if (!opts.kernels.empty() && std::find(opts.kernels.begin(),
+                                         opts.kernels.end(), name)
+      == opts.kernels.end()) {
+    return;
+  }
+  for (int32 i = 0; i < opts.warmup; ++i) {
+    func();
+  }
+  std::vector<double> samples;
+  ResetPerfCounters();
+  double start = NowSeconds();
+  while (true) {
+    double begin = NowSeconds();
+    func();
+    double end = NowSeconds();
+    samples.push_back(end - begin);
+    int32 repeats = samples.size();
+    double elapsed = end - start;
+    if ((repeats >= opts.min_repeats && elapsed >= opts.min_seconds) ||
+        repeats >= opts.max_repeats ||
+        (repeats >= 3 && elapsed >= opts.max_seconds)) {
+      break;
+    }
+  }
+  std::sort(samples.begin(), samples.end());
+  BenchResult result;
+  result.name = name;
+  result.m = m;
+  result.k = k;
+  result.n = n;
+  result.prefetch_rows = PrefetchRows();
+  result.stream_bytes = StreamingStoreBytes();
+  result.repeats = samples.size();
+  double median = samples[samples.size() / 2];
+  double p99 = samples[std::min<size_t>(samples.size() - 1,
+                                        (samples.size() * 99) / 100)];
+  result.median_us = median * 1e6;
+  result.p99_us = p99 * 1e6;
+  result.gops = ops / median * 1e-9;
+  result.gbytes_per_s = bytes / median * 1e-9;
+  // The timed calls are the only outermost kernel scopes since the reset.
+  std::vector<PerfCounterStats> stats;
+  GetPerfCounterStats(&stats);
+  for (int32 i = 0; i < kPerfNumCounters; ++i) {
+    double total = stats.empty() ? -1 : 0;
+    for (size_t s = 0; s < stats.size() && total >= 0; ++s) {
+      total = stats[s].counts[i] < 0 ? -1 : total + stats[s].counts[i];
+    }
+    result.counters[i] = total < 0 ? -1 : total / result.repeats;
+  }
+  results->push_back(result);
+
+  char line[256];
+  snprintf(line, sizeof(line),
+           "%-14s %5d %5d %5d %6d %12.2f %12.2f %9.3f %9.3f",
+           name.c_str(), m, k, n, result.repeats, result.median_us,
+           result.p99_us, result.gops, result.gbytes_per_s);
+  std::cout << line << std::endl;
+}
+
+// Runs every kernel on out(m, n) = x(m, k) * w(n, k)^T. <k> is a multiple of
+// 8, so the bit matrices pack 8 values per word.
+static void BenchShape(const BenchOptions& opts, int32 m, int32 k, int32 n,
+                       std::vector<BenchResult>* results) {
+  Matrix x(m, k), w(n, k), out(m, n), x_out(m, k);
+  x.SetRandomUniform();
+  w.SetRandomUniform();
+  BitMatrix x_bit(x, 8, 8);
+  BitMatrix w_bit(w, 1, 8);
+  const double mkn = 2.0 * m * k * n;
+  const double float_bytes = 4.0 * (m * k + n * k + m * n);
+
+  RunBench(opts, "MatMatRaw", m, k, n, mkn, float_bytes,
+           [&]() { out.MatMatRaw(x, w); }, results);
+  RunBench(opts, "AddMatMat", m, k, n, mkn, float_bytes,
+           [&]() { out.AddMatMat(1.0f, x, kNoTrans, w, kTrans, 0.0f); },
+           results);
+  RunBench(opts, "BitMatBitMat", m, k, n, mkn,
+           8.0 * (x_bit.NumRows() * x_bit.NumCols()
+                  + w_bit.NumRows() * w_bit.NumCols()) + 4.0 * m * n,
+           [&]() { BitMatBitMat(x_bit, w_bit, &out); }, results);
+  if (n == opts.ns[0]) {
+    // The conversions do not depend on n.
+    RunBench(opts, "Quantize", m, k, 0, 1.0 * m * k, 5.0 * m * k,
+             [&]() { x_bit.Quantize(x); }, results);
+    RunBench(opts, "ToMatrix", m, k, 0, 1.0 * m * k, 5.0 * m * k,
+             [&]() { x_bit.ToMatrix(&x_out); }, results);
+  }
+  if (m == opts.batches[0]) {
+    // GEMV, i.e. one frame through a layer, does not depend on the batch.
+    Vector vec(k), vec_out(n);
+    vec.SetRandomUniform();
+    RunBench(opts, "AddMatVec", 1, k, n, 2.0 * n * k,
+             4.0 * (n * k + k + n),
+             [&]() { vec_out.AddMatVec(1.0f, w, kNoTrans, vec, 0.0f); },
+             results);
+  }
+  if (opts.huge_pages != kHugePagesOff) {
+    HugePageStats stats;
+    GetHugePageStats(&stats);
+    char line[256];
+    snprintf(line, sizeof(line),
+             "huge pages: %.1f MiB hugetlb, %.1f of %.1f MiB madvised backed, "
+             "%lld fallbacks", stats.hugetlb_bytes / 1048576.0,
+             stats.transparent_bytes / 1048576.0,
+             stats.madvised_bytes / 1048576.0,
+             static_cast<long long>(stats.num_fallbacks));
+    std::cout << line << std::endl;
+  }
+}
+
+static void WriteJson(const std::vector<BenchResult>& results,
+                      const std::string& filename) {
+  std::ofstream os(filename.c_str());
+  if (!os.good()) {
+    SNOWBOY_ERROR << "Fail to open " << filename << " for writing.";
+  }
+  os << "{\"threads\": " << ThreadPool::Global()->NumThreads()
+     << ", \"benchmarks\": [" << std::endl;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult& r = results[i];
+    os << "{\"name\": \"" << r.name << "\", \"m\": " << r.m
+       << ", \"k\": " << r.k << ", \"n\": " << r.n
+       << ", \"prefetch_rows\": " << r.prefetch_rows
+       << ", \"stream_bytes\": " << r.stream_bytes
+       << ", \"repeats\": " << r.repeats
+       << ", \"median_us\": " << r.median_us
+       << ", \"p99_us\": " << r.p99_us
+       << ", \"gops\": " << r.gops
+       << ", \"gbytes_per_s\": " << r.gbytes_per_s;
+    if (r.counters[kPerfCycles] >= 0) {
+      const char* names[kPerfNumCounters] = {
+        "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+      };
+      for (int32 c = 0; c < kPerfNumCounters; ++c) {
+        os << ", \"" << names[c] << "\": " << r.counters[c];
+      }
+      if (r.counters[kPerfInstructions] >= 0 && r.counters[kPerfCycles] > 0) {
+        os << ", \"ipc\": "
+           << r.counters[kPerfInstructions] / r.counters[kPerfCycles];
+      }
+    }
+    os << "}"
+       << (i + 1 < results.size() ? "," : "") << std::endl;
+  }
+  os << "]}" << std::endl;
+}
+
+// Returns the number after "<key>": in <line>, or -1 if it is not there.
+static double JsonNumber(const std::string& line, const std::string& key) {
+  size_t pos = line.find("\"" + key + "\":");
+  if (pos == std::string::npos) {
+    return -1;
+  }
+  return std::atof(line.c_str() + pos + key.size() + 3);
+}
+
+// Reads the median times of a file written by WriteJson(), one benchmark per
+// line, keyed by BenchKey().
+static void ReadBaseline(const std::string& filename,
+                         std::map<std::string, double>* medians) {
+  std::ifstream is(filename.c_str());
+  if (!is.good()) {
+    SNOWBOY_ERROR << "Fail to open baseline " << filename;
+  }
+  std::string line;
+  while (std::getline(is, line)) {
+    size_t pos = line.find("\"name\": \"");
+    if (pos == std::string::npos) {
+      continue;
+    }
+    pos += 9;
+    std::string name = line.substr(pos, line.find('"', pos) - pos);
+    // Files from before the sweep ran with the defaults.
+    double prefetch_rows = JsonNumber(line, "prefetch_rows");
+    double stream_bytes = JsonNumber(line, "stream_bytes");
+    (*medians)[BenchKey(name, JsonNumber(line, "m"), JsonNumber(line, "k"),
+                        JsonNumber(line, "n"),
+                        prefetch_rows < 0 ? PrefetchRows() : prefetch_rows,
+                        stream_bytes < 0 ? StreamingStoreBytes()
+                                         : stream_bytes)] =
+        JsonNumber(line, "median_us");
+  }
+}
+
+// Prints the change of each median against the baseline, and returns the
+// number of benchmarks slower by more than --threshold.
+static int32 CompareBaseline(const BenchOptions& opts,
+                             const std::vector<BenchResult>& results) {
+  std::map<std::string, double> medians;
+  ReadBaseline(opts.baseline, &medians);
+  std::cout << std::endl << "Against " << opts.baseline << ":" << std::endl;
+  int32 num_regressions = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult& r = results[i];
+    std::string key = BenchKey(r.name, r.m, r.k, r.n, r.prefetch_rows,
+                               r.stream_bytes);
+    std::map<std::string, double>::const_iterator iter = medians.find(key);
+    if (iter == medians.end() || iter->second <= 0) {
+      continue;
+    }
+    double change = r.median_us / iter->second - 1.0;
+    bool regression = change > opts.threshold;
+    num_regressions += regression;
+    char line[256];
+    snprintf(line, sizeof(line), "%-32s %12.2f %12.2f %+8.1f%%%s",
+             key.c_str(), iter->second, r.median_us, 100 * change,
+             regression ? "  REGRESSION" : "");
+    std::cout << line << std::endl;
+  }
+  return num_regressions;
+}
+
+static std::vector<int32> ParseIntList(const std::string& value) {
+  std::vector<int32> list;
+  std::istringstream iss(value);
+  std::string item;
+  while (std::getline(iss, item, ',')) {
+    list.push_back(std::atoi(item.c_str()));
+  }
+  return list;
+}
+
+static std::vector<int64> ParseInt64List(const std::string& value) {
+  std::vector<int64> list;
+  std::istringstream iss(value);
+  std::string item;
+  while (std::getline(iss, item, ',')) {
+    list.push_back(std::atoll(item.c_str()));
+  }
+  return list;
+}
+
+static std::vector<std::string> ParseStringList(const std::string& value) {
+  std::vector<std::string> list;
+  std::istringstream iss(value);
+  std::string item;
+  while (std::getline(iss, item, ',')) {
+    list.push_back(item);
+  }
+  return list;
+}
+
+static void ParseOptions(int argc, char* argv[], BenchOptions* opts) {
+  const char* usage =
+      "Usage: snowboy-matrix-bench [options]\n"
+      "  --batch=1,16,256     rows of x\n"
+      "  --k=64,512,4096      inner dimensions, multiples of 8\n"
+      "  --n=64,512,4096      output columns\n"
+      "  --kernels=a,b        only runs these, e.g. BitMatBitMat,Quantize\n"
+      "  --warmup=3           untimed runs before timing\n"
+      "  --min-repeats=10     timed runs, at least\n"
+      "  --max-repeats=1000   timed runs, at most\n"
+      "  --min-seconds=0.2    time per benchmark, at least\n"
+      "  --max-seconds=2      time per benchmark, at most (3 runs minimum)\n"
+      "  --json=file          writes the results as JSON\n"
+      "  --baseline=file      compares against an earlier --json file\n"
+      "  --threshold=0.1      relative slowdown reported as a regression\n"
+      "  --huge-pages=off     off, thp or hugetlb, for buffers of 4 MiB+\n"
+      "  --prefetch-rows=0    rows prefetched ahead, 0 for none, e.g. 0,2,4,8\n"
+      "  --stream-bytes=67108864\n"
+      "                       outputs from this size use non-temporal\n"
+      "                       stores, 0 for none, e.g. 0,1\n";
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    size_t pos = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || pos == std::string::npos) {
+      std::cerr << usage;
+      SNOWBOY_ERROR << "Unknown argument " << arg;
+    }
+    std::string key = arg.substr(2, pos - 2);
+    std::string value = arg.substr(pos + 1);
+    if (key == "batch") {
+      opts->batches = ParseIntList(value);
+    } else if (key == "k") {
+      opts->ks = ParseIntList(value);
+    } else if (key == "n") {
+      opts->ns = ParseIntList(value);
+    } else if (key == "kernels") {
+      opts->kernels = ParseStringList(value);
+    } else if (key == "warmup") {
+      opts->warmup = std::atoi(value.c_str());
+    } else if (key == "min-repeats") {
+      opts->min_repeats = std::atoi(value.c_str());
+    } else if (key == "max-repeats") {
+      opts->max_repeats = std::atoi(value.c_str());
+    } else if (key == "min-seconds") {
+      opts->min_seconds = std::atof(value.c_str());
+    } else if (key == "max-seconds") {
+      opts->max_seconds = std::atof(value.c_str());
+    } else if (key == "json") {
+      opts->json = value;
+    } else if (key == "baseline") {
+      opts->baseline = value;
+    } else if (key == "huge-pages") {
+      if (value == "off") {
+        opts->huge_pages = kHugePagesOff;
+      } else if (value == "thp") {
+        opts->huge_pages = kHugePagesTransparent;
+      } else if (value == "hugetlb") {
+        opts->huge_pages = kHugePagesHugetlb;
+      } else {
+        SNOWBOY_ERROR << "--huge-pages must be off, thp or hugetlb.";
+      }
+    } else if (key == "prefetch-rows") {
+      opts->prefetch_rows = ParseIntList(value);
+    } else if (key == "stream-bytes") {
+      opts->stream_bytes = ParseInt64List(value);
+    } else if (key == "threshold") {
+      opts->threshold = std::atof(value.c_str());
+    } else {
+      std::cerr << usage;
+      SNOWBOY_ERROR << "Unknown option --" << key;
+    }
+  }
+  if (opts->batches.empty() || opts->ks.empty() || opts->ns.empty() ||
+      opts->prefetch_rows.empty() || opts->stream_bytes.empty()) {
+    SNOWBOY_ERROR << "--batch, --k, --n, --prefetch-rows and --stream-bytes "
+        << "must not be empty.";
+  }
+  for (size_t i = 0; i < opts->prefetch_rows.size(); ++i) {
+    if (opts->prefetch_rows[i] < 0) {
+      SNOWBOY_ERROR << "--prefetch-rows must not be negative, got "
+          << opts->prefetch_rows[i];
+    }
+  }
+  for (size_t i = 0; i < opts->stream_bytes.size(); ++i) {
+    if (opts->stream_bytes[i] < 0) {
+      SNOWBOY_ERROR << "--stream-bytes must not be negative, got "
+          << opts->stream_bytes[i];
+    }
+  }
+  for (size_t i = 0; i < opts->ks.size(); ++i) {
+    if (opts->ks[i] <= 0 || opts->ks[i] % 8 != 0) {
+      SNOWBOY_ERROR << "--k must be positive multiples of 8, got "
+          << opts->ks[i];
+    }
+  }
+}
+
+}  // namespace snowboy
+
+int main(int argc, char* argv[]) {
+  using namespace snowboy;
+  BenchOptions opts;
+  ParseOptions(argc, argv, &opts);
+  SetHugePagePolicy(opts.huge_pages);
+
+  std::cout << "threads: " << ThreadPool::Global()->NumThreads() << std::endl;
+  char header[256];
+  snprintf(header, sizeof(header), "%-14s %5s %5s %5s %6s %12s %12s %9s %9s",
+           "kernel", "m", "k", "n", "reps", "median_us", "p99_us", "GOPS",
+           "GB/s");
+  std::cout << header << std::endl;
+  // The defaults, to restore after each setting, as BenchKey() tells the
+  // results of other settings apart by them.
+  const int32 default_prefetch_rows = PrefetchRows();
+  const int64 default_stream_bytes = StreamingStoreBytes();
+  const bool sweep = opts.prefetch_rows.size() > 1 ||
+      opts.stream_bytes.size() > 1;
+  std::vector<BenchResult> results;
+  for (size_t p = 0; p < opts.prefetch_rows.size(); ++p) {
+    for (size_t s = 0; s < opts.stream_bytes.size(); ++s) {
+      SetPrefetchRows(opts.prefetch_rows[p]);
+      SetStreamingStoreBytes(opts.stream_bytes[s]);
+      if (sweep || opts.prefetch_rows[p] != default_prefetch_rows ||
+          opts.stream_bytes[s] != default_stream_bytes) {
+        std::cout << "prefetch rows: " << opts.prefetch_rows[p]
+                  << ", streaming stores from: " << opts.stream_bytes[s]
+                  << " bytes" << std::endl;
+      }
+      for (size_t b = 0; b < opts.batches.size(); ++b) {
+        for (size_t k = 0; k < opts.ks.size(); ++k) {
+          for (size_t n = 0; n < opts.ns.size(); ++n) {
+            BenchShape(opts, opts.batches[b], opts.ks[k], opts.ns[n],
+                       &results);
+          }
+        }
+      }
+    }
+  }
+  SetPrefetchRows(default_prefetch_rows);
+  SetStreamingStoreBytes(default_stream_bytes);
+
+  if (!opts.json.empty()) {
+    WriteJson(results, opts.json);
+  }
+  if (!opts.baseline.empty() && CompareBaseline(opts, results) > 0) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,390 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+// End-to-end streaming benchmark. Builds a feed-forward network with the
+// shapes of a hotword model, and feeds synthetic frames through it one at a
+// time with the per-frame call sequence of the detector: quantize, multiply,
+// bias, activation, and softmax on the output. Reports p50/p95/p99/p99.9
+// latency per frame and the number of heap allocations per frame. With
+// --streams=N, N streams run concurrently on their own threads and share the
+// weights, as in a server; with --frame-ms each stream is paced at the frame
+// rate and latency is measured from the time the frame was due, so backlog
+// counts against it. --trace writes the kernel calls of the timed frames as a
+// Chrome trace, see trace-events.h. --no-alloc runs each timed frame in a
+// NoAllocationScope that aborts with a backtrace on the first heap
+// allocation, see matrix-memory.h.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "matrix/bit-matrix.h"
+#include "matrix/matrix-memory.h"
+#include "matrix/matrix-wrapper.h"
+#include "matrix/thread-pool.h"
+#include "matrix/trace-events.h"
+#include "matrix/vector-wrapper.h"
+
+// Counts the heap allocations of each thread: operator new, and also
+// posix_memalign(), which is what SnowboyMemalign() calls, on glibc. Not
+// inlined, so the compiler does not pair malloc() with delete.
+static thread_local long long g_num_allocs = 0;
+static thread_local long long g_alloc_bytes = 0;
+
+__attribute__((noinline)) void* operator new(size_t size) {
+  snowboy::CheckNoAllocationScope(size);
+  ++g_num_allocs;
+  g_alloc_bytes += size;
+  void* p = std::malloc(size > 0 ? size : 1);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+
+#if defined(__GLIBC__)
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+
+extern "C" int posix_memalign(void** p, size_t alignment, size_t size) {
+  ++g_num_allocs;
+  g_alloc_bytes += size;
+  *p = __libc_memalign(alignment, size);
+  return *p == NULL ? ENOMEM : 0;
+}
+#endif
+
+namespace snowboy {
+
+struct StreamBenchOptions {
+  int32 input_dim;
+  int32 hidden_dim;
+  int32 num_hidden;
+  int32 output_dim;
+  int32 streams;
+  int32 frames;
+  int32 warmup_frames;
+  double frame_ms;
+  bool use_float;
+  bool no_alloc;
+  std::string json;
+  std::string trace;
+
+  StreamBenchOptions() : input_dim(400), hidden_dim(512), num_hidden(3),
+                         output_dim(128), streams(1), frames(5000),
+                         warmup_frames(100), frame_ms(0), use_float(false),
+                         no_alloc(false) {}
+};
+
+// Read-only weights, shared by all streams.
+struct StreamNetwork {
+  std::vector<Matrix*> weights;
+  std::vector<BitMatrix*> bit_weights;
+  std::vector<Vector*> biases;
+
+  ~StreamNetwork() {
+    for (size_t l = 0; l < weights.size(); ++l) {
+      delete weights[l];
+      delete bit_weights[l];
+      delete biases[l];
+    }
+  }
+};
+
+// Per-stream buffers, allocated once before the first frame.
+struct StreamState {
+  Matrix frame;
+  std::vector<BitMatrix*> inputs;
+  std::vector<Matrix*> outputs;
+
+  ~StreamState() {
+    for (size_t l = 0; l < outputs.size(); ++l) {
+      delete inputs[l];
+      delete outputs[l];
+    }
+  }
+};
+
+struct StreamStats {
+  std::vector<double> latencies_us;
+  std::vector<long long> allocs;
+  std::vector<long long> alloc_bytes;
+};
+
+static void BuildNetwork(const StreamBenchOptions& opts, StreamNetwork* net) {
+  std::vector<int32> dims;
+  dims.push_back(opts.input_dim);
+  for (int32 l = 0; l < opts.num_hidden; ++l) {
+    dims.push_back(opts.hidden_dim);
+  }
+  dims.push_back(opts.output_dim);
+  for (size_t l = 0; l + 1 < dims.size(); ++l) {
+    Matrix* weight = new Matrix(dims[l + 1], dims[l]);
+    weight->SetRandomUniform();
+    Vector* bias = new Vector(dims[l + 1]);
+    bias->SetRandomGaussian();
+    net->weights.push_back(weight);
+    net->bit_weights.push_back(new BitMatrix(*weight, 1, 8));
+    net->biases.push_back(bias);
+  }
+}
+
+static void InitState(const StreamNetwork& net, StreamState* state) {
+  state->frame.Resize(1, net.weights[0]->NumCols());
+  for (size_t l = 0; l < net.weights.size(); ++l) {
+    Matrix input(1, net.weights[l]->NumCols());
+    state->inputs.push_back(new BitMatrix(input, 8, 8));
+    state->outputs.push_back(new Matrix(1, net.weights[l]->NumRows()));
+  }
+}
+
+// One frame through the network, the call sequence of the detector.
+static void ProcessFrame(const StreamBenchOptions& opts,
+                         const StreamNetwork& net, StreamState* state) {
+  SNOWBOY_TRACE_SCOPE("Frame", 1, state->frame.NumCols(), 0, 0);
+  const MatrixBase* in = &state->frame;
+  const size_t num_layers = net.weights.size();
+  for (size_t l = 0; l < num_layers; ++l) {
+    Matrix* out = state->outputs[l];
+    if (opts.use_float) {
+      out->AddMatMat(1.0f, *in, kNoTrans, *net.weights[l], kTrans, 0.0f);
+    } else {
+      state->inputs[l]->Quantize(*in, kQuantizePerRow);
+      BitMatBitMat(*state->inputs[l], *net.bit_weights[l], out);
+    }
+    out->AddVecToRows(1.0f, *net.biases[l]);
+    if (l + 1 < num_layers) {
+      out->ApplyFloor(0.0f);
+    } else {
+      out->ApplySoftmaxPerRow();
+    }
+    in = out;
+  }
+}
+
+static double NowSeconds() {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void RunStream(const StreamBenchOptions& opts, const StreamNetwork& net,
+                      StreamStats* stats) {
+  StreamState state;
+  InitState(net, &state);
+  stats->latencies_us.reserve(opts.frames);
+  stats->allocs.reserve(opts.frames);
+  stats->alloc_bytes.reserve(opts.frames);
+
+  const double frame_seconds = opts.frame_ms * 1e-3;
+  double due = NowSeconds();
+  for (int32 f = -opts.warmup_frames; f < opts.frames; ++f) {
+    // Synthetic features, so that the quantization ranges vary.
+    state.frame.SetRandomGaussian();
+    if (frame_seconds > 0) {
+      due += frame_seconds;
+      double wait = due - NowSeconds();
+      if (wait > 0) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+      }
+    }
+    if (f == 0 && !opts.trace.empty()) {
+      SetTracingEnabled(true);
+    }
+    long long allocs = g_num_allocs;
+    long long alloc_bytes = g_alloc_bytes;
+    double begin = frame_seconds > 0 ? due : NowSeconds();
+    if (f >= 0 && opts.no_alloc) {
+      NoAllocationScope no_allocation;
+      ProcessFrame(opts, net, &state);
+    } else {
+      ProcessFrame(opts, net, &state);
+    }
+    double end = NowSeconds();
+    if (f >= 0) {
+      stats->latencies_us.push_back((end - begin) * 1e6);
+      stats->allocs.push_back(g_num_allocs - allocs);
+      stats->alloc_bytes.push_back(g_alloc_bytes - alloc_bytes);
+    }
+  }
+}
+
+static double Percentile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t index = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static void ParseOptions(int argc, char* argv[], StreamBenchOptions* opts) {
+  const char* usage =
+      "Usage: snowboy-matrix-stream-bench [options]\n"
+      "  --input-dim=400      features per frame\n"
+      "  --hidden-dim=512     units per hidden layer, a multiple of 8\n"
+      "  --num-hidden=3       hidden layers\n"
+      "  --output-dim=128     softmax outputs\n"
+      "  --streams=1          concurrent streams, one thread each\n"
+      "  --frames=5000        timed frames per stream\n"
+      "  --warmup-frames=100  untimed frames per stream\n"
+      "  --frame-ms=0         paces each stream, 0 runs back to back\n"
+      "  --float=false        float weights instead of BitMatrix\n"
+      "  --no-alloc=false     aborts on any allocation in a timed frame\n"
+      "  --json=file          writes the results as JSON\n"
+      "  --trace=file         writes a Chrome trace of the timed frames\n";
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    size_t pos = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || pos == std::string::npos) {
+      std::cerr << usage;
+      SNOWBOY_ERROR << "Unknown argument " << arg;
+    }
+    std::string key = arg.substr(2, pos - 2);
+    std::string value = arg.substr(pos + 1);
+    if (key == "input-dim") {
+      opts->input_dim = std::atoi(value.c_str());
+    } else if (key == "hidden-dim") {
+      opts->hidden_dim = std::atoi(value.c_str());
+    } else if (key == "num-hidden") {
+      opts->num_hidden = std::atoi(value.c_str());
+    } else if (key == "output-dim") {
+      opts->output_dim = std::atoi(value.c_str());
+    } else if (key == "streams") {
+      opts->streams = std::atoi(value.c_str());
+    } else if (key == "frames") {
+      opts->frames = std::atoi(value.c_str());
+    } else if (key == "warmup-frames") {
+      opts->warmup_frames = std::atoi(value.c_str());
+    } else if (key == "frame-ms") {
+      opts->frame_ms = std::atof(value.c_str());
+    } else if (key == "float") {
+      opts->use_float = (value == "true" || value == "1");
+    } else if (key == "no-alloc") {
+      opts->no_alloc = (value == "true" || value == "1");
+    } else if (key == "json") {
+      opts->json = value;
+    } else if (key == "trace") {
+      opts->trace = value;
+    } else {
+      std::cerr << usage;
+      SNOWBOY_ERROR << "Unknown option --" << key;
+    }
+  }
+  if (opts->input_dim % 8 != 0 || opts->hidden_dim % 8 != 0) {
+    SNOWBOY_ERROR << "--input-dim and --hidden-dim must be multiples of 8, "
+        << "as BitMatrix packs 8 values per word.";
+  }
+  if (opts->streams < 1 || opts->frames < 1) {
+    SNOWBOY_ERROR << "--streams and --frames must be positive.";
+  }
+  if (opts->no_alloc && !opts->trace.empty()) {
+    SNOWBOY_ERROR << "--no-alloc does not work with --trace, which allocates "
+        << "its buffers in the first traced frame.";
+  }
+}
+
+}  // namespace snowboy
+
+int main(int argc, char* argv[]) {
+  using namespace snowboy;
+  StreamBenchOptions opts;
+  ParseOptions(argc, argv, &opts);
+  SetNoAllocationAbort(opts.no_alloc);
+  // The library runs serially until the global pool exists.
+  ThreadPool::Global();
+
+  StreamNetwork net;
+  BuildNetwork(opts, &net);
+
+  std::vector<StreamStats> stats(opts.streams);
+  if (opts.streams == 1) {
+    RunStream(opts, net, &stats[0]);
+  } else {
+    std::vector<std::thread> threads;
+    for (int32 s = 0; s < opts.streams; ++s) {
+      threads.push_back(std::thread(RunStream, std::cref(opts), std::cref(net),
+                                    &stats[s]));
+    }
+    for (size_t s = 0; s < threads.size(); ++s) {
+      threads[s].join();
+    }
+  }
+
+  if (!opts.trace.empty()) {
+    SetTracingEnabled(false);
+    std::ofstream os(opts.trace.c_str());
+    if (!os.good()) {
+      SNOWBOY_ERROR << "Fail to open " << opts.trace << " for writing.";
+    }
+    WriteChromeTrace(&os);
+  }
+
+  std::vector<double> latencies;
+  long long total_allocs = 0, total_bytes = 0, max_allocs = 0;
+  for (size_t s = 0; s < stats.size(); ++s) {
+    latencies.insert(latencies.end(), stats[s].latencies_us.begin(),
+                     stats[s].latencies_us.end());
+    for (size_t f = 0; f < stats[s].allocs.size(); ++f) {
+      total_allocs += stats[s].allocs[f];
+      total_bytes += stats[s].alloc_bytes[f];
+      max_allocs = std::max(max_allocs, stats[s].allocs[f]);
+    }
+  }
+  std::sort(latencies.begin(), latencies.end());
+  const double num_frames = latencies.size();
+  const double p50 = Percentile(latencies, 50);
+  const double p95 = Percentile(latencies, 95);
+  const double p99 = Percentile(latencies, 99);
+  const double p999 = Percentile(latencies, 99.9);
+  const double max = latencies.back();
+
+  MatrixMemoryStats memory;
+  GetMatrixMemoryStats(&memory);
+  char line[512];
+  snprintf(line, sizeof(line),
+           "%s, %d hidden x %d, %d streams, %d frames each\n"
+           "latency_us: p50 %.2f  p95 %.2f  p99 %.2f  p99.9 %.2f  max %.2f\n"
+           "allocations per frame: mean %.2f  max %lld  bytes %.1f\n"
+           "matrix memory: %.1f KiB in use, %.1f KiB peak",
+           opts.use_float ? "float" : "bit", opts.num_hidden, opts.hidden_dim,
+           opts.streams, opts.frames, p50, p95, p99, p999, max,
+           total_allocs / num_frames, max_allocs, total_bytes / num_frames,
+           memory.bytes_in_use / 1024.0, memory.peak_bytes_in_use / 1024.0);
+  std::cout << line << std::endl;
+
+  if (!opts.json.empty()) {
+    std::ofstream os(opts.json.c_str());
+    if (!os.good()) {
+      SNOWBOY_ERROR << "Fail to open " << opts.json << " for writing.";
+    }
+    os << "{\"name\": \"" << (opts.use_float ? "stream_float" : "stream_bit")
+       << "\", \"streams\": " << opts.streams
+       << ", \"frames\": " << opts.frames
+       << ", \"p50_us\": " << p50 << ", \"p95_us\": " << p95
+       << ", \"p99_us\": " << p99 << ", \"p999_us\": " << p999
+       << ", \"max_us\": " << max
+       << ", \"allocs_per_frame\": " << total_allocs / num_frames
+       << ", \"max_allocs_per_frame\": " << max_allocs
+       << ", \"alloc_bytes_per_frame\": " << total_bytes / num_frames
+       << ", \"peak_matrix_bytes\": " << memory.peak_bytes_in_use << "}"
+       << std::endl;
+  }
+  return 0;
+}
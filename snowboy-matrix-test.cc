@@ -1,10 +1,47 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "matrix/bit-matrix.h"
+#include "matrix/fixed-point.h"
+#include "matrix/half-matrix.h"
+#include "matrix/half-vector.h"
+#include "matrix/kernel-tuning.h"
+#include "matrix/matrix-expression.h"
+#include "matrix/matrix-memory.h"
 #include "matrix/matrix-wrapper.h"
+#include "matrix/numa.h"
+#include "matrix/perf-counters.h"
+#include "matrix/quantize-calibration.h"
+#include "matrix/thread-pool.h"
+#include "matrix/trace-events.h"
 #include "matrix/vector-wrapper.h"
 #include "utils/snowboy-math.h"
 
+// Reports heap allocations inside a NoAllocationScope, as an application that
+// replaces operator new would, so that TestMatrixMemory() also catches those
+// that do not go through MatrixMemalign().
+void* operator new(size_t size) {
+  snowboy::CheckNoAllocationScope(size);
+  void* p = std::malloc(size > 0 ? size : 1);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
 namespace snowboy {
 
 void Print(const VectorBase& vec) {
@@ -127,6 +164,84 @@ bool TestMatrixAddMatMat(const float tolerance) {
   return true;
 }
 
+bool TestMatrixAddMatMatBiasAct(const float tolerance) {
+  MatrixActivationType acts[] = {kNoActivation, kRelu, kClippedRelu,
+                                 kSigmoid, kTanh};
+  for (int32 i = 0; i < 10; ++i) {
+    int32 num_rows = static_cast<int32>(100 * RandomUniform());
+    int32 num_cols = static_cast<int32>(100 * RandomUniform());
+    int32 num_connect = static_cast<int32>(100 * RandomUniform());
+    num_rows = num_rows > 0 ? num_rows : 10;
+    num_cols = num_cols > 0 ? num_cols : 10;
+    num_connect = num_connect > 0 ? num_connect : 10;
+    Matrix mat1(num_rows, num_connect);
+    Matrix mat2(num_cols, num_connect);
+    Vector bias(num_cols);
+    mat1.SetRandomGaussian();
+    mat2.SetRandomGaussian();
+    bias.SetRandomGaussian();
+
+    MatrixActivationType act = acts[i % 5];
+    float alpha = RandomGaussian();
+    Matrix mat3(num_rows, num_cols);
+    Matrix mat4(num_rows, num_cols);
+    mat3.AddMatMatBiasAct(alpha, mat1, kNoTrans, mat2, kTrans, bias, act, 6.0f);
+    mat4.AddMatMat(alpha, mat1, kNoTrans, mat2, kTrans, 0.0f);
+    mat4.AddVecToRows(1.0f, bias);
+    for (int32 r = 0; r < mat4.NumRows(); ++r) {
+      for (int32 c = 0; c < mat4.NumCols(); ++c) {
+        float x = mat4(r, c);
+        if (act == kRelu) {
+          x = std::max(x, 0.0f);
+        } else if (act == kClippedRelu) {
+          x = std::min(std::max(x, 0.0f), 6.0f);
+        } else if (act == kSigmoid) {
+          x = 1.0f / (1.0f + std::exp(-x));
+        } else if (act == kTanh) {
+          x = std::tanh(x);
+        }
+        mat4(r, c) = x;
+      }
+    }
+
+    if (!IsEqual(tolerance, mat3, mat4)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TestMatrixAssign(const float tolerance) {
+  for (int32 i = 0; i < 10; ++i) {
+    int32 num_rows = static_cast<int32>(100 * RandomUniform());
+    int32 num_cols = static_cast<int32>(100 * RandomUniform());
+    num_rows = num_rows > 0 ? num_rows : 10;
+    num_cols = num_cols > 0 ? num_cols : 10;
+    Matrix mat(num_rows + 1, num_cols + 1);
+    mat.SetRandomGaussian();
+    Vector bias(num_cols);
+    bias.SetRandomGaussian();
+
+    // Works on a view, so the stride is not the number of columns.
+    Matrix mat1(mat);
+    Matrix mat2(mat);
+    SubMatrix sub1(mat1.Range(1, num_rows, 1, num_cols));
+    SubMatrix sub2(mat2.Range(1, num_rows, 1, num_cols));
+    float alpha = RandomGaussian();
+    sub1.Assign(min(max(alpha * sub1 + bias, 0.0f), 1.0f));
+    sub2.Scale(alpha);
+    sub2.AddVecToRows(1.0f, bias);
+    sub2.ApplyRange(0.0f, 1.0f);
+
+    if (!IsEqual(tolerance, mat1, mat2)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
 bool TestMatrixAddVecVec(const float tolerance) {
   for (int32 i = 0; i < 10; ++i) {
     int32 num_rows = static_cast<int32>(100 * RandomUniform());
@@ -164,6 +279,1252 @@ bool TestMatrixAddVecVec(const float tolerance) {
   return true;
 }
 
+bool TestMatrixTranspose(const float tolerance) {
+  for (int32 i = 0; i < 10; ++i) {
+    int32 num_rows = static_cast<int32>(100 * RandomUniform());
+    int32 num_cols = static_cast<int32>(100 * RandomUniform());
+    num_rows = num_rows > 0 ? num_rows : 10;
+    num_cols = num_cols > 0 ? num_cols : 10;
+    if (i % 2 == 0) {
+      num_cols = num_rows;
+    }
+    Matrix mat(num_rows, num_cols);
+    mat.SetRandomGaussian();
+
+    Matrix mat1(mat);
+    Matrix mat2(mat, kTrans);
+    Matrix mat3(num_cols, num_rows);
+    for (int32 r = 0; r < mat3.NumRows(); ++r) {
+      for (int32 c = 0; c < mat3.NumCols(); ++c) {
+        mat3(r, c) = mat(c, r);
+      }
+    }
+    mat1.Transpose();
+
+    if (!IsEqual(tolerance, mat1, mat3) || !IsEqual(tolerance, mat2, mat3)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+  }
+
+  // Non-square matrices whose sizes are multiples of the padding fit in their
+  // own allocation once transposed, so they are transposed in place.
+  const int32 sizes[][2] = {{16, 48}, {48, 16}, {32, 80}, {64, 16}};
+  for (int32 i = 0; i < 4; ++i) {
+    Matrix mat(sizes[i][0], sizes[i][1]);
+    mat.SetRandomGaussian();
+    Matrix mat1(mat);
+    Matrix mat2(mat, kTrans);
+    const float *data = mat1.Data();
+    mat1.Transpose();
+    if (mat1.Data() != data || !IsEqual(0.0f, mat1, mat2)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TestMatrixApplySoftmaxPerRow(const float tolerance) {
+  for (int32 i = 0; i < 10; ++i) {
+    int32 num_rows = static_cast<int32>(100 * RandomUniform());
+    int32 num_cols = static_cast<int32>(100 * RandomUniform());
+    num_rows = num_rows > 0 ? num_rows : 10;
+    num_cols = num_cols > 0 ? num_cols : 10;
+    Matrix mat(num_rows, num_cols);
+    mat.SetRandomGaussian();
+    mat.Scale(10.0f);
+
+    Matrix mat1(mat);
+    Matrix mat2(mat);
+    Matrix mat3(mat);
+    mat1.ApplySoftmaxPerRow();
+    mat2.ApplyLogSoftmaxPerRow();
+    for (int32 r = 0; r < mat3.NumRows(); ++r) {
+      float max = mat3.Row(r).Max(), sum = 0.0f;
+      for (int32 c = 0; c < mat3.NumCols(); ++c) {
+        sum += std::exp(mat3(r, c) - max);
+      }
+      for (int32 c = 0; c < mat3.NumCols(); ++c) {
+        mat3(r, c) = mat3(r, c) - max - std::log(sum);
+      }
+    }
+
+    if (!IsEqual(tolerance, mat2, mat3)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+    mat2.Row(0).CopyFromVec(mat.Row(0));
+    float normalizer = mat2.Row(0).ApplySoftmax();
+    for (int32 r = 0; r < mat3.NumRows(); ++r) {
+      for (int32 c = 0; c < mat3.NumCols(); ++c) {
+        mat3(r, c) = std::exp(mat3(r, c));
+      }
+    }
+    if (!IsEqual(tolerance, mat1, mat3)
+        || std::abs(normalizer - (mat(0, 0) - std::log(mat3(0, 0))))
+        > tolerance) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TestMatrixSpliceRows(const float tolerance) {
+  for (int32 i = 0; i < 10; ++i) {
+    int32 num_splice = static_cast<int32>(10 * RandomUniform());
+    int32 num_frames = static_cast<int32>(100 * RandomUniform());
+    int32 num_cols = static_cast<int32>(100 * RandomUniform());
+    num_splice = num_splice > 0 ? num_splice : 5;
+    num_frames = num_frames > num_splice ? num_frames : 10 + num_splice;
+    num_cols = num_cols > 0 ? num_cols : 10;
+    int32 num_rows = num_frames - num_splice + 1;
+
+    // Spliced views require contiguous rows.
+    Vector feats_data(num_frames * num_cols);
+    feats_data.SetRandomGaussian();
+    SubMatrix feats(feats_data.Data(), num_frames, num_cols, num_cols);
+    SubMatrix view = feats.SpliceRows(0, num_rows, num_splice);
+
+    // Materializes the spliced matrix.
+    Matrix spliced(num_rows, num_splice * num_cols);
+    for (int32 s = 0; s < num_splice; ++s) {
+      std::vector<MatrixIndexT> indices(num_rows);
+      for (int32 r = 0; r < num_rows; ++r) {
+        indices[r] = r + s;
+      }
+      spliced.ColRange(s * num_cols, num_cols).CopyRows(feats, indices);
+    }
+
+    int32 num_outputs = static_cast<int32>(100 * RandomUniform());
+    num_outputs = num_outputs > 0 ? num_outputs : 10;
+    Matrix weights(num_outputs, num_splice * num_cols);
+    weights.SetRandomGaussian();
+
+    Matrix mat1(num_rows, num_outputs);
+    Matrix mat2(num_rows, num_outputs);
+    mat1.AddMatMat(1.0f, view, kNoTrans, weights, kTrans, 0.0f);
+    mat2.AddMatMat(1.0f, spliced, kNoTrans, weights, kTrans, 0.0f);
+
+    Matrix mat3(num_splice * num_cols, num_outputs);
+    Matrix mat4(num_splice * num_cols, num_outputs);
+    mat3.AddMatMat(1.0f, view, kTrans, mat1, kNoTrans, 0.0f);
+    mat4.AddMatMat(1.0f, spliced, kTrans, mat1, kNoTrans, 0.0f);
+
+    Vector vec1(num_outputs);
+    Vector vec2(num_outputs);
+    vec1.AddMatVec(1.0f, weights, kNoTrans, view.Row(0), 0.0f);
+    vec2.AddMatVec(1.0f, weights, kNoTrans, spliced.Row(0), 0.0f);
+
+    if (!IsEqual(tolerance, mat1, mat2) || !IsEqual(tolerance, mat3, mat4)
+        || !IsEqual(tolerance, vec1, vec2)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+
+    // The spliced view as the second operand: its columns index the output
+    // columns without transpose, and the inner dimension with it.
+    Matrix mat5(num_outputs, num_splice * num_cols);
+    Matrix mat6(num_outputs, num_splice * num_cols);
+    mat5.AddMatMat(1.0f, mat1, kTrans, view, kNoTrans, 0.0f);
+    mat6.AddMatMat(1.0f, mat1, kTrans, spliced, kNoTrans, 0.0f);
+    Matrix mat7(num_outputs, num_rows);
+    Matrix mat8(num_outputs, num_rows);
+    mat7.AddMatMat(1.0f, weights, kNoTrans, view, kTrans, 0.0f);
+    mat8.AddMatMat(1.0f, weights, kNoTrans, spliced, kTrans, 0.0f);
+
+    // Overlapping rows in AddMatVec(), both ways.
+    Vector vec3(num_rows), vec4(num_rows);
+    Vector vec5(num_splice * num_cols), vec6(num_splice * num_cols);
+    vec3.AddMatVec(1.0f, view, kNoTrans, weights.Row(0), 0.0f);
+    vec4.AddMatVec(1.0f, spliced, kNoTrans, weights.Row(0), 0.0f);
+    vec5.AddMatVec(1.0f, view, kTrans, vec3, 0.0f);
+    vec6.AddMatVec(1.0f, spliced, kTrans, vec3, 0.0f);
+
+    // A row with stride 0, which has no whole strides to split into.
+    SubMatrix row(feats_data.Data(), 1, num_splice * num_cols, 0);
+    Matrix mat9(1, num_outputs), mat10(1, num_outputs);
+    mat9.AddMatMat(1.0f, row, kNoTrans, weights, kTrans, 0.0f);
+    mat10.AddMatMat(1.0f, spliced.RowRange(0, 1), kNoTrans, weights, kTrans,
+                    0.0f);
+
+    if (!IsEqual(tolerance, mat5, mat6) || !IsEqual(tolerance, mat7, mat8) ||
+        !IsEqual(tolerance, vec3, vec4) || !IsEqual(tolerance, vec5, vec6) ||
+        !IsEqual(tolerance, mat9, mat10)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TestHalfMatrix(const float tolerance) {
+  MatrixHalfType types[] = {kFloat16, kBFloat16};
+  for (int32 i = 0; i < 10; ++i) {
+    int32 num_rows = static_cast<int32>(100 * RandomUniform());
+    int32 num_cols = static_cast<int32>(100 * RandomUniform());
+    int32 num_connect = static_cast<int32>(100 * RandomUniform());
+    num_rows = num_rows > 0 ? num_rows : 10;
+    num_cols = num_cols > 0 ? num_cols : 10;
+    num_connect = num_connect > 0 ? num_connect : 10;
+    Matrix mat1(num_rows, num_connect);
+    Matrix mat2(num_cols, num_connect);
+    mat1.SetRandomUniform();
+    mat2.SetRandomUniform();
+
+    // Compares against the float product with the rounded weights, the
+    // rounding itself is checked with a relative tolerance.
+    HalfMatrix half(mat2, types[i % 2]);
+    Matrix mat3(num_cols, num_connect);
+    half.CopyToMat(&mat3);
+    for (int32 r = 0; r < mat2.NumRows(); ++r) {
+      for (int32 c = 0; c < mat2.NumCols(); ++c) {
+        if (std::abs(mat3(r, c) - mat2(r, c)) > 0.01f * std::abs(mat2(r, c))) {
+          std::cerr << __func__ << " test failed." << std::endl;
+          return false;
+        }
+      }
+    }
+
+    Matrix mat4(num_rows, num_cols);
+    Matrix mat5(num_rows, num_cols);
+    float alpha = RandomGaussian();
+    AddMatHalfMat(alpha, mat1, half, 0.0f, &mat4);
+    mat5.AddMatMat(alpha, mat1, kNoTrans, mat3, kTrans, 0.0f);
+
+    Vector vec1(num_cols);
+    Vector vec2(num_cols);
+    AddHalfMatVec(alpha, half, mat1.Row(0), 0.0f, &vec1);
+    vec2.AddMatVec(alpha, mat3, kNoTrans, mat1.Row(0), 0.0f);
+
+    if (!IsEqual(tolerance, mat4, mat5) || !IsEqual(tolerance, vec1, vec2)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+
+    // Write() and Read() round trip, in binary and text mode, keep the values
+    // and the type. The vector holds the rounded weights of a row.
+    for (int32 binary = 0; binary < 2; ++binary) {
+      std::stringstream ss;
+      HalfVector half_vec(mat2.Row(0), types[i % 2]);
+      half.Write(binary, &ss);
+      half_vec.Write(binary, &ss);
+      HalfMatrix half2(types[(i + 1) % 2]);
+      HalfVector half_vec2(types[(i + 1) % 2]);
+      half2.Read(binary, &ss);
+      half_vec2.Read(binary, &ss);
+      Matrix mat6(num_cols, num_connect);
+      Vector vec3(num_connect);
+      half2.CopyToMat(&mat6);
+      half_vec2.CopyToVec(&vec3);
+      if (half2.Type() != half.Type() || half_vec2.Type() != half.Type() ||
+          !IsEqual(0.0f, mat6, mat3) || !IsEqual(0.0f, vec3, mat3.Row(0))) {
+        std::cerr << __func__ << " test failed." << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool TestIntMatrix(const float tolerance) {
+  for (int32 i = 0; i < 10; ++i) {
+    int32 num_rows = static_cast<int32>(100 * RandomUniform());
+    int32 num_cols = static_cast<int32>(100 * RandomUniform());
+    num_rows = num_rows > 0 ? num_rows : 10;
+    num_cols = num_cols > 0 ? num_cols : 10;
+    Matrix mat1(num_rows, num_cols);
+    mat1.SetRandomGaussian();
+
+    // Fixed-point conversion, values beyond the int16 range saturate.
+    float scale = (i % 2 == 0) ? 1024.0f : 65536.0f;
+    Int16Matrix mat2(num_rows, num_cols);
+    mat2.CopyFromMat(mat1, scale);
+    Matrix mat3(num_rows, num_cols);
+    mat2.CopyToMat(1.0f / scale, &mat3);
+    for (int32 r = 0; r < num_rows; ++r) {
+      for (int32 c = 0; c < num_cols; ++c) {
+        float expected = std::max(-32768.0f,
+                                  std::min(32767.0f, scale * mat1(r, c)));
+        if (std::abs(scale * mat3(r, c) - expected) > 0.5f) {
+          std::cerr << __func__ << " test failed." << std::endl;
+          return false;
+        }
+      }
+    }
+
+    // Write() and Read() round trip, in binary and text mode.
+    for (int32 binary = 0; binary < 2; ++binary) {
+      std::stringstream ss;
+      mat2.RowRange(0, num_rows / 2 + 1).Write(binary, &ss);
+      Int16Matrix mat4;
+      mat4.Read(binary, &ss);
+      if (!IsEqual(mat4, Int16Matrix(mat2.RowRange(0, num_rows / 2 + 1)))) {
+        std::cerr << __func__ << " test failed." << std::endl;
+        return false;
+      }
+    }
+
+    // The same containers hold doubles.
+    MatrixT<double> mat10(num_rows, num_cols);
+    mat10.CopyFromMat(mat1, 1.0f);
+    std::stringstream ss;
+    mat10.Write(true, &ss);
+    MatrixT<double> mat11;
+    mat11.Read(true, &ss);
+    Matrix mat12(num_rows, num_cols);
+    mat11.CopyToMat(1.0f, &mat12);
+    if (!IsEqual(mat10, mat11) || !IsEqual(0.0f, mat1, mat12)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+
+    // Integer dot products of bit matrices, against the float output.
+    Matrix mat5(num_rows, 8 * num_cols);
+    Matrix mat6(num_cols, 8 * num_cols);
+    mat5.SetRandomUniform();
+    mat6.SetRandomUniform();
+    BitMatrix bit_mat1(mat5, 8, 8);
+    BitMatrix bit_mat2(mat6, 1, 8);
+    Int32Matrix mat7(num_rows, num_cols);
+    Matrix mat8(num_rows, num_cols);
+    Matrix mat9(num_rows, num_cols);
+    BitMatBitMat(bit_mat1, bit_mat2, &mat7);
+    BitMatBitMat(bit_mat1, bit_mat2, &mat8);
+    mat7.CopyToMat(bit_mat1.Scale() * bit_mat2.Scale(), &mat9);
+    if (!IsEqual(tolerance, mat8, mat9)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TestFixedAffine(const float tolerance) {
+  for (int32 i = 0; i < 10; ++i) {
+    int32 num_rows = static_cast<int32>(100 * RandomUniform());
+    int32 num_cols = static_cast<int32>(100 * RandomUniform());
+    int32 num_connect = static_cast<int32>(100 * RandomUniform());
+    num_rows = num_rows > 0 ? num_rows : 10;
+    num_cols = num_cols > 0 ? num_cols : 10;
+    num_connect = num_connect > 0 ? num_connect : 10;
+    Matrix mat1(num_rows, num_connect);
+    Matrix mat2(num_cols, num_connect);
+    Vector bias(num_cols);
+    mat1.SetRandomUniform();
+    mat2.SetRandomGaussian();
+    bias.SetRandomGaussian();
+
+    // Inputs, weights and outputs in Q10, the weights go through Read().
+    const int32 frac_bits = 10;
+    const float scale = 1 << frac_bits;
+    Int16Matrix x(num_rows, num_connect);
+    x.CopyFromMat(mat1, scale);
+    x.CopyToMat(1.0f / scale, &mat1);
+    std::stringstream ss;
+    mat2.Write(true, &ss);
+    Int16Matrix w;
+    int32 w_frac_bits = frac_bits;
+    ReadFixedPointMatrix(true, &ss, &w, &w_frac_bits);
+    w.CopyToMat(1.0f / scale, &mat2);
+    Int32Vector fixed_bias(num_cols);
+    fixed_bias.CopyFromVec(bias, scale * scale);
+    fixed_bias.CopyToVec(1.0f / (scale * scale), &bias);
+
+    // The float layer on the same rounded values differs from the fixed-point
+    // one only by the final rounding.
+    MatrixActivationType act = (i % 2 == 0) ? kRelu : kNoActivation;
+    Matrix mat3(num_rows, num_cols);
+    mat3.AddMatMatBiasAct(1.0f, mat1, kNoTrans, mat2, kTrans, bias, act);
+    Int16Matrix out(num_rows, num_cols);
+    FixedAffine(x, w, fixed_bias, frac_bits, act, 0, &out);
+    Matrix mat4(num_rows, num_cols);
+    out.CopyToMat(1.0f / scale, &mat4);
+    if (!IsEqual(0.5f / scale + tolerance, mat3, mat4)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+
+    Int32Matrix prod(num_rows, num_cols);
+    Int32Vector prod_row(num_cols);
+    FixedMatMat(x, w, &prod);
+    FixedMatVec(w, x.Row(0), &prod_row);
+    if (!IsEqual(prod.Row(0), prod_row)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TestBitSubMatrix(const float tolerance) {
+  for (int32 i = 0; i < 10; ++i) {
+    int32 num_rows = static_cast<int32>(100 * RandomUniform());
+    int32 num_cols = static_cast<int32>(100 * RandomUniform());
+    int32 num_words = static_cast<int32>(20 * RandomUniform());
+    num_rows = num_rows > 1 ? num_rows : 10;
+    num_cols = num_cols > 1 ? num_cols : 10;
+    num_words = num_words > 1 ? num_words : 10;
+    Matrix mat1(num_rows, 8 * num_words);
+    Matrix mat2(num_cols, 8 * num_words);
+    mat1.SetRandomUniform();
+    mat2.SetRandomUniform();
+    BitMatrix bit_mat1(mat1, 8, 8);
+    BitMatrix bit_mat2(mat2, 1, 8);
+    Int32Matrix mat3(num_rows, num_cols);
+    BitMatBitMat(bit_mat1, bit_mat2, &mat3);
+
+    // Splits the inner dimension with word ranges, and the output with row
+    // ranges of the weights.
+    int32 split_words = num_words / 2;
+    int32 split_cols = num_cols / 2;
+    Int32Matrix mat4(num_rows, num_cols);
+    Int32Matrix mat5(num_rows, num_cols);
+    for (int32 part = 0; part < 2; ++part) {
+      int32 col_offset = part == 0 ? 0 : split_cols;
+      int32 cols = part == 0 ? split_cols : num_cols - split_cols;
+      BitSubMatrix weights(bit_mat2.RowRange(col_offset, cols));
+      SubMatrixT<int32> out(mat4.ColRange(col_offset, cols));
+      BitMatBitMat(bit_mat1, weights, &out);
+
+      int32 word_offset = part == 0 ? 0 : split_words;
+      int32 words = part == 0 ? split_words : num_words - split_words;
+      Int32Matrix partial(num_rows, num_cols);
+      BitMatBitMat(bit_mat1.ColRange(word_offset, words),
+                   bit_mat2.ColRange(word_offset, words), &partial);
+      for (int32 r = 0; r < num_rows; ++r) {
+        for (int32 c = 0; c < num_cols; ++c) {
+          mat5(r, c) += partial(r, c);
+        }
+      }
+    }
+    if (!IsEqual(mat3, mat4) || !IsEqual(mat3, mat5)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TestBitMatrixToMatrix(const float tolerance) {
+  // Pairs of (quant_bits, align_bits).
+  int32 bits[][2] = {{1, 1}, {1, 8}, {8, 8}, {4, 4}, {2, 8}};
+  for (int32 i = 0; i < 10; ++i) {
+    int32 quant_bits = bits[i % 5][0];
+    int32 align_bits = bits[i % 5][1];
+    int32 pack_factor = 64 / align_bits;
+    int32 num_rows = static_cast<int32>(100 * RandomUniform());
+    int32 num_words = static_cast<int32>(10 * RandomUniform());
+    num_rows = num_rows > 0 ? num_rows : 10;
+    num_words = num_words > 0 ? num_words : 10;
+    Matrix mat1(num_rows, num_words * pack_factor);
+    mat1.SetRandomUniform();
+    BitMatrix bit_mat(mat1, quant_bits, align_bits);
+    Matrix mat2(num_rows, num_words * pack_factor);
+    bit_mat.ToMatrix(&mat2);
+
+    float max_value = (1 << quant_bits) - 1;
+    Matrix mat3(num_rows, num_words * pack_factor);
+    for (int32 r = 0; r < mat1.NumRows(); ++r) {
+      for (int32 c = 0; c < mat1.NumCols(); ++c) {
+        float value = std::nearbyint(mat1(r, c) * max_value);
+        mat3(r, c) = quant_bits == 1 ? (value == 1 ? 1.0f : -1.0f)
+                                     : value / max_value;
+      }
+    }
+
+    // Per-row scales.
+    Vector row_scales(num_rows);
+    Matrix mat4(num_rows, num_words * pack_factor);
+    row_scales.SetRandomUniform();
+    bit_mat.ToMatrix(row_scales, &mat4);
+
+    mat3.Scale(quant_bits == 1 ? bit_mat.Scale() : 1.0f);
+    if (!IsEqual(tolerance, mat2, mat3)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+    for (int32 r = 0; r < num_rows; ++r) {
+      mat2.Row(r).Scale(row_scales(r) / bit_mat.Scale());
+    }
+    if (!IsEqual(tolerance, mat2, mat4)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TestThreadPool(const float tolerance) {
+  ThreadPool pool(3);
+  for (int32 i = 0; i < 10; ++i) {
+    int32 n = static_cast<int32>(10000 * RandomUniform());
+    int32 grain = static_cast<int32>(100 * RandomUniform());
+    std::vector<int32> count(n, 0);
+    // Each index is visited exactly once, also by nested loops.
+    pool.ParallelFor(0, n, grain, [&](MatrixIndexT begin, MatrixIndexT end) {
+      pool.ParallelFor(begin, end, 1, [&](MatrixIndexT b, MatrixIndexT e) {
+        for (MatrixIndexT j = b; j < e; ++j) {
+          count[j]++;
+        }
+      });
+    });
+    for (int32 j = 0; j < n; ++j) {
+      if (count[j] != 1) {
+        std::cerr << __func__ << " test failed." << std::endl;
+        return false;
+      }
+    }
+  }
+
+  // Uneven chunks, where most of the work sits in the range of one thread,
+  // are stolen by the others.
+  std::vector<int32> visits(1000, 0);
+  pool.ParallelFor(0, 1000, 1, [&](MatrixIndexT begin, MatrixIndexT end) {
+    for (MatrixIndexT j = begin; j < end; ++j) {
+      if (j < 250) {
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+      }
+      visits[j]++;
+    }
+  });
+  if (std::count(visits.begin(), visits.end(), 1) != 1000) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+
+  // An exception ends the loop on the calling thread, after the workers are
+  // done, and leaves the pool usable.
+  bool caught = false;
+  try {
+    pool.ParallelFor(0, 1000, 1, [&](MatrixIndexT begin, MatrixIndexT end) {
+      for (MatrixIndexT j = begin; j < end; ++j) {
+        if (j == 500) {
+          throw std::runtime_error("body failed");
+        }
+      }
+    });
+  } catch (const std::runtime_error &e) {
+    caught = true;
+  }
+  std::atomic<int32> chunks(0);
+  std::thread::id caller = std::this_thread::get_id();
+  pool.ParallelFor(0, 1000, 1, [&](MatrixIndexT begin, MatrixIndexT end) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    if (std::this_thread::get_id() != caller) {
+      ++chunks;
+    }
+  });
+  if (!caught || chunks == 0) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+
+  // Large enough to be converted by several threads, if any.
+  Matrix mat1(2000, 512);
+  Matrix mat2(2000, 512, kUndefined);
+  mat1.SetRandomUniform();
+  BitMatrix bit_mat(mat1, 8, 8);
+  bit_mat.ToMatrix(&mat2);
+  if (!IsEqual(0.5f * bit_mat.Scale() + tolerance, mat1, mat2)) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+
+  // The same results on a pinned pool set for this thread, and serially.
+  Matrix mat3(300, 256), mat4(200, 256);
+  mat3.SetRandomUniform();
+  mat4.SetRandomUniform();
+  Matrix out1(300, 200), out2(300, 200);
+  {
+    ThreadPool pinned(2, std::vector<int32>(1, 0));
+    ScopedThreadPool scoped(&pinned);
+#if defined(__linux__)
+    if (ThreadPool::Current() != &pinned || pinned.WorkerCpu(1) != 0) {
+#else
+    if (ThreadPool::Current() != &pinned) {
+#endif
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+    out1.MatMatRaw(mat3, mat4);
+    out1.ApplySoftmaxPerRow();
+  }
+  {
+    ScopedThreadPool serial(NULL);
+    out2.MatMatRaw(mat3, mat4);
+    out2.ApplySoftmaxPerRow();
+  }
+  if (!IsEqual(tolerance, out1, out2)) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool TestQuantizeCalibrator(const float tolerance) {
+  // Uniform data on (0, 1), seen in batches of growing range.
+  QuantizeCalibrator calibrator;
+  for (int32 i = 0; i < 10; ++i) {
+    Matrix mat(100, 64);
+    mat.SetRandomUniform();
+    mat.Scale(0.1f * (i + 1));
+    calibrator.Accumulate(mat);
+  }
+  Matrix mat1(1000, 64);
+  mat1.SetRandomUniform();
+  QuantizeCalibrator calibrator2;
+  calibrator2.Accumulate(mat1);
+  calibrator.Merge(calibrator2);
+  float median = calibrator2.ClipValue(kCalibratePercentile, 8, 50.0f);
+  if (std::abs(median - 0.5f) > 0.05f ||
+      calibrator.AbsMax() != calibrator.ClipValue(kCalibrateAbsMax, 8)) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+
+  // ReLU-like activations with a few outliers: percentile and KL clip them,
+  // which gives a smaller error than absmax on the bulk of the data.
+  Matrix mat2(1000, 64);
+  mat2.SetRandomGaussian();
+  mat2.ApplyFloor(0.0f);
+  mat2(0, 0) = 100.0f;
+  mat2(1, 0) = 50.0f;
+  QuantizeCalibrator calibrator3;
+  calibrator3.Accumulate(mat2);
+  QuantizeCalibrationType types[] = {kCalibrateAbsMax, kCalibratePercentile,
+                                     kCalibrateKL};
+  float error[3];
+  for (int32 t = 0; t < 3; ++t) {
+    float scale = calibrator3.Scale(types[t], 4);
+    BitMatrix bit_mat(mat2, 4, 8, scale);
+    Matrix mat3(mat2.NumRows(), mat2.NumCols());
+    bit_mat.ToMatrix(&mat3);
+    error[t] = 0.0f;
+    for (int32 r = 2; r < mat2.NumRows(); ++r) {
+      for (int32 c = 0; c < mat2.NumCols(); ++c) {
+        error[t] += (mat3(r, c) - mat2(r, c)) * (mat3(r, c) - mat2(r, c));
+      }
+    }
+  }
+  if (!(error[1] < error[0] && error[2] < error[0])) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+
+  // Write() and Read() round trip.
+  std::stringstream ss;
+  calibrator3.Write(true, &ss);
+  QuantizeCalibrator calibrator4;
+  calibrator4.Read(true, &ss);
+  if (calibrator4.Scale(kCalibrateKL, 4) != calibrator3.Scale(kCalibrateKL, 4)) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+
+  // 1-bit scales are refused, and dynamic 1-bit quantization keeps the sign
+  // of symmetric data, also for values close to 0.
+  bool refused = false;
+  try {
+    calibrator3.Scale(kCalibrateAbsMax, 1);
+  } catch (const std::exception&) {
+    refused = true;
+  }
+  Matrix mat4(4, 64);
+  mat4.SetRandomUniform();
+  for (int32 r = 0; r < mat4.NumRows(); ++r) {
+    for (int32 c = 0; c < mat4.NumCols(); ++c) {
+      mat4(r, c) = 2.0f * mat4(r, c) - 1.0f;
+    }
+  }
+  mat4(0, 0) = 1.0f;
+  mat4(0, 1) = -1.0f;
+  mat4(1, 0) = 0.05f;
+  BitMatrix bit_mat4(mat4, 1, 8);
+  bit_mat4.Quantize(mat4, kQuantizePerTensor);
+  Matrix mat5(mat4.NumRows(), mat4.NumCols());
+  bit_mat4.ToMatrix(&mat5);
+  for (int32 r = 0; r < mat4.NumRows() && refused; ++r) {
+    for (int32 c = 0; c < mat4.NumCols(); ++c) {
+      if (mat4(r, c) != 0.0f && (mat4(r, c) > 0) != (mat5(r, c) > 0)) {
+        refused = false;
+      }
+    }
+  }
+  if (!refused) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool TestBitMatrixDynamicQuantize(const float tolerance) {
+  BitQuantizeType types[] = {kQuantizePerRow, kQuantizePerTensor};
+  for (int32 i = 0; i < 10; ++i) {
+    int32 num_rows = static_cast<int32>(100 * RandomUniform());
+    int32 num_cols = static_cast<int32>(100 * RandomUniform());
+    int32 num_words = static_cast<int32>(20 * RandomUniform());
+    num_rows = num_rows > 0 ? num_rows : 10;
+    num_cols = num_cols > 0 ? num_cols : 10;
+    num_words = num_words > 0 ? num_words : 10;
+    int32 quant_bits = (i % 4 == 0) ? 1 : 8;
+
+    // Rows with different levels, and with negative values.
+    Matrix mat1(num_rows, 8 * num_words);
+    mat1.SetRandomGaussian();
+    for (int32 r = 0; r < num_rows; ++r) {
+      mat1.Row(r).Scale(std::exp(4 * RandomGaussian()));
+    }
+    BitMatrix bit_mat1(num_rows, num_words);
+    bit_mat1 = BitMatrix(mat1, quant_bits, 8);
+    bit_mat1.Quantize(mat1, types[i % 2]);
+    Matrix mat2(num_rows, 8 * num_words);
+    bit_mat1.ToMatrix(&mat2);
+    if (quant_bits == 8) {
+      // Every value is within half a step of its code.
+      for (int32 r = 0; r < num_rows; ++r) {
+        for (int32 c = 0; c < mat1.NumCols(); ++c) {
+          if (std::abs(mat2(r, c) - mat1(r, c)) >
+              0.5001f * bit_mat1.RowScale(r) + tolerance) {
+            std::cerr << __func__ << " test failed." << std::endl;
+            return false;
+          }
+        }
+      }
+    }
+
+    // The epilogue gives the product of the dequantized matrices.
+    Matrix mat3(num_cols, 8 * num_words);
+    mat3.SetRandomUniform();
+    BitMatrix bit_mat2(mat3, 1, 8);
+    Matrix mat4(num_cols, 8 * num_words);
+    bit_mat2.ToMatrix(&mat4);
+    Matrix mat5(num_rows, num_cols);
+    Matrix mat6(num_rows, num_cols);
+    BitMatBitMat(bit_mat1, bit_mat2, &mat5);
+    mat6.AddMatMat(1.0f, mat2, kNoTrans, mat4, kTrans, 0.0f);
+    for (int32 r = 0; r < num_rows; ++r) {
+      for (int32 c = 0; c < num_cols; ++c) {
+        if (std::abs(mat5(r, c) - mat6(r, c)) >
+            1e-4f * (std::abs(mat6(r, c)) + bit_mat1.RowScale(r) * 255)) {
+          std::cerr << __func__ << " test failed." << std::endl;
+          return false;
+        }
+      }
+    }
+
+    // A static Quantize() after the dynamic one uses the static scale again.
+    BitMatrix bit_mat3(mat1, quant_bits, 8);
+    bit_mat1.Quantize(mat1);
+    Matrix mat7(num_rows, 8 * num_words), mat8(num_rows, 8 * num_words);
+    bit_mat1.ToMatrix(&mat7);
+    bit_mat3.ToMatrix(&mat8);
+    if (bit_mat1.Scale() != bit_mat3.Scale() || bit_mat1.Offset() != 0.0f ||
+        !IsEqual(0.0f, mat7, mat8)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+  }
+
+  // 1-bit values in 1-bit slots, 64 per word, are on the side of the offset
+  // of their input value.
+  Matrix mat1(7, 64 * 3), mat2(7, 64 * 3);
+  mat1.SetRandomGaussian();
+  BitMatrix bit_mat(7, 3);
+  bit_mat = BitMatrix(mat1, 1, 1);
+  bit_mat.Quantize(mat1, kQuantizePerTensor);
+  bit_mat.ToMatrix(&mat2);
+  for (int32 r = 0; r < mat1.NumRows(); ++r) {
+    for (int32 c = 0; c < mat1.NumCols(); ++c) {
+      if ((mat1(r, c) > bit_mat.Offset()) != (mat2(r, c) > bit_mat.Offset())) {
+        std::cerr << __func__ << " test failed." << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool TestAddBitMatBitMat(const float tolerance) {
+  MatrixTransposeType trans[] = {kNoTrans, kTrans};
+  for (int32 i = 0; i < 8; ++i) {
+    MatrixTransposeType trans_x = trans[i % 2];
+    MatrixTransposeType trans_y = trans[(i / 2) % 2];
+    // Transposed operands are packed along the output dimensions, so those
+    // are multiples of the 8 values per word as well.
+    int32 num_rows = 8 * static_cast<int32>(1 + 10 * RandomUniform());
+    int32 num_cols = 8 * static_cast<int32>(1 + 10 * RandomUniform());
+    int32 num_inner = 8 * static_cast<int32>(1 + 20 * RandomUniform());
+    Matrix mat1(trans_x == kNoTrans ? num_rows : num_inner,
+                trans_x == kNoTrans ? num_inner : num_rows);
+    Matrix mat2(trans_y == kTrans ? num_cols : num_inner,
+                trans_y == kTrans ? num_inner : num_cols);
+    mat1.SetRandomUniform();
+    mat2.SetRandomUniform();
+    BitMatrix bit_mat1(mat1, (i < 4) ? 8 : 1, 8);
+    BitMatrix bit_mat2(mat2, (i < 4) ? 1 : 4, 8);
+    Matrix mat3(mat1.NumRows(), mat1.NumCols());
+    Matrix mat4(mat2.NumRows(), mat2.NumCols());
+    bit_mat1.ToMatrix(&mat3);
+    bit_mat2.ToMatrix(&mat4);
+
+    // Other layouts are refused, and transposed once into the native one.
+    Matrix mat5(num_rows, num_cols);
+    if (trans_x != kNoTrans || trans_y != kTrans) {
+      bool refused = false;
+      try {
+        AddBitMatBitMat(1.0f, bit_mat1, trans_x, bit_mat2, trans_y, 0.0f,
+                        &mat5);
+      } catch (const std::exception&) {
+        refused = true;
+      }
+      if (!refused) {
+        std::cerr << __func__ << " test failed." << std::endl;
+        return false;
+      }
+    }
+    if (trans_x == kTrans) {
+      bit_mat1.Transpose();
+    }
+    if (trans_y == kNoTrans) {
+      bit_mat2.Transpose();
+    }
+
+    // Accumulates on top of the existing output.
+    mat5.SetRandomGaussian();
+    Matrix mat6(mat5);
+    float alpha = 0.5f, beta = (i % 3 == 0) ? 0.0f : 2.0f;
+    AddBitMatBitMat(alpha, bit_mat1, kNoTrans, bit_mat2, kTrans, beta, &mat5);
+    mat6.AddMatMat(alpha, mat3, trans_x, mat4, trans_y, beta);
+    for (int32 r = 0; r < num_rows; ++r) {
+      for (int32 c = 0; c < num_cols; ++c) {
+        if (std::abs(mat5(r, c) - mat6(r, c)) >
+            1e-4f * (num_inner + std::abs(mat6(r, c)))) {
+          std::cerr << __func__ << " test failed." << std::endl;
+          return false;
+        }
+      }
+    }
+
+    // Integer accumulation.
+    Int32Matrix mat7(num_rows, num_cols);
+    Int32Matrix mat8(num_rows, num_cols);
+    mat7.Set(3);
+    AddBitMatBitMat(2, bit_mat1, kNoTrans, bit_mat2, kTrans, -1, &mat7);
+    AddBitMatBitMat(1, bit_mat1, kNoTrans, bit_mat2, kTrans, 0, &mat8);
+    for (int32 r = 0; r < num_rows; ++r) {
+      for (int32 c = 0; c < num_cols; ++c) {
+        if (mat7(r, c) != 2 * mat8(r, c) - 3) {
+          std::cerr << __func__ << " test failed." << std::endl;
+          return false;
+        }
+      }
+    }
+
+    // The member stores the same products in the words of a bit matrix.
+    BitMatrix bit_mat3(num_rows, num_cols);
+    bit_mat3.AddBitMatBitMat(bit_mat1, bit_mat2);
+    for (int32 r = 0; r < num_rows; ++r) {
+      for (int32 c = 0; c < num_cols; ++c) {
+        if (static_cast<int32>(bit_mat3.RowData(r)[c]) != mat8(r, c)) {
+          std::cerr << __func__ << " test failed." << std::endl;
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool TestKernelTuning(const float tolerance) {
+  // Bit weights of 600 x 512 values, and float ones of 1.2 MiB, so that
+  // AddMatVec() takes the prefetching path.
+  Matrix mat1(16, 512), mat2(600, 512);
+  mat1.SetRandomUniform();
+  mat2.SetRandomUniform();
+  BitMatrix bit_mat1(mat1, 8, 8);
+  BitMatrix bit_mat2(mat2, 1, 8);
+  Vector vec(512);
+  vec.SetRandomUniform();
+  const int32 prefetch_rows = PrefetchRows();
+  const int64 stream_bytes = StreamingStoreBytes();
+
+  // Without the hints, then prefetching 3 rows ahead and streaming every
+  // output.
+  Matrix out[2], unpacked[2];
+  Int32Matrix int_out[2];
+  Vector vec_out[2];
+  for (int32 i = 0; i < 2; ++i) {
+    SetPrefetchRows(i == 0 ? 0 : 3);
+    SetStreamingStoreBytes(i == 0 ? 0 : 1);
+    out[i].Resize(16, 600);
+    int_out[i].Resize(16, 600);
+    unpacked[i].Resize(600, 512);
+    vec_out[i].Resize(600);
+    BitMatBitMat(bit_mat1, bit_mat2, &out[i]);
+    BitMatBitMat(bit_mat1, bit_mat2, &int_out[i]);
+    bit_mat2.ToMatrix(&unpacked[i]);
+    vec_out[i].AddMatVec(1.0f, mat2, kNoTrans, vec, 0.0f);
+  }
+  // Unaligned rows fall back to regular stores.
+  Matrix unpacked2(600, 520);
+  SubMatrix unaligned(unpacked2.ColRange(1, 512));
+  bit_mat2.ToMatrix(&unaligned);
+  SetPrefetchRows(prefetch_rows);
+  SetStreamingStoreBytes(stream_bytes);
+
+  if (!IsEqual(tolerance, out[0], out[1]) ||
+      !IsEqual(tolerance, unpacked[0], unpacked[1]) ||
+      !IsEqual(tolerance, unpacked[0], unaligned) ||
+      !IsEqual(tolerance, vec_out[0], vec_out[1])) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+  for (int32 r = 0; r < 16; ++r) {
+    for (int32 c = 0; c < 600; ++c) {
+      if (int_out[0](r, c) != int_out[1](r, c)) {
+        std::cerr << __func__ << " test failed." << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool TestBitMatrixTranspose(const float tolerance) {
+  int32 align_bits[] = {1, 2, 4, 8, 16, 32};
+  for (int32 i = 0; i < 12; ++i) {
+    int32 align = align_bits[i % 6];
+    int32 pack_factor = 64 / align;
+    int32 quant_bits = (i < 6) ? 1 : std::min(align, 8);
+    int32 num_rows = pack_factor * static_cast<int32>(1 + 3 * RandomUniform());
+    int32 num_words = static_cast<int32>(1 + 4 * RandomUniform());
+    Matrix mat1(num_rows, num_words * pack_factor);
+    mat1.SetRandomUniform();
+    BitMatrix bit_mat1(mat1, quant_bits, align);
+
+    // Same values as transposing the dequantized matrix.
+    BitMatrix bit_mat2(bit_mat1, kTrans);
+    Matrix mat2(num_rows, num_words * pack_factor);
+    Matrix mat3(num_words * pack_factor, num_rows);
+    bit_mat1.ToMatrix(&mat2);
+    bit_mat2.ToMatrix(&mat3);
+    if (!IsEqual(tolerance, Matrix(mat2, kTrans), mat3)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+
+    // Transposing twice gives back the codes.
+    bit_mat2.Transpose();
+    if (bit_mat2.NumRows() != num_rows || bit_mat2.NumCols() != num_words) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+    for (int32 r = 0; r < num_rows; ++r) {
+      for (int32 c = 0; c < num_words; ++c) {
+        if (bit_mat2(r, c) != bit_mat1(r, c)) {
+          std::cerr << __func__ << " test failed." << std::endl;
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool TestPerfCounters(const float tolerance) {
+  Matrix mat1(16, 64);
+  Matrix mat2(32, 64);
+  mat1.SetRandomUniform();
+  mat2.SetRandomUniform();
+  BitMatrix bit_mat1(mat1, 8, 8);
+  BitMatrix bit_mat2(mat2, 1, 8);
+  Matrix mat3(16, 32);
+  ResetPerfCounters();
+  BitMatBitMat(bit_mat1, bit_mat2, &mat3);
+  BitMatBitMat(bit_mat1, bit_mat2, &mat3);
+  std::vector<PerfCounterStats> stats;
+  GetPerfCounterStats(&stats);
+  if (!PerfCountersAvailable()) {
+    // Compiled out, or no access to the counters.
+    return stats.empty();
+  }
+  // One entry for the shape; the nested VecVec() calls are not counted.
+  if (stats.size() != 1 || std::string(stats[0].name) != "AddBitMatBitMat" ||
+      stats[0].m != 16 || stats[0].k != 64 || stats[0].n != 32 ||
+      stats[0].calls != 2 || stats[0].counts[kPerfCycles] <= 0) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+  ResetPerfCounters();
+  GetPerfCounterStats(&stats);
+  return stats.empty();
+}
+
+bool TestTraceEvents(const float tolerance) {
+  Matrix mat1(16, 64);
+  Matrix mat2(32, 64);
+  mat1.SetRandomUniform();
+  mat2.SetRandomUniform();
+  BitMatrix bit_mat1(mat1, 8, 8);
+  BitMatrix bit_mat2(mat2, 1, 8);
+  Matrix mat3(16, 32);
+
+  // Nothing is recorded while disabled, and the arguments of a scope are not
+  // evaluated.
+  ClearTrace();
+  BitMatBitMat(bit_mat1, bit_mat2, &mat3);
+  int32 num_evaluated = 0;
+  {
+    SNOWBOY_TRACE_SCOPE("Test", ++num_evaluated, 0, 0, 0);
+  }
+  std::ostringstream oss1;
+  WriteChromeTrace(&oss1);
+  if (oss1.str().find("AddBitMatBitMat") != std::string::npos ||
+      num_evaluated != 0) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+
+  SetTracingEnabled(true, 4);
+  for (int32 i = 0; i < 3; ++i) {
+    BitMatBitMat(bit_mat1, bit_mat2, &mat3);
+    mat3.ApplyFloor(0.0f);
+  }
+  SetTracingEnabled(false);
+  std::ostringstream oss2;
+  WriteChromeTrace(&oss2);
+  ClearTrace();
+  // The buffer of this thread keeps the last 4 events, and does not wrap
+  // past them.
+  std::string trace = oss2.str();
+  size_t count = 0;
+  for (size_t pos = trace.find("\"ph\": \"X\""); pos != std::string::npos;
+       pos = trace.find("\"ph\": \"X\"", pos + 1)) {
+    ++count;
+  }
+  if (trace.find("\"traceEvents\"") == std::string::npos ||
+      trace.find("\"name\": \"AddBitMatBitMat\"") == std::string::npos ||
+      trace.find("\"m\": 16, \"k\": 64, \"n\": 32") == std::string::npos ||
+      count != 4) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool TestMatrixMemory(const float tolerance) {
+  MatrixMemoryStats before, after;
+  GetThreadMatrixMemoryStats(&before);
+  int64 size = 0;
+  {
+    // Transpose() of a 10 x 30 matrix does not fit in place and reallocates.
+    Matrix mat(10, 30);
+    size = sizeof(float) * mat.NumRows() * mat.Stride();
+    mat.Transpose();
+    GetThreadMatrixMemoryStats(&after);
+    if (after.num_allocs - before.num_allocs != 2 ||
+        after.num_frees - before.num_frees != 1 ||
+        after.bytes_in_use - before.bytes_in_use !=
+        static_cast<int64>(sizeof(float) * mat.NumRows() * mat.Stride())) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+  }
+  GetThreadMatrixMemoryStats(&after);
+  if (after.bytes_in_use != before.bytes_in_use ||
+      after.peak_bytes_in_use < before.bytes_in_use + size) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+
+  // The per-frame calls of a detector do not allocate once their buffers
+  // exist.
+  Matrix frame(1, 128);
+  Matrix weight(100, 128);
+  Vector bias(100);
+  frame.SetRandomGaussian();
+  weight.SetRandomUniform();
+  bias.SetRandomGaussian();
+  BitMatrix bit_weight(weight, 1, 8);
+  BitMatrix bit_frame(frame, 8, 8);
+  Matrix out(1, 100);
+  int64 violations = NumNoAllocationViolations();
+  {
+    // The first kQuantizePerRow of <bit_frame> is in the scope: its row scales
+    // must already be there.
+    NoAllocationScope no_allocation;
+    bit_frame.Quantize(frame, kQuantizePerRow);
+    BitMatBitMat(bit_frame, bit_weight, &out);
+    out.AddVecToRows(1.0f, bias);
+    out.ApplySoftmaxPerRow();
+    bias.Norm(3.0f);
+  }
+  if (NumNoAllocationViolations() != violations) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+  {
+    NoAllocationScope no_allocation;
+    Vector tmp(10);
+  }
+  if (NumNoAllocationViolations() != violations + 1) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool TestHugePages(const float tolerance) {
+#if defined(__linux__)
+  HugePageStats before, after;
+  GetHugePageStats(&before);
+  SetHugePagePolicy(kHugePagesHugetlb, 2 << 20);
+  {
+    // 4 MiB, above the threshold; with no hugetlbfs pool reserved, it falls
+    // back to transparent huge pages.
+    Matrix mat(1024, 1024);
+    Vector vec(1024);
+    mat.SetRandomUniform();
+    GetHugePageStats(&after);
+    const int64 bytes = sizeof(float) * mat.NumRows() * mat.Stride();
+    if (reinterpret_cast<uintptr_t>(mat.Data()) % (2 << 20) != 0 ||
+        after.hugetlb_bytes + after.madvised_bytes
+        != before.hugetlb_bytes + before.madvised_bytes + bytes ||
+        after.transparent_bytes > after.madvised_bytes) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      SetHugePagePolicy(kHugePagesOff);
+      return false;
+    }
+    Matrix copy(mat);
+    if (!IsEqual(tolerance, mat, copy)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      SetHugePagePolicy(kHugePagesOff);
+      return false;
+    }
+  }
+  SetHugePagePolicy(kHugePagesOff);
+  GetHugePageStats(&after);
+  if (after.hugetlb_bytes != before.hugetlb_bytes ||
+      after.madvised_bytes != before.madvised_bytes) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+#endif
+  return true;
+}
+
+// Returns true if the padding of each row of <mat> is zero.
+static bool PaddingIsZero(const MatrixBase& mat) {
+  for (int32 r = 0; r < mat.NumRows(); ++r) {
+    for (int32 c = mat.NumCols(); c < mat.Stride(); ++c) {
+      if (mat.RowData(r)[c] != 0) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool TestZeroPadding(const float tolerance) {
+  const int32 kFloatsPerPad = kMatrixPadBytes / sizeof(float);
+  // Dirties the heap with a freed matrix, so that padding that is not cleared
+  // shows up in the next ones.
+  {
+    Matrix dirty(64, 64, kUndefined);
+    dirty.Set(1.0f);
+  }
+  Matrix mat1(20, 3, kUndefined);
+  mat1.SetRandomUniform();
+  Matrix mat2(mat1);
+  mat2.Resize(21, 5, kCopyData);
+  Matrix mat3(mat1);
+  // Small enough to transpose in place.
+  mat3.Transpose();
+  Vector vec1(37, kUndefined);
+  vec1.SetRandomUniform();
+  vec1.RemoveElement(3);
+  if (mat1.Stride() % kFloatsPerPad != 0 ||
+      reinterpret_cast<uintptr_t>(mat1.Data()) % kMatrixPadBytes != 0 ||
+      !PaddingIsZero(mat1) || !PaddingIsZero(mat2) || !PaddingIsZero(mat3) ||
+      vec1.PaddedDim() % kFloatsPerPad != 0 ||
+      reinterpret_cast<uintptr_t>(vec1.Data()) % kMatrixPadBytes != 0) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+  for (int32 d = vec1.Dim(); d < vec1.PaddedDim(); ++d) {
+    if (vec1.Data()[d] != 0) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+  }
+
+  // Bit matrices, also after a Read() that goes row by row.
+  Matrix mat4(16, 24);
+  mat4.SetRandomUniform();
+  BitMatrix bit1(mat4, 8, 8);
+  std::stringstream ss;
+  bit1.Write(true, &ss);
+  BitMatrix bit2;
+  bit2.Read(true, &ss);
+  const BitMatrix* bits[] = {&bit1, &bit2};
+  for (int32 i = 0; i < 2; ++i) {
+    if (bits[i]->Stride() % (kMatrixPadBytes / sizeof(uint64)) != 0) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+    for (int32 r = 0; r < bits[i]->NumRows(); ++r) {
+      for (int32 c = bits[i]->NumCols(); c < bits[i]->Stride(); ++c) {
+        if (bits[i]->RowData(r)[c] != 0) {
+          std::cerr << __func__ << " test failed." << std::endl;
+          return false;
+        }
+      }
+    }
+  }
+  Matrix out1(16, 24), out2(16, 24);
+  bit1.ToMatrix(&out1);
+  bit2.ToMatrix(&out2);
+  if (!IsEqual(tolerance, out1, out2)) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool TestNumaReplicated(const float tolerance) {
+  Matrix mat(100, 64);
+  mat.SetRandomUniform();
+  Matrix weights(mat);
+  BitMatrix bit_weights(mat, 8, 8);
+  BitMatrix bit_copy(bit_weights, kNoTrans);
+  NumaReplicated<Matrix> replicated(&weights);
+  NumaReplicated<BitMatrix> bit_replicated(&bit_weights);
+  // The weights move into the replicas, one per node.
+  if (weights.NumRows() != 0 || bit_weights.NumRows() != 0 ||
+      replicated.NumReplicas() != NumNumaNodes() ||
+      CurrentNumaNode() < 0 || CurrentNumaNode() >= NumNumaNodes()) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+  Matrix out1(100, 64), out2(100, 64);
+  bit_copy.ToMatrix(&out1);
+  for (int32 node = 0; node < NumNumaNodes(); ++node) {
+    bit_replicated.Replica(node).ToMatrix(&out2);
+    if (!IsEqual(tolerance, mat, replicated.Replica(node)) ||
+        !IsEqual(tolerance, out1, out2)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+  }
+  if (!IsEqual(tolerance, mat, replicated.Local())) {
+    std::cerr << __func__ << " test failed." << std::endl;
+    return false;
+  }
+  return true;
+}
+
 bool TestVectorScale(const float tolerance) {
   for (int32 i = 0; i < 10; ++i) {
     int32 dim = static_cast<int32>(100 * RandomUniform());
@@ -308,6 +1669,59 @@ bool TestVectorAddMatVec(const float tolerance) {
   return true;
 }
 
+bool TestVectorApplyLogPow(const float tolerance) {
+  for (int32 i = 0; i < 10; ++i) {
+    int32 dim = static_cast<int32>(100 * RandomUniform());
+    dim = dim > 0 ? dim : 10;
+    Vector vec(dim);
+    vec.SetRandomUniform();
+    vec.Scale(10.0f);
+
+    Vector vec1(vec);
+    Vector vec2(vec);
+    Vector vec3(vec);
+    float power = 3.0f * RandomGaussian();
+    vec1.ApplyLog();
+    vec2.ApplyPow(power);
+    for (int32 d = 0; d < vec3.Dim(); ++d) {
+      if (std::abs(vec1(d) - std::log(vec3(d))) > tolerance
+          || std::abs(vec2(d) - std::pow(vec3(d), power))
+          > tolerance * std::max(1.0f, std::pow(vec3(d), power))) {
+        std::cerr << __func__ << " test failed." << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool TestVectorAssign(const float tolerance) {
+  for (int32 i = 0; i < 10; ++i) {
+    int32 dim = static_cast<int32>(100 * RandomUniform());
+    dim = dim > 0 ? dim : 10;
+    Vector vec(dim), vec3(dim), vec4(dim);
+    vec.SetRandomGaussian();
+    vec3.SetRandomGaussian();
+    vec4.SetRandomGaussian();
+
+    Vector vec1(vec);
+    Vector vec2(vec);
+    float alpha = RandomGaussian();
+    float beta = RandomGaussian();
+    vec1.Assign(max((alpha * vec1 + beta * vec3) * vec4, 0));
+    vec2.Scale(alpha);
+    vec2.AddVec(beta, vec3);
+    vec2.MulElements(vec4);
+    vec2.ApplyFloor(0);
+
+    if (!IsEqual(tolerance, vec1, vec2)) {
+      std::cerr << __func__ << " test failed." << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
 bool TestVectorNorm(const float tolerance) {
   for (int32 i = 0; i < 10; ++i) {
     int32 dim = static_cast<int32>(100 * RandomUniform());
@@ -339,12 +1753,41 @@ int main() {
   float tolerance = 0.01f;
   bool success = true;
 
+  // The library runs serially until the application creates the global pool.
+  if (snowboy::ThreadPool::Current() != NULL) {
+    std::cerr << "The global thread pool was created unasked." << std::endl;
+    success = false;
+  }
+  snowboy::ThreadPool::Global();
+
   // Tests Matrix library.
   std::cout << "Testing Matrix library..." << std::endl;
   success = snowboy::TestMatrixScale(tolerance) && success;
   success = snowboy::TestMatrixAddMat(tolerance) && success;
   success = snowboy::TestMatrixAddMatMat(tolerance) && success;
+  success = snowboy::TestMatrixAddMatMatBiasAct(tolerance) && success;
   success = snowboy::TestMatrixAddVecVec(tolerance) && success;
+  success = snowboy::TestMatrixAssign(tolerance) && success;
+  success = snowboy::TestMatrixTranspose(tolerance) && success;
+  success = snowboy::TestMatrixSpliceRows(tolerance) && success;
+  success = snowboy::TestMatrixApplySoftmaxPerRow(tolerance) && success;
+  success = snowboy::TestHalfMatrix(tolerance) && success;
+  success = snowboy::TestIntMatrix(tolerance) && success;
+  success = snowboy::TestFixedAffine(tolerance) && success;
+  success = snowboy::TestBitSubMatrix(tolerance) && success;
+  success = snowboy::TestBitMatrixToMatrix(tolerance) && success;
+  success = snowboy::TestThreadPool(tolerance) && success;
+  success = snowboy::TestQuantizeCalibrator(tolerance) && success;
+  success = snowboy::TestBitMatrixDynamicQuantize(tolerance) && success;
+  success = snowboy::TestAddBitMatBitMat(tolerance) && success;
+  success = snowboy::TestBitMatrixTranspose(tolerance) && success;
+  success = snowboy::TestPerfCounters(tolerance) && success;
+  success = snowboy::TestTraceEvents(tolerance) && success;
+  success = snowboy::TestMatrixMemory(tolerance) && success;
+  success = snowboy::TestNumaReplicated(tolerance) && success;
+  success = snowboy::TestHugePages(tolerance) && success;
+  success = snowboy::TestZeroPadding(tolerance) && success;
+  success = snowboy::TestKernelTuning(tolerance) && success;
 
   // Tests Vector library.
   std::cout << std::endl;
@@ -355,6 +1798,8 @@ int main() {
   success = snowboy::TestVectorAddDiagMat2(tolerance) && success;
   success = snowboy::TestVectorAddMatVec(tolerance) && success;
   success = snowboy::TestVectorNorm(tolerance) && success;
+  success = snowboy::TestVectorAssign(tolerance) && success;
+  success = snowboy::TestVectorApplyLogPow(tolerance) && success;
 
   std::cout << std::endl;
   if (success) {
@@ -0,0 +1,333 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#include <algorithm>
+#include <new>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "matrix/matrix-memory.h"
+#include "matrix/thread-pool.h"
+#include "matrix/trace-events.h"
+#include "utils/snowboy-debug.h"
+
+namespace snowboy {
+
+// True on pool workers and on a caller while it runs a loop, so that nested
+// loops run serially instead of waiting for busy workers.
+static thread_local bool in_parallel_for = false;
+
+// Pool set by ScopedThreadPool on this thread, if <current_pool_set>.
+static thread_local ThreadPool* current_pool = NULL;
+static thread_local bool current_pool_set = false;
+
+// The global pool and its configuration.
+static std::mutex global_pool_mutex;
+static std::atomic<ThreadPool*> global_pool(NULL);
+static int32 global_num_workers = -1;
+static std::vector<int32> global_cpus;
+
+static inline uint64 PackRange(const MatrixIndexT begin,
+                               const MatrixIndexT end) {
+  return (static_cast<uint64>(static_cast<uint32>(begin)) << 32)
+      | static_cast<uint32>(end);
+}
+
+static inline void UnpackRange(const uint64 packed, MatrixIndexT* begin,
+                               MatrixIndexT* end) {
+  *begin = static_cast<MatrixIndexT>(static_cast<uint32>(packed >> 32));
+  *end = static_cast<MatrixIndexT>(static_cast<uint32>(packed));
+}
+
+ThreadPool::ThreadPool(const int32 num_workers,
+                       const std::vector<int32>& cpus) :
+    worker_cpus_(num_workers, -1), ranges_(NULL),
+    stop_(false), generation_(0), active_workers_(0), invoke_(NULL),
+    func_(NULL), no_allocation_(false), chunk_(1) {
+  SNOWBOY_ASSERT(num_workers >= 0);
+  void* ranges = SnowboyMemalign(alignof(Range),
+                                 sizeof(Range) * (num_workers + 1));
+  if (ranges == NULL) {
+    throw std::bad_alloc();
+  }
+  ranges_ = static_cast<Range*>(ranges);
+  for (int32 i = 0; i < num_workers + 1; ++i) {
+    new (&ranges_[i]) Range();
+    ranges_[i].packed.store(0, std::memory_order_relaxed);
+  }
+  for (int32 i = 0; i < num_workers; ++i) {
+    workers_.push_back(std::thread(&ThreadPool::WorkerLoop, this, i + 1));
+    if (cpus.empty()) {
+      continue;
+    }
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpus[i % cpus.size()], &cpu_set);
+    if (pthread_setaffinity_np(workers_.back().native_handle(),
+                               sizeof(cpu_set), &cpu_set) == 0) {
+      worker_cpus_[i] = cpus[i % cpus.size()];
+    } else {
+      SNOWBOY_WARN << "Fail to pin thread pool worker " << i << " to CPU "
+          << cpus[i % cpus.size()];
+    }
+#else
+    SNOWBOY_WARN << "Pinning thread pool workers is only supported on Linux.";
+#endif
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  job_ready_.notify_all();
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    workers_[i].join();
+  }
+  for (int32 i = 0; i < NumThreads(); ++i) {
+    ranges_[i].~Range();
+  }
+  SnowboyMemalignFree(ranges_);
+}
+
+ThreadPool* ThreadPool::Global() {
+  ThreadPool* pool = global_pool.load(std::memory_order_acquire);
+  if (pool != NULL) {
+    return pool;
+  }
+  std::lock_guard<std::mutex> lock(global_pool_mutex);
+  pool = global_pool.load(std::memory_order_relaxed);
+  if (pool == NULL) {
+    int32 num_workers = global_num_workers;
+    if (num_workers < 0) {
+      num_workers = std::max<int32>(1, std::thread::hardware_concurrency()) - 1;
+    }
+    // Never deleted, so that it outlives static objects that use it.
+    pool = new ThreadPool(num_workers, global_cpus);
+    global_pool.store(pool, std::memory_order_release);
+  }
+  return pool;
+}
+
+void ThreadPool::ConfigureGlobal(const int32 num_workers,
+                                 const std::vector<int32>& cpus) {
+  SNOWBOY_ASSERT(num_workers >= 0);
+  std::lock_guard<std::mutex> lock(global_pool_mutex);
+  if (global_pool.load(std::memory_order_relaxed) != NULL) {
+    SNOWBOY_ERROR << "ThreadPool::ConfigureGlobal() must be called before the "
+        << "global thread pool is first used.";
+  }
+  global_num_workers = num_workers;
+  global_cpus = cpus;
+}
+
+ThreadPool* ThreadPool::Current() {
+  return current_pool_set ? current_pool
+                          : global_pool.load(std::memory_order_acquire);
+}
+
+int32 ThreadPool::WorkerCpu(const int32 worker) const {
+  SNOWBOY_ASSERT(worker >= 0 && worker < static_cast<int32>(workers_.size()));
+  return worker_cpus_[worker];
+}
+
+bool ThreadPool::TakeFront(const int32 index, MatrixIndexT* chunk_begin,
+                           MatrixIndexT* chunk_end) {
+  std::atomic<uint64>& packed = ranges_[index].packed;
+  uint64 current = packed.load(std::memory_order_acquire);
+  while (true) {
+    MatrixIndexT begin, end;
+    UnpackRange(current, &begin, &end);
+    if (begin >= end) {
+      return false;
+    }
+    MatrixIndexT middle = std::min(end, begin + chunk_);
+    if (packed.compare_exchange_weak(current, PackRange(middle, end),
+                                     std::memory_order_acq_rel)) {
+      *chunk_begin = begin;
+      *chunk_end = middle;
+      return true;
+    }
+  }
+}
+
+bool ThreadPool::StealBack(const int32 index, MatrixIndexT* steal_begin,
+                           MatrixIndexT* steal_end) {
+  std::atomic<uint64>& packed = ranges_[index].packed;
+  uint64 current = packed.load(std::memory_order_acquire);
+  while (true) {
+    MatrixIndexT begin, end;
+    UnpackRange(current, &begin, &end);
+    if (begin >= end) {
+      return false;
+    }
+    MatrixIndexT middle = (end - begin <= chunk_) ? begin
+                                                  : begin + (end - begin) / 2;
+    if (packed.compare_exchange_weak(current, PackRange(begin, middle),
+                                     std::memory_order_acq_rel)) {
+      *steal_begin = middle;
+      *steal_end = end;
+      return true;
+    }
+  }
+}
+
+void ThreadPool::RunChunks(const int32 index) {
+  if (no_allocation_ && !InNoAllocationScope()) {
+    NoAllocationScope no_allocation;
+    RunChunks(index);
+    return;
+  }
+  const int32 num_threads = NumThreads();
+  while (true) {
+    MatrixIndexT chunk_begin, chunk_end;
+    while (TakeFront(index, &chunk_begin, &chunk_end)) {
+      SNOWBOY_TRACE_SCOPE("ParallelFor", chunk_end - chunk_begin, 0, 0, 0);
+      invoke_(func_, chunk_begin, chunk_end);
+    }
+    // Own range is empty: steal from the others, starting with the next
+    // thread so that thieves spread over the victims.
+    bool stolen = false;
+    for (int32 i = 1; i < num_threads && !stolen; ++i) {
+      MatrixIndexT steal_begin, steal_end;
+      if (StealBack((index + i) % num_threads, &steal_begin, &steal_end)) {
+        ranges_[index].packed.store(PackRange(steal_begin, steal_end),
+                                    std::memory_order_release);
+        stolen = true;
+      }
+    }
+    if (!stolen) {
+      return;
+    }
+  }
+}
+
+void ThreadPool::DropChunks() {
+  for (int32 t = 0; t < NumThreads(); ++t) {
+    ranges_[t].packed.store(PackRange(0, 0), std::memory_order_release);
+  }
+}
+
+void ThreadPool::WorkerLoop(const int32 index) {
+  in_parallel_for = true;
+  uint64 generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      job_ready_.wait(lock, [&] { return stop_ || generation_ != generation; });
+      if (stop_) {
+        return;
+      }
+      generation = generation_;
+    }
+    try {
+      RunChunks(index);
+    } catch (...) {
+      // Passed on to the caller, which is waiting for this thread anyway.
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (error_ == nullptr) {
+        error_ = std::current_exception();
+      }
+      DropChunks();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--active_workers_ == 0) {
+        job_done_.notify_one();
+      }
+    }
+  }
+}
+
+class ThreadPool::JobGuard {
+ public:
+  explicit JobGuard(ThreadPool* pool) : pool_(pool) {
+    in_parallel_for = true;
+  }
+
+  ~JobGuard() {
+    pool_->DropChunks();
+    {
+      std::unique_lock<std::mutex> lock(pool_->mutex_);
+      pool_->job_done_.wait(lock, [this] {
+        return pool_->active_workers_ == 0;
+      });
+      pool_->invoke_ = NULL;
+      pool_->func_ = NULL;
+    }
+    in_parallel_for = false;
+  }
+
+ private:
+  ThreadPool* pool_;
+
+  SNOWBOY_DISALLOW_COPY_AND_ASSIGN(JobGuard);
+};
+
+void ThreadPool::Run(const MatrixIndexT begin, const MatrixIndexT end,
+                     const MatrixIndexT grain, ChunkFunction invoke,
+                     const void* func) {
+  if (begin >= end) {
+    return;
+  }
+  const MatrixIndexT n = end - begin;
+  const MatrixIndexT min_chunk = std::max<MatrixIndexT>(1, grain);
+  if (workers_.empty() || in_parallel_for || n <= min_chunk) {
+    invoke(func, begin, end);
+    return;
+  }
+
+  std::lock_guard<std::mutex> job_lock(job_mutex_);
+  {
+    JobGuard job(this);
+    std::unique_lock<std::mutex> lock(mutex_);
+    // A few chunks per thread, so that there is something left to steal.
+    const int32 num_threads = NumThreads();
+    MatrixIndexT num_chunks = std::min<MatrixIndexT>(
+        4 * num_threads, (n + min_chunk - 1) / min_chunk);
+    chunk_ = (n + num_chunks - 1) / num_chunks;
+    // Thread t starts with the t-th of <num_threads> equal ranges.
+    for (int32 t = 0; t < num_threads; ++t) {
+      MatrixIndexT range_begin =
+          begin + static_cast<MatrixIndexT>(static_cast<int64>(n) * t
+                                            / num_threads);
+      MatrixIndexT range_end =
+          begin + static_cast<MatrixIndexT>(static_cast<int64>(n) * (t + 1)
+                                            / num_threads);
+      ranges_[t].packed.store(PackRange(range_begin, range_end),
+                              std::memory_order_relaxed);
+    }
+    invoke_ = invoke;
+    func_ = func;
+    no_allocation_ = InNoAllocationScope();
+    error_ = nullptr;
+    active_workers_ = workers_.size();
+    ++generation_;
+    lock.unlock();
+    job_ready_.notify_all();
+    RunChunks(0);
+  }
+  // The workers are done, and callers are still serialized by <job_lock>.
+  if (error_ != nullptr) {
+    std::exception_ptr error = error_;
+    error_ = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+ScopedThreadPool::ScopedThreadPool(ThreadPool* pool)
+    : previous_(current_pool), previous_set_(current_pool_set) {
+  current_pool = pool;
+  current_pool_set = true;
+}
+
+ScopedThreadPool::~ScopedThreadPool() {
+  current_pool = previous_;
+  current_pool_set = previous_set_;
+}
+
+}  // namespace snowboy
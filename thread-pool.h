@@ -0,0 +1,201 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#ifndef SNOWBOY_MATRIX_THREAD_POOL_H_
+#define SNOWBOY_MATRIX_THREAD_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "matrix/matrix-common.h"
+#include "utils/snowboy-types.h"
+#include "utils/snowboy-utils.h"
+
+namespace snowboy {
+
+// Fixed set of worker threads for data-parallel loops over rows. The calling
+// thread takes part in the loop, so a pool with N - 1 workers uses N threads.
+//
+// A loop is split into one contiguous range per thread, so that a thread sees
+// the same rows from one loop to the next. Each thread takes chunks from the
+// front of its own range, and once it is empty steals the back half of the
+// range of another thread, so that uneven chunks or a descheduled thread do
+// not hold up the loop. Ranges are packed in one atomic word per thread and a
+// loop allocates nothing.
+//
+// A ParallelFor() called from a thread that is already running a loop, i.e.,
+// from a loop body or from any thread of any pool, runs serially on that
+// thread, so nested loops never oversubscribe the machine. Concurrent callers
+// of one pool are served one at a time.
+//
+// If a chunk throws, e.g. through SNOWBOY_ERROR, the chunks not yet started are
+// dropped, and ParallelFor() waits for the threads still running one before it
+// rethrows the first exception on the calling thread.
+class ThreadPool {
+ public:
+  // Creates a pool with <num_workers> threads besides the caller. If <cpus> is
+  // not empty, worker i is pinned to CPU cpus[i % cpus.size()]; the caller
+  // is left alone. Pinning is only supported on Linux.
+  explicit ThreadPool(const int32 num_workers,
+                      const std::vector<int32>& cpus = std::vector<int32>());
+
+  ~ThreadPool();
+
+  // Returns the pool shared by the matrix library, with one thread per
+  // hardware thread unless configured otherwise with ConfigureGlobal().
+  // Created on the first call. The library itself never calls it, so that it
+  // starts no threads unless the application asks for them: until then, loops
+  // run on the calling thread.
+  static ThreadPool* Global();
+
+  // Sets the number of workers and the CPUs of the global pool. Must be
+  // called before the first use of Global().
+  static void ConfigureGlobal(const int32 num_workers,
+                              const std::vector<int32>& cpus);
+
+  // Returns the pool used by the matrix library on the calling thread: the
+  // one set by a ScopedThreadPool if any, otherwise the global pool if
+  // Global() has created it. NULL means that loops run serially.
+  static ThreadPool* Current();
+
+  // Returns the number of threads taking part in a loop, i.e., workers + 1.
+  int32 NumThreads() const { return workers_.size() + 1; }
+
+  // Returns the CPU worker <worker> is pinned to, or -1 if it is not pinned.
+  int32 WorkerCpu(const int32 worker) const;
+
+  // Calls func(chunk_begin, chunk_end) on contiguous chunks covering
+  // [begin, end), with at least <grain> indices per chunk except for the last
+  // one, and returns when all chunks are done. <func> is called by reference,
+  // not wrapped in a std::function, so that a loop does not allocate.
+  template <typename Func>
+  void ParallelFor(const MatrixIndexT begin, const MatrixIndexT end,
+                   const MatrixIndexT grain, const Func& func) {
+    Run(begin, end, grain, &InvokeChunk<Func>, &func);
+  }
+
+ private:
+  typedef void (*ChunkFunction)(const void* func, MatrixIndexT chunk_begin,
+                                MatrixIndexT chunk_end);
+
+  // Ends the job of Run() on destruction, also when a chunk of the caller
+  // throws: drops the chunks left, waits for the workers, which may still call
+  // <func_> in the caller's frame, and clears the job.
+  class JobGuard;
+
+  template <typename Func>
+  static void InvokeChunk(const void* func, MatrixIndexT chunk_begin,
+                          MatrixIndexT chunk_end) {
+    (*static_cast<const Func*>(func))(chunk_begin, chunk_end);
+  }
+
+  // The remaining range [begin, end) of one thread, as (begin << 32) | end,
+  // alone on its cache line so that threads do not share lines.
+  struct alignas(64) Range {
+    std::atomic<uint64> packed;
+  };
+
+  void Run(const MatrixIndexT begin, const MatrixIndexT end,
+           const MatrixIndexT grain, ChunkFunction invoke, const void* func);
+
+  void WorkerLoop(const int32 index);
+
+  // Takes up to <chunk_> indices from the front of range <index>.
+  bool TakeFront(const int32 index, MatrixIndexT* chunk_begin,
+                 MatrixIndexT* chunk_end);
+
+  // Takes the back half of range <index>, or all of it if it is not larger
+  // than a chunk.
+  bool StealBack(const int32 index, MatrixIndexT* steal_begin,
+                 MatrixIndexT* steal_end);
+
+  // Runs chunks of the current job on thread <index> until there are none
+  // left in any range.
+  void RunChunks(const int32 index);
+
+  // Empties all ranges, so that the threads start no more chunks of the
+  // current job.
+  void DropChunks();
+
+  std::vector<std::thread> workers_;
+  std::vector<int32> worker_cpus_;
+
+  // One per thread, the caller first. Allocated 64-byte aligned, which
+  // std::vector does not do for over-aligned types before C++17.
+  Range* ranges_;
+
+  // Serializes callers of ParallelFor().
+  std::mutex job_mutex_;
+
+  // Protects the job description and the counters below.
+  std::mutex mutex_;
+  std::condition_variable job_ready_;
+  std::condition_variable job_done_;
+  bool stop_;
+  uint64 generation_;
+  int32 active_workers_;
+
+  // The current job. <no_allocation_> is true if the caller is inside a
+  // NoAllocationScope, which then also covers the workers.
+  ChunkFunction invoke_;
+  const void* func_;
+  bool no_allocation_;
+  MatrixIndexT chunk_;
+
+  // First exception thrown by a worker in the current job.
+  std::exception_ptr error_;
+
+  SNOWBOY_DISALLOW_COPY_AND_ASSIGN(ThreadPool);
+};
+
+// Sets the pool that the matrix library uses on the calling thread, from
+// construction to destruction. With a NULL pool the library runs serially on
+// the thread, e.g. on the threads of an application that already runs one
+// stream per core. Scopes nest.
+class ScopedThreadPool {
+ public:
+  explicit ScopedThreadPool(ThreadPool* pool);
+
+  ~ScopedThreadPool();
+
+ private:
+  ThreadPool* previous_;
+  bool previous_set_;
+
+  SNOWBOY_DISALLOW_COPY_AND_ASSIGN(ScopedThreadPool);
+};
+
+// Number of indices per parallel chunk, such that each chunk does about 64K
+// units of work, e.g. values converted or multiply-adds, given the work per
+// index. Loops below that, e.g. in the per-frame path, stay on the calling
+// thread.
+inline MatrixIndexT ParallelGrain(const int64 work_per_index) {
+  return std::max<int64>(1, 65536 / std::max<int64>(1, work_per_index));
+}
+
+// Runs the loop on ThreadPool::Current(), or serially if there is none. A loop
+// that fits in one chunk does not even look up the pool.
+template <typename Func>
+void ParallelFor(const MatrixIndexT begin, const MatrixIndexT end,
+                 const MatrixIndexT grain, const Func& func) {
+  if (end - begin <= std::max<MatrixIndexT>(1, grain)) {
+    if (begin < end) {
+      func(begin, end);
+    }
+    return;
+  }
+  ThreadPool* pool = ThreadPool::Current();
+  if (pool != NULL) {
+    pool->ParallelFor(begin, end, grain, func);
+  } else if (begin < end) {
+    func(begin, end);
+  }
+}
+
+}  // namespace snowboy
+
+#endif  // SNOWBOY_MATRIX_THREAD_POOL_H_
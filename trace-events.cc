@@ -0,0 +1,177 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "matrix/trace-events.h"
+
+namespace snowboy {
+
+namespace internal {
+
+std::atomic<bool> trace_enabled(false);
+
+}  // namespace internal
+
+struct TraceEvent {
+  const char* name;
+  uint64 begin;
+  uint64 end;
+  MatrixIndexT m;
+  MatrixIndexT k;
+  MatrixIndexT n;
+  int64 bytes;
+};
+
+// Ring buffer of one thread. Only the owning thread writes; <head_> counts
+// the events ever written and is published after each write.
+class TraceBuffer {
+ public:
+  TraceBuffer(const int32 capacity, const int64 tid)
+      : events_(capacity), mask_(capacity - 1), head_(0), tid_(tid) {}
+
+  void Record(const TraceEvent& event) {
+    uint64 head = head_.load(std::memory_order_relaxed);
+    events_[head & mask_] = event;
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  // Appends the events still in the buffer, oldest first.
+  void GetEvents(std::vector<TraceEvent>* events) const {
+    uint64 head = head_.load(std::memory_order_acquire);
+    uint64 size = std::min<uint64>(head, events_.size());
+    for (uint64 i = head - size; i < head; ++i) {
+      events->push_back(events_[i & mask_]);
+    }
+  }
+
+  void Clear() { head_.store(0, std::memory_order_release); }
+
+  int64 Tid() const { return tid_; }
+
+ private:
+  std::vector<TraceEvent> events_;
+  const uint64 mask_;
+  std::atomic<uint64> head_;
+  const int64 tid_;
+};
+
+// Buffers outlive their threads, so that the events of finished threads are
+// still dumped.
+static std::mutex trace_mutex;
+static std::vector<std::unique_ptr<TraceBuffer> > trace_buffers;
+static int32 trace_capacity = 65536;
+
+// Timestamp and wall time when tracing was enabled, to convert timestamps to
+// microseconds.
+static uint64 trace_origin_ticks = 0;
+static double trace_origin_seconds = 0;
+
+static double NowSeconds() {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int64 CurrentThreadId() {
+#if defined(__linux__)
+  return syscall(SYS_gettid);
+#else
+  static std::atomic<int64> next_tid(1);
+  return next_tid.fetch_add(1);
+#endif
+}
+
+static TraceBuffer* GetThreadTraceBuffer() {
+  static thread_local TraceBuffer* buffer = NULL;
+  if (buffer == NULL) {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_buffers.push_back(std::unique_ptr<TraceBuffer>(
+        new TraceBuffer(trace_capacity, CurrentThreadId())));
+    buffer = trace_buffers.back().get();
+  }
+  return buffer;
+}
+
+void internal::RecordTraceEvent(const char* name, const uint64 begin,
+                                const uint64 end, const MatrixIndexT m,
+                                const MatrixIndexT k, const MatrixIndexT n,
+                                const int64 bytes) {
+  TraceEvent event = {name, begin, end, m, k, n, bytes};
+  GetThreadTraceBuffer()->Record(event);
+}
+
+void SetTracingEnabled(const bool enabled, const int32 capacity) {
+  SNOWBOY_ASSERT(capacity > 0);
+  {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    int32 rounded = 1;
+    while (rounded < capacity) {
+      rounded <<= 1;
+    }
+    trace_capacity = rounded;
+    if (enabled && trace_origin_ticks == 0) {
+      trace_origin_ticks = internal::TraceTimestamp();
+      trace_origin_seconds = NowSeconds();
+    }
+  }
+  internal::trace_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void ClearTrace() {
+  std::lock_guard<std::mutex> lock(trace_mutex);
+  for (size_t i = 0; i < trace_buffers.size(); ++i) {
+    trace_buffers[i]->Clear();
+  }
+}
+
+void WriteChromeTrace(std::ostream* os) {
+  SNOWBOY_ASSERT(os != NULL);
+  std::lock_guard<std::mutex> lock(trace_mutex);
+  // Timestamp ticks per microsecond, measured since tracing was enabled.
+  double ticks_per_us = 1;
+  if (trace_origin_ticks != 0) {
+    uint64 ticks = internal::TraceTimestamp() - trace_origin_ticks;
+    double seconds = NowSeconds() - trace_origin_seconds;
+    if (seconds > 0 && ticks > 0) {
+      ticks_per_us = ticks / (seconds * 1e6);
+    }
+  }
+
+  std::ios_base::fmtflags flags = os->flags();
+  std::streamsize precision = os->precision();
+  *os << std::fixed;
+  os->precision(3);
+  *os << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+  bool first = true;
+  std::vector<TraceEvent> events;
+  for (size_t b = 0; b < trace_buffers.size(); ++b) {
+    events.clear();
+    trace_buffers[b]->GetEvents(&events);
+    for (size_t i = 0; i < events.size(); ++i) {
+      const TraceEvent& e = events[i];
+      double ts = (static_cast<double>(e.begin)
+                   - static_cast<double>(trace_origin_ticks)) / ticks_per_us;
+      double dur = (e.end - e.begin) / ticks_per_us;
+      *os << (first ? "\n" : ",\n")
+          << "{\"name\": \"" << e.name << "\", \"cat\": \"matrix\""
+          << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << trace_buffers[b]->Tid()
+          << ", \"ts\": " << ts << ", \"dur\": " << dur
+          << ", \"args\": {\"m\": " << e.m << ", \"k\": " << e.k
+          << ", \"n\": " << e.n << ", \"bytes\": " << e.bytes << "}}";
+      first = false;
+    }
+  }
+  *os << "\n]}" << std::endl;
+  os->flags(flags);
+  os->precision(precision);
+}
+
+}  // namespace snowboy
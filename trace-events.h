@@ -0,0 +1,122 @@
+// Copyright 2017  Baidu (author: Meixu Song)
+
+// Hot-path tracing of the matrix kernels. SNOWBOY_TRACE_SCOPE(name, m, k, n,
+// bytes) records one event per call, with the shape, the bytes touched and
+// the thread, into a ring buffer owned by the calling thread, with rdtsc
+// timestamps. WriteChromeTrace() dumps the buffers as Chrome trace-event JSON,
+// which chrome://tracing and Perfetto load, e.g. to see where a slow frame
+// spent its time across quantize, multiply and activation, and on which
+// threads of the pool.
+//
+// Tracing is enabled at run time with SetTracingEnabled(). While disabled, a
+// trace scope costs one predictable branch on a global flag; its shape and
+// bytes are not evaluated. The buffers are single-producer and lock-free; each
+// keeps the last <capacity> events of its thread. Dumping while kernels run is
+// allowed, but events written during the dump may be torn, so dump after the
+// work of interest.
+
+#ifndef SNOWBOY_MATRIX_TRACE_EVENTS_H_
+#define SNOWBOY_MATRIX_TRACE_EVENTS_H_
+
+#include <atomic>
+#include <ostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+#include "matrix/matrix-common.h"
+#include "utils/snowboy-debug.h"
+#include "utils/snowboy-types.h"
+#include "utils/snowboy-utils.h"
+
+namespace snowboy {
+
+// Enables or disables tracing for all threads. Each thread allocates a buffer
+// of <capacity> events, rounded up to a power of two, on its first event.
+// Re-enabling keeps the recorded events, see ClearTrace().
+void SetTracingEnabled(const bool enabled, const int32 capacity = 65536);
+
+// Drops all recorded events. Must not run concurrently with traced kernels.
+void ClearTrace();
+
+// Writes the recorded events of all threads as Chrome trace-event JSON.
+void WriteChromeTrace(std::ostream* os);
+
+namespace internal {
+
+extern std::atomic<bool> trace_enabled;
+
+inline uint64 TraceTimestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Appends a complete event to the buffer of the calling thread.
+void RecordTraceEvent(const char* name, const uint64 begin, const uint64 end,
+                      const MatrixIndexT m, const MatrixIndexT k,
+                      const MatrixIndexT n, const int64 bytes);
+
+}  // namespace internal
+
+inline bool TracingEnabled() {
+  return internal::trace_enabled.load(std::memory_order_relaxed);
+}
+
+// Records the time between construction and destruction. <name> must be a
+// string literal, it is kept as is.
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name)
+      : name_(NULL), m_(0), k_(0), n_(0), bytes_(0), begin_(0) {
+    if (TracingEnabled()) {
+      name_ = name;
+      begin_ = internal::TraceTimestamp();
+    }
+  }
+
+  // Returns true if the event is recorded, i.e. tracing was enabled at
+  // construction.
+  bool Enabled() const { return begin_ != 0; }
+
+  void SetShape(const MatrixIndexT m, const MatrixIndexT k,
+                const MatrixIndexT n, const int64 bytes) {
+    m_ = m;
+    k_ = k;
+    n_ = n;
+    bytes_ = bytes;
+  }
+
+  ~TraceScope() {
+    if (begin_ != 0) {
+      internal::RecordTraceEvent(name_, begin_, internal::TraceTimestamp(),
+                                 m_, k_, n_, bytes_);
+    }
+  }
+
+ private:
+  const char* name_;
+  MatrixIndexT m_;
+  MatrixIndexT k_;
+  MatrixIndexT n_;
+  int64 bytes_;
+  uint64 begin_;
+
+  SNOWBOY_DISALLOW_COPY_AND_ASSIGN(TraceScope);
+};
+
+// The shape and the bytes are only evaluated when tracing is enabled.
+#define SNOWBOY_TRACE_SCOPE(name, m, k, n, bytes)                             \
+  ::snowboy::TraceScope snowboy_trace_scope_(name);                           \
+  if (snowboy_trace_scope_.Enabled())                                         \
+    snowboy_trace_scope_.SetShape(m, k, n, bytes)
+
+}  // namespace snowboy
+
+#endif  // SNOWBOY_MATRIX_TRACE_EVENTS_H_
@@ -31,80 +31,142 @@
 #include <algorithm>
 #include <cmath>
 #include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
 
+#include "matrix/float-kernel.h"
+#include "matrix/kernel-tuning.h"
+#include "matrix/matrix-memory.h"
 #include "matrix/matrix-wrapper.h"
+#include "matrix/perf-counters.h"
+#include "matrix/trace-events.h"
 #include "matrix/vector-wrapper.h"
 #include "utils/snowboy-io.h"
 #include "utils/snowboy-math.h"
 
 namespace snowboy {
 
+// Converts <x> to Real, rounded to nearest and saturated to the range of Real
+// for integer types.
+template <typename Real>
+static inline Real convert_from_float(const float x) {
+  if (!std::numeric_limits<Real>::is_integer) {
+    return static_cast<Real>(x);
+  }
+  const float lo = static_cast<float>(std::numeric_limits<Real>::min());
+  const float hi = static_cast<float>(std::numeric_limits<Real>::max());
+  if (!(x > lo)) {
+    // Also maps NaN to the lower bound rather than to undefined behavior.
+    return std::numeric_limits<Real>::min();
+  } else if (x >= hi) {
+    return std::numeric_limits<Real>::max();
+  }
+  return static_cast<Real>(std::lrintf(x));
+}
+
+// Token of the binary format, it records the element type so that e.g. an
+// int16 vector is never read as an int32 one.
+template <typename Real> static const char* vector_token();
+template <> const char* vector_token<float>() { return "FV"; }
+template <> const char* vector_token<double>() { return "DV"; }
+template <> const char* vector_token<int16>() { return "IV16"; }
+template <> const char* vector_token<int32>() { return "IV32"; }
+
 ////////////////////////////////////////////////////////////////////////////////
 //
-// VectorBase class
+// VectorBaseT class
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-bool VectorBase::IsZero(const float cutoff) const {
-  float abs_max = 0.0;
+template <typename Real>
+bool VectorBaseT<Real>::IsZero(const Real cutoff) const {
+  Real abs_max = 0.0;
   for (MatrixIndexT i = 0; i < Dim(); ++i)
     abs_max = std::max(std::fabs(data_[i]), abs_max);
   return (abs_max <= cutoff);
 }
 
-void VectorBase::Set(const float value) {
+template <typename Real>
+void VectorBaseT<Real>::Set(const Real value) {
   std::fill(data_, data_ + dim_, value);
 }
 
-void VectorBase::SetZero() {
-  std::memset(data_, 0, dim_ * sizeof(float));
+template <typename Real>
+void VectorBaseT<Real>::SetZero() {
+  std::memset(data_, 0, dim_ * sizeof(Real));
 }
 
-void VectorBase::SetRandomGaussian() {
+template <typename Real>
+void VectorBaseT<Real>::SetRandomGaussian() {
   for (MatrixIndexT i = 0; i < Dim(); ++i) {
     data_[i] = RandomGaussian();
   }
 }
 
-void VectorBase::SetRandomUniform() {
+template <typename Real>
+void VectorBaseT<Real>::SetRandomUniform() {
   for (MatrixIndexT i = 0; i < Dim(); ++i) {
     data_[i] = RandomUniform();
   }
 }
 
-SubVector VectorBase::Range(const MatrixIndexT origin,
-                            const MatrixIndexT length) {
-  return SubVector(*this, origin, length);
+template <typename Real>
+SubVectorT<Real> VectorBaseT<Real>::Range(const MatrixIndexT origin,
+                                          const MatrixIndexT length) {
+  return SubVectorT<Real>(*this, origin, length);
 }
 
-const SubVector VectorBase::Range(const MatrixIndexT origin,
-                                  const MatrixIndexT length) const {
-  return SubVector(*this, origin, length);
+template <typename Real>
+const SubVectorT<Real> VectorBaseT<Real>::Range(
+    const MatrixIndexT origin, const MatrixIndexT length) const {
+  return SubVectorT<Real>(*this, origin, length);
 }
 
-void VectorBase::CopyFromVec(const VectorBase& vec) {
+template <typename Real>
+void VectorBaseT<Real>::CopyFromVec(const VectorBaseT<Real>& vec) {
   SNOWBOY_ASSERT(Dim() == vec.Dim());
   if (data_ != vec.data_) {
-    std::memcpy(data_, vec.data_, sizeof(float) * dim_);
+    std::memcpy(data_, vec.data_, sizeof(Real) * dim_);
   }
 }
 
-void VectorBase::CopyRowsFromMat(const MatrixBase& mat) {
+template <typename Real>
+void VectorBaseT<Real>::CopyFromVec(const VectorBase& vec, const float scale) {
+  SNOWBOY_ASSERT(dim_ == vec.Dim());
+  const float* vec_data = vec.Data();
+  for (MatrixIndexT i = 0; i < dim_; ++i) {
+    data_[i] = convert_from_float<Real>(scale * vec_data[i]);
+  }
+}
+
+template <typename Real>
+void VectorBaseT<Real>::CopyToVec(const float scale, VectorBase* vec) const {
+  SNOWBOY_ASSERT(vec != NULL && dim_ == vec->Dim());
+  float* vec_data = vec->Data();
+  for (MatrixIndexT i = 0; i < dim_; ++i) {
+    vec_data[i] = scale * data_[i];
+  }
+}
+
+template <typename Real>
+void VectorBaseT<Real>::CopyRowsFromMat(const MatrixBaseT<Real>& mat) {
   SNOWBOY_ASSERT(dim_ == mat.NumCols() * mat.NumRows());
 
   const MatrixIndexT cols = mat.NumCols();
   const MatrixIndexT rows = mat.NumRows();
 
   if (mat.Stride() == cols) {
-    memcpy(data_, mat.Data(), sizeof(float) * rows * cols);
+    memcpy(data_, mat.Data(), sizeof(Real) * rows * cols);
   } else {
     for (MatrixIndexT r = 0; r < rows; ++r) {
-      memcpy(data_ + r * cols, mat.RowData(r), sizeof(float) * cols);
+      memcpy(data_ + r * cols, mat.RowData(r), sizeof(Real) * cols);
     }
   }
 }
 
-void VectorBase::CopyColsFromMat(const MatrixBase& mat) {
+template <typename Real>
+void VectorBaseT<Real>::CopyColsFromMat(const MatrixBaseT<Real>& mat) {
   SNOWBOY_ASSERT(dim_ == mat.NumCols() * mat.NumRows());
 
   for (MatrixIndexT r = 0; r < mat.NumRows(); ++r) {
@@ -114,27 +176,32 @@ void VectorBase::CopyColsFromMat(const MatrixBase& mat) {
   }
 }
 
-float VectorBase::Sum() const {
-  float sum = 0.0;
+template <typename Real>
+Real VectorBaseT<Real>::Sum() const {
+  Real sum = 0.0;
   for (MatrixIndexT d = 0; d < dim_; ++d) {
     sum += data_[d];
   }
   return sum;
 }
 
-void VectorBase::Add(const float value) {
+template <typename Real>
+void VectorBaseT<Real>::Add(const Real value) {
   for (MatrixIndexT d = 0; d < dim_; ++d) {
     data_[d] += value;
   }
 }
 
-void VectorBase::AddVec(const float alpha, const VectorBase& vec) {
+template <typename Real>
+void VectorBaseT<Real>::AddVec(const Real alpha, const VectorBaseT<Real>& vec) {
   SNOWBOY_ASSERT(dim_ == vec.dim_);
   SNOWBOY_ASSERT(&vec != this);
   cblas_saxpy(dim_, alpha, vec.Data(), 1, data_, 1);
 }
 
-void VectorBase::AddVec2(const float alpha, const VectorBase& vec) {
+template <typename Real>
+void VectorBaseT<Real>::AddVec2(const Real alpha,
+                                const VectorBaseT<Real>& vec) {
   SNOWBOY_ASSERT(dim_ == vec.dim_);
   if (alpha != 1.0) {
     for (MatrixIndexT d = 0; d < dim_; ++d) {
@@ -147,45 +214,51 @@ void VectorBase::AddVec2(const float alpha, const VectorBase& vec) {
   }
 }
 
-void VectorBase::AddDiagMat2(const float alpha, const MatrixBase& mat,
-                             const MatrixTransposeType trans,
-                             const float beta) {
+template <typename Real>
+void VectorBaseT<Real>::AddDiagMat2(const Real alpha,
+                                    const MatrixBaseT<Real>& mat,
+                                    const MatrixTransposeType trans,
+                                    const Real beta) {
   if (trans == kNoTrans) {
     SNOWBOY_ASSERT(dim_ == mat.NumRows());
     MatrixIndexT cols = mat.NumCols(), mat_stride = mat.Stride();
-    float* data = data_;
-    const float* mat_data = mat.Data();
+    Real* data = data_;
+    const Real* mat_data = mat.Data();
     for (MatrixIndexT i = 0; i < dim_; i++, mat_data += mat_stride, data++) {
       *data = beta * *data + alpha * cblas_sdot(cols, mat_data, 1, mat_data, 1);
     }
   } else {
     SNOWBOY_ASSERT(dim_ == mat.NumCols());
     MatrixIndexT rows = mat.NumRows(), mat_stride = mat.Stride();
-    float* data = data_;
-    const float* mat_data = mat.Data();
+    Real* data = data_;
+    const Real* mat_data = mat.Data();
     for (MatrixIndexT i = 0; i < dim_; i++, mat_data++, data++)
       *data = beta * *data + alpha * cblas_sdot(rows, mat_data, mat_stride,
                                                 mat_data, mat_stride);
   }
 }
 
-void VectorBase::Scale(const float alpha) {
+template <typename Real>
+void VectorBaseT<Real>::Scale(const Real alpha) {
   cblas_sscal(dim_, alpha, data_, 1);
 }
 
-void VectorBase::MulElements(const VectorBase& vec) {
+template <typename Real>
+void VectorBaseT<Real>::MulElements(const VectorBaseT<Real>& vec) {
   SNOWBOY_ASSERT(dim_ == vec.Dim());
   for (MatrixIndexT d = 0; d < dim_; ++d) {
     data_[d] *= vec(d);
   }
 }
 
-float VectorBase::DotVec(const VectorBase& vec) const {
+template <typename Real>
+Real VectorBaseT<Real>::DotVec(const VectorBaseT<Real>& vec) const {
   SNOWBOY_ASSERT(dim_ == vec.Dim());
   return cblas_sdot(dim_, data_, 1, vec.Data(), 1);
 }
 
-void VectorBase::ApplyFloor(const float floor) {
+template <typename Real>
+void VectorBaseT<Real>::ApplyFloor(const Real floor) {
   for (MatrixIndexT d = 0; d < dim_; ++d) {
     if (data_[d] < floor) {
       data_[d] = floor;
@@ -193,14 +266,16 @@ void VectorBase::ApplyFloor(const float floor) {
   }
 }
 
-void VectorBase::ApplyLog() {
-  for (MatrixIndexT d = 0; d < dim_; ++d) {
-    SNOWBOY_ASSERT(data_[d] > 0);
-    data_[d] = std::log(data_[d]);
+template <typename Real>
+void VectorBaseT<Real>::ApplyLog() {
+  if (!float_kernel_log(data_, data_, dim_)) {
+    SNOWBOY_ERROR << "Fail to take the log of a vector with non-positive "
+        << "elements.";
   }
 }
 
-void VectorBase::ApplyPow(const float power) {
+template <typename Real>
+void VectorBaseT<Real>::ApplyPow(const Real power) {
   if (power == 1.0) {
     return;
   }
@@ -217,48 +292,100 @@ void VectorBase::ApplyPow(const float power) {
       data_[i] = std::sqrt(data_[i]);
     }
   } else {
-    for (MatrixIndexT i = 0; i < dim_; i++) {
-      data_[i] = pow(data_[i], power);
-      if (data_[i] == HUGE_VAL) {
-        SNOWBOY_ERROR << "Could not raise element "  << i << " to power "
-            << power << ": returned value = " << data_[i];
-      }
+    MatrixIndexT i = float_kernel_pow(data_, data_, dim_, power);
+    if (i >= 0) {
+      SNOWBOY_ERROR << "Could not raise element "  << i << " to power "
+          << power << ": returned value = " << data_[i];
     }
   }
 }
 
-float VectorBase::ApplySoftmax() {
-  float max = Max(), sum = 0.0;
-  float* data = data_;
-  for (MatrixIndexT i = 0; i < dim_; ++i) {
-    sum += (data[i] = std::exp(data[i] - max));
-  }
-  Scale(1.0 / sum);
-  return max + std::log(sum);
+template <typename Real>
+Real VectorBaseT<Real>::ApplySoftmax() {
+  return float_kernel_softmax(data_, data_, dim_);
 }
 
-void VectorBase::AddMatVec(const float alpha, const MatrixBase& mat,
-                           const MatrixTransposeType trans,
-                           const VectorBase& vec, const float beta) {
+template <typename Real>
+Real VectorBaseT<Real>::ApplyLogSoftmax() {
+  return float_kernel_log_softmax(data_, data_, dim_);
+}
+
+template <typename Real>
+void VectorBaseT<Real>::AddMatVec(const Real alpha,
+                                  const MatrixBaseT<Real>& mat,
+                                  const MatrixTransposeType trans,
+                                  const VectorBaseT<Real>& vec,
+                                  const Real beta) {
+  SNOWBOY_PERF_SCOPE("AddMatVec", 1, vec.Dim(), dim_);
+  SNOWBOY_TRACE_SCOPE("AddMatVec", 1, vec.Dim(), dim_,
+                      sizeof(Real)
+                      * (static_cast<int64>(mat.NumRows()) * mat.NumCols()
+                         + vec.Dim() + dim_));
   if (trans == kNoTrans) {
     SNOWBOY_ASSERT(mat.NumRows() == dim_ && mat.NumCols() == vec.Dim());
   } else {
     SNOWBOY_ASSERT(mat.NumCols() == dim_ && mat.NumRows() == vec.Dim());
   }
   SNOWBOY_ASSERT(this != &vec);
+  if (mat.Stride() <= 0 && mat.NumCols() > 0) {
+    // Stride 0 has no blocks to split into, see below; copies instead.
+    MatrixT<Real> dense(mat);
+    AddMatVec(alpha, dense, trans, vec, beta);
+    return;
+  }
+  if (mat.Stride() < mat.NumCols()) {
+    // Overlapping rows (see MatrixBase::SpliceRows()), which cblas does not
+    // accept. We split <mat> into column blocks that do not overlap.
+    const MatrixIndexT step = mat.Stride();
+    for (MatrixIndexT offset = 0; offset < mat.NumCols(); offset += step) {
+      MatrixIndexT width = std::min(step, mat.NumCols() - offset);
+      SubMatrixT<Real> block(mat.ColRange(offset, width));
+      if (trans == kNoTrans) {
+        AddMatVec(alpha, block, kNoTrans, vec.Range(offset, width),
+                  offset == 0 ? beta : 1.0f);
+      } else {
+        Range(offset, width).AddMatVec(alpha, block, kTrans, vec, beta);
+      }
+    }
+    return;
+  }
+  const MatrixIndexT prefetch_rows = PrefetchRows();
+  const size_t row_bytes = sizeof(Real) * mat.NumCols();
+  if (trans == kNoTrans && prefetch_rows > 0 &&
+      row_bytes * mat.NumRows() > (1 << 20)) {
+    // Weights too large for the caches. cblas walks the rows in order, but
+    // the hardware prefetcher loses the stream at row boundaries, so the rows
+    // go through in panels of about 16 KiB, and the rows after a panel are
+    // prefetched before it is multiplied.
+    const MatrixIndexT panel = std::max<MatrixIndexT>(
+        prefetch_rows, (16 << 10) / row_bytes);
+    for (MatrixIndexT r = 0; r < mat.NumRows(); r += panel) {
+      const MatrixIndexT panel_rows = std::min(panel, mat.NumRows() - r);
+      const MatrixIndexT ahead = std::min(prefetch_rows,
+                                          mat.NumRows() - r - panel_rows);
+      for (MatrixIndexT i = 0; i < ahead; ++i) {
+        PrefetchRange(mat.RowData(r + panel_rows + i), row_bytes);
+      }
+      cblas_sgemv(CblasRowMajor, CblasNoTrans, panel_rows, mat.NumCols(),
+                  alpha, mat.RowData(r), mat.Stride(), vec.Data(), 1, beta,
+                  data_ + r, 1);
+    }
+    return;
+  }
   cblas_sgemv(CblasRowMajor, static_cast<CBLAS_TRANSPOSE>(trans),
               mat.NumRows(), mat.NumCols(), alpha,
               mat.Data(), mat.Stride(), vec.Data(), 1, beta, data_, 1);
 }
 
-float VectorBase::Max() const {
-  float ans = -std::numeric_limits<float>::infinity();
-  const float* data = data_;
+template <typename Real>
+Real VectorBaseT<Real>::Max() const {
+  Real ans = -std::numeric_limits<Real>::infinity();
+  const Real* data = data_;
   MatrixIndexT i;
   for (i = 0; i + 4 <= dim_; i += 4) {
-    float a1 = data[i], a2 = data[i + 1], a3 = data[i + 2], a4 = data[i + 3];
+    Real a1 = data[i], a2 = data[i + 1], a3 = data[i + 2], a4 = data[i + 3];
     if (a1 > ans || a2 > ans || a3 > ans || a4 > ans) {
-      float b1 = (a1 > a2 ? a1 : a2), b2 = (a3 > a4 ? a3 : a4);
+      Real b1 = (a1 > a2 ? a1 : a2), b2 = (a3 > a4 ? a3 : a4);
       if (b1 > ans) ans = b1;
       if (b2 > ans) ans = b2;
     }
@@ -271,14 +398,15 @@ float VectorBase::Max() const {
   return ans;
 }
 
-float VectorBase::Max(MatrixIndexT* index) const {
+template <typename Real>
+Real VectorBaseT<Real>::Max(MatrixIndexT* index) const {
   SNOWBOY_ASSERT(index != NULL);
-  float ans = -std::numeric_limits<float>::infinity();
+  Real ans = -std::numeric_limits<Real>::infinity();
   *index = -1;
-  const float* data = data_;
+  const Real* data = data_;
   MatrixIndexT i;
   for (i = 0; i + 4 <= dim_; i += 4) {
-    float a1 = data[i], a2 = data[i + 1], a3 = data[i + 2], a4 = data[i + 3];
+    Real a1 = data[i], a2 = data[i + 1], a3 = data[i + 2], a4 = data[i + 3];
     if (a1 > ans || a2 > ans || a3 > ans || a4 > ans) {
       if (a1 > ans) { ans = a1; *index = i; }
       if (a2 > ans) { ans = a2; *index = i + 1; }
@@ -295,14 +423,15 @@ float VectorBase::Max(MatrixIndexT* index) const {
   return ans;
 }
 
-float VectorBase::Min() const {
-  float ans = std::numeric_limits<float>::infinity();
-  const float* data = data_;
+template <typename Real>
+Real VectorBaseT<Real>::Min() const {
+  Real ans = std::numeric_limits<Real>::infinity();
+  const Real* data = data_;
   MatrixIndexT i;
   for (i = 0; i + 4 <= dim_; i += 4) {
-    float a1 = data[i], a2 = data[i + 1], a3 = data[i + 2], a4 = data[i + 3];
+    Real a1 = data[i], a2 = data[i + 1], a3 = data[i + 2], a4 = data[i + 3];
     if (a1 < ans || a2 < ans || a3 < ans || a4 < ans) {
-      float b1 = (a1 < a2 ? a1 : a2), b2 = (a3 < a4 ? a3 : a4);
+      Real b1 = (a1 < a2 ? a1 : a2), b2 = (a3 < a4 ? a3 : a4);
       if (b1 < ans) ans = b1;
       if (b2 < ans) ans = b2;
     }
@@ -315,14 +444,15 @@ float VectorBase::Min() const {
   return ans;
 }
 
-float VectorBase::Min(MatrixIndexT* index) const {
+template <typename Real>
+Real VectorBaseT<Real>::Min(MatrixIndexT* index) const {
   SNOWBOY_ASSERT(index != NULL);
-  float ans = std::numeric_limits<float>::infinity();
+  Real ans = std::numeric_limits<Real>::infinity();
   *index = -1;
-  const float* data = data_;
+  const Real* data = data_;
   MatrixIndexT i;
   for (i = 0; i + 4 <= dim_; i += 4) {
-    float a1 = data[i], a2 = data[i + 1], a3 = data[i + 2], a4 = data[i + 3];
+    Real a1 = data[i], a2 = data[i + 1], a3 = data[i + 2], a4 = data[i + 3];
     if (a1 < ans || a2 < ans || a3 < ans || a4 < ans) {
       if (a1 < ans) { ans = a1; *index = i; }
       if (a2 < ans) { ans = a2; *index = i + 1; }
@@ -339,9 +469,10 @@ float VectorBase::Min(MatrixIndexT* index) const {
   return ans;
 }
 
-float VectorBase::Norm(float p) const {
+template <typename Real>
+Real VectorBaseT<Real>::Norm(Real p) const {
   SNOWBOY_ASSERT(p >= 0.0f);
-  float sum = 0.0f;
+  Real sum = 0.0f;
   if (p == 0.0f) {
     for (MatrixIndexT d = 0; d < dim_; ++d) {
       if (data_[d] != 0.0f) {
@@ -357,7 +488,7 @@ float VectorBase::Norm(float p) const {
   } else if (p == 2.0f) {
     return cblas_snrm2(dim_, data_, 1);
   } else {
-    float tmp;
+    Real tmp;
     bool ok = true;
     for (MatrixIndexT d = 0; d < dim_; d++) {
       tmp = std::pow(std::abs(data_[d]), p);
@@ -367,40 +498,49 @@ float VectorBase::Norm(float p) const {
       }
       sum += tmp;
     }
-    tmp = std::pow(sum, static_cast<float>(1.0f / p));
+    tmp = std::pow(sum, static_cast<Real>(1.0f / p));
     SNOWBOY_ASSERT(tmp != HUGE_VAL);
     if (ok) {
       return tmp;
     } else {
-      float maximum = this->Max(), minimum = this->Min(),
+      Real maximum = this->Max(), minimum = this->Min(),
             max_abs = std::max(maximum, -minimum);
       SNOWBOY_ASSERT(max_abs > 0);
-      Vector tmp_vec(*this);
-      tmp_vec.Scale(1.0f / max_abs);
-      return tmp_vec.Norm(p) * max_abs;
+      // Same as above on the values scaled by 1 / max_abs, which keeps the
+      // powers in range, without a temporary copy.
+      const Real inv_max_abs = 1.0f / max_abs;
+      sum = 0.0f;
+      for (MatrixIndexT d = 0; d < dim_; d++) {
+        sum += std::pow(std::abs(data_[d] * inv_max_abs), p);
+      }
+      return std::pow(sum, static_cast<Real>(1.0f / p)) * max_abs;
     }
   }
 }
 
-float VectorBase::EuclideanDistance(const VectorBase& vec) const {
+template <typename Real>
+Real VectorBaseT<Real>::EuclideanDistance(const VectorBaseT<Real>& vec) const {
   SNOWBOY_ASSERT(dim_ == vec.Dim());
-  float sum = 0.0f;
+  Real sum = 0.0f;
   for (MatrixIndexT d = 0; d < dim_; ++d) {
     sum += (data_[d] - vec(d)) * (data_[d] - vec(d));
   }
   return std::sqrt(sum);
 }
 
-float VectorBase::CosineDistance(const VectorBase& vec) const {
+template <typename Real>
+Real VectorBaseT<Real>::CosineDistance(const VectorBaseT<Real>& vec) const {
   SNOWBOY_ASSERT(dim_ == vec.Dim());
-  float similarity = this->DotVec(vec) / this->Norm(2) / vec.Norm(2);
+  Real similarity = this->DotVec(vec) / this->Norm(2) / vec.Norm(2);
   return (1.0f - similarity) / 2.0f;
 }
 
-void VectorBase::Read(const bool binary, const bool add, std::istream* is) {
+template <typename Real>
+void VectorBaseT<Real>::Read(const bool binary, const bool add,
+                             std::istream* is) {
   SNOWBOY_ASSERT(is != NULL);
-  Vector tmp(Dim());
-  tmp.Read(binary, false, is);
+  VectorT<Real> tmp(Dim());
+  tmp.Read(binary, is);
   if (Dim() != tmp.Dim()) {
     SNOWBOY_ERROR << "Fail to read Vector: size mismatch " << Dim()
         << " vs. " << tmp.Dim();
@@ -412,22 +552,30 @@ void VectorBase::Read(const bool binary, const bool add, std::istream* is) {
   }
 }
 
-void VectorBase::Read(const bool binary, std::istream* is) {
+template <typename Real>
+void VectorBaseT<Real>::Read(const bool binary, std::istream* is) {
   SNOWBOY_ASSERT(is != NULL);
-  Read(binary, false, is);
+  VectorT<Real> tmp(Dim());
+  tmp.Read(binary, is);
+  if (Dim() != tmp.Dim()) {
+    SNOWBOY_ERROR << "Fail to read Vector: size mismatch " << Dim()
+        << " vs. " << tmp.Dim();
+  }
+  CopyFromVec(tmp);
 }
 
-void VectorBase::Write(const bool binary, std::ostream* os) const {
+template <typename Real>
+void VectorBaseT<Real>::Write(const bool binary, std::ostream* os) const {
   SNOWBOY_ASSERT(os != NULL);
   if (!os->good()) {
     SNOWBOY_ERROR << "Fail to write Vector to stream.";
   }
   if (binary) {
-    WriteToken(binary, "FV", os);   // We only write float value.
+    WriteToken(binary, vector_token<Real>(), os);
     int32 size = Dim();             // 32-bit on disk.
     SNOWBOY_ASSERT(Dim() == (MatrixIndexT)(size));
     WriteBasicType(binary, size, os);
-    os->write(reinterpret_cast<const char*>(Data()), sizeof(float) * size);
+    os->write(reinterpret_cast<const char*>(Data()), sizeof(Real) * size);
   } else {
     *os << " [ ";
     for (MatrixIndexT i = 0; i < Dim(); ++i) {
@@ -442,16 +590,17 @@ void VectorBase::Write(const bool binary, std::ostream* os) const {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Vector class
+// VectorT class
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-void Vector::Resize(const MatrixIndexT dim,
-                    const MatrixResizeType resize_type) {
+template <typename Real>
+void VectorT<Real>::Resize(const MatrixIndexT dim,
+                           const MatrixResizeType resize_type) {
   // First, checks if the current dimension satisfies the requested one.
-  if (dim_ == dim) {
+  if (this->dim_ == dim) {
     if (resize_type == kSetZero) {
-      Set(0);
+      this->Set(0);
     }
     return;
   }
@@ -460,123 +609,128 @@ void Vector::Resize(const MatrixIndexT dim,
 
   // Second, handles the kCopyData case.
   if (local_resize_type == kCopyData) {
-    if (data_ == NULL || dim_ == 0) {
+    if (this->data_ == NULL || this->dim_ == 0) {
       // Old vector is empty, we have nothing to copy.
       local_resize_type = kSetZero;
     } else {
-      MatrixResizeType new_resize_type = (dim > dim_) ? kSetZero : kUndefined;
-      Vector tmp(dim, new_resize_type);
-      MatrixIndexT dim_min = std::min(dim, dim_);
-      memcpy(tmp.data_, data_, sizeof(float) * dim_min);
+      MatrixResizeType new_resize_type =
+          (dim > this->dim_) ? kSetZero : kUndefined;
+      VectorT<Real> tmp(dim, new_resize_type);
+      MatrixIndexT dim_min = std::min(dim, this->dim_);
+      memcpy(tmp.data_, this->data_, sizeof(Real) * dim_min);
       tmp.Swap(this);
       return;
     }
   }
 
   // Now, resize type is either kSetZero or kUndefined.
-  if (data_ != NULL) {
+  if (this->data_ != NULL) {
     ReleaseVectorMemory();
   }
   AllocateVectorMemory(dim);
   if (local_resize_type == kSetZero) {
-    Set(0);
+    this->Set(0);
   }
 }
 
-void Vector::Swap(Vector* other) {
-  std::swap(data_, other->data_);
-  std::swap(dim_, other->dim_);
+template <typename Real>
+void VectorT<Real>::Swap(VectorT<Real>* other) {
+  std::swap(this->data_, other->data_);
+  std::swap(this->dim_, other->dim_);
 }
 
-void Vector::RemoveElement(const MatrixIndexT index) {
-  SNOWBOY_ASSERT(index < dim_ && index >= 0);
-  for (MatrixIndexT j = index + 1; j < dim_; ++j) {
-    data_[j - 1] = data_[j];
+template <typename Real>
+void VectorT<Real>::RemoveElement(const MatrixIndexT index) {
+  SNOWBOY_ASSERT(index < this->dim_ && index >= 0);
+  for (MatrixIndexT j = index + 1; j < this->dim_; ++j) {
+    this->data_[j - 1] = this->data_[j];
   }
-  dim_--;
+  this->dim_--;
+  // The freed element is now padding.
+  this->data_[this->dim_] = 0;
 }
 
-Vector& Vector::operator=(const Vector& other) {
-  if (dim_ != other.Dim()) {
+template <typename Real>
+VectorT<Real>& VectorT<Real>::operator=(const VectorT<Real>& other) {
+  if (this->dim_ != other.Dim()) {
     Resize(other.Dim(), kUndefined);
   }
-  CopyFromVec(other);
+  this->CopyFromVec(other);
   return *this;
 }
 
-Vector& Vector::operator=(const VectorBase& other) {
-  if (dim_ != other.Dim()) {
+template <typename Real>
+VectorT<Real>& VectorT<Real>::operator=(const VectorBaseT<Real>& other) {
+  if (this->dim_ != other.Dim()) {
     Resize(other.Dim(), kUndefined);
   }
-  CopyFromVec(other);
+  this->CopyFromVec(other);
   return *this;
 }
 
-void Vector::AllocateVectorMemory(const MatrixIndexT dim) {
+template <typename Real>
+void VectorT<Real>::AllocateVectorMemory(const MatrixIndexT dim) {
   SNOWBOY_ASSERT(dim >= 0);
 
   if (dim == 0) {
-    dim_ = 0;
-    data_ = NULL;
+    this->dim_ = 0;
+    this->data_ = NULL;
     return;
   }
 
-  SNOWBOY_ASSERT(SNOWBOY_MEM_ALIGN % sizeof(float) == 0);
-  size_t size = sizeof(float) * static_cast<size_t>(dim);
-  void* data = SnowboyMemalign(SNOWBOY_MEM_ALIGN, size);
+  SNOWBOY_ASSERT(SNOWBOY_MEM_ALIGN % sizeof(Real) == 0);
+  const MatrixIndexT padded_dim = PaddedDim(dim);
+  size_t size = sizeof(Real) * static_cast<size_t>(padded_dim);
+  void* data = MatrixMemalign(
+      std::max<size_t>(SNOWBOY_MEM_ALIGN, kMatrixPadBytes), size);
 
   if (data != NULL) {
-    data_ = static_cast<float*>(data);
-    dim_ = dim;
+    this->data_ = static_cast<Real*>(data);
+    this->dim_ = dim;
+    std::memset(this->data_ + dim, 0, sizeof(Real) * (padded_dim - dim));
   } else {
     throw std::bad_alloc();
   }
 }
 
-void Vector::ReleaseVectorMemory() {
-  if (data_ != NULL)
-    SnowboyMemalignFree(data_);
-  data_ = NULL;
-  dim_ = 0;
+template <typename Real>
+MatrixIndexT VectorT<Real>::PaddedDim(const MatrixIndexT dim) {
+  size_t num_per_pad = kMatrixPadBytes / sizeof(Real);
+  return dim + (num_per_pad - dim % num_per_pad) % num_per_pad;
 }
 
-void Vector::Read(const bool binary, const bool add, std::istream* is) {
-  SNOWBOY_ASSERT(is != NULL);
-  if (add) {
-    Vector tmp(Dim());
-    tmp.Read(binary, false, is);
-    if (Dim() == 0) {
-      Resize(tmp.Dim());
-    }
-    if (Dim() != tmp.Dim()) {
-      SNOWBOY_ERROR << "Fail to read Vector: size mismatch " << Dim()
-          << " vs. " << tmp.Dim();
-    }
-    AddVec(1.0, tmp);
-    return;
-  }
+template <typename Real>
+void VectorT<Real>::ReleaseVectorMemory() {
+  if (this->data_ != NULL)
+    MatrixMemalignFree(this->data_);
+  this->data_ = NULL;
+  this->dim_ = 0;
+}
 
+template <typename Real>
+void VectorT<Real>::Read(const bool binary, std::istream* is) {
+  SNOWBOY_ASSERT(is != NULL);
   if (binary) {
     int32 size;
-    ExpectToken(binary, "FV", is);
+    ExpectToken(binary, vector_token<Real>(), is);
     ReadBasicType(binary, &size, is);
-    if ((MatrixIndexT)(size) != Dim()) {
+    if ((MatrixIndexT)(size) != this->Dim()) {
       Resize(size);
     }
     if (size > 0) {
-      is->read(reinterpret_cast<char*>(data_), sizeof(float) * size);
+      is->read(reinterpret_cast<char*>(this->data_), sizeof(Real) * size);
     }
     if (is->fail()) {
       SNOWBOY_ERROR << "Fail to read Vector.";
     }
   } else {  // Text mode reading; format is " [ 1.1 2.0 3.4 ]\n"
     ExpectToken(binary, "[", is);
-    std::vector<float> data;
+    std::vector<Real> data;
     bool is_end = false;
     while (!is_end) {
       int next_char = is->peek();
       if (next_char == '-' || (next_char >= '0' && next_char <= '9')) {
-        float f;
+        Real f;
         *is >> f;
         if ((!std::isspace(is->peek())) && is->peek() != ']') {
           SNOWBOY_ERROR << "Fail to read Vector: expecting space after number.";
@@ -612,40 +766,60 @@ void Vector::Read(const bool binary, const bool add, std::istream* is) {
       if (is_end) {
         Resize(data.size());
         for (size_t i = 0; i < data.size(); ++i) {
-          data_[i] = data[i];
+          this->data_[i] = data[i];
         }
       }
     }
   }
 }
 
-void Vector::Read(const bool binary, std::istream* is) {
+template <typename Real>
+void VectorT<Real>::Read(const bool binary, const bool add,
+                         std::istream* is) {
   SNOWBOY_ASSERT(is != NULL);
-  Read(binary, false, is);
+  if (add) {
+    VectorT<Real> tmp(this->Dim());
+    tmp.Read(binary, is);
+    if (this->Dim() == 0) {
+      Resize(tmp.Dim());
+    }
+    if (this->Dim() != tmp.Dim()) {
+      SNOWBOY_ERROR << "Fail to read Vector: size mismatch " << this->Dim()
+          << " vs. " << tmp.Dim();
+    }
+    this->AddVec(1.0, tmp);
+    return;
+  }
+
+  Read(binary, is);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// SubVector class
+// SubVectorT class
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-SubVector::SubVector(const VectorBase& vec,
-                     const MatrixIndexT origin,
-                     const MatrixIndexT length) {
+template <typename Real>
+SubVectorT<Real>::SubVectorT(const VectorBaseT<Real>& vec,
+                             const MatrixIndexT origin,
+                             const MatrixIndexT length) {
   SNOWBOY_ASSERT(origin >= 0 && length >= 0 && origin + length <= vec.Dim());
-  data_ = const_cast<float*>(vec.Data() + origin);
-  dim_ = length;
+  this->data_ = const_cast<Real*>(vec.Data() + origin);
+  this->dim_ = length;
 }
 
-SubVector::SubVector(const MatrixBase& mat, MatrixIndexT row) {
-  data_ = const_cast<float*>(mat.RowData(row));
-  dim_ = mat.NumCols();
+template <typename Real>
+SubVectorT<Real>::SubVectorT(const MatrixBaseT<Real>& mat, MatrixIndexT row) {
+  this->data_ = const_cast<Real*>(mat.RowData(row));
+  this->dim_ = mat.NumCols();
 }
 
-SubVector::SubVector(const SubVector& other) {
-  data_ = other.data_;
-  dim_ = other.dim_;
+template <typename Real>
+SubVectorT<Real>::SubVectorT(const SubVectorT<Real>& other)
+    : VectorBaseT<Real>() {
+  this->data_ = other.data_;
+  this->dim_ = other.dim_;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -669,4 +843,64 @@ bool IsEqual(const float tolerance,
   return true;
 }
 
+template <typename Real>
+bool IsEqual(const VectorBaseT<Real>& vec1, const VectorBaseT<Real>& vec2) {
+  return vec1.Dim() == vec2.Dim() &&
+      std::equal(vec1.Data(), vec1.Data() + vec1.Dim(), vec2.Data());
+}
+
+// All members for float. For the other element types, only the members that
+// do not need cblas or the float kernels, see vector-wrapper.h.
+template class VectorBaseT<float>;
+template class VectorT<float>;
+template class SubVectorT<float>;
+
+#define SNOWBOY_INSTANTIATE_VECTOR(Real)                                      \
+  template void VectorBaseT<Real>::Set(const Real value);                    \
+  template void VectorBaseT<Real>::SetZero();                                \
+  template SubVectorT<Real> VectorBaseT<Real>::Range(                         \
+      const MatrixIndexT origin, const MatrixIndexT length);                  \
+  template const SubVectorT<Real> VectorBaseT<Real>::Range(                   \
+      const MatrixIndexT origin, const MatrixIndexT length) const;            \
+  template void VectorBaseT<Real>::CopyFromVec(const VectorBaseT<Real>& vec); \
+  template void VectorBaseT<Real>::CopyFromVec(const VectorBase& vec,         \
+                                               const float scale);            \
+  template void VectorBaseT<Real>::CopyToVec(const float scale,               \
+                                             VectorBase* vec) const;          \
+  template void VectorBaseT<Real>::CopyRowsFromMat(                           \
+      const MatrixBaseT<Real>& mat);                                          \
+  template void VectorBaseT<Real>::CopyColsFromMat(                           \
+      const MatrixBaseT<Real>& mat);                                          \
+  template void VectorBaseT<Real>::Read(const bool binary, std::istream* is); \
+  template void VectorBaseT<Real>::Write(const bool binary,                   \
+                                         std::ostream* os) const;             \
+  template void VectorT<Real>::Resize(const MatrixIndexT length,              \
+                                      const MatrixResizeType resize_type);    \
+  template void VectorT<Real>::Swap(VectorT<Real>* other);                    \
+  template void VectorT<Real>::RemoveElement(const MatrixIndexT index);       \
+  template VectorT<Real>& VectorT<Real>::operator=(                           \
+      const VectorT<Real>& other);                                            \
+  template VectorT<Real>& VectorT<Real>::operator=(                           \
+      const VectorBaseT<Real>& other);                                        \
+  template void VectorT<Real>::Read(const bool binary, std::istream* is);     \
+  template void VectorT<Real>::AllocateVectorMemory(const MatrixIndexT dim);  \
+  template MatrixIndexT VectorT<Real>::PaddedDim(const MatrixIndexT dim);     \
+  template void VectorT<Real>::ReleaseVectorMemory();                         \
+  template class SubVectorT<Real>;
+
+SNOWBOY_INSTANTIATE_VECTOR(double)
+SNOWBOY_INSTANTIATE_VECTOR(int16)
+SNOWBOY_INSTANTIATE_VECTOR(int32)
+
+#undef SNOWBOY_INSTANTIATE_VECTOR
+
+template bool IsEqual(const VectorBaseT<float>& vec1,
+                      const VectorBaseT<float>& vec2);
+template bool IsEqual(const VectorBaseT<double>& vec1,
+                      const VectorBaseT<double>& vec2);
+template bool IsEqual(const VectorBaseT<int16>& vec1,
+                      const VectorBaseT<int16>& vec2);
+template bool IsEqual(const VectorBaseT<int32>& vec1,
+                      const VectorBaseT<int32>& vec2);
+
 }  // namespace snowboy
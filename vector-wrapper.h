@@ -40,182 +40,208 @@ namespace snowboy {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// VectorBase class
+// VectorBaseT class
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-class VectorBase {
+// Common part of VectorT and SubVectorT, templated on the element type. The
+// members that copy, view, convert and serialize the data are instantiated for
+// float, double, int16 and int32. The arithmetic, which goes through cblas and
+// the float kernels, is only defined for float, i.e. for VectorBase.
+template <typename Real>
+class VectorBaseT {
  public:
-  bool IsZero(const float cutoff = 1.0e-06) const;
-
   // Sets all members of a vector to a specified value.
-  void Set(const float value);
+  void Set(const Real value);
 
   // Set vector to all zeros.
   void SetZero();
 
-  // Sets to random values of a normal distribution.
-  void SetRandomGaussian();
-
-  // Sets to numbers uniformly distributed on (0, 1).
-  void SetRandomUniform();
-
   // Returns the  dimension of the vector.
   inline MatrixIndexT Dim() const { return dim_; }
 
   // Returns a pointer to the start of the vector's data.
-  inline float* Data() { return data_; }
-  inline const float* Data() const { return data_; }
+  inline Real* Data() { return data_; }
+  inline const Real* Data() const { return data_; }
 
   // Returns the value at given index.
-  inline const float operator()(const MatrixIndexT index) const {
+  inline const Real operator()(const MatrixIndexT index) const {
     SNOWBOY_ASSERT(index < dim_ && index >= 0);
     return data_[index];
   }
-  inline float& operator()(const MatrixIndexT index) {
+  inline Real& operator()(const MatrixIndexT index) {
     SNOWBOY_ASSERT(index < dim_ && index >= 0);
     return data_[index];
   }
 
   // Returns a sub vector from origin with given length.
-  SubVector Range(const MatrixIndexT origin, const MatrixIndexT length);
-  const SubVector Range(const MatrixIndexT origin,
-                        const MatrixIndexT length) const;
+  SubVectorT<Real> Range(const MatrixIndexT origin,
+                         const MatrixIndexT length);
+  const SubVectorT<Real> Range(const MatrixIndexT origin,
+                               const MatrixIndexT length) const;
 
   // Copies data from another vector vec.
-  void CopyFromVec(const VectorBase& vec);
+  void CopyFromVec(const VectorBaseT<Real>& vec);
+
+  // Converts from float: *this = scale * vec, rounded to nearest and saturated
+  // to the range of Real for integer types.
+  void CopyFromVec(const VectorBase& vec, const float scale);
+
+  // Converts to float: *vec = scale * *this.
+  void CopyToVec(const float scale, VectorBase* vec) const;
 
   // Stacks the rows in the matrix mat.
-  void CopyRowsFromMat(const MatrixBase& mat);
+  void CopyRowsFromMat(const MatrixBaseT<Real>& mat);
 
   // Stacks the columns in the matrix mat.
-  void CopyColsFromMat(const MatrixBase& mat);
+  void CopyColsFromMat(const MatrixBaseT<Real>& mat);
+
+  void Read(const bool binary, std::istream* is);
+
+  void Write(const bool binary, std::ostream* os) const;
+
+  // The members below are only defined for float, and deleted for the other
+  // element types, see SNOWBOY_DELETE_VECTOR_ARITHMETIC.
+
+  bool IsZero(const Real cutoff = 1.0e-06) const;
+
+  // Sets to random values of a normal distribution.
+  void SetRandomGaussian();
+
+  // Sets to numbers uniformly distributed on (0, 1).
+  void SetRandomUniform();
+
+  // Evaluates an element-wise expression into the vector in a single pass,
+  // e.g. v.Assign(max(a * v + b * w, 0)). Needs matrix/matrix-expression.h.
+  template <typename Expr>
+  void Assign(const MatrixExpression<Expr>& expr);
 
   // Computes the sum of the vector.
-  float Sum() const;
+  Real Sum() const;
 
   // Adds <value> to every vector element.
-  void Add(const float value);
+  void Add(const Real value);
 
   // Adds vector: *this = *this + alpha * vec
-  void AddVec(const float alpha, const VectorBase& vec);
+  void AddVec(const Real alpha, const VectorBaseT<Real>& vec);
 
   // Adds vector: *this = *this + alpha * vec^2
-  void AddVec2(const float alpha, const VectorBase& vec);
+  void AddVec2(const Real alpha, const VectorBaseT<Real>& vec);
 
   // Adds the diagonal of a matrix times itself:
   // *this = alpha * diag(M M^T) +  beta * *this (if trans == kNoTrans), or
   // *this = alpha * diag(M^T M) +  beta * *this (if trans == kTrans).
-  void AddDiagMat2(const float alpha, const MatrixBase& mat,
+  void AddDiagMat2(const Real alpha, const MatrixBaseT<Real>& mat,
                    const MatrixTransposeType trans = kNoTrans,
-                   const float beta = 1.0f);
+                   const Real beta = 1.0f);
 
   // Multiplies all elements by <alpha>.
-  void Scale(const float alpha);
+  void Scale(const Real alpha);
 
   // Element-wise multiplication.
-  void MulElements(const VectorBase& vec);
+  void MulElements(const VectorBaseT<Real>& vec);
 
   // Dot product of <this, vec>
-  float DotVec(const VectorBase& vec) const;
+  Real DotVec(const VectorBaseT<Real>& vec) const;
 
   // Applies floor on each of the vector's elements.
-  void ApplyFloor(const float floor);
+  void ApplyFloor(const Real floor);
 
   // Applies logarithm on each of the vector's elements.
   void ApplyLog();
 
   // Takes all elements of vector to a power.
-  void ApplyPow(const float power);
+  void ApplyPow(const Real power);
 
   // Applies soft-max to vector and return normalizer.
-  float ApplySoftmax();
+  Real ApplySoftmax();
+
+  // Applies log soft-max to vector and return normalizer.
+  Real ApplyLogSoftmax();
 
   // this = beta * this + alpha * mat * vec
-  void AddMatVec(const float alpha, const MatrixBase& mat,
-                 const MatrixTransposeType trans, const VectorBase& vec,
-                 const float beta);
+  void AddMatVec(const Real alpha, const MatrixBaseT<Real>& mat,
+                 const MatrixTransposeType trans, const VectorBaseT<Real>& vec,
+                 const Real beta);
 
   // Computes the p-th norm of the vector.
-  float Norm(float p) const;
+  Real Norm(Real p) const;
 
   // Computes Euclidean distance between <this> and <vec>.
-  float EuclideanDistance(const VectorBase& vec) const;
+  Real EuclideanDistance(const VectorBaseT<Real>& vec) const;
 
   // Computes Cosine distance between <this> and <vec>.
   // Note: Cosine distance is not a proper distance metric, as it does not have
   //       the triangle inequality property and it violates the coincidence
   //       axiom. We use the following fomula to compute the distance:
   //           distance = (1.0f - similarity) / 2.0f;
-  float CosineDistance(const VectorBase& vec) const;
+  Real CosineDistance(const VectorBaseT<Real>& vec) const;
 
   // Returns the maximum value of all the elements, or -infinity for empty
   // vectors. If <index> is provided, returns the associated index, -1 if vector
   // is empty.
-  float Max() const;
-  float Max(MatrixIndexT* index) const;
+  Real Max() const;
+  Real Max(MatrixIndexT* index) const;
 
   // Returns the minimum value of all the elements, or infinity for empty
   // vectors. If <index> is provided, returns the associated index, -1 if vector
   // is empty.
-  float Min() const;
-  float Min(MatrixIndexT* index) const;
+  Real Min() const;
+  Real Min(MatrixIndexT* index) const;
 
   // If <add> is true, then read the Vector from stream, and add it to the
   // current Vector.
   void Read(const bool binary, const bool add, std::istream* is);
-  void Read(const bool binary, std::istream* is);
-
-  void Write(const bool binary, std::ostream* os) const;
 
  protected:
   // Constructor, this version creates an empty vector. We put the constructor
   // as protected so that it is only callable from child classes.
-  VectorBase(): dim_(0), data_(NULL) {}
+  VectorBaseT(): dim_(0), data_(NULL) {}
 
   // Destructor, memory allocation happens in child classes. We put the
   // destructor as protected so that it is only callable from child classes.
-  ~VectorBase() { }
+  ~VectorBaseT() { }
 
   // Vector dimension.
   MatrixIndexT dim_;
 
   // Data pointer.
-  float* data_;
+  Real* data_;
 
-  SNOWBOY_DISALLOW_COPY_AND_ASSIGN(VectorBase);
+  SNOWBOY_DISALLOW_COPY_AND_ASSIGN(VectorBaseT);
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Vector class
+// VectorT class
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-class Vector: public VectorBase {
+template <typename Real>
+class VectorT: public VectorBaseT<Real> {
  public:
   // Constructor, this version creates an empty vector.
-  Vector() : VectorBase() {}
+  VectorT() : VectorBaseT<Real>() {}
 
   // Constructor, this version creates a vector with a specific size, and sets
   // initial values to zero by default.
-  explicit Vector(const MatrixIndexT size,
-                  const MatrixResizeType resize_type = kSetZero) :
-      VectorBase() {
+  explicit VectorT(const MatrixIndexT size,
+                   const MatrixResizeType resize_type = kSetZero) :
+      VectorBaseT<Real>() {
     Resize(size, resize_type);
   }
 
-  // Copy constructor, this version copies from Vector.
-  explicit Vector(const Vector& vec) : VectorBase() {
+  // Copy constructor, this version copies from VectorT.
+  explicit VectorT(const VectorT<Real>& vec) : VectorBaseT<Real>() {
     Resize(vec.Dim(), kUndefined);
-    CopyFromVec(vec);
+    this->CopyFromVec(vec);
   }
 
-  // Copy constructor, this version copies from VectorBase, which is needed to
-  // copy from SubVector.
-  explicit Vector(const VectorBase& vec) : VectorBase() {
+  // Copy constructor, this version copies from VectorBaseT, which is needed to
+  // copy from SubVectorT.
+  explicit VectorT(const VectorBaseT<Real>& vec) : VectorBaseT<Real>() {
     Resize(vec.Dim(), kUndefined);
-    CopyFromVec(vec);
+    this->CopyFromVec(vec);
   }
 
   // Resizes vector to a specified size, works in linear time to the number of
@@ -224,58 +250,118 @@ class Vector: public VectorBase {
               const MatrixResizeType resize_type = kSetZero);
 
   // Swaps the contents of <*this> and <*other>. Shallow swap.
-  void Swap(Vector* other);
+  void Swap(VectorT<Real>* other);
 
   // Removes one specific element changes the other elements correspondingly.
   void RemoveElement(const MatrixIndexT index);
 
-  // Assignment operator, one for class Vector and another for VectorBase.
-  Vector& operator=(const Vector& other);
-  Vector& operator=(const VectorBase& other);
+  // Returns the number of elements allocated, a multiple of kMatrixPadBytes;
+  // those past Dim() are zero.
+  MatrixIndexT PaddedDim() const { return PaddedDim(this->dim_); }
+
+  // Assignment operator, one for class VectorT and another for VectorBaseT.
+  VectorT<Real>& operator=(const VectorT<Real>& other);
+  VectorT<Real>& operator=(const VectorBaseT<Real>& other);
 
   // Destructor
-  ~Vector() { ReleaseVectorMemory(); }
+  ~VectorT() { ReleaseVectorMemory(); }
+
+  void Read(const bool binary, std::istream* is);
 
   // If <add> is true, then read the Vector from stream, and add it to the
-  // current Vector.
+  // current Vector. Only defined for float.
   void Read(const bool binary, const bool add, std::istream* is);
-  void Read(const bool binary, std::istream* is);
 
  private:
   // Allocates memory for <data_>.
   void AllocateVectorMemory(const MatrixIndexT dim);
 
+  static MatrixIndexT PaddedDim(const MatrixIndexT dim);
+
   void ReleaseVectorMemory();
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// SubVector class
+// SubVectorT class
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-class SubVector : public VectorBase {
+template <typename Real>
+class SubVectorT : public VectorBaseT<Real> {
  public:
-  // Constructor, this version creates a SubVector from Vector or SubVector, and
-  // it is not const-safe.
-  SubVector(const VectorBase& vec,
-            const MatrixIndexT origin,
-            const MatrixIndexT length);
+  // Constructor, this version creates a SubVectorT from VectorT or SubVectorT,
+  // and it is not const-safe.
+  SubVectorT(const VectorBaseT<Real>& vec,
+             const MatrixIndexT origin,
+             const MatrixIndexT length);
 
-  // Constructor, this version creates a SubVector from a row of MatrixBase, and
-  // it is not const-safe.
-  SubVector(const MatrixBase& mat, MatrixIndexT row);
+  // Constructor, this version creates a SubVectorT from a row of MatrixBaseT,
+  // and it is not const-safe.
+  SubVectorT(const MatrixBaseT<Real>& mat, MatrixIndexT row);
 
   // Copy constructor, needed for Range() to work in base class.
-  SubVector(const SubVector& other);
+  SubVectorT(const SubVectorT<Real>& other);
 
-  ~SubVector() {}
+  ~SubVectorT() {}
 
  private:
-  SubVector() {}  // Blocks the default constructor.
-  SNOWBOY_DISALLOW_ASSIGN(SubVector);
+  SubVectorT() {}  // Blocks the default constructor.
+  SNOWBOY_DISALLOW_ASSIGN(SubVectorT);
 };
 
+// The arithmetic needs cblas or the float kernels, so for the other element
+// types it is deleted, and a call fails to compile rather than to link.
+#define SNOWBOY_DELETE_VECTOR_ARITHMETIC(Real)                                \
+  template <> bool VectorBaseT<Real>::IsZero(const Real cutoff) const         \
+      = delete;                                                               \
+  template <> void VectorBaseT<Real>::SetRandomGaussian() = delete;           \
+  template <> void VectorBaseT<Real>::SetRandomUniform() = delete;            \
+  template <> Real VectorBaseT<Real>::Sum() const = delete;                   \
+  template <> void VectorBaseT<Real>::Add(const Real value) = delete;         \
+  template <> void VectorBaseT<Real>::AddVec(                                 \
+      const Real alpha, const VectorBaseT<Real>& vec) = delete;               \
+  template <> void VectorBaseT<Real>::AddVec2(                                \
+      const Real alpha, const VectorBaseT<Real>& vec) = delete;               \
+  template <> void VectorBaseT<Real>::AddDiagMat2(                            \
+      const Real alpha, const MatrixBaseT<Real>& mat,                         \
+      const MatrixTransposeType trans, const Real beta) = delete;             \
+  template <> void VectorBaseT<Real>::Scale(const Real alpha) = delete;       \
+  template <> void VectorBaseT<Real>::MulElements(                            \
+      const VectorBaseT<Real>& vec) = delete;                                 \
+  template <> Real VectorBaseT<Real>::DotVec(                                 \
+      const VectorBaseT<Real>& vec) const = delete;                           \
+  template <> void VectorBaseT<Real>::ApplyFloor(const Real floor) = delete;  \
+  template <> void VectorBaseT<Real>::ApplyLog() = delete;                    \
+  template <> void VectorBaseT<Real>::ApplyPow(const Real power) = delete;    \
+  template <> Real VectorBaseT<Real>::ApplySoftmax() = delete;                \
+  template <> Real VectorBaseT<Real>::ApplyLogSoftmax() = delete;             \
+  template <> void VectorBaseT<Real>::AddMatVec(                              \
+      const Real alpha, const MatrixBaseT<Real>& mat,                         \
+      const MatrixTransposeType trans, const VectorBaseT<Real>& vec,          \
+      const Real beta) = delete;                                              \
+  template <> Real VectorBaseT<Real>::Norm(Real p) const = delete;            \
+  template <> Real VectorBaseT<Real>::EuclideanDistance(                      \
+      const VectorBaseT<Real>& vec) const = delete;                           \
+  template <> Real VectorBaseT<Real>::CosineDistance(                         \
+      const VectorBaseT<Real>& vec) const = delete;                           \
+  template <> Real VectorBaseT<Real>::Max() const = delete;                   \
+  template <> Real VectorBaseT<Real>::Max(MatrixIndexT* index) const          \
+      = delete;                                                               \
+  template <> Real VectorBaseT<Real>::Min() const = delete;                   \
+  template <> Real VectorBaseT<Real>::Min(MatrixIndexT* index) const          \
+      = delete;                                                               \
+  template <> void VectorBaseT<Real>::Read(const bool binary, const bool add, \
+                                           std::istream* is) = delete;        \
+  template <> void VectorT<Real>::Read(const bool binary, const bool add,     \
+                                       std::istream* is) = delete;
+
+SNOWBOY_DELETE_VECTOR_ARITHMETIC(double)
+SNOWBOY_DELETE_VECTOR_ARITHMETIC(int16)
+SNOWBOY_DELETE_VECTOR_ARITHMETIC(int32)
+
+#undef SNOWBOY_DELETE_VECTOR_ARITHMETIC
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Functions
@@ -285,6 +371,10 @@ class SubVector : public VectorBase {
 bool IsEqual(const float tolerance,
              const VectorBase& vec1, const VectorBase& vec2);
 
+// Returns true if the vectors have the same size and elements.
+template <typename Real>
+bool IsEqual(const VectorBaseT<Real>& vec1, const VectorBaseT<Real>& vec2);
+
 }  // namespace snowboy
 
 #endif  // SNOWBOY_MATRIX_VECTOR_WRAPPER_H_